@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = BLOCKSIZE) in;
+
+layout (std430, binding = 0) readonly buffer Positions
+{
+	vec4 positions[];
+};
+
+// lower corner (0-2) and upper corner (3-5) of the bounding box as ordered integers
+layout (std430, binding = 1) buffer Bounds
+{
+	uint bounds[6];
+};
+
+shared vec3 minpos[BLOCKSIZE];
+shared vec3 maxpos[BLOCKSIZE];
+
+// Map a float to an unsigned integer with the same ordering,
+// so that the bounds can be reduced using integer atomics.
+uint FloatToOrderedUint (float f)
+{
+	uint u = floatBitsToUint (f);
+	return ((u & 0x80000000u) != 0) ? ~u : (u | 0x80000000u);
+}
+
+void main (void)
+{
+	const uint lid = gl_LocalInvocationIndex;
+
+	// invocations beyond the last particle repeat the last particle
+	vec3 pos = positions[min (gl_GlobalInvocationID.x, uint (NUM_PARTICLES - 1))].xyz;
+	minpos[lid] = pos;
+	maxpos[lid] = pos;
+
+	// reduce the bounding box in shared memory
+	for (uint stride = BLOCKSIZE / 2; stride > 0; stride >>= 1)
+	{
+		barrier ();
+		memoryBarrierShared ();
+		if (lid < stride)
+		{
+			minpos[lid] = min (minpos[lid], minpos[lid + stride]);
+			maxpos[lid] = max (maxpos[lid], maxpos[lid + stride]);
+		}
+	}
+
+	// combine the bounding boxes of all work groups
+	if (lid == 0)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			atomicMin (bounds[i], FloatToOrderedUint (minpos[0][i]));
+			atomicMax (bounds[i + 3], FloatToOrderedUint (maxpos[0][i]));
+		}
+	}
+}
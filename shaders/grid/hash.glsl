@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+// Determine the grid cell containing a position.
+ivec3 GetGridCell (vec3 pos)
+{
+	return ivec3 (clamp (pos - gridorigin.xyz, vec3 (0, 0, 0), GRID_SIZE));
+}
+
+// Determine the grid cell of a sort key (see key.glsl).
+ivec3 GetKeyCell (ParticleKey key)
+{
+#ifdef COMPACT_PARTICLES
+	// the upper bits of the fixed point coordinates are the grid cell
+	return min (ivec3 ((key & KEY_COORDINATE_MASK) >> KEY_FRACTION_BITS), ivec3 (GRID_SIZE));
+#else
+	return GetGridCell (key.pos);
+#endif
+}
+
+#ifdef MORTON_ORDER
+// Spread the lower 10 bits of a value, so that there are two zero bits between each of them.
+uint SpreadBits (uint v)
+{
+	v &= 0x3FFu;
+	v = (v | (v << 16)) & 0x030000FFu;
+	v = (v | (v << 8)) & 0x0300F00Fu;
+	v = (v | (v << 4)) & 0x030C30C3u;
+	v = (v | (v << 2)) & 0x09249249u;
+	return v;
+}
+#endif
+
+// Determine the hash of a grid cell, which is used as sort key.
+// For the dense grid this is the linear index of the cell, for the hashed grid
+// it is the bucket of the hash table containing the cell. Since the size of the
+// hash table is a multiple of the grid size in x direction, the buckets of the
+// cells in a row in x direction are still contiguous. With MORTON_ORDER it is
+// the Morton code of the cell instead of the linear index.
+uint GetCellHash (ivec3 cell)
+{
+#ifdef MORTON_ORDER
+	// interleave the bits of the coordinates, so that cells that are close in all
+	// directions are close in sorted order (cells have to be inside the grid)
+	return SpreadBits (uint (cell.x)) | (SpreadBits (uint (cell.y)) << 1) | (SpreadBits (uint (cell.z)) << 2);
+#else
+	// use integer arithmetic, so that the index is exact for large grids
+	int index = cell.x * GRID_HASHWEIGHTS.x + cell.y * GRID_HASHWEIGHTS.y + cell.z * GRID_HASHWEIGHTS.z;
+#ifdef HASHED_GRID
+	// cells outside the grid (which can be accessed by the neighbour search)
+	// have negative indices, so shift them by a multiple of the table size
+	return uint (index + HASH_INDEX_OFFSET) % uint (HASH_TABLE_SIZE);
+#else
+	return uint (index);
+#endif
+#endif
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+// The sort keys consist of the predicted position and the id of a particle.
+// By default a key is a vec3 and an int (16 bytes). With COMPACT_PARTICLES it is
+// three words (12 bytes), each holding one coordinate relative to the grid origin in
+// 24-bit fixed point in its lower bits and 8 bits of the id in its upper bits.
+// The upper 10 bits of each coordinate are the grid cell and the lower
+// KEY_FRACTION_BITS bits the position within the cell.
+// Key arrays are declared with PARTICLE_KEYS and accessed with LoadKey and StoreKey,
+// since compact keys are stored as a plain array of words.
+#ifdef COMPACT_PARTICLES
+#define ParticleKey uvec3
+#define PARTICLE_KEYS(name) uint name[]
+#define LoadKey(keys, i) uvec3 (keys[3 * (i)], keys[3 * (i) + 1], keys[3 * (i) + 2])
+#define StoreKey(keys, i, key) (keys[3 * (i)] = (key).x, keys[3 * (i) + 1] = (key).y, keys[3 * (i) + 2] = (key).z)
+
+#define KEY_COORDINATE_MASK 0xFFFFFFu
+const float KEY_SCALE = float (1 << KEY_FRACTION_BITS);
+
+vec3 GetKeyPosition (ParticleKey key)
+{
+	return vec3 (key & KEY_COORDINATE_MASK) * (1.0 / KEY_SCALE) + gridorigin.xyz;
+}
+
+int GetKeyId (ParticleKey key)
+{
+	return int ((key.x >> 24) | ((key.y >> 24) << 8) | ((key.z >> 24) << 16));
+}
+
+ParticleKey MakeKey (vec3 pos, int id)
+{
+	// round to the nearest fixed point value; positions outside the range of
+	// the coordinates are clamped
+	vec3 coord = clamp ((pos - gridorigin.xyz) * KEY_SCALE + 0.5, vec3 (0, 0, 0), vec3 (KEY_COORDINATE_MASK));
+	return uvec3 (coord) | ((uvec3 (id, id >> 8, id >> 16) & 0xFFu) << 24);
+}
+#else
+struct ParticleKey {
+	vec3 pos;
+	int id;
+};
+#define PARTICLE_KEYS(name) ParticleKey name[]
+#define LoadKey(keys, i) keys[i]
+#define StoreKey(keys, i, key) (keys[i] = (key))
+
+vec3 GetKeyPosition (ParticleKey key)
+{
+	return key.pos;
+}
+
+int GetKeyId (ParticleKey key)
+{
+	return key.id;
+}
+
+ParticleKey MakeKey (vec3 pos, int id)
+{
+	return ParticleKey (pos, id);
+}
+#endif
@@ -25,29 +25,70 @@ layout (local_size_x = BLOCKSIZE) in;
 
 layout (std430, binding = 0) readonly buffer ParticleKeys
 {
-	vec4 particlekeys[];
+	PARTICLE_KEYS (particlekeys);
 };
 
-layout (binding = 0, r32i) uniform writeonly iimage3D gridtexture;
-layout (binding = 1, r32i) uniform writeonly iimage3D gridendtexture;
+#ifdef HASHED_GRID
+layout (std430, binding = 1) writeonly buffer GridStart
+{
+	int gridstart[];
+};
+
+layout (std430, binding = 2) writeonly buffer GridEnd
+{
+	int gridend[];
+};
 
 void main (void)
 {
 	uint gid;
 	gid = gl_GlobalInvocationID.x;
-	
+	if (gid >= NUM_PARTICLES)
+		return;
+
+	uint hash = GetCellHash (GetKeyCell (LoadKey (particlekeys, gid)));
+
 	if (gid == 0)
+		gridstart[hash] = 0;
+	else
 	{
-		imageStore (gridtexture, ivec3 (0, 0, 0), ivec4 (0, 0, 0, 0));
-		return;
+		uint hash2 = GetCellHash (GetKeyCell (LoadKey (particlekeys, gid - 1)));
+		if (hash != hash2)
+		{
+			gridstart[hash] = int (gid);
+			gridend[hash2] = int (gid);
+		}
 	}
 
-	ivec3 gridpos = ivec3 (clamp (particlekeys[gid].xyz, vec3 (0, 0, 0), GRID_SIZE));
-	ivec3 gridpos2 = ivec3 (clamp (particlekeys[gid - 1].xyz, vec3 (0, 0, 0), GRID_SIZE));
-	
-	if (gridpos != gridpos2)
+	if (gid == NUM_PARTICLES - 1)
+		gridend[hash] = int (gid + 1);
+}
+#else
+layout (binding = 0, r32i) uniform writeonly iimage3D gridtexture;
+layout (binding = 1, r32i) uniform writeonly iimage3D gridendtexture;
+
+void main (void)
+{
+	uint gid;
+	gid = gl_GlobalInvocationID.x;
+	if (gid >= NUM_PARTICLES)
+		return;
+
+	ivec3 gridpos = GetKeyCell (LoadKey (particlekeys, gid));
+
+	if (gid == 0)
+		imageStore (gridtexture, gridpos, ivec4 (0, 0, 0, 0));
+	else
 	{
-		imageStore (gridtexture, gridpos, ivec4 (gid, 0, 0, 0));
-		imageStore (gridendtexture, gridpos2, ivec4 (gid, 0, 0, 0));
+		ivec3 gridpos2 = GetKeyCell (LoadKey (particlekeys, gid - 1));
+		if (gridpos != gridpos2)
+		{
+			imageStore (gridtexture, gridpos, ivec4 (gid, 0, 0, 0));
+			imageStore (gridendtexture, gridpos2, ivec4 (gid, 0, 0, 0));
+		}
 	}
+
+	if (gid == NUM_PARTICLES - 1)
+		imageStore (gridendtexture, gridpos, ivec4 (gid + 1, 0, 0, 0));
 }
+#endif
@@ -25,26 +25,74 @@ layout (local_size_x = BLOCKSIZE) in;
 
 layout (std430, binding = 0) readonly buffer ParticleKeys
 {
-	vec4 particlekeys[];
+	PARTICLE_KEYS (particlekeys);
 };
 
+#ifdef HASHED_GRID
+layout (std430, binding = 1) readonly buffer GridStart
+{
+	int gridstart[];
+};
+
+layout (std430, binding = 2) readonly buffer GridEnd
+{
+	int gridend[];
+};
+
+int GetCellStart (ivec3 cell)
+{
+	return gridstart[GetCellHash (cell)];
+}
+
+int GetCellEnd (ivec3 cell)
+{
+	return gridend[GetCellHash (cell)];
+}
+#else
 layout (binding = 0) uniform isampler3D gridtexture;
 layout (binding = 1) uniform isampler3D gridendtexture;
 
+int GetCellStart (ivec3 cell)
+{
+	return texelFetch (gridtexture, cell, 0).x;
+}
+
+int GetCellEnd (ivec3 cell)
+{
+	return texelFetch (gridendtexture, cell, 0).x;
+}
+#endif
+
 layout (binding = 0, rgba32i) uniform writeonly iimageBuffer neighbourtexture;
+#ifdef NEIGHBOUR_WIDE_ENTRIES
+layout (binding = 2, rgba32i) uniform writeonly iimageBuffer neighbourcounttexture;
+#endif
+#ifdef NEIGHBOUR_CELL_TABLE
+layout (binding = 1, r32i) uniform writeonly iimageBuffer neighbourcellindextexture;
+#endif
 
-// neighbour grids in y and z direction
-const ivec3 gridoffsets[9] = {
-	ivec3 (0, -1, -1),
-	ivec3 (0, -1, 0),
-	ivec3 (0, -1, 1),
-	ivec3 (0, 0, -1),
-	ivec3 (0, 0, 0),
-	ivec3 (0, 0, 1),
-	ivec3 (0, 1, -1),
-	ivec3 (0, 1, 0),
-	ivec3 (0, 1, 1)
+#ifndef NEIGHBOUR_WIDE_ENTRIES
+// number of neighbour ranges whose number of particles was clamped to 255
+layout (std430, binding = 3) buffer Overflow
+{
+	uint overflows;
 };
+#endif
+
+#define NEIGHBOUR_ROW_LENGTH (2 * NEIGHBOUR_EXTENT + 1)
+#ifdef MORTON_ORDER
+// neighbouring cells in x direction are not contiguous in Morton order, so each of the
+// NEIGHBOUR_RANGES cells is a range of its own, enumerated x major, y, z minor
+#define NEIGHBOUR_RUN_EXTENT 0
+#define GetRangeOffset(o) (ivec3 ((o) / (NEIGHBOUR_ROW_LENGTH * NEIGHBOUR_ROW_LENGTH), \
+		((o) / NEIGHBOUR_ROW_LENGTH) % NEIGHBOUR_ROW_LENGTH, (o) % NEIGHBOUR_ROW_LENGTH) - ivec3 (NEIGHBOUR_EXTENT))
+#else
+// the neighbour rows in y and z direction are enumerated y major, z minor;
+// each row covers 2 * NEIGHBOUR_EXTENT + 1 cells in x direction
+#define NEIGHBOUR_RUN_EXTENT NEIGHBOUR_EXTENT
+#define GetRangeOffset(o) (ivec3 (0, (o) / NEIGHBOUR_ROW_LENGTH, (o) % NEIGHBOUR_ROW_LENGTH) \
+		- ivec3 (0, NEIGHBOUR_EXTENT, NEIGHBOUR_EXTENT))
+#endif
 
 // offset between grids in x direction
 const ivec3 gridxoffset = ivec3 (1, 0, 0);
@@ -53,40 +101,92 @@ void main (void)
 {
 	uint particleid;
 	particleid = gl_GlobalInvocationID.x;
+	if (particleid >= NUM_PARTICLES)
+		return;
+
+	ivec3 gridpos = GetKeyCell (LoadKey (particlekeys, particleid));
 
-	ivec3 gridpos = ivec3 (particlekeys[particleid].xyz);
-	
-	int cells[9];
+#ifdef NEIGHBOUR_CELL_TABLE
+	// all particles in a cell share the neighbour ranges,
+	// so only the first particle of each cell determines them
+	// (for the hashed grid all cells in a bucket share the same neighbour buckets)
+	int cellstart = GetCellStart (gridpos);
+	if (cellstart == -1)
+		cellstart = int (particleid);
+	imageStore (neighbourcellindextexture, int (particleid), ivec4 (cellstart, 0, 0, 0));
+	if (cellstart != int (particleid))
+		return;
+#endif
 
-	// go through all 9 neighbour directions in y/z direction 
-	for (int o = 0; o < 9; o++) {
+	// the table is padded to whole texels with empty ranges
+	int cells[NEIGHBOUR_TEXELS * 3];
+#ifdef NEIGHBOUR_WIDE_ENTRIES
+	int counts[NEIGHBOUR_TEXELS * 3];
+#endif
+	for (int o = NEIGHBOUR_RANGES; o < NEIGHBOUR_TEXELS * 3; o++) {
+		cells[o] = 0;
+#ifdef NEIGHBOUR_WIDE_ENTRIES
+		counts[o] = 0;
+#endif
+	}
+
+	// go through all neighbour directions in y/z direction 
+	for (int o = 0; o < NEIGHBOUR_RANGES; o++) {
+		ivec3 rowoffset = GetRangeOffset (o);
 		int numcells = 0;
 		int entries = 0;
 		int cell = -1;
 		
 		// got through all cells in x direction
-		for (int j = -1; j <= 1; j++)
+		for (int j = -NEIGHBOUR_RUN_EXTENT; j <= NEIGHBOUR_RUN_EXTENT; j++)
 		{
+			ivec3 neighbourcell = gridpos + rowoffset + j * gridxoffset;
+#ifdef MORTON_ORDER
+			// the Morton code is only defined for cells inside the grid
+			if (any (lessThan (neighbourcell, ivec3 (0))) || any (greaterThanEqual (neighbourcell, ivec3 (GRID_SIZE))))
+				continue;
+#endif
+#ifdef HASHED_GRID
+			// buckets are only contiguous within a row in x direction
+			if (neighbourcell.x < 0 || neighbourcell.x >= int (GRID_SIZE.x))
+				continue;
+#endif
 			// fetch its starting position
-			int c = texelFetch (gridtexture, gridpos + gridoffsets[o] + j * gridxoffset, 0).x;
+			int c = GetCellStart (neighbourcell);
 			// store the position, if we don't already have a starting point
 			if (cell == -1) cell = c;
 			// if the cell exists
 			if (c != -1)
 			{
 				// lookup its size and update entry count
-				int end = texelFetch (gridendtexture, gridpos + gridoffsets[o] + j * gridxoffset, 0).x;
+				int end = GetCellEnd (neighbourcell);
 				entries += end - c;
 			}
 		}
 		
-		cells[o] = cell + (entries<<24);
+		// empty ranges start at particle 0
+		if (cell == -1) cell = 0;
+
+#ifdef NEIGHBOUR_WIDE_ENTRIES
+		cells[o] = cell;
+		counts[o] = entries;
+#else
+		// pack the number of entries into the upper 8 bits
+		// (clamping drops neighbours, so it is counted and reported by the host)
+		if (entries > 255)
+			atomicAdd (overflows, 1u);
+		cells[o] = cell + (min (entries, 255) << 24);
+#endif
 	}
 
-	for (int i = 0; i < 3; i++)
+	for (int i = 0; i < NEIGHBOUR_TEXELS; i++)
 	{
 		// store everything in the neighbour texture
-		imageStore (neighbourtexture, int (particleid * 3 + i), ivec4 (cells[i*3+0], cells[i*3+1], cells[i*3+2], 0));
+		int index = int (particleid) * NEIGHBOUR_TEXELS + i;
+		imageStore (neighbourtexture, index, ivec4 (cells[i*3+0], cells[i*3+1], cells[i*3+2], 0));
+#ifdef NEIGHBOUR_WIDE_ENTRIES
+		imageStore (neighbourcounttexture, index, ivec4 (counts[i*3+0], counts[i*3+1], counts[i*3+2], 0));
+#endif
 	}
 
 }
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = BLOCKSIZE) in;
+
+layout (std430, binding = 0) readonly buffer Data
+{
+	PARTICLE_KEYS (data);
+};
+
+layout (std430, binding = 1) buffer SortState
+{
+	// number of neighbouring keys in the wrong order before and after the local sort
+	uint disorder[2];
+};
+
+// index of the counter in disorder[]
+uniform int target;
+
+shared uint count;
+
+// padding keys beyond NUM_KEYS are sorted to the end (see counting.glsl)
+uint GetHash (in uint id)
+{
+	if (id >= NUM_KEYS)
+		return 0xFFFFFFFFu;
+	return GetCellHash (GetKeyCell (LoadKey (data, id)));
+}
+
+void main (void)
+{
+	const uint gid = gl_GlobalInvocationID.x;
+
+	if (gl_LocalInvocationIndex == 0)
+		count = 0u;
+
+	barrier ();
+	memoryBarrierShared ();
+
+	if (gid + 1 < PADDED_KEYS && GetHash (gid) > GetHash (gid + 1))
+		atomicAdd (count, 1u);
+
+	barrier ();
+	memoryBarrierShared ();
+
+	if (gl_LocalInvocationIndex == 0 && count > 0)
+		atomicAdd (disorder[target], count);
+}
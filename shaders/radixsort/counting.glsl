@@ -25,7 +25,7 @@ layout (local_size_x = HALFBLOCKSIZE) in;
 
 layout (std430, binding = 0) buffer Data
 {
-	vec4 data[];
+	PARTICLE_KEYS (data);
 };
 
 layout (std430, binding = 1) writeonly buffer PrefixSum
@@ -50,10 +50,13 @@ const int n = BLOCKSIZE;
 
 uniform int bitshift;
 
-uint GetHash (in vec3 pos)
+// Keys beyond NUM_KEYS only pad the input to a multiple of the block size.
+// They get the largest possible key, so that the stable sort keeps them at the end.
+uint GetHash (in uint id)
 {
-	ivec3 grid = ivec3 (clamp (pos.xyz, vec3 (0, 0, 0), GRID_SIZE));
-	return uint (dot (grid, GRID_HASHWEIGHTS));
+	if (id >= NUM_KEYS)
+		return 0xFFFFFFFFu;
+	return GetCellHash (GetKeyCell (LoadKey (data, id)));
 }
 
 void main (void)
@@ -67,8 +70,8 @@ void main (void)
 	int bankOffsetA = CONFLICT_FREE_OFFSET(ai);
 	int bankOffsetB = CONFLICT_FREE_OFFSET(bi);
 	
-	uint bits1 = bitfieldExtract (GetHash (data[gl_WorkGroupID.x * BLOCKSIZE + lid].xyz), bitshift, 2);
-	uint bits2 = bitfieldExtract (GetHash (data[gl_WorkGroupID.x * BLOCKSIZE + lid + (n/2)].xyz), bitshift, 2);
+	uint bits1 = bitfieldExtract (GetHash (gl_WorkGroupID.x * BLOCKSIZE + lid), bitshift, 2);
+	uint bits2 = bitfieldExtract (GetHash (gl_WorkGroupID.x * BLOCKSIZE + lid + (n/2)), bitshift, 2);
 	mask[ai + bankOffsetA] = uvec4 (equal (bits1 * uvec4 (1, 1, 1, 1), uvec4 (0, 1, 2, 3)));
 	mask[bi + bankOffsetB] = uvec4 (equal (bits2 * uvec4 (1, 1, 1, 1), uvec4 (0, 1, 2, 3)));
 
@@ -25,7 +25,7 @@ layout (local_size_x = BLOCKSIZE) in;
 
 layout (std430, binding = 0) readonly buffer Data
 {
-	vec4 data[];
+	PARTICLE_KEYS (data);
 };
 
 layout (std430, binding = 1) readonly buffer PrefixSum
@@ -40,18 +40,19 @@ layout (std430, binding = 2) readonly buffer BlockSum
 
 layout (std430, binding = 3) writeonly buffer Result
 {
-	vec4 result[];
+	PARTICLE_KEYS (result);
 };
 
 uniform uvec4 blocksumoffsets;
 
 uniform int bitshift;
 
+// padding keys beyond NUM_KEYS are sorted to the end (see counting.glsl)
 uint GetHash (int id)
 {
-	vec3 pos = data[id].xyz;
-	ivec3 grid = ivec3 (clamp (pos, vec3 (0, 0, 0), GRID_SIZE));
-	return uint (dot (grid, GRID_HASHWEIGHTS));
+	if (id >= NUM_KEYS)
+		return 0xFFFFFFFFu;
+	return GetCellHash (GetKeyCell (LoadKey (data, id)));
 }
 
 void main (void)
@@ -61,5 +62,6 @@ void main (void)
 
 	uint bits = bitfieldExtract (GetHash (gid), bitshift, 2);
 	
-	result[blocksum[blocksumoffsets[bits] + gl_WorkGroupID.x] + prefixsum[gid]] = data[gid];
+	ParticleKey value = LoadKey (data, gid);
+	StoreKey (result, blocksum[blocksumoffsets[bits] + gl_WorkGroupID.x] + prefixsum[gid], value);
 }
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = DIGIT_GROUPSIZE) in;
+
+layout (std430, binding = 0) readonly buffer Data
+{
+	PARTICLE_KEYS (data);
+};
+
+layout (std430, binding = 1) writeonly buffer Histogram
+{
+	uint histogram[];
+};
+
+uniform int bitshift;
+
+shared uint counts[RADIX];
+
+// padding keys beyond NUM_KEYS are sorted to the end (see counting.glsl)
+uint GetHash (in uint id)
+{
+	if (id >= NUM_KEYS)
+		return 0xFFFFFFFFu;
+	return GetCellHash (GetKeyCell (LoadKey (data, id)));
+}
+
+void main (void)
+{
+	const uint lid = gl_LocalInvocationIndex;
+
+	for (uint d = lid; d < RADIX; d += DIGIT_GROUPSIZE)
+		counts[d] = 0u;
+
+	barrier ();
+	memoryBarrierShared ();
+
+	// count the digits of all keys of the tile
+	for (uint i = 0; i < DIGIT_TILESIZE; i += DIGIT_GROUPSIZE)
+	{
+		uint id = gl_WorkGroupID.x * DIGIT_TILESIZE + i + lid;
+		if (id < PADDED_KEYS)
+			atomicAdd (counts[bitfieldExtract (GetHash (id), bitshift, DIGIT_BITS)], 1u);
+	}
+
+	barrier ();
+	memoryBarrierShared ();
+
+	// the histograms are stored digit by digit, so that their exclusive prefix sum
+	// yields the global offset of the keys of each digit in each tile
+	for (uint d = lid; d < RADIX; d += DIGIT_GROUPSIZE)
+		histogram[d * NUM_TILES + gl_WorkGroupID.x] = counts[d];
+}
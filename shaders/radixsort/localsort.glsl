@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = HALFBLOCKSIZE) in;
+
+layout (std430, binding = 0) buffer Data
+{
+	PARTICLE_KEYS (data);
+};
+
+// offset of the first tile (0 or HALFBLOCKSIZE, so that the tiles of the second
+// pass straddle the boundaries of the tiles of the first pass)
+uniform uint tileoffset;
+
+// sort keys consisting of the hash and the index in the tile, which makes them unique
+// and thereby the bitonic sort stable
+shared uvec2 keys[BLOCKSIZE];
+shared ParticleKey values[BLOCKSIZE];
+
+// padding keys beyond NUM_KEYS are sorted to the end (see counting.glsl)
+uint GetHash (in uint id, in ParticleKey value)
+{
+	if (id >= NUM_KEYS)
+		return 0xFFFFFFFFu;
+	return GetCellHash (GetKeyCell (value));
+}
+
+bool Greater (in uvec2 a, in uvec2 b)
+{
+	return a.x > b.x || (a.x == b.x && a.y > b.y);
+}
+
+void main (void)
+{
+	const uint lid = gl_LocalInvocationIndex;
+	const uint start = gl_WorkGroupID.x * BLOCKSIZE + tileoffset;
+
+	// load the whole tile first, since it is sorted in place
+	for (uint i = lid; i < BLOCKSIZE; i += HALFBLOCKSIZE)
+	{
+		values[i] = LoadKey (data, start + i);
+		keys[i] = uvec2 (GetHash (start + i, values[i]), i);
+	}
+
+	// bitonic sort with one compare and exchange per invocation in each step
+	for (uint k = 2; k <= BLOCKSIZE; k <<= 1)
+	{
+		for (uint j = k >> 1; j > 0; j >>= 1)
+		{
+			barrier ();
+			memoryBarrierShared ();
+
+			uint a = 2 * j * (lid / j) + (lid % j);
+			uint b = a + j;
+			bool ascending = (a & k) == 0;
+			if (Greater (keys[a], keys[b]) == ascending)
+			{
+				uvec2 tmp = keys[a];
+				keys[a] = keys[b];
+				keys[b] = tmp;
+			}
+		}
+	}
+
+	barrier ();
+	memoryBarrierShared ();
+
+	for (uint i = lid; i < BLOCKSIZE; i += HALFBLOCKSIZE)
+	{
+		ParticleKey value = values[keys[i].y];
+		StoreKey (data, start + i, value);
+	}
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = DIGIT_GROUPSIZE) in;
+
+layout (std430, binding = 0) readonly buffer Data
+{
+	PARTICLE_KEYS (data);
+};
+
+layout (std430, binding = 1) readonly buffer Histogram
+{
+	uint histogram[];
+};
+
+layout (std430, binding = 3) writeonly buffer Result
+{
+	PARTICLE_KEYS (result);
+};
+
+uniform int bitshift;
+
+// global position of the next key of each digit
+shared uint offsets[RADIX];
+// number and then global position of the keys of each digit in each subgroup
+shared uint subgroupoffsets[MAX_SUBGROUPS * RADIX];
+
+// padding keys beyond NUM_KEYS are sorted to the end (see counting.glsl)
+uint GetHash (in uint id, in ParticleKey value)
+{
+	if (id >= NUM_KEYS)
+		return 0xFFFFFFFFu;
+	return GetCellHash (GetKeyCell (value));
+}
+
+void main (void)
+{
+	const uint lid = gl_LocalInvocationIndex;
+	// the subgroups handle consecutive keys in the order of their ids, so that
+	// the ranks obtained from the ballots preserve the order of equal digits
+	const uint local = gl_SubgroupID * gl_SubgroupSize + gl_SubgroupInvocationID;
+
+	for (uint d = lid; d < RADIX; d += DIGIT_GROUPSIZE)
+		offsets[d] = histogram[d * NUM_TILES + gl_WorkGroupID.x];
+
+	for (uint i = 0; i < DIGIT_TILESIZE; i += DIGIT_GROUPSIZE)
+	{
+		for (uint j = lid; j < MAX_SUBGROUPS * RADIX; j += DIGIT_GROUPSIZE)
+			subgroupoffsets[j] = 0u;
+
+		barrier ();
+		memoryBarrierShared ();
+
+		uint id = gl_WorkGroupID.x * DIGIT_TILESIZE + i + local;
+		bool valid = id < PADDED_KEYS;
+		ParticleKey value = LoadKey (data, valid ? id : 0u);
+		uint digit = valid ? bitfieldExtract (GetHash (id, value), bitshift, DIGIT_BITS) : 0u;
+
+		// determine the invocations of the subgroup with the same digit bit by bit
+		uvec4 match = subgroupBallot (valid);
+		for (int b = 0; b < DIGIT_BITS; b++)
+		{
+			bool bit = bitfieldExtract (digit, b, 1) != 0;
+			uvec4 ballot = subgroupBallot (bit);
+			match &= bit ? ballot : ~ballot;
+		}
+		uint rank = subgroupBallotExclusiveBitCount (match);
+
+		// the first invocation with each digit stores the number of keys with that digit
+		if (valid && rank == 0)
+			subgroupoffsets[gl_SubgroupID * RADIX + digit] = subgroupBallotBitCount (match);
+
+		barrier ();
+		memoryBarrierShared ();
+
+		// replace the counts by global positions subgroup by subgroup
+		for (uint d = lid; d < RADIX; d += DIGIT_GROUPSIZE)
+		{
+			uint offset = offsets[d];
+			for (uint s = 0; s < gl_NumSubgroups; s++)
+			{
+				uint count = subgroupoffsets[s * RADIX + d];
+				subgroupoffsets[s * RADIX + d] = offset;
+				offset += count;
+			}
+			offsets[d] = offset;
+		}
+
+		barrier ();
+		memoryBarrierShared ();
+
+		if (valid)
+			StoreKey (result, subgroupoffsets[gl_SubgroupID * RADIX + digit] + rank, value);
+
+		barrier ();
+	}
+}
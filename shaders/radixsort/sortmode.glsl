@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = 1) in;
+
+layout (std430, binding = 1) buffer SortState
+{
+	// number of neighbouring keys in the wrong order before and after the local sort
+	uint disorder[2];
+	// how the keys are sorted in the current run
+	uint mode;
+	uint padding;
+	// number of runs sorted in each mode so far
+	uint modecounts[4];
+	// indirect dispatch arguments of the local and the full sort
+	uvec4 dispatches[NUM_SORT_DISPATCHES];
+};
+
+// dispatch command of a conditional run, which is skipped if it has no work groups
+layout (std430, binding = 2) readonly buffer Condition
+{
+	uvec4 condition;
+};
+
+// 0 before a conditional run, 1 after checking the order of the input, 2 after the local sort
+uniform int stage;
+// whether the order of the input of a conditional run is checked first
+uniform bool incremental;
+
+#define SORT_MODE_SORTED 0u
+#define SORT_MODE_LOCAL 1u
+#define SORT_MODE_LOCAL_FULL 2u
+#define SORT_MODE_FULL 3u
+// the condition of the run is not met (not counted)
+#define SORT_MODE_SKIPPED 4u
+// the order of the input is checked next (not counted)
+#define SORT_MODE_CHECK 5u
+
+void main (void)
+{
+	if (stage == 0)
+	{
+		// skip the whole run or decide after checking the order of the input
+		if (condition.x == 0u)
+			mode = SORT_MODE_SKIPPED;
+		else
+			mode = incremental ? SORT_MODE_CHECK : SORT_MODE_FULL;
+	}
+	else if (mode == SORT_MODE_SKIPPED)
+	{
+		return;
+	}
+	else if (stage == 1)
+	{
+		// skip the sort if the keys are still sorted, try a local sort if only a few
+		// keys are out of order and fall back to a full sort otherwise
+		if (disorder[0] == 0)
+			mode = SORT_MODE_SORTED;
+		else if (disorder[0] <= LOCAL_SORT_LIMIT)
+			mode = SORT_MODE_LOCAL;
+		else
+			mode = SORT_MODE_FULL;
+	}
+	else
+	{
+		// the keys may have moved too far for the local sort
+		if (mode == SORT_MODE_LOCAL && disorder[1] > 0)
+			mode = SORT_MODE_LOCAL_FULL;
+		modecounts[mode]++;
+		if (mode != SORT_MODE_LOCAL_FULL)
+			return;
+	}
+
+	bool fullsort = (mode == SORT_MODE_FULL || mode == SORT_MODE_LOCAL_FULL);
+	for (uint i = 0; i < NUM_SORT_DISPATCHES; i++)
+	{
+		bool enabled;
+		if (i == CHECKINPUT_SORT_DISPATCH)
+			enabled = (mode == SORT_MODE_CHECK);
+		else if (mode == SORT_MODE_CHECK)
+			// the other dispatches are decided after the check
+			enabled = false;
+		else if (i == COPY_SORT_DISPATCH)
+			// the keys have to be copied, if the passes of the full sort are skipped
+			enabled = !fullsort;
+		else if (i < FIRST_FULL_SORT_DISPATCH)
+			enabled = (mode == SORT_MODE_LOCAL);
+		else
+			enabled = fullsort;
+		dispatches[i] = uvec4 (enabled ? SORT_DISPATCH_GROUPS[i] : 0u, 1, 1, 0);
+	}
+}
@@ -23,19 +23,21 @@
 
 layout (local_size_x = BLOCKSIZE) in;
 
-struct ParticleKey {
-	vec3 pos;
-	int id;
-};
-
 layout (std430, binding = 1) readonly buffer ParticleKeys
 {
-	ParticleKey particlekeys[];
+	PARTICLE_KEYS (particlekeys);
 };
 
 
 layout (binding = 2) uniform isamplerBuffer neighbourcelltexture;
 layout (binding = 0, r32f) uniform writeonly imageBuffer lambdatexture;
+layout (binding = 1, r32f) uniform writeonly imageBuffer densityerrortexture;
+
+// if enabled, the density error (the positive part of the density constraint)
+// is stored for each particle, so that it can be reduced by densityerror.glsl
+uniform bool computedensityerror;
+
+#define NEIGHBOUR_DATA(j) vec4 (GetKeyPosition (LoadKey (particlekeys, j)), 0)
 
 
 float Wpoly6 (float r)
@@ -65,7 +67,13 @@ vec3 gradWspiky (vec3 r)
 
 void main (void)
 {
-	vec3 position = particlekeys[gl_GlobalInvocationID.x].pos;
+#ifdef TILED_SOLVER
+	LoadNeighbourTile ();
+#endif
+	if (gl_GlobalInvocationID.x >= NUM_PARTICLES)
+		return;
+
+	vec3 position = GetKeyPosition (LoadKey (particlekeys, gl_GlobalInvocationID.x));
 
 	float sum_k_grad_Ci = 0;
 	float rho = 0;
@@ -74,7 +82,7 @@ void main (void)
 
 	FOR_EACH_NEIGHBOUR(j)
 	{
-		vec3 position_j = particlekeys[j].pos;
+		vec3 position_j = NEIGHBOUR_ENTRY (j).xyz;
 		
 		// compute rho_i (equation 2)
 		float len = distance (position, position_j);
@@ -100,4 +108,6 @@ void main (void)
 	float C_i = rho * one_over_rho_0 - 1;
 	float lambda = -C_i / (sum_k_grad_Ci + epsilon);
 	imageStore (lambdatexture, int (gl_GlobalInvocationID.x), vec4 (lambda, 0, 0, 0));
+	if (computedensityerror)
+		imageStore (densityerrortexture, int (gl_GlobalInvocationID.x), vec4 (max (C_i, 0), 0, 0, 0));
 }
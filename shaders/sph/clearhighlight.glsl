@@ -4,5 +4,8 @@ layout (binding = 0, r32ui) uniform uimageBuffer highlighttexture;
 
 void main (void)
 {
+	if (gl_GlobalInvocationID.x >= NUM_PARTICLES)
+		return;
+
 	imageAtomicAnd (highlighttexture, int (gl_GlobalInvocationID.x), uint (1));
 }
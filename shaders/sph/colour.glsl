@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = BLOCKSIZE) in;
+
+layout (std430, binding = 1) readonly buffer ParticleKeys
+{
+	PARTICLE_KEYS (particlekeys);
+};
+
+layout (binding = 0, r32ui) uniform writeonly uimageBuffer colourtexture;
+
+// Assign each particle one of eight colours by the parity of the grid cell it was
+// sorted into. Particles of the same colour are only neighbours, if they are in the
+// same cell, so most of the neighbours of a colour have already been corrected by
+// the preceding passes of a Gauss-Seidel iteration.
+void main (void)
+{
+	if (gl_GlobalInvocationID.x >= NUM_PARTICLES)
+		return;
+
+	ivec3 cell = GetKeyCell (LoadKey (particlekeys, gl_GlobalInvocationID.x));
+	uint colour = uint ((cell.x & 1) | ((cell.y & 1) << 1) | ((cell.z & 1) << 2));
+	imageStore (colourtexture, int (gl_GlobalInvocationID.x), uvec4 (colour, 0, 0, 0));
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = BLOCKSIZE) in;
+
+layout (std430, binding = 1) readonly buffer ParticleKeys
+{
+	PARTICLE_KEYS (particlekeys);
+};
+
+// magnitude of the vorticity of each particle
+layout (std430, binding = 3) readonly buffer VorticityBuffer
+{
+	float vorticities[];
+};
+
+// vorticity of each particle
+layout (std430, binding = 2) readonly buffer VorticityVectors
+{
+	vec4 vorticityvectors[];
+};
+
+layout (binding = 2) uniform isamplerBuffer neighbourcelltexture;
+
+vec3 gradWspiky (vec3 r)
+{
+	float l = length (r);
+	if (l > h || l == 0)
+		return vec3 (0, 0, 0);
+	float tmp = h - l;
+	return (-3 * 4.774648292756860 * tmp * tmp) * r / (l * h*h*h*h*h*h);
+}
+
+// Applies the vorticity confinement force using the vorticities of all particles
+// computed by the previous pass (vorticity.glsl) and stores the final state.
+void main (void)
+{
+	if (gl_GlobalInvocationID.x >= NUM_PARTICLES)
+		return;
+
+	int i = int (gl_GlobalInvocationID.x);
+	ParticleKey key = LoadKey (particlekeys, i);
+	vec3 position = GetKeyPosition (key);
+
+	// gradient of the vorticity magnitude
+	vec3 gradVorticity = vec3 (0, 0, 0);
+	FOR_EACH_NEIGHBOUR(j)
+	{
+		vec3 p_ij = position - GetKeyPosition (LoadKey (particlekeys, j));
+		gradVorticity += vorticities[j] * gradWspiky (p_ij);
+	}
+	END_FOR_EACH_NEIGHBOUR(j)
+
+	float l = length (gradVorticity);
+	if (l > 0)
+		gradVorticity /= l;
+	vec3 N = gradVorticity;
+
+	// apply vorticity force to the velocity after XSPH viscosity
+	vec3 velocity = imageLoad (velocitytexture, GetVelocityIndex (i, key)).xyz;
+	velocity += timestep * vorticity_epsilon * cross (N, vorticityvectors[i].xyz);
+
+	// update particle information
+	StoreParticle (i, key, velocity);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = DENSITY_ERROR_GROUPS) in;
+
+// maximum and sum of the density errors of each work group for each solver iteration
+layout (std430, binding = 0) readonly buffer DensityErrors
+{
+	vec2 densityerrors[];
+};
+
+// solver state of the current simulation step
+layout (std430, binding = 2) buffer SolverState
+{
+	// indirect dispatch arguments of the particle passes
+	uint particlegroups[3];
+	// indirect dispatch arguments of the density error reduction
+	uint reductiongroups[3];
+	// non-zero as soon as the solver has converged
+	uint converged;
+	// number of solver iterations run in the current step
+	uint iterations;
+	// number of solver iterations run in all steps
+	uint totaliterations;
+};
+
+uniform int iteration;
+uniform float tolerance;
+
+shared float partialsums[DENSITY_ERROR_GROUPS];
+
+void main (void)
+{
+	const uint lid = gl_LocalInvocationIndex;
+
+	// sum the partial results of the density error reduction of this iteration
+	partialsums[lid] = densityerrors[uint (iteration) * DENSITY_ERROR_GROUPS + lid].y;
+	for (uint stride = DENSITY_ERROR_GROUPS / 2; stride > 0; stride >>= 1)
+	{
+		barrier ();
+		memoryBarrierShared ();
+		if (lid < stride)
+			partialsums[lid] += partialsums[lid + stride];
+	}
+
+	if (lid == 0 && converged == 0)
+	{
+		if (partialsums[0] / float (NUM_PARTICLES) < tolerance)
+		{
+			// skip all remaining solver passes of this step
+			converged = 1;
+			particlegroups[0] = 0;
+			reductiongroups[0] = 0;
+		}
+		else
+		{
+			iterations++;
+			totaliterations++;
+		}
+	}
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = BLOCKSIZE) in;
+
+layout (binding = 1, r32f) uniform readonly imageBuffer densityerrortexture;
+
+// maximum and sum of the density errors of each work group for each solver iteration
+layout (std430, binding = 0) writeonly buffer DensityErrors
+{
+	vec2 densityerrors[];
+};
+
+uniform int iteration;
+
+shared vec2 partialerrors[BLOCKSIZE];
+
+void main (void)
+{
+	const uint lid = gl_LocalInvocationIndex;
+
+	// each invocation accumulates a strided part of the particles
+	vec2 errors = vec2 (0, 0);
+	for (uint i = gl_GlobalInvocationID.x; i < NUM_PARTICLES; i += gl_NumWorkGroups.x * BLOCKSIZE)
+	{
+		float error = imageLoad (densityerrortexture, int (i)).x;
+		errors = vec2 (max (errors.x, error), errors.y + error);
+	}
+	partialerrors[lid] = errors;
+
+	// reduce the work group in shared memory
+	for (uint stride = BLOCKSIZE / 2; stride > 0; stride >>= 1)
+	{
+		barrier ();
+		memoryBarrierShared ();
+		if (lid < stride)
+		{
+			vec2 other = partialerrors[lid + stride];
+			partialerrors[lid] = vec2 (max (partialerrors[lid].x, other.x), partialerrors[lid].y + other.y);
+		}
+	}
+
+	if (lid == 0)
+		densityerrors[uint (iteration) * gl_NumWorkGroups.x + gl_WorkGroupID.x] = partialerrors[0];
+}
@@ -1,10 +1,40 @@
-#define FOR_EACH_NEIGHBOUR(var) for (int o = 0; o < 3; o++) {\
-		ivec3 datav = texelFetch (neighbourcelltexture, int (gl_GlobalInvocationID.x * 3 + o)).xyz;\
+#ifdef NEIGHBOUR_CELL_TABLE
+// the neighbour ranges are stored once per grid cell at the index of the first
+// particle in the cell, each particle only stores the index of its cell's entry
+layout (binding = 5) uniform isamplerBuffer neighbourcellindextexture;
+#define NEIGHBOUR_TABLE_OFFSET (texelFetch (neighbourcellindextexture, int (gl_GlobalInvocationID.x)).x * NEIGHBOUR_TEXELS)
+#else
+#define NEIGHBOUR_TABLE_OFFSET (int (gl_GlobalInvocationID.x) * NEIGHBOUR_TEXELS)
+#endif
+#ifdef NEIGHBOUR_WIDE_ENTRIES
+// the number of entries of each neighbour range is stored in a separate table
+layout (binding = 6) uniform isamplerBuffer neighbourcounttexture;
+#define FETCH_NEIGHBOUR_COUNTS(offset) texelFetch (neighbourcounttexture, offset).xyz
+#define NEIGHBOUR_RANGE_START(data) (data)
+#define NEIGHBOUR_RANGE_ENTRIES(data, count) (count)
+#else
+// the number of entries is packed into the upper 8 bits of the range start
+#define FETCH_NEIGHBOUR_COUNTS(offset) ivec3 (0, 0, 0)
+#define NEIGHBOUR_RANGE_START(data) ((data) & 0xFFFFFF)
+#define NEIGHBOUR_RANGE_ENTRIES(data, count) int (uint (data) >> 24)
+#endif
+#ifdef TILED_SOLVER
+// the neighbour data of a work group is staged in shared memory (see tile.glsl);
+// the shaders define NEIGHBOUR_DATA(j) to fetch the data of particle j from global memory
+void LoadNeighbourTile (void);
+vec4 GetNeighbourTileEntry (int j, int row);
+#define NEIGHBOUR_ENTRY(var) GetNeighbourTileEntry (var, o * 3 + comp)
+#else
+#define NEIGHBOUR_ENTRY(var) NEIGHBOUR_DATA (var)
+#endif
+#define FOR_EACH_NEIGHBOUR(var) { int neighbourtableoffset = NEIGHBOUR_TABLE_OFFSET;\
+		for (int o = 0; o < NEIGHBOUR_TEXELS; o++) {\
+		ivec3 datav = texelFetch (neighbourcelltexture, neighbourtableoffset + o).xyz;\
+		ivec3 countv = FETCH_NEIGHBOUR_COUNTS (neighbourtableoffset + o);\
 		for (int comp = 0; comp < 3; comp++) {\
-		int data = datav[comp];\
-		int entries = data >> 24;\
-		data = data & 0xFFFFFF;\
+		int data = NEIGHBOUR_RANGE_START (datav[comp]);\
+		int entries = NEIGHBOUR_RANGE_ENTRIES (datav[comp], countv[comp]);\
 		/*if (data == 0) continue;*/\
 		for (int var = data; var < data + entries; var++) {\
 		if (var != gl_GlobalInvocationID.x) {
-#define END_FOR_EACH_NEIGHBOUR(var)	}}}}
+#define END_FOR_EACH_NEIGHBOUR(var)	}}}}}
@@ -1,21 +1,37 @@
 layout (local_size_x = BLOCKSIZE) in;
 
-struct ParticleKey {
-	vec3 pos;
-	int id;
-};
-
 layout (std430, binding = 1) readonly buffer ParticleKeys
 {
-	ParticleKey particlekeys[];
+	PARTICLE_KEYS (particlekeys);
 };
 
 layout (binding = 2) uniform isamplerBuffer neighbourcelltexture;
 layout (binding = 0, r32ui) uniform uimageBuffer highlighttexture;
 
+#ifdef SORTED_PARTICLES
+// ids in the order of the keys of the previous step, to which the keys refer
+layout (std430, binding = 5) readonly buffer SortedIds
+{
+	int sortedids[];
+};
+
+int GetParticleId (int i)
+{
+	return sortedids[GetKeyId (LoadKey (particlekeys, i))];
+}
+#else
+int GetParticleId (int i)
+{
+	return GetKeyId (LoadKey (particlekeys, i));
+}
+#endif
+
 void main (void)
 {
-	int id = particlekeys[gl_GlobalInvocationID.x].id;
+	if (gl_GlobalInvocationID.x >= NUM_PARTICLES)
+		return;
+
+	int id = GetParticleId (int (gl_GlobalInvocationID.x));
 
 	uint flag = imageLoad (highlighttexture, id).x;
 	
@@ -23,7 +39,7 @@ void main (void)
 	{
 		FOR_EACH_NEIGHBOUR(j)
 		{
-			imageAtomicOr (highlighttexture, particlekeys[j].id, uint(2));
+			imageAtomicOr (highlighttexture, GetParticleId (j), uint(2));
 		}
 		END_FOR_EACH_NEIGHBOUR(j)
 	}
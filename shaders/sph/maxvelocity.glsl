@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = BLOCKSIZE) in;
+
+layout (std430, binding = 0) readonly buffer Velocities
+{
+#ifdef COMPACT_PARTICLES
+	// four half floats
+	uvec2 velocities[];
+#else
+	vec4 velocities[];
+#endif
+};
+
+// maximum particle speed as float bits (non-negative floats have the same ordering as their bits)
+layout (std430, binding = 1) buffer MaxVelocity
+{
+	uint maxvelocity;
+};
+
+shared float speeds[BLOCKSIZE];
+
+vec3 GetVelocity (uint id)
+{
+#ifdef COMPACT_PARTICLES
+	return vec3 (unpackHalf2x16 (velocities[id].x), unpackHalf2x16 (velocities[id].y).x);
+#else
+	return velocities[id].xyz;
+#endif
+}
+
+void main (void)
+{
+	const uint lid = gl_LocalInvocationIndex;
+
+	speeds[lid] = (gl_GlobalInvocationID.x < NUM_PARTICLES) ? length (GetVelocity (gl_GlobalInvocationID.x)) : 0.0;
+
+	// reduce the work group in shared memory
+	for (uint stride = BLOCKSIZE / 2; stride > 0; stride >>= 1)
+	{
+		barrier ();
+		memoryBarrierShared ();
+		if (lid < stride)
+			speeds[lid] = max (speeds[lid], speeds[lid + stride]);
+	}
+
+	// combine the maxima of all work groups
+	if (lid == 0)
+		atomicMax (maxvelocity, floatBitsToUint (speeds[0]));
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = 1) in;
+
+// state of the neighbour search with a skin (see predictpos.glsl)
+layout (std430, binding = 3) buffer SearchState
+{
+	// indirect dispatch arguments of the passes of the neighbour search
+	uint searchgroups[3];
+	// non-zero, if a particle has moved too far since the last neighbour search
+	uint skinexceeded;
+	// number of steps since the last neighbour search
+	uint searchage;
+	// number of neighbour searches so far
+	uint numsearches;
+};
+
+// set by the host, if the grid or the particles have changed
+uniform bool searchrequest;
+// maximum number of steps between neighbour searches
+uniform uint searchinterval;
+
+void main (void)
+{
+	// search the neighbours, if requested, if a particle has moved too far or if the
+	// interval has passed, and skip all passes of the neighbour search otherwise
+	searchage++;
+	bool search = searchrequest || skinexceeded != 0u || searchage >= searchinterval;
+	if (search)
+	{
+		searchage = 0u;
+		skinexceeded = 0u;
+		numsearches++;
+	}
+	searchgroups[0] = search ? uint ((NUM_PARTICLES + BLOCKSIZE - 1) / BLOCKSIZE) : 0u;
+	searchgroups[1] = 1u;
+	searchgroups[2] = 1u;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+// Access to the particle state at the end of a step. The positions of the
+// previous step are read through the keys and the new state is written for the
+// particle at a given place in the order of the sorted keys.
+#ifdef SORTED_PARTICLES
+// positions and ids in the order of the keys of the previous step
+layout (std430, binding = 4) readonly buffer PreviousPositions
+{
+	vec4 previouspositions[];
+};
+layout (std430, binding = 5) readonly buffer PreviousIds
+{
+	int previousids[];
+};
+// positions and ids in the order of the current keys
+layout (std430, binding = 6) writeonly buffer SortedPositions
+{
+	vec4 sortedpositions[];
+};
+layout (std430, binding = 7) writeonly buffer SortedIds
+{
+	int sortedids[];
+};
+#else
+layout (binding = 0, rgba32f) uniform imageBuffer positiontexture;
+#endif
+layout (binding = 1, VELOCITY_FORMAT) uniform imageBuffer velocitytexture;
+
+// position of a particle at the beginning of the step
+vec3 GetPreviousPosition (ParticleKey key)
+{
+#ifdef SORTED_PARTICLES
+	// the key refers to the place of the particle in the previous order
+	return previouspositions[GetKeyId (key)].xyz;
+#else
+	return imageLoad (positiontexture, GetKeyId (key)).xyz;
+#endif
+}
+
+// velocity of a particle from its displacement during the step
+vec3 GetStepVelocity (ParticleKey key)
+{
+	return (GetKeyPosition (key) - GetPreviousPosition (key)) / timestep;
+}
+
+// index of the velocity of the particle at place i
+int GetVelocityIndex (int i, ParticleKey key)
+{
+#ifdef SORTED_PARTICLES
+	// the velocities are stored in the order of the keys
+	return i;
+#else
+	return GetKeyId (key);
+#endif
+}
+
+// store the final position and velocity of the particle at place i
+void StoreParticle (int i, ParticleKey key, vec3 velocity)
+{
+#ifdef SORTED_PARTICLES
+	// the state is moved along with the key, so that all following passes read it in sorted order
+	sortedpositions[i] = vec4 (GetKeyPosition (key), 0);
+	sortedids[i] = previousids[GetKeyId (key)];
+#else
+	imageStore (positiontexture, GetKeyId (key), vec4 (GetKeyPosition (key), 0));
+#endif
+	imageStore (velocitytexture, GetVelocityIndex (i, key), vec4 (velocity, 0));
+}
@@ -1,38 +1,72 @@
 layout (local_size_x = BLOCKSIZE) in;
 
-struct ParticleKey {
-	vec3 pos;
-	int id;
-};
-
-layout (std430, binding = 1) writeonly buffer ParticleKeys
+layout (std430, binding = 1) buffer ParticleKeys
 {
-	ParticleKey particlekeys[];
+	PARTICLE_KEYS (particlekeys);
 };
 
 layout (location = 0) uniform bool extforce;
+// keep the particle order of the previous step, so that the keys are nearly sorted
+layout (location = 1) uniform bool keeporder;
+
+#ifdef NEIGHBOUR_SKIN
+// keys at the last neighbour search; a particle that has moved further than
+// NEIGHBOUR_SKIN_TRIGGER since then requests a new neighbour search in this step
+layout (std430, binding = 2) readonly buffer NeighbourSkin
+{
+	PARTICLE_KEYS (skinkeys);
+};
+// (see neighboursearch.glsl)
+layout (std430, binding = 3) buffer SearchState
+{
+	uint searchgroups[3];
+	uint skinexceeded;
+};
+#endif
 
+#ifdef SORTED_PARTICLES
+// positions in the order of the keys of the previous step
+layout (std430, binding = 4) readonly buffer SortedPositions
+{
+	vec4 sortedpositions[];
+};
+#else
 layout (binding = 0) uniform samplerBuffer positiontexture;
+#endif
 layout (binding = 1) uniform samplerBuffer velocitytexture;
 
 void main (void)
 {
-	ParticleKey key;
-	key.id = int (gl_GlobalInvocationID.x);
+	if (gl_GlobalInvocationID.x >= NUM_PARTICLES)
+		return;
 
-	key.pos = texelFetch (positiontexture, key.id).xyz;
-	vec3 velocity = texelFetch (velocitytexture, key.id).xyz;
+#ifdef SORTED_PARTICLES
+	// the particle state is stored in the order of the keys, so the particle keeps
+	// its place and the key refers to it by this place instead of its id
+	int id = int (gl_GlobalInvocationID.x);
+	vec3 pos = sortedpositions[id].xyz;
+#else
+	int id = keeporder ? GetKeyId (LoadKey (particlekeys, gl_GlobalInvocationID.x)) : int (gl_GlobalInvocationID.x);
+	vec3 pos = texelFetch (positiontexture, id).xyz;
+#endif
+	vec3 velocity = texelFetch (velocitytexture, id).xyz;
 
 	// optionally apply an additional external force to some particles
-	if (extforce && key.pos.z > GRID_SIZE.z/2)
+	if (extforce && pos.z > 0.5 * (domainmin.z + domainmax.z))
 		velocity += 2 * gravity * vec3 (0, 0, -1) * timestep;
 	
 	// gravity
 	//velocity += gravity * vec3 (n.x * 0.05, -1, n.y*0.05) * timestep;
 	velocity += gravity * vec3 (0, -1, 0) * timestep;
 
-	key.pos += timestep * velocity;
+	pos += timestep * velocity;
+
+#ifdef NEIGHBOUR_SKIN
+	if (distance (pos, GetKeyPosition (LoadKey (skinkeys, gl_GlobalInvocationID.x))) > NEIGHBOUR_SKIN_TRIGGER)
+		skinexceeded = 1u;
+#endif
 
 	// predict new position
-	particlekeys[key.id] = key;
+	ParticleKey key = MakeKey (pos, id);
+	StoreKey (particlekeys, gl_GlobalInvocationID.x, key);
 }
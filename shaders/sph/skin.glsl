@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = BLOCKSIZE) in;
+
+layout (std430, binding = 1) readonly buffer ParticleKeys
+{
+	PARTICLE_KEYS (particlekeys);
+};
+
+// keys at the last neighbour search (see predictpos.glsl)
+layout (std430, binding = 2) writeonly buffer NeighbourSkin
+{
+	PARTICLE_KEYS (skinkeys);
+};
+
+// remembers the keys of a neighbour search (dispatched only if the neighbours are searched)
+void main (void)
+{
+	if (gl_GlobalInvocationID.x >= NUM_PARTICLES)
+		return;
+	StoreKey (skinkeys, gl_GlobalInvocationID.x, LoadKey (particlekeys, gl_GlobalInvocationID.x));
+}
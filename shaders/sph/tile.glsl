@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// This file is appended to the solver shaders compiled with TILED_SOLVER.
+// The particles of a work group are consecutive in sorted order, so for each of the
+// neighbour rows (see neighbourcells.glsl) the union of their neighbour ranges
+// is a single contiguous range of sorted particles. These ranges are loaded into
+// shared memory once, so that the solver does not read the data of each neighbour
+// from global memory for every particle it is a neighbour of. Rows that do not fit
+// into TILE_CAPACITY entries are read from global memory.
+// The lambda and the position correction pass are tiled separately rather than fused,
+// since the corrections need the lambdas of neighbours in other work groups, which
+// are only complete after a barrier across all work groups, i.e. a separate dispatch.
+
+shared float tilex[TILE_CAPACITY];
+shared float tiley[TILE_CAPACITY];
+shared float tilez[TILE_CAPACITY];
+shared float tilew[TILE_CAPACITY];
+
+#define TILE_ROWS (NEIGHBOUR_TEXELS * 3)
+
+shared int tilestart[TILE_ROWS];
+shared int tileend[TILE_ROWS];
+shared int tileoffset[TILE_ROWS];
+
+void LoadNeighbourTile (void)
+{
+	const int lid = int (gl_LocalInvocationIndex);
+
+	if (lid < TILE_ROWS)
+	{
+		tilestart[lid] = 0x7FFFFFFF;
+		tileend[lid] = 0;
+	}
+
+	barrier ();
+	memoryBarrierShared ();
+
+	// determine the union of the neighbour ranges of the work group for each row
+	if (gl_GlobalInvocationID.x < NUM_PARTICLES)
+	{
+		int neighbourtableoffset = NEIGHBOUR_TABLE_OFFSET;
+		for (int o = 0; o < NEIGHBOUR_TEXELS; o++)
+		{
+			ivec3 datav = texelFetch (neighbourcelltexture, neighbourtableoffset + o).xyz;
+			ivec3 countv = FETCH_NEIGHBOUR_COUNTS (neighbourtableoffset + o);
+			for (int comp = 0; comp < 3; comp++)
+			{
+				int start = NEIGHBOUR_RANGE_START (datav[comp]);
+				int entries = NEIGHBOUR_RANGE_ENTRIES (datav[comp], countv[comp]);
+				if (entries > 0)
+				{
+					atomicMin (tilestart[o * 3 + comp], start);
+					atomicMax (tileend[o * 3 + comp], start + entries);
+				}
+			}
+		}
+	}
+
+	barrier ();
+	memoryBarrierShared ();
+
+	// assign the rows to the tile as long as they fit
+	if (lid == 0)
+	{
+		int offset = 0;
+		for (int row = 0; row < TILE_ROWS; row++)
+		{
+			int len = max (tileend[row] - tilestart[row], 0);
+			if (offset + len <= TILE_CAPACITY)
+			{
+				tileoffset[row] = offset;
+				offset += len;
+			}
+			else
+				tileoffset[row] = -1;
+		}
+	}
+
+	barrier ();
+	memoryBarrierShared ();
+
+	// load the rows cooperatively
+	for (int row = 0; row < TILE_ROWS; row++)
+	{
+		if (tileoffset[row] < 0)
+			continue;
+		for (int k = lid; k < tileend[row] - tilestart[row]; k += BLOCKSIZE)
+		{
+			vec4 data = NEIGHBOUR_DATA (tilestart[row] + k);
+			tilex[tileoffset[row] + k] = data.x;
+			tiley[tileoffset[row] + k] = data.y;
+			tilez[tileoffset[row] + k] = data.z;
+			tilew[tileoffset[row] + k] = data.w;
+		}
+	}
+
+	barrier ();
+	memoryBarrierShared ();
+}
+
+vec4 GetNeighbourTileEntry (int j, int row)
+{
+	if (tileoffset[row] < 0)
+		return NEIGHBOUR_DATA (j);
+	int k = tileoffset[row] + j - tilestart[row];
+	return vec4 (tilex[k], tiley[k], tilez[k], tilew[k]);
+}
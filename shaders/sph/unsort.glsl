@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+// header is included here
+
+layout (local_size_x = BLOCKSIZE) in;
+
+// positions and ids in the order of the sorted keys
+layout (std430, binding = 0) readonly buffer SortedPositions
+{
+	vec4 sortedpositions[];
+};
+layout (std430, binding = 1) readonly buffer SortedIds
+{
+	int sortedids[];
+};
+
+// positions indexed by particle id
+layout (std430, binding = 2) writeonly buffer Positions
+{
+	vec4 positions[];
+};
+
+void main (void)
+{
+	if (gl_GlobalInvocationID.x >= NUM_PARTICLES)
+		return;
+
+	positions[sortedids[gl_GlobalInvocationID.x]] = sortedpositions[gl_GlobalInvocationID.x];
+}
@@ -1,19 +1,39 @@
 layout (local_size_x = BLOCKSIZE) in;
 
-struct ParticleKey {
-	vec3 pos;
-	int id;
-};
-
 layout (std430, binding = 1) buffer ParticleKeys
 {
-	ParticleKey particlekeys[];
+	PARTICLE_KEYS (particlekeys);
 };
 
 layout (binding = 2) uniform isamplerBuffer neighbourcelltexture;
 layout (binding = 3) uniform samplerBuffer lambdatexture;
 layout (binding = 4) uniform sampler3D collisiontexture;
 
+#ifdef SEPARATE_OUTPUT
+// The corrected positions are written to a separate buffer, so that all particles
+// see the positions of the last pass (Jacobi). If colour is not negative, only the
+// particles of that colour are corrected and all others are copied, so that
+// consecutive passes over the eight colours form a Gauss-Seidel iteration.
+layout (std430, binding = 7) writeonly buffer CorrectedKeys
+{
+	PARTICLE_KEYS (correctedkeys);
+};
+layout (binding = 7) uniform usamplerBuffer colourtexture;
+
+// Once the adaptive solver has converged, the passes only copy the particles,
+// so that the result still ends up in the buffer the host expects.
+layout (std430, binding = 2) readonly buffer SolverState
+{
+	uint particlegroups[3];
+	uint reductiongroups[3];
+	uint converged;
+};
+
+uniform int colour;
+#endif
+
+#define NEIGHBOUR_DATA(j) vec4 (GetKeyPosition (LoadKey (particlekeys, j)), texelFetch (lambdatexture, j).x)
+
 float Wpoly6 (float r)
 {
 	if (r > h)
@@ -41,7 +61,35 @@ vec3 gradWspiky (vec3 r)
 
 void main (void)
 {
-	vec3 position = particlekeys[gl_GlobalInvocationID.x].pos;
+#ifdef SEPARATE_OUTPUT
+	// the flag is the same for the whole work group, so the tile barriers are not affected
+	if (converged != 0)
+	{
+		if (gl_GlobalInvocationID.x < NUM_PARTICLES)
+		{
+			ParticleKey key = LoadKey (particlekeys, gl_GlobalInvocationID.x);
+			StoreKey (correctedkeys, gl_GlobalInvocationID.x, key);
+		}
+		return;
+	}
+#endif
+#ifdef TILED_SOLVER
+	LoadNeighbourTile ();
+#endif
+	if (gl_GlobalInvocationID.x >= NUM_PARTICLES)
+		return;
+
+	ParticleKey key = LoadKey (particlekeys, gl_GlobalInvocationID.x);
+
+#ifdef SEPARATE_OUTPUT
+	if (colour >= 0 && texelFetch (colourtexture, int (gl_GlobalInvocationID.x)).x != uint (colour))
+	{
+		StoreKey (correctedkeys, gl_GlobalInvocationID.x, key);
+		return;
+	}
+#endif
+
+	vec3 position = GetKeyPosition (key);
 
 	vec3 deltap = vec3 (0, 0, 0);
 	
@@ -52,14 +100,15 @@ void main (void)
 	{
 		// This might fetch an already updated position,
 		// but that doesn't cause any harm.
-		vec3 position_j = particlekeys[j].pos;
+		vec4 data_j = NEIGHBOUR_ENTRY (j);
+		vec3 position_j = data_j.xyz;
 		
 		float scorr = tensile_instability_scale * Wpoly6 (distance (position, position_j));
 		scorr *= scorr;
 		scorr *= scorr;
 		scorr = -tensile_instability_k * scorr;
 		
-		float lambda_j = texelFetch (lambdatexture, j).x;  
+		float lambda_j = data_j.w;
 	
 		// accumulate position corrections (part of equation 12)
 		deltap += (lambda + lambda_j + scorr) * gradWspiky (position - position_j);
@@ -95,11 +144,14 @@ void main (void)
 	walldist = (GRID_SIZE - wall) - position;
 	position = (GRID_SIZE - wall) - walldist * (vec3 (greaterThan (walldist, vec3 (0, 0, 0))) * 1.75 - 0.75);*/
 
-	vec3 wall = vec3 (16, 0, 16 );
-
-	position = clamp (position, vec3 (0, 0, 0) + wall, GRID_SIZE - wall);
+	position = clamp (position, domainmin.xyz, domainmax.xyz);
 	/*position = clamp (position, vec3 (-16, 0, -16), vec3 (16, 16, 16));*/
 	// collision detection end
 
-	particlekeys[gl_GlobalInvocationID.x].pos = position;
+	key = MakeKey (position, GetKeyId (key));
+#ifdef SEPARATE_OUTPUT
+	StoreKey (correctedkeys, gl_GlobalInvocationID.x, key);
+#else
+	StoreKey (particlekeys, gl_GlobalInvocationID.x, key);
+#endif
 }
@@ -1,18 +1,23 @@
 layout (local_size_x = BLOCKSIZE) in;
 
-layout (std430, binding = 1) buffer ParticleKeys
+layout (std430, binding = 1) readonly buffer ParticleKeys
 {
-	vec4 particlekeys[];
+	PARTICLE_KEYS (particlekeys);
 };
 
-layout (std430, binding = 3) coherent buffer VorticityBuffer
+// magnitude of the vorticity of each particle
+layout (std430, binding = 3) writeonly buffer VorticityBuffer
 {
 	float vorticities[];
 };
 
-layout (binding = 2) uniform isamplerBuffer neighbourcelltexture;
+// vorticity of each particle
+layout (std430, binding = 2) writeonly buffer VorticityVectors
+{
+	vec4 vorticityvectors[];
+};
 
-layout (binding = 1, rgba32f) uniform imageBuffer velocitytexture;
+layout (binding = 2) uniform isamplerBuffer neighbourcelltexture;
 
 float Wpoly6 (float r)
 {
@@ -31,56 +36,38 @@ vec3 gradWspiky (vec3 r)
 	return (-3 * 4.774648292756860 * tmp * tmp) * r / (l * h*h*h*h*h*h);
 }
 
+// This pass computes the vorticity of each particle and applies the XSPH viscosity.
+// The velocities of the step are computed from the displacements of the particles,
+// so that the velocity buffer is only written and the velocities of the neighbours
+// are the same for all particles. The vorticity confinement force depends on the
+// vorticities of the neighbours and is applied in a second pass (confinement.glsl),
+// which also stores the new positions.
 void main (void)
 {
-	vec4 key = particlekeys[gl_GlobalInvocationID.x];
-	int particleid = floatBitsToInt (key.w);
-	vec3 position = key.xyz;
+	if (gl_GlobalInvocationID.x >= NUM_PARTICLES)
+		return;
+
+	int i = int (gl_GlobalInvocationID.x);
+	ParticleKey key = LoadKey (particlekeys, i);
+	vec3 position = GetKeyPosition (key);
+	vec3 velocity = GetStepVelocity (key);
 
-	// fetch velocity	
-	vec3 velocity = imageLoad (velocitytexture, particleid).xyz;
-	
 	// calculate vorticity & apply XSPH viscosity
-	vec3 v = vec3 (0, 0, 0);
 	vec3 vorticity = vec3 (0, 0, 0);
-	float rho = 0;
+	vec3 v = vec3 (0, 0, 0);
 	FOR_EACH_NEIGHBOUR(j)
 	{
-		vec4 key_j = particlekeys[j];
-		vec3 v_ij = imageLoad (velocitytexture, floatBitsToInt (key_j.w)).xyz - velocity;
-		vec3 p_ij = position - key_j.xyz;
+		ParticleKey key_j = LoadKey (particlekeys, j);
+		vec3 v_ij = GetStepVelocity (key_j) - velocity;
+		vec3 p_ij = position - GetKeyPosition (key_j);
 		float tmp = Wpoly6 (length (p_ij));
-		rho += tmp;
 		v += v_ij * tmp;
 		vorticity += cross (v_ij, gradWspiky (p_ij));
 	}
 	END_FOR_EACH_NEIGHBOUR(j)
 	velocity += xsph_viscosity_c * v;
-	
-	vorticities[gl_GlobalInvocationID.x] = length (vorticity);
-	
-	barrier ();
-	memoryBarrier ();
-	
-	// vorticity confinement
-	vec3 gradVorticity = vec3 (0, 0, 0);
-	FOR_EACH_NEIGHBOUR(j)
-	{
-		vec3 p_ij = position - particlekeys[j].xyz;
-		// There is no real guarantee that vorticities[] contains the correct
-		// values at this point, but there seem to be no issues in practice.
-		gradVorticity += vorticities[j] * gradWspiky (p_ij);
-	}
-	END_FOR_EACH_NEIGHBOUR(j)
-	
-	float l = length (gradVorticity);
-	if (l > 0)
-		gradVorticity /= l;
-	vec3 N = gradVorticity;
-	
-	// apply vorticity force
-	velocity += timestep * vorticity_epsilon * cross (N, vorticity);
-	
-	// update particle information
-	imageStore (velocitytexture, particleid, vec4 (velocity, 0));
+
+	vorticities[i] = length (vorticity);
+	vorticityvectors[i] = vec4 (vorticity, 0);
+	imageStore (velocitytexture, GetVelocityIndex (i, key), vec4 (velocity, 0));
 }
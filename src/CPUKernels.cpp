@@ -0,0 +1,554 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "CPUKernels.h"
+#include <cmath>
+#if (defined (__GNUC__) || defined (__clang__)) && (defined (__x86_64__) || defined (__i386__))
+#include <immintrin.h>
+
+/*
+ * The vectorised kernels are compiled for their instruction set with target attributes,
+ * while the rest of the file (and of the program) is compiled for the baseline, so that
+ * the CPU is only asked for the instructions it supports at runtime.
+ */
+#define SIMD_DISPATCH
+#define TARGET_AVX512 __attribute__ ((target ("avx512f")))
+#define TARGET_AVX2 __attribute__ ((target ("avx2,fma")))
+#endif
+
+/** Instruction sets.
+ * Instruction sets of the solver kernels.
+ */
+typedef enum instructionset {
+	INSTRUCTION_SET_SCALAR,
+	INSTRUCTION_SET_AVX2,
+	INSTRUCTION_SET_AVX512
+} instructionset_t;
+
+/** Get host instruction set.
+ * Determines the widest instruction set of the vectorised kernels the CPU supports.
+ * \returns the instruction set
+ */
+static instructionset_t GetHostInstructionSet (void)
+{
+#ifdef SIMD_DISPATCH
+	static const instructionset_t instructionset = [] () {
+		__builtin_cpu_init ();
+		if (__builtin_cpu_supports ("avx512f"))
+			return INSTRUCTION_SET_AVX512;
+		if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+			return INSTRUCTION_SET_AVX2;
+		return INSTRUCTION_SET_SCALAR;
+	} ();
+	return instructionset;
+#else
+	return INSTRUCTION_SET_SCALAR;
+#endif
+}
+
+/** Kernel constants.
+ * Constants of the smoothing kernels precomputed for a kernel width.
+ */
+typedef struct kernelconstants {
+	/** Squared kernel width. */
+	float h2;
+	/** Poly6 kernel normalization (1.56668147106 / h^9). */
+	float poly6;
+	/** Spiky gradient normalization (-3 * 4.774648292756860 / h^6). */
+	float spiky;
+} kernelconstants_t;
+
+/** Compute kernel constants.
+ * \param h kernel width
+ * \returns the kernel constants
+ */
+static inline kernelconstants_t GetKernelConstants (const float &h)
+{
+	kernelconstants_t c;
+	float h3 = h * h * h;
+	c.h2 = h * h;
+	c.poly6 = 1.56668147106f / (h3 * h3 * h3);
+	c.spiky = -3 * 4.774648292756860f / (h3 * h3);
+	return c;
+}
+
+/** Scalar lambda.
+ * Calculates lambda_i for a single sorted particle.
+ * \param in kernel input
+ * \param c kernel constants
+ * \param i sorted particle index
+ * \returns lambda_i
+ */
+static float CalcLambdaScalar (const cpukernelinput_t &in, const kernelconstants_t &c, const uint32_t i)
+{
+	const float px = in.x[i], py = in.y[i], pz = in.z[i];
+	float rho = 0, sum_k_grad_Ci = 0;
+	float gx = 0, gy = 0, gz = 0;
+
+	for (int o = 0; o < in.numranges; o++)
+	{
+		uint32_t start = in.neighbourstart[in.numranges * i + o];
+		uint32_t end = start + in.neighbourcount[in.numranges * i + o];
+		for (uint32_t j = start; j < end; j++)
+		{
+			if (j == i)
+				continue;
+			float dx = px - in.x[j], dy = py - in.y[j], dz = pz - in.z[j];
+			float r2 = dx * dx + dy * dy + dz * dz;
+			float r = std::sqrt (r2);
+			if (r > in.h)
+				continue;
+
+			// compute rho_i (equation 2)
+			float tmp = c.h2 - r2;
+			rho += c.poly6 * tmp * tmp * tmp;
+
+			// sum gradients of Ci (equation 8 and parts of equation 9)
+			if (r == 0)
+				continue;
+			tmp = in.h - r;
+			float f = c.spiky * tmp * tmp / r * in.one_over_rho_0;
+			sum_k_grad_Ci += f * f * r2;
+			gx += f * dx;
+			gy += f * dy;
+			gz += f * dz;
+		}
+	}
+	sum_k_grad_Ci += gx * gx + gy * gy + gz * gz;
+
+	// compute lambda_i (equations 1 and 9)
+	float C_i = rho * in.one_over_rho_0 - 1;
+	return -C_i / (sum_k_grad_Ci + in.epsilon);
+}
+
+/** Clamp to domain.
+ * Clamps a corrected position to the simulation domain and stores it.
+ */
+static inline void StorePosition (const cpukernelinput_t &in, const size_t i, float px, float py, float pz,
+		float *x, float *y, float *z)
+{
+	x[i] = std::fmin (std::fmax (px, in.wallmin[0]), in.wallmax[0]);
+	y[i] = std::fmin (std::fmax (py, in.wallmin[1]), in.wallmax[1]);
+	z[i] = std::fmin (std::fmax (pz, in.wallmin[2]), in.wallmax[2]);
+}
+
+/** Scalar position update.
+ * Calculates the position correction for a single sorted particle.
+ * \param in kernel input
+ * \param c kernel constants
+ * \param lambdas lambda_i of each sorted particle
+ * \param i sorted particle index
+ * \param x array to store the corrected x coordinate in
+ * \param y array to store the corrected y coordinate in
+ * \param z array to store the corrected z coordinate in
+ */
+static void UpdatePositionScalar (const cpukernelinput_t &in, const kernelconstants_t &c, const float *lambdas,
+		const uint32_t i, float *x, float *y, float *z)
+{
+	const float px = in.x[i], py = in.y[i], pz = in.z[i];
+	const float lambda = lambdas[i];
+	float deltax = 0, deltay = 0, deltaz = 0;
+
+	for (int o = 0; o < in.numranges; o++)
+	{
+		uint32_t start = in.neighbourstart[in.numranges * i + o];
+		uint32_t end = start + in.neighbourcount[in.numranges * i + o];
+		for (uint32_t j = start; j < end; j++)
+		{
+			if (j == i)
+				continue;
+			float dx = px - in.x[j], dy = py - in.y[j], dz = pz - in.z[j];
+			float r2 = dx * dx + dy * dy + dz * dz;
+			float r = std::sqrt (r2);
+			if (r > in.h || r == 0)
+				continue;
+
+			float tmp = c.h2 - r2;
+			float scorr = in.tensile_instability_scale * c.poly6 * tmp * tmp * tmp;
+			scorr *= scorr;
+			scorr *= scorr;
+			scorr = -in.tensile_instability_k * scorr;
+
+			// accumulate position corrections (part of equation 12)
+			tmp = in.h - r;
+			float f = (lambda + lambdas[j] + scorr) * c.spiky * tmp * tmp / r;
+			deltax += f * dx;
+			deltay += f * dy;
+			deltaz += f * dz;
+		}
+	}
+
+	StorePosition (in, i, px + in.one_over_rho_0 * deltax, py + in.one_over_rho_0 * deltay,
+			pz + in.one_over_rho_0 * deltaz, x, y, z);
+}
+
+#ifdef SIMD_DISPATCH
+
+/** AVX-512 vector width.
+ * Number of neighbour pairs processed per AVX-512 instruction.
+ */
+#define AVX512_WIDTH 16
+
+/** Vectorised lambda.
+ * Calculates lambda_i for a single sorted particle using AVX-512.
+ * Neighbours outside the kernel support, the particle itself and lanes past the
+ * end of a neighbour range are masked out instead of branched over.
+ */
+TARGET_AVX512 static float CalcLambdaAVX512 (const cpukernelinput_t &in, const kernelconstants_t &c, const uint32_t i)
+{
+	const __m512i lanes = _mm512_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m512 px = _mm512_set1_ps (in.x[i]), py = _mm512_set1_ps (in.y[i]), pz = _mm512_set1_ps (in.z[i]);
+	const __m512 h = _mm512_set1_ps (in.h), h2 = _mm512_set1_ps (c.h2);
+	const __m512 zero = _mm512_setzero_ps ();
+	const __m512 spiky = _mm512_set1_ps (c.spiky * in.one_over_rho_0);
+	const __m512i self = _mm512_set1_epi32 (int32_t (i));
+	__m512 rho = zero, sum_k_grad_Ci = zero, gx = zero, gy = zero, gz = zero;
+
+	for (int o = 0; o < in.numranges; o++)
+	{
+		uint32_t start = in.neighbourstart[in.numranges * i + o];
+		uint32_t end = start + in.neighbourcount[in.numranges * i + o];
+		for (uint32_t j = start; j < end; j += AVX512_WIDTH)
+		{
+			__m512i idx = _mm512_add_epi32 (_mm512_set1_epi32 (int32_t (j)), lanes);
+			__mmask16 mask = (end - j >= AVX512_WIDTH) ? __mmask16 (0xFFFF) : __mmask16 ((1u << (end - j)) - 1);
+			mask &= _mm512_cmpneq_epi32_mask (idx, self);
+
+			__m512 dx = _mm512_sub_ps (px, _mm512_maskz_loadu_ps (mask, &in.x[j]));
+			__m512 dy = _mm512_sub_ps (py, _mm512_maskz_loadu_ps (mask, &in.y[j]));
+			__m512 dz = _mm512_sub_ps (pz, _mm512_maskz_loadu_ps (mask, &in.z[j]));
+			__m512 r2 = _mm512_fmadd_ps (dz, dz, _mm512_fmadd_ps (dy, dy, _mm512_mul_ps (dx, dx)));
+			__m512 r = _mm512_sqrt_ps (r2);
+			mask = _mm512_mask_cmp_ps_mask (mask, r, h, _CMP_LE_OQ);
+
+			// compute rho_i (equation 2)
+			__m512 tmp = _mm512_sub_ps (h2, r2);
+			rho = _mm512_mask3_fmadd_ps (_mm512_mul_ps (_mm512_mul_ps (tmp, tmp), tmp), _mm512_set1_ps (c.poly6),
+					rho, mask);
+
+			// sum gradients of Ci (equation 8 and parts of equation 9)
+			mask = _mm512_mask_cmp_ps_mask (mask, r, zero, _CMP_GT_OQ);
+			tmp = _mm512_sub_ps (h, r);
+			__m512 f = _mm512_maskz_div_ps (mask, _mm512_mul_ps (spiky, _mm512_mul_ps (tmp, tmp)), r);
+			sum_k_grad_Ci = _mm512_fmadd_ps (_mm512_mul_ps (f, f), r2, sum_k_grad_Ci);
+			gx = _mm512_fmadd_ps (f, dx, gx);
+			gy = _mm512_fmadd_ps (f, dy, gy);
+			gz = _mm512_fmadd_ps (f, dz, gz);
+		}
+	}
+
+	float sx = _mm512_reduce_add_ps (gx), sy = _mm512_reduce_add_ps (gy), sz = _mm512_reduce_add_ps (gz);
+	float sum = _mm512_reduce_add_ps (sum_k_grad_Ci) + sx * sx + sy * sy + sz * sz;
+
+	// compute lambda_i (equations 1 and 9)
+	float C_i = _mm512_reduce_add_ps (rho) * in.one_over_rho_0 - 1;
+	return -C_i / (sum + in.epsilon);
+}
+
+/** Vectorised position update.
+ * Calculates the position correction for a single sorted particle using AVX-512.
+ */
+TARGET_AVX512 static void UpdatePositionAVX512 (const cpukernelinput_t &in, const kernelconstants_t &c, const float *lambdas,
+		const uint32_t i, float *x, float *y, float *z)
+{
+	const __m512i lanes = _mm512_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m512 px = _mm512_set1_ps (in.x[i]), py = _mm512_set1_ps (in.y[i]), pz = _mm512_set1_ps (in.z[i]);
+	const __m512 h = _mm512_set1_ps (in.h), h2 = _mm512_set1_ps (c.h2);
+	const __m512 zero = _mm512_setzero_ps ();
+	const __m512 poly6 = _mm512_set1_ps (in.tensile_instability_scale * c.poly6);
+	const __m512 k = _mm512_set1_ps (-in.tensile_instability_k);
+	const __m512 spiky = _mm512_set1_ps (c.spiky);
+	const __m512 lambda = _mm512_set1_ps (lambdas[i]);
+	const __m512i self = _mm512_set1_epi32 (int32_t (i));
+	__m512 deltax = zero, deltay = zero, deltaz = zero;
+
+	for (int o = 0; o < in.numranges; o++)
+	{
+		uint32_t start = in.neighbourstart[in.numranges * i + o];
+		uint32_t end = start + in.neighbourcount[in.numranges * i + o];
+		for (uint32_t j = start; j < end; j += AVX512_WIDTH)
+		{
+			__m512i idx = _mm512_add_epi32 (_mm512_set1_epi32 (int32_t (j)), lanes);
+			__mmask16 mask = (end - j >= AVX512_WIDTH) ? __mmask16 (0xFFFF) : __mmask16 ((1u << (end - j)) - 1);
+			mask &= _mm512_cmpneq_epi32_mask (idx, self);
+
+			__m512 dx = _mm512_sub_ps (px, _mm512_maskz_loadu_ps (mask, &in.x[j]));
+			__m512 dy = _mm512_sub_ps (py, _mm512_maskz_loadu_ps (mask, &in.y[j]));
+			__m512 dz = _mm512_sub_ps (pz, _mm512_maskz_loadu_ps (mask, &in.z[j]));
+			__m512 r2 = _mm512_fmadd_ps (dz, dz, _mm512_fmadd_ps (dy, dy, _mm512_mul_ps (dx, dx)));
+			__m512 r = _mm512_sqrt_ps (r2);
+			mask = _mm512_mask_cmp_ps_mask (mask, r, h, _CMP_LE_OQ);
+			mask = _mm512_mask_cmp_ps_mask (mask, r, zero, _CMP_GT_OQ);
+
+			__m512 tmp = _mm512_sub_ps (h2, r2);
+			__m512 scorr = _mm512_mul_ps (poly6, _mm512_mul_ps (_mm512_mul_ps (tmp, tmp), tmp));
+			scorr = _mm512_mul_ps (scorr, scorr);
+			scorr = _mm512_mul_ps (k, _mm512_mul_ps (scorr, scorr));
+
+			// accumulate position corrections (part of equation 12)
+			__m512 s = _mm512_add_ps (_mm512_add_ps (lambda, _mm512_maskz_loadu_ps (mask, &lambdas[j])), scorr);
+			tmp = _mm512_sub_ps (h, r);
+			__m512 f = _mm512_maskz_div_ps (mask, _mm512_mul_ps (_mm512_mul_ps (s, spiky), _mm512_mul_ps (tmp, tmp)), r);
+			deltax = _mm512_fmadd_ps (f, dx, deltax);
+			deltay = _mm512_fmadd_ps (f, dy, deltay);
+			deltaz = _mm512_fmadd_ps (f, dz, deltaz);
+		}
+	}
+
+	StorePosition (in, i, in.x[i] + in.one_over_rho_0 * _mm512_reduce_add_ps (deltax),
+			in.y[i] + in.one_over_rho_0 * _mm512_reduce_add_ps (deltay),
+			in.z[i] + in.one_over_rho_0 * _mm512_reduce_add_ps (deltaz), x, y, z);
+}
+
+/** AVX-512 lambdas.
+ * Calculates lambda_i for the sorted particles in [begin, end) using AVX-512.
+ */
+TARGET_AVX512 static void CalcLambdasAVX512 (const cpukernelinput_t &in, const kernelconstants_t &c,
+		const size_t &begin, const size_t &end, float *lambdas)
+{
+	for (size_t i = begin; i < end; i++)
+		lambdas[i] = CalcLambdaAVX512 (in, c, uint32_t (i));
+}
+
+/** AVX-512 position updates.
+ * Calculates the position corrections for the sorted particles in [begin, end) using AVX-512.
+ */
+TARGET_AVX512 static void UpdatePositionsAVX512 (const cpukernelinput_t &in, const kernelconstants_t &c,
+		const float *lambdas, const size_t &begin, const size_t &end, float *x, float *y, float *z)
+{
+	for (size_t i = begin; i < end; i++)
+		UpdatePositionAVX512 (in, c, lambdas, uint32_t (i), x, y, z);
+}
+
+/** AVX2 vector width.
+ * Number of neighbour pairs processed per AVX2 instruction.
+ */
+#define AVX2_WIDTH 8
+
+/** Horizontal sum.
+ * \param v vector
+ * \returns the sum of all elements of v
+ */
+TARGET_AVX2 static inline float HorizontalSum (const __m256 &v)
+{
+	__m128 s = _mm_add_ps (_mm256_castps256_ps128 (v), _mm256_extractf128_ps (v, 1));
+	s = _mm_add_ps (s, _mm_movehl_ps (s, s));
+	s = _mm_add_ss (s, _mm_movehdup_ps (s));
+	return _mm_cvtss_f32 (s);
+}
+
+/** Lane mask.
+ * Returns a mask of the lanes that refer to valid neighbours.
+ * \param j first neighbour index of the lanes
+ * \param end end of the neighbour range
+ * \param self index of the particle itself
+ * \returns a mask with all bits set in valid lanes
+ */
+TARGET_AVX2 static inline __m256i LaneMask (const uint32_t &j, const uint32_t &end, const __m256i &self)
+{
+	const __m256i lanes = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i mask = _mm256_cmpgt_epi32 (_mm256_set1_epi32 (int32_t (end - j)), lanes);
+	__m256i isself = _mm256_cmpeq_epi32 (_mm256_add_epi32 (_mm256_set1_epi32 (int32_t (j)), lanes), self);
+	return _mm256_andnot_si256 (isself, mask);
+}
+
+/** Vectorised lambda.
+ * Calculates lambda_i for a single sorted particle using AVX2.
+ * Neighbours outside the kernel support, the particle itself and lanes past the
+ * end of a neighbour range are masked out instead of branched over.
+ */
+TARGET_AVX2 static float CalcLambdaAVX2 (const cpukernelinput_t &in, const kernelconstants_t &c, const uint32_t i)
+{
+	const __m256 px = _mm256_set1_ps (in.x[i]), py = _mm256_set1_ps (in.y[i]), pz = _mm256_set1_ps (in.z[i]);
+	const __m256 h = _mm256_set1_ps (in.h), h2 = _mm256_set1_ps (c.h2);
+	const __m256 zero = _mm256_setzero_ps ();
+	const __m256 poly6 = _mm256_set1_ps (c.poly6);
+	const __m256 spiky = _mm256_set1_ps (c.spiky * in.one_over_rho_0);
+	const __m256i self = _mm256_set1_epi32 (int32_t (i));
+	__m256 rho = zero, sum_k_grad_Ci = zero, gx = zero, gy = zero, gz = zero;
+
+	for (int o = 0; o < in.numranges; o++)
+	{
+		uint32_t start = in.neighbourstart[in.numranges * i + o];
+		uint32_t end = start + in.neighbourcount[in.numranges * i + o];
+		for (uint32_t j = start; j < end; j += AVX2_WIDTH)
+		{
+			__m256i lanemask = LaneMask (j, end, self);
+			__m256 dx = _mm256_sub_ps (px, _mm256_maskload_ps (&in.x[j], lanemask));
+			__m256 dy = _mm256_sub_ps (py, _mm256_maskload_ps (&in.y[j], lanemask));
+			__m256 dz = _mm256_sub_ps (pz, _mm256_maskload_ps (&in.z[j], lanemask));
+			__m256 r2 = _mm256_fmadd_ps (dz, dz, _mm256_fmadd_ps (dy, dy, _mm256_mul_ps (dx, dx)));
+			__m256 r = _mm256_sqrt_ps (r2);
+			__m256 mask = _mm256_and_ps (_mm256_castsi256_ps (lanemask), _mm256_cmp_ps (r, h, _CMP_LE_OQ));
+
+			// compute rho_i (equation 2)
+			__m256 tmp = _mm256_sub_ps (h2, r2);
+			tmp = _mm256_mul_ps (_mm256_mul_ps (tmp, tmp), tmp);
+			rho = _mm256_fmadd_ps (_mm256_and_ps (mask, tmp), poly6, rho);
+
+			// sum gradients of Ci (equation 8 and parts of equation 9)
+			mask = _mm256_and_ps (mask, _mm256_cmp_ps (r, zero, _CMP_GT_OQ));
+			tmp = _mm256_sub_ps (h, r);
+			__m256 f = _mm256_div_ps (_mm256_mul_ps (spiky, _mm256_mul_ps (tmp, tmp)), r);
+			f = _mm256_and_ps (mask, f);
+			sum_k_grad_Ci = _mm256_fmadd_ps (_mm256_mul_ps (f, f), r2, sum_k_grad_Ci);
+			gx = _mm256_fmadd_ps (f, dx, gx);
+			gy = _mm256_fmadd_ps (f, dy, gy);
+			gz = _mm256_fmadd_ps (f, dz, gz);
+		}
+	}
+
+	float sx = HorizontalSum (gx), sy = HorizontalSum (gy), sz = HorizontalSum (gz);
+	float sum = HorizontalSum (sum_k_grad_Ci) + sx * sx + sy * sy + sz * sz;
+
+	// compute lambda_i (equations 1 and 9)
+	float C_i = HorizontalSum (rho) * in.one_over_rho_0 - 1;
+	return -C_i / (sum + in.epsilon);
+}
+
+/** Vectorised position update.
+ * Calculates the position correction for a single sorted particle using AVX2.
+ */
+TARGET_AVX2 static void UpdatePositionAVX2 (const cpukernelinput_t &in, const kernelconstants_t &c, const float *lambdas,
+		const uint32_t i, float *x, float *y, float *z)
+{
+	const __m256 px = _mm256_set1_ps (in.x[i]), py = _mm256_set1_ps (in.y[i]), pz = _mm256_set1_ps (in.z[i]);
+	const __m256 h = _mm256_set1_ps (in.h), h2 = _mm256_set1_ps (c.h2);
+	const __m256 zero = _mm256_setzero_ps ();
+	const __m256 poly6 = _mm256_set1_ps (in.tensile_instability_scale * c.poly6);
+	const __m256 k = _mm256_set1_ps (-in.tensile_instability_k);
+	const __m256 spiky = _mm256_set1_ps (c.spiky);
+	const __m256 lambda = _mm256_set1_ps (lambdas[i]);
+	const __m256i self = _mm256_set1_epi32 (int32_t (i));
+	__m256 deltax = zero, deltay = zero, deltaz = zero;
+
+	for (int o = 0; o < in.numranges; o++)
+	{
+		uint32_t start = in.neighbourstart[in.numranges * i + o];
+		uint32_t end = start + in.neighbourcount[in.numranges * i + o];
+		for (uint32_t j = start; j < end; j += AVX2_WIDTH)
+		{
+			__m256i lanemask = LaneMask (j, end, self);
+			__m256 dx = _mm256_sub_ps (px, _mm256_maskload_ps (&in.x[j], lanemask));
+			__m256 dy = _mm256_sub_ps (py, _mm256_maskload_ps (&in.y[j], lanemask));
+			__m256 dz = _mm256_sub_ps (pz, _mm256_maskload_ps (&in.z[j], lanemask));
+			__m256 r2 = _mm256_fmadd_ps (dz, dz, _mm256_fmadd_ps (dy, dy, _mm256_mul_ps (dx, dx)));
+			__m256 r = _mm256_sqrt_ps (r2);
+			__m256 mask = _mm256_and_ps (_mm256_castsi256_ps (lanemask), _mm256_cmp_ps (r, h, _CMP_LE_OQ));
+			mask = _mm256_and_ps (mask, _mm256_cmp_ps (r, zero, _CMP_GT_OQ));
+
+			__m256 tmp = _mm256_sub_ps (h2, r2);
+			__m256 scorr = _mm256_mul_ps (poly6, _mm256_mul_ps (_mm256_mul_ps (tmp, tmp), tmp));
+			scorr = _mm256_mul_ps (scorr, scorr);
+			scorr = _mm256_mul_ps (k, _mm256_mul_ps (scorr, scorr));
+
+			// accumulate position corrections (part of equation 12)
+			__m256 s = _mm256_add_ps (_mm256_add_ps (lambda, _mm256_maskload_ps (&lambdas[j], lanemask)), scorr);
+			tmp = _mm256_sub_ps (h, r);
+			__m256 f = _mm256_div_ps (_mm256_mul_ps (_mm256_mul_ps (s, spiky), _mm256_mul_ps (tmp, tmp)), r);
+			f = _mm256_and_ps (mask, f);
+			deltax = _mm256_fmadd_ps (f, dx, deltax);
+			deltay = _mm256_fmadd_ps (f, dy, deltay);
+			deltaz = _mm256_fmadd_ps (f, dz, deltaz);
+		}
+	}
+
+	StorePosition (in, i, in.x[i] + in.one_over_rho_0 * HorizontalSum (deltax),
+			in.y[i] + in.one_over_rho_0 * HorizontalSum (deltay),
+			in.z[i] + in.one_over_rho_0 * HorizontalSum (deltaz), x, y, z);
+}
+
+/** AVX2 lambdas.
+ * Calculates lambda_i for the sorted particles in [begin, end) using AVX2.
+ */
+TARGET_AVX2 static void CalcLambdasAVX2 (const cpukernelinput_t &in, const kernelconstants_t &c,
+		const size_t &begin, const size_t &end, float *lambdas)
+{
+	for (size_t i = begin; i < end; i++)
+		lambdas[i] = CalcLambdaAVX2 (in, c, uint32_t (i));
+}
+
+/** AVX2 position updates.
+ * Calculates the position corrections for the sorted particles in [begin, end) using AVX2.
+ */
+TARGET_AVX2 static void UpdatePositionsAVX2 (const cpukernelinput_t &in, const kernelconstants_t &c,
+		const float *lambdas, const size_t &begin, const size_t &end, float *x, float *y, float *z)
+{
+	for (size_t i = begin; i < end; i++)
+		UpdatePositionAVX2 (in, c, lambdas, uint32_t (i), x, y, z);
+}
+
+#endif
+
+const char *CPUKernels::GetInstructionSet (void)
+{
+	switch (GetHostInstructionSet ())
+	{
+	case INSTRUCTION_SET_AVX512:
+		return "AVX-512";
+	case INSTRUCTION_SET_AVX2:
+		return "AVX2";
+	default:
+		return "scalar";
+	}
+}
+
+void CPUKernels::CalcLambdas (const cpukernelinput_t &input, const size_t &begin, const size_t &end,
+		float *lambdas, const bool &simd)
+{
+	const kernelconstants_t c = GetKernelConstants (input.h);
+	switch (simd ? GetHostInstructionSet () : INSTRUCTION_SET_SCALAR)
+	{
+#ifdef SIMD_DISPATCH
+	case INSTRUCTION_SET_AVX512:
+		CalcLambdasAVX512 (input, c, begin, end, lambdas);
+		break;
+	case INSTRUCTION_SET_AVX2:
+		CalcLambdasAVX2 (input, c, begin, end, lambdas);
+		break;
+#endif
+	default:
+		for (size_t i = begin; i < end; i++)
+			lambdas[i] = CalcLambdaScalar (input, c, uint32_t (i));
+		break;
+	}
+}
+
+void CPUKernels::UpdatePositions (const cpukernelinput_t &input, const float *lambdas, const size_t &begin,
+		const size_t &end, float *x, float *y, float *z, const bool &simd)
+{
+	const kernelconstants_t c = GetKernelConstants (input.h);
+	switch (simd ? GetHostInstructionSet () : INSTRUCTION_SET_SCALAR)
+	{
+#ifdef SIMD_DISPATCH
+	case INSTRUCTION_SET_AVX512:
+		UpdatePositionsAVX512 (input, c, lambdas, begin, end, x, y, z);
+		break;
+	case INSTRUCTION_SET_AVX2:
+		UpdatePositionsAVX2 (input, c, lambdas, begin, end, x, y, z);
+		break;
+#endif
+	default:
+		for (size_t i = begin; i < end; i++)
+			UpdatePositionScalar (input, c, lambdas, uint32_t (i), x, y, z);
+		break;
+	}
+}
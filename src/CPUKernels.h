@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef CPUKERNELS_H
+#define CPUKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+/** Input of the CPU solver kernels.
+ * Structure-of-arrays view of the sorted particle data and the solver parameters.
+ */
+typedef struct cpukernelinput {
+	/** Particle x coordinates in sorted order. */
+	const float *x;
+	/** Particle y coordinates in sorted order. */
+	const float *y;
+	/** Particle z coordinates in sorted order. */
+	const float *z;
+	/** Start of each neighbour range of each particle. */
+	const uint32_t *neighbourstart;
+	/** Number of particles in each neighbour range of each particle. */
+	const uint32_t *neighbourcount;
+	/** Number of neighbour ranges per particle. */
+	int numranges;
+	/** Smoothing kernel width. */
+	float h;
+	/** One over rest density. */
+	float one_over_rho_0;
+	/** CFM epsilon. */
+	float epsilon;
+	/** Tensile instability K. */
+	float tensile_instability_k;
+	/** Tensile instability scale. */
+	float tensile_instability_scale;
+	/** Lower corner of the simulation domain. */
+	float wallmin[3];
+	/** Upper corner of the simulation domain. */
+	float wallmax[3];
+} cpukernelinput_t;
+
+/** CPU kernels class.
+ * Contains the inner loops of the CPU constraint solver. If the CPU supports
+ * AVX2 or AVX-512, the neighbour loops process 8 or 16 neighbour pairs per
+ * instruction with masked cutoffs, otherwise scalar code is used. The vectorised
+ * kernels are always compiled and the widest supported one is chosen at runtime.
+ */
+class CPUKernels
+{
+public:
+	/** Get instruction set.
+	 * Returns the name of the instruction set the vectorised kernels use on this CPU.
+	 * \returns the instruction set name
+	 */
+	static const char *GetInstructionSet (void);
+
+	/** Calculate lambdas.
+	 * Calculates lambda_i for the sorted particles in [begin, end).
+	 * \param input sorted particle data and parameters
+	 * \param begin first particle to process
+	 * \param end end of the particle range to process
+	 * \param lambdas array to store the results in
+	 * \param simd flag indicating whether to use the vectorised kernels
+	 */
+	static void CalcLambdas (const cpukernelinput_t &input, const size_t &begin, const size_t &end,
+			float *lambdas, const bool &simd);
+
+	/** Update positions.
+	 * Calculates the position corrections for the sorted particles in [begin, end),
+	 * applies them and clamps the result to the simulation domain.
+	 * \param input sorted particle data and parameters
+	 * \param lambdas lambda_i of each sorted particle
+	 * \param begin first particle to process
+	 * \param end end of the particle range to process
+	 * \param x array to store the corrected x coordinates in
+	 * \param y array to store the corrected y coordinates in
+	 * \param z array to store the corrected z coordinates in
+	 * \param simd flag indicating whether to use the vectorised kernels
+	 */
+	static void UpdatePositions (const cpukernelinput_t &input, const float *lambdas, const size_t &begin,
+			const size_t &end, float *x, float *y, float *z, const bool &simd);
+};
+
+#endif /* CPUKERNELS_H */
@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "CPUSPH.h"
+#include <chrono>
+
+/** Smoothing kernel width.
+ * Has to match the constant h used in the compute shaders.
+ */
+static const float h = 2.0f;
+
+/** Poly6 kernel.
+ * \param r radius
+ * \returns smoothing weight
+ */
+static inline float Wpoly6 (const float &r)
+{
+	if (r > h)
+		return 0;
+	float tmp = h * h - r * r;
+	return 1.56668147106f * tmp * tmp * tmp / (h*h*h*h*h*h*h*h*h);
+}
+
+/** Gradient of the spiky kernel.
+ * \param r difference vector
+ * \returns kernel gradient
+ */
+static inline glm::vec3 gradWspiky (const glm::vec3 &r)
+{
+	float l = glm::length (r);
+	if (l > h || l == 0)
+		return glm::vec3 (0, 0, 0);
+	float tmp = h - l;
+	return (-3 * 4.774648292756860f * tmp * tmp) * r / (l * h*h*h*h*h*h);
+}
+
+/** Nanoseconds since a point in time.
+ * \param start the point in time
+ * \returns the number of nanoseconds since start
+ */
+static inline GLint64 NanosecondsSince (const std::chrono::steady_clock::time_point &start)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now () - start).count ();
+}
+
+CPUSPH::CPUSPH (const unsigned int &_numparticles, const glm::ivec3 &_gridsize, const unsigned int &numthreads)
+	: threadpool (numthreads), sphparams (SPH::GetDefaultParameters ()), num_solveriterations (5),
+	  vorticityconfinement (false), simd (true), externalforce (false), gridsize (_gridsize),
+	  domainmin (16, 0, 16), domainmax (_gridsize.x - 16, _gridsize.y, _gridsize.z - 16), numparticles (_numparticles)
+{
+	positions.resize (numparticles);
+	velocities.resize (numparticles);
+	predicted.resize (numparticles);
+	hashes.resize (numparticles);
+	sortkeys.resize (numparticles);
+	sortkeys2.resize (numparticles);
+	sortvalues.resize (numparticles);
+	sortedids.resize (numparticles);
+	sortedx.resize (numparticles);
+	sortedy.resize (numparticles);
+	sortedz.resize (numparticles);
+	correctedx.resize (numparticles);
+	correctedy.resize (numparticles);
+	correctedz.resize (numparticles);
+	neighbourstart.resize (NUM_NEIGHBOUR_RANGES * numparticles);
+	neighbourcount.resize (NUM_NEIGHBOUR_RANGES * numparticles);
+	lambdas.resize (numparticles);
+	vorticities.resize (numparticles);
+	correctedvelocities.resize (numparticles);
+
+	cellstart.assign (size_t (gridsize.x) * size_t (gridsize.y) * size_t (gridsize.z), -1);
+	cellend.assign (cellstart.size (), -1);
+
+	for (int i = 0; i < SPH::TIMING_NUM_PHASES; i++)
+		timings[i] = 0;
+}
+
+CPUSPH::~CPUSPH (void)
+{
+}
+
+void CPUSPH::SetParticles (const std::vector<glm::vec4> &_positions, const std::vector<glm::vec4> &_velocities)
+{
+	if (_positions.size () != numparticles || _velocities.size () != numparticles)
+		throw std::runtime_error ("The particle data does not match the number of particles in the simulation.");
+	for (unsigned int i = 0; i < numparticles; i++)
+	{
+		positions[i] = glm::vec3 (_positions[i].x, _positions[i].y, _positions[i].z);
+		velocities[i] = glm::vec3 (_velocities[i].x, _velocities[i].y, _velocities[i].z);
+	}
+}
+
+void CPUSPH::GetParticles (std::vector<glm::vec4> &_positions, std::vector<glm::vec4> &_velocities) const
+{
+	_positions.resize (numparticles);
+	_velocities.resize (numparticles);
+	for (unsigned int i = 0; i < numparticles; i++)
+	{
+		_positions[i] = glm::vec4 (positions[i], 0.0f);
+		_velocities[i] = glm::vec4 (velocities[i], 0.0f);
+	}
+}
+
+glm::ivec3 CPUSPH::GetCell (const glm::vec3 &pos) const
+{
+	glm::ivec3 cell = glm::ivec3 (glm::clamp (pos, glm::vec3 (0, 0, 0), glm::vec3 (gridsize)));
+	return glm::min (cell, gridsize - glm::ivec3 (1, 1, 1));
+}
+
+void CPUSPH::Run (void)
+{
+	std::chrono::steady_clock::time_point start;
+
+	start = std::chrono::steady_clock::now ();
+	PredictPositions ();
+	timings[SPH::TIMING_PREDICTPOS] = NanosecondsSince (start);
+
+	start = std::chrono::steady_clock::now ();
+	SortParticles ();
+	timings[SPH::TIMING_SORT] = NanosecondsSince (start);
+
+	start = std::chrono::steady_clock::now ();
+	FindNeighbourCells ();
+	timings[SPH::TIMING_NEIGHBOURCELLS] = NanosecondsSince (start);
+
+	start = std::chrono::steady_clock::now ();
+	for (unsigned int iteration = 0; iteration < num_solveriterations; iteration++)
+		SolverIteration ();
+	timings[SPH::TIMING_SOLVER] = NanosecondsSince (start);
+
+	start = std::chrono::steady_clock::now ();
+	Update ();
+	if (vorticityconfinement)
+		VorticityConfinement ();
+	timings[SPH::TIMING_VORTICITY] = NanosecondsSince (start);
+}
+
+void CPUSPH::PredictPositions (void)
+{
+	const glm::ivec3 hashweights (1, gridsize.x * gridsize.z, gridsize.x);
+	threadpool.ParallelFor (numparticles, [&] (size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			glm::vec3 velocity = velocities[i];
+
+			// optionally apply an additional external force to some particles
+			if (externalforce && positions[i].z > 0.5f * (domainmin.z + domainmax.z))
+				velocity += 2 * sphparams.gravity * glm::vec3 (0, 0, -1) * sphparams.timestep;
+
+			// gravity
+			velocity += sphparams.gravity * glm::vec3 (0, -1, 0) * sphparams.timestep;
+
+			// predict new position and compute the sort key
+			predicted[i] = positions[i] + sphparams.timestep * velocity;
+			hashes[i] = uint32_t (glm::dot (GetCell (predicted[i]), hashweights));
+		}
+	});
+}
+
+void CPUSPH::SortParticles (void)
+{
+	// stable least significant digit radix sort with 8 bit digits
+	const unsigned int numchunks = 4 * threadpool.GetNumThreads ();
+	const size_t chunksize = (numparticles + numchunks - 1) / numchunks;
+	uint32_t numbits = 1;
+	while ((uint64_t (cellstart.size ()) - 1) >> numbits)
+		numbits++;
+
+	std::vector<uint32_t> histograms (256 * numchunks);
+
+	// the first pass reads the hashes and the particle ids directly
+	const uint32_t *srckeys = &hashes[0];
+	const uint32_t *srcvalues = NULL;
+	uint32_t *dstkeys = &sortkeys[0];
+	uint32_t *dstvalues = &sortvalues[0];
+
+	for (uint32_t shift = 0; shift < numbits; shift += 8)
+	{
+		// count digits in each chunk
+		threadpool.ParallelFor (numchunks, [&] (size_t begin, size_t end) {
+			for (size_t chunk = begin; chunk < end; chunk++)
+			{
+				uint32_t *histogram = &histograms[256 * chunk];
+				std::fill (histogram, histogram + 256, 0);
+				for (size_t i = chunk * chunksize; i < std::min ((chunk + 1) * chunksize, size_t (numparticles)); i++)
+					histogram[(srckeys[i] >> shift) & 0xFF]++;
+			}
+		}, 1);
+
+		// compute the output offset of each digit in each chunk
+		uint32_t offset = 0;
+		for (int digit = 0; digit < 256; digit++)
+		{
+			for (unsigned int chunk = 0; chunk < numchunks; chunk++)
+			{
+				uint32_t count = histograms[256 * chunk + digit];
+				histograms[256 * chunk + digit] = offset;
+				offset += count;
+			}
+		}
+
+		// scatter keys and values
+		threadpool.ParallelFor (numchunks, [&] (size_t begin, size_t end) {
+			for (size_t chunk = begin; chunk < end; chunk++)
+			{
+				uint32_t *histogram = &histograms[256 * chunk];
+				for (size_t i = chunk * chunksize; i < std::min ((chunk + 1) * chunksize, size_t (numparticles)); i++)
+				{
+					uint32_t dst = histogram[(srckeys[i] >> shift) & 0xFF]++;
+					dstkeys[dst] = srckeys[i];
+					dstvalues[dst] = (srcvalues != NULL) ? srcvalues[i] : uint32_t (i);
+				}
+			}
+		}, 1);
+
+		// swap source and destination
+		srckeys = dstkeys;
+		srcvalues = dstvalues;
+		dstkeys = (dstkeys == &sortkeys[0]) ? &sortkeys2[0] : &sortkeys[0];
+		dstvalues = (dstvalues == &sortvalues[0]) ? &sortedids[0] : &sortvalues[0];
+	}
+
+	// gather the sorted ids and positions
+	threadpool.ParallelFor (numparticles, [&] (size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t id = srcvalues[i];
+			sortedids[i] = id;
+			sortedx[i] = predicted[id].x;
+			sortedy[i] = predicted[id].y;
+			sortedz[i] = predicted[id].z;
+			sortkeys[i] = srckeys[i];
+		}
+	});
+}
+
+void CPUSPH::FindNeighbourCells (void)
+{
+	// clear the cells that were occupied in the last step
+	for (const uint32_t &cell : occupiedcells)
+		cellstart[cell] = -1;
+	occupiedcells.clear ();
+
+	// find the start and the end of each occupied cell
+	for (unsigned int i = 0; i < numparticles; i++)
+	{
+		if (i == 0 || sortkeys[i] != sortkeys[i - 1])
+		{
+			cellstart[sortkeys[i]] = i;
+			occupiedcells.push_back (sortkeys[i]);
+		}
+		if (i == numparticles - 1 || sortkeys[i] != sortkeys[i + 1])
+			cellend[sortkeys[i]] = i + 1;
+	}
+
+	// find the neighbour ranges of each particle
+	threadpool.ParallelFor (numparticles, [&] (size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t hash = sortkeys[i];
+			glm::ivec3 cell (hash % gridsize.x, hash / (gridsize.x * gridsize.z), (hash / gridsize.x) % gridsize.z);
+
+			int o = 0;
+			// go through all 9 neighbour directions in y/z direction
+			for (int y = cell.y - 1; y <= cell.y + 1; y++)
+			{
+				for (int z = cell.z - 1; z <= cell.z + 1; z++, o++)
+				{
+					int32_t start = -1;
+					uint32_t count = 0;
+					if (y >= 0 && y < gridsize.y && z >= 0 && z < gridsize.z)
+					{
+						// go through all cells in x direction
+						for (int x = std::max (cell.x - 1, 0); x <= std::min (cell.x + 1, gridsize.x - 1); x++)
+						{
+							size_t c = size_t (x) + size_t (gridsize.x) * (size_t (z) + size_t (gridsize.z) * size_t (y));
+							if (cellstart[c] != -1)
+							{
+								if (start == -1)
+									start = cellstart[c];
+								count += cellend[c] - cellstart[c];
+							}
+						}
+					}
+					neighbourstart[NUM_NEIGHBOUR_RANGES * i + o] = (start == -1) ? 0 : uint32_t (start);
+					neighbourcount[NUM_NEIGHBOUR_RANGES * i + o] = count;
+				}
+			}
+		}
+	});
+}
+
+cpukernelinput_t CPUSPH::GetKernelInput (void) const
+{
+	cpukernelinput_t input;
+	input.x = &sortedx[0];
+	input.y = &sortedy[0];
+	input.z = &sortedz[0];
+	input.neighbourstart = &neighbourstart[0];
+	input.neighbourcount = &neighbourcount[0];
+	input.numranges = NUM_NEIGHBOUR_RANGES;
+	input.h = h;
+	input.one_over_rho_0 = sphparams.one_over_rho_0;
+	input.epsilon = sphparams.epsilon;
+	input.tensile_instability_k = sphparams.tensile_instability_k;
+	input.tensile_instability_scale = sphparams.tensile_instability_scale;
+	for (int i = 0; i < 3; i++)
+	{
+		input.wallmin[i] = domainmin[i];
+		input.wallmax[i] = domainmax[i];
+	}
+	return input;
+}
+
+void CPUSPH::SolverIteration (void)
+{
+	const cpukernelinput_t input = GetKernelInput ();
+
+	// calculate lambda_i for each particle
+	threadpool.ParallelFor (numparticles, [&] (size_t begin, size_t end) {
+		CPUKernels::CalcLambdas (input, begin, end, &lambdas[0], simd);
+	});
+
+	// calculate the position corrections
+	threadpool.ParallelFor (numparticles, [&] (size_t begin, size_t end) {
+		CPUKernels::UpdatePositions (input, &lambdas[0], begin, end, &correctedx[0], &correctedy[0],
+				&correctedz[0], simd);
+	});
+
+	// the corrections are computed from the positions of the last iteration only
+	std::swap (sortedx, correctedx);
+	std::swap (sortedy, correctedy);
+	std::swap (sortedz, correctedz);
+}
+
+double CPUSPH::BenchmarkSolver (const unsigned int &iterations, uint64_t &numpairs)
+{
+	numpairs = 0;
+	for (const uint32_t &count : neighbourcount)
+		numpairs += count;
+
+	// keep the particle state of the last step
+	std::vector<float> x (sortedx), y (sortedy), z (sortedz), l (lambdas);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	for (unsigned int iteration = 0; iteration < iterations; iteration++)
+		SolverIteration ();
+	GLint64 elapsed = NanosecondsSince (start);
+
+	sortedx.swap (x);
+	sortedy.swap (y);
+	sortedz.swap (z);
+	lambdas.swap (l);
+
+	return (iterations > 0) ? double (elapsed) / double (iterations) : 0.0;
+}
+
+void CPUSPH::Update (void)
+{
+	// calculate velocities and update positions
+	threadpool.ParallelFor (numparticles, [&] (size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t id = sortedids[i];
+			glm::vec3 position = GetSortedPosition (i);
+			velocities[id] = (position - positions[id]) / sphparams.timestep;
+			positions[id] = position;
+		}
+	});
+}
+
+void CPUSPH::VorticityConfinement (void)
+{
+	// calculate vorticity & apply XSPH viscosity
+	threadpool.ParallelFor (numparticles, [&] (size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			const glm::vec3 position = GetSortedPosition (i);
+			const glm::vec3 velocity = velocities[sortedids[i]];
+			glm::vec3 v (0, 0, 0);
+			glm::vec3 vorticity (0, 0, 0);
+
+			for (int o = 0; o < NUM_NEIGHBOUR_RANGES; o++)
+			{
+				uint32_t start = neighbourstart[NUM_NEIGHBOUR_RANGES * i + o];
+				uint32_t count = neighbourcount[NUM_NEIGHBOUR_RANGES * i + o];
+				for (uint32_t j = start; j < start + count; j++)
+				{
+					if (j == i)
+						continue;
+					glm::vec3 v_ij = velocities[sortedids[j]] - velocity;
+					glm::vec3 p_ij = position - GetSortedPosition (j);
+					v += v_ij * Wpoly6 (glm::length (p_ij));
+					vorticity += glm::cross (v_ij, gradWspiky (p_ij));
+				}
+			}
+			correctedvelocities[i] = velocity + sphparams.xsph_viscosity_c * v;
+			vorticities[i] = vorticity;
+		}
+	});
+
+	// vorticity confinement
+	threadpool.ParallelFor (numparticles, [&] (size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			const glm::vec3 position = GetSortedPosition (i);
+			glm::vec3 gradVorticity (0, 0, 0);
+
+			for (int o = 0; o < NUM_NEIGHBOUR_RANGES; o++)
+			{
+				uint32_t start = neighbourstart[NUM_NEIGHBOUR_RANGES * i + o];
+				uint32_t count = neighbourcount[NUM_NEIGHBOUR_RANGES * i + o];
+				for (uint32_t j = start; j < start + count; j++)
+				{
+					if (j == i)
+						continue;
+					gradVorticity += glm::length (vorticities[j]) * gradWspiky (position - GetSortedPosition (j));
+				}
+			}
+
+			float l = glm::length (gradVorticity);
+			if (l > 0)
+				gradVorticity /= l;
+
+			// apply vorticity force
+			correctedvelocities[i] += sphparams.timestep * sphparams.vorticity_epsilon
+					* glm::cross (gradVorticity, vorticities[i]);
+		}
+	});
+
+	// update particle velocities
+	threadpool.ParallelFor (numparticles, [&] (size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			velocities[sortedids[i]] = correctedvelocities[i];
+	});
+}
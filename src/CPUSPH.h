@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef CPUSPH_H
+#define CPUSPH_H
+
+#include "common.h"
+#include "SPH.h"
+#include "ThreadPool.h"
+#include "CPUKernels.h"
+
+/** CPU SPH class.
+ * This class runs the same SPH simulation step as the SPH class on the CPU.
+ * It provides the same interface, but does not require an OpenGL context,
+ * so it can be used on machines without GPU and to validate the GPU results.
+ * The work of each phase is distributed over a thread pool. The sorted particle
+ * positions are stored as structure of arrays, so that the solver kernels can
+ * process several neighbours at once using SIMD instructions.
+ */
+class CPUSPH
+{
+public:
+	/** Constructor.
+	 * \param numparticles number of particles in the simulation
+	 * \param gridsize size of the particle grid
+	 * \param numthreads number of threads to use (0 to use one thread per hardware thread)
+	 */
+	CPUSPH (const unsigned int &numparticles, const glm::ivec3 &gridsize = glm::ivec3 (128, 64, 128),
+			const unsigned int &numthreads = 0);
+	/** Destructor.
+	 */
+	~CPUSPH (void);
+
+	/** Get rest density.
+	 * Returns the current rest density.
+	 * \returns the rest density
+	 */
+	float GetRestDensity (void) const {
+		return 1.0f / sphparams.one_over_rho_0;
+	}
+
+	/** Set rest density.
+	 * Specifies the rest density.
+	 * \param rho the new rest density
+	 */
+	void SetRestDensity (const float &rho) {
+		sphparams.one_over_rho_0 = 1.0f / rho;
+	}
+
+	/** Get CFM epsilon.
+	 * Returns the constraint force mixing epsilon.
+	 * \returns the CFM epsilon
+	 */
+	const float &GetCFMEpsilon (void) const {
+		return sphparams.epsilon;
+	}
+
+	/** Specify CFM epsilon.
+	 * Specifies the constraint force mixing epsilon.
+	 * \param epsilon the CFM epsilon
+	 */
+	void SetCFMEpsilon (const float &epsilon) {
+		sphparams.epsilon = epsilon;
+	}
+
+	/** Get gravity.
+	 * Returns the gravity strength.
+	 * \returns the gravity strength
+	 */
+	const float &GetGravity (void) const {
+		return sphparams.gravity;
+	}
+
+	/** Set gravity.
+	 * Specifies the gravity strength.
+	 * \param gravity the gravity strength
+	 */
+	void SetGravity (const float &gravity) {
+		sphparams.gravity = gravity;
+	}
+
+	/** Get time step.
+	 * Returns the simulation time step.
+	 * \returns the simulation time step.
+	 */
+	const float &GetTimestep (void) const {
+		return sphparams.timestep;
+	}
+
+	/** Set time step.
+	 * Specifies the simulation time step.
+	 * \param timestep the simulation time step.
+	 */
+	void SetTimestep (const float &timestep) {
+		sphparams.timestep = timestep;
+	}
+
+	/** Get tensile instability K.
+	 * Returns tensile instability K.
+	 * \returns tensile instability K.
+	 */
+	const float &GetTensileInstabilityK (void) const {
+		return sphparams.tensile_instability_k;
+	}
+
+	/** Set tensile instability K
+	 * Specifies the tensile instability K.
+	 * \param k tensile instability K.
+	 */
+	void SetTensileInstabilityK (const float &k) {
+		sphparams.tensile_instability_k = k;
+	}
+
+	/** Get tensile instability scale.
+	 * Returns tensile instability scale.
+	 * \returns tensile instability scale.
+	 */
+	const float &GetTensileInstabilityScale (void) const {
+		return sphparams.tensile_instability_scale;
+	}
+
+	/** Set tensile instability scale.
+	 * \param v tensile instability scale.
+	 */
+	void SetTensileInstabilityScale (const float &v) {
+		sphparams.tensile_instability_scale = v;
+	}
+
+	/** Get XSPH viscosity.
+	 * Returns the XSPH viscosity constant.
+	 * \returns the XSPH viscosity constant.
+	 */
+	const float &GetXSPHViscosity (void) const {
+		return sphparams.xsph_viscosity_c;
+	}
+
+	/** Set XSPH viscosity.
+	 * Specifies the XSPH viscosity.
+	 * \param v XSPH viscosity
+	 */
+	void SetXSPHViscosity (const float &v) {
+		sphparams.xsph_viscosity_c = v;
+	}
+
+	/** Get vorticity epsilon.
+	 * Returns the vorticity confinement epsilon.
+	 * \returns the vorticity confinement epsilon.
+	 */
+	const float &GetVorticityEpsilon (void) const {
+		return sphparams.vorticity_epsilon;
+	}
+
+	/** Set Vorticity epsilon.
+	 * Specifies the vorticity confinement epsilon.
+	 * \param epsilon the vorticity confinement epsilon.
+	 */
+	void SetVorticityEpsilon (const float &epsilon) {
+		sphparams.vorticity_epsilon = epsilon;
+	}
+
+	/** Get number of solver iterations.
+	 * Returns the number of solver iterations currently used.
+	 * \returns the number of solver iterations.
+	 */
+	const unsigned int &GetNumSolverIterations (void) const {
+		return num_solveriterations;
+	}
+
+	/** Set number of solver iterations.
+	 * Specifies the number of solver iterations.
+	 * \param iter the number of solver iterations.
+	 */
+	void SetNumSolverIterations (const unsigned int &iter) {
+		num_solveriterations = iter;
+	}
+
+	/** Check vorticity confinement.
+	 * Checks the state of the vorticity confinement.
+	 * \returns True, if vorticity confinement is enabled, false, if not.
+	 */
+	const bool &IsVorticityConfinementEnabled (void) const {
+		return vorticityconfinement;
+	}
+
+	/** Enable/disable vorticity confinement.
+	 * Specifies whether to use vorticity confinement or not.
+	 * \param flag Flag indicating whether to use vorticity confinement.
+	 */
+	void SetVorticityConfinementEnabled (const bool &flag) {
+		vorticityconfinement = flag;
+	}
+
+	/** Check SIMD kernels.
+	 * Checks whether the vectorised solver kernels are used.
+	 * \returns True, if the vectorised kernels are used, false, if the scalar kernels are used.
+	 */
+	const bool &IsSIMDEnabled (void) const {
+		return simd;
+	}
+
+	/** Enable/disable SIMD kernels.
+	 * Specifies whether to use the vectorised solver kernels. Has no effect if
+	 * the program was not compiled for an instruction set supporting them.
+	 * \param flag Flag indicating whether to use the vectorised kernels.
+	 */
+	void SetSIMDEnabled (const bool &flag) {
+		simd = flag;
+	}
+
+	/** Set domain bounds.
+	 * Specifies the region the particles are confined to (see SPH::SetDomainBounds).
+	 * Particles outside the grid are sorted into its boundary cells.
+	 * \param min lower corner of the domain
+	 * \param max upper corner of the domain
+	 */
+	void SetDomainBounds (const glm::vec3 &min, const glm::vec3 &max) {
+		domainmin = min;
+		domainmax = max;
+	}
+
+	/** Activate/deactivate an external force.
+	 * Activates or deactivates an external force in negative z direction
+	 * that is applied to all particles with a z-coordinate larger than
+	 * the center of the domain.
+	 * \param state true to enable the external force, false to disable it
+	 */
+	void SetExternalForce (bool state) {
+		externalforce = state;
+	}
+
+	/** Set particles.
+	 * Specifies new particle positions and velocities.
+	 * \param positions particle positions (one entry for each particle)
+	 * \param velocities particle velocities (one entry for each particle)
+	 */
+	void SetParticles (const std::vector<glm::vec4> &positions, const std::vector<glm::vec4> &velocities);
+
+	/** Get particles.
+	 * Returns the current particle positions and velocities.
+	 * \param positions vector to store the particle positions in
+	 * \param velocities vector to store the particle velocities in
+	 */
+	void GetParticles (std::vector<glm::vec4> &positions, std::vector<glm::vec4> &velocities) const;
+
+	/** Run simulation.
+	 * Runs one step of the SPH simulation.
+	 */
+	void Run (void);
+
+	/** Benchmark solver.
+	 * Runs solver iterations on the particle state of the last simulation step
+	 * without modifying it and measures their duration. Requires at least
+	 * one previous simulation step.
+	 * \param iterations number of solver iterations to run
+	 * \param numpairs variable to store the number of neighbour pairs processed per iteration in
+	 * \returns the average time per solver iteration in nanoseconds
+	 */
+	double BenchmarkSolver (const unsigned int &iterations, uint64_t &numpairs);
+
+	/** Get timing.
+	 * Returns the time spent in a phase of the last simulation step.
+	 * \param phase the phase for which to return the time
+	 * \returns the time spent in the phase in nanoseconds
+	 */
+	GLint64 GetTiming (const SPH::timingphase_t &phase) const {
+		return timings[phase];
+	}
+
+	/** Get number of threads.
+	 * Returns the number of threads used for the simulation.
+	 * \returns the number of threads
+	 */
+	unsigned int GetNumThreads (void) const {
+		return threadpool.GetNumThreads ();
+	}
+private:
+	/** Predict positions.
+	 * Applies external forces and predicts the new particle positions.
+	 */
+	void PredictPositions (void);
+	/** Sort particles.
+	 * Sorts the particles with respect to their grid cell.
+	 */
+	void SortParticles (void);
+	/** Find neighbour cells.
+	 * Determines the grid cell ranges and the neighbour ranges of each particle.
+	 */
+	void FindNeighbourCells (void);
+	/** Solver iteration.
+	 * Runs one iteration of the constraint solver.
+	 */
+	void SolverIteration (void);
+	/** Update.
+	 * Updates the particle velocities and positions.
+	 */
+	void Update (void);
+	/** Vorticity confinement.
+	 * Applies XSPH viscosity and vorticity confinement.
+	 */
+	void VorticityConfinement (void);
+
+	/** Get kernel input.
+	 * Returns the input of the solver kernels for the current sorted particle data.
+	 * \returns the kernel input
+	 */
+	cpukernelinput_t GetKernelInput (void) const;
+
+	/** Get sorted position.
+	 * Returns the position of a sorted particle.
+	 * \param i sorted particle index
+	 * \returns the position
+	 */
+	glm::vec3 GetSortedPosition (const size_t &i) const {
+		return glm::vec3 (sortedx[i], sortedy[i], sortedz[i]);
+	}
+
+	/** Get cell.
+	 * Returns the grid cell containing a position.
+	 * \param pos position
+	 * \returns the grid cell
+	 */
+	glm::ivec3 GetCell (const glm::vec3 &pos) const;
+
+	/** Number of neighbour ranges.
+	 * Number of neighbour ranges (rows of three cells in x direction) for each particle.
+	 */
+	static const int NUM_NEIGHBOUR_RANGES = 9;
+
+	/** Thread pool.
+	 * Used to distribute the work of each phase.
+	 */
+	ThreadPool threadpool;
+
+	/** SPH parameters.
+	 */
+	SPH::sphparams_t sphparams;
+
+	/** Number of solver iterations.
+	 * Number of solver iterations used for the constraint solver.
+	 */
+	unsigned int num_solveriterations;
+
+	/** Vorticity confinement flag.
+	 * flag indicating whether vorticity confinement should be used.
+	 */
+	bool vorticityconfinement;
+
+	/** SIMD flag.
+	 * Flag indicating whether to use the vectorised solver kernels.
+	 */
+	bool simd;
+
+	/** External force flag.
+	 * Flag indicating whether the external force is active.
+	 */
+	bool externalforce;
+
+	/** Grid size.
+	 * Size of the particle grid.
+	 */
+	const glm::ivec3 gridsize;
+
+	/** Domain minimum.
+	 * Lower corner of the region the particles are confined to.
+	 */
+	glm::vec3 domainmin;
+
+	/** Domain maximum.
+	 * Upper corner of the region the particles are confined to.
+	 */
+	glm::vec3 domainmax;
+
+	/** Number of particles.
+	 * Stores the number of particles in the simulation.
+	 */
+	const unsigned int numparticles;
+
+	/** Positions.
+	 * Position of each particle (indexed by particle id).
+	 */
+	std::vector<glm::vec3> positions;
+	/** Velocities.
+	 * Velocity of each particle (indexed by particle id).
+	 */
+	std::vector<glm::vec3> velocities;
+	/** Predicted positions.
+	 * Predicted position of each particle (indexed by particle id).
+	 */
+	std::vector<glm::vec3> predicted;
+	/** Cell hashes.
+	 * Grid cell hash of each particle used as sort key.
+	 */
+	std::vector<uint32_t> hashes;
+	/** Sort keys.
+	 * Temporary storage for the sort keys.
+	 */
+	std::vector<uint32_t> sortkeys;
+	/** Second sort keys.
+	 * Temporary storage for the sort keys of every other radix sort pass.
+	 */
+	std::vector<uint32_t> sortkeys2;
+	/** Sort values.
+	 * Temporary storage for the sorted particle ids.
+	 */
+	std::vector<uint32_t> sortvalues;
+	/** Sorted ids.
+	 * Particle ids in sorted order.
+	 */
+	std::vector<uint32_t> sortedids;
+	/** Sorted positions.
+	 * Particle x, y and z coordinates in sorted order, which are modified by the solver.
+	 */
+	std::vector<float> sortedx, sortedy, sortedz;
+	/** Corrected positions.
+	 * Particle x, y and z coordinates written by a solver iteration.
+	 */
+	std::vector<float> correctedx, correctedy, correctedz;
+	/** Cell start.
+	 * Index of the first sorted particle in each grid cell or -1 for empty cells.
+	 */
+	std::vector<int32_t> cellstart;
+	/** Cell end.
+	 * Index after the last sorted particle in each grid cell.
+	 */
+	std::vector<int32_t> cellend;
+	/** Occupied cells.
+	 * Hashes of the cells that contain particles in the current step.
+	 */
+	std::vector<uint32_t> occupiedcells;
+	/** Neighbour range start.
+	 * First particle of each neighbour range of each sorted particle.
+	 */
+	std::vector<uint32_t> neighbourstart;
+	/** Neighbour range count.
+	 * Number of particles in each neighbour range of each sorted particle.
+	 */
+	std::vector<uint32_t> neighbourcount;
+	/** Lambdas.
+	 * Scaling factor of each sorted particle computed by the solver.
+	 */
+	std::vector<float> lambdas;
+	/** Vorticities.
+	 * Vorticity of each sorted particle.
+	 */
+	std::vector<glm::vec3> vorticities;
+	/** Corrected velocities.
+	 * Velocity of each sorted particle after applying XSPH viscosity.
+	 */
+	std::vector<glm::vec3> correctedvelocities;
+	/** Timings.
+	 * Time spent in each phase of the last simulation step in nanoseconds.
+	 */
+	GLint64 timings[SPH::TIMING_NUM_PHASES];
+};
+
+#endif /* CPUSPH_H */
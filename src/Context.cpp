@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "common.h"
+#include <stdlib.h>
+
+/** \file Context.cpp
+ * OpenGL context source file.
+ * The source file that creates the OpenGL context and applies driver workarounds.
+ * It is shared by the simulation and the benchmark executables.
+ */
+
+#ifndef GL_SUBGROUP_SIZE_KHR
+/* KHR_shader_subgroup tokens, which are missing in older versions of glcorearb.h */
+#define GL_SUBGROUP_SIZE_KHR 0x9532
+#define GL_SUBGROUP_SUPPORTED_STAGES_KHR 0x9533
+#define GL_SUBGROUP_SUPPORTED_FEATURES_KHR 0x9534
+#define GL_SUBGROUP_FEATURE_BASIC_BIT_KHR 0x00000001
+#define GL_SUBGROUP_FEATURE_BALLOT_BIT_KHR 0x00000008
+#endif
+
+/** GLFW window.
+ * The GLFW window.
+ */
+GLFWwindow *window = NULL;
+
+/** OpenGL extension support flags.
+ * Structure that contains flags indicating whether
+ * specific OpenGL extensions are supported or not.
+ */
+glextflags_t GLEXTS;
+
+void glfwErrorCallback (int error, const char *msg)
+{
+    std::cerr << "GLFW error: " << msg << std::endl;
+}
+
+/** OpenGL debug callback.
+ * Outputs a debug message from OpenGL.
+ * \param source source of the debug message
+ * \param type type of the debug message
+ * \param id debug message id
+ * \param severity severity of the debug message
+ * \param length length of the debug message
+ * \param message debug message
+ * \param userParam user pointer
+ *
+ */
+void glDebugCallback (GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
+        const GLchar *message, const void *userParam)
+{
+    std::cerr << "OpenGL debug message: " << std::string (message, length) << std::endl;
+}
+
+/** Broken ATI glMemoryBarrier entry point.
+ * This stores the non functional glMemoryBarrier entry point provided by ATI drivers.
+ */
+PFNGLMEMORYBARRIERPROC _glMemoryBarrier_BROKEN_ATIHACK = 0;
+
+/** Workaround for broken glMemoryBarrier provided by ATI drivers.
+ * This is used as a hack to work around the broken implementation
+ * of glMemoryBarrier provided by ATI drivers. It synchronizes
+ * the GPU command queue using a sync object before calling the
+ * apparently non functional entry point provided by the driver.
+ * It is not clear whether this actually results in the desired
+ * behavior, but it seems to produce much better results than
+ * just calling glMemoryBarrier (which seems to have no effect
+ * at all).
+ * \param bitfield Specifies the barriers to insert.
+ */
+void _glMemoryBarrier_ATIHACK (GLbitfield bitfield)
+{
+	GLsync syncobj = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glWaitSync (syncobj, 0, GL_TIMEOUT_IGNORED);
+	glDeleteSync (syncobj);
+	_glMemoryBarrier_BROKEN_ATIHACK (bitfield);
+}
+
+/** Dummy override for glMemoryBarrier.
+ * This is used as a dummy function that does nothing. glMemoryBarrier
+ * will be overridden by this function, if the environment variable
+ * PBF_NO_MEMORY_BARRIERS is set to 1.
+ * \param bitfield ignored argument
+ */
+void _glMemoryBarrier_DISABLED (GLbitfield bitfield)
+{
+}
+
+/** Legacy glBindBuffersBase.
+ * Legacy implementation of glBindBuffersBase. This is used as a fallback if
+ * GL_ARB_multi_bind is not available.
+ * \param target Specify the target of the bind operation.
+ * \param first Specify the index of the first binding point within the array specified by target.
+ * \param count Specify the number of contiguous binding points to which to bind buffers.
+ * \param buffers A pointer to an array of names of buffer objects to bind to the targets on the specified binding point, or NULL.
+ */
+void _glBindBuffersBase (GLenum target, GLuint first, GLsizei count, const GLuint *buffers)
+{
+	for (GLsizei i = 0; i < count; i++)
+	{
+		if (buffers == NULL)
+			glBindBufferBase (target, first + i, 0);
+		else
+			glBindBufferBase (target, first + i, buffers[i]);
+	}
+}
+
+bool CheckEnvironment (const char *varname)
+{
+	const char *env = getenv (varname);
+	if (env != NULL) {
+		switch (env[0])
+		{
+		case '0':
+		case 'f':
+		case 'F':
+		case 'n':
+		case 'N':
+			return false;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool IsExtensionSupported (const std::string &name)
+{
+	GLint n = 0;
+	glGetIntegerv (GL_NUM_EXTENSIONS, &n);
+	for (int i = 0; i < n; i++)
+	{
+		const char *ext = reinterpret_cast<const char*> (glGetStringi (GL_EXTENSIONS, i));
+		if (ext != NULL && !name.compare (ext))
+			return true;
+	}
+	return false;
+}
+
+void CreateContext (const int &width, const int &height, const bool &hidden)
+{
+	// check whether a debug context should be created
+	bool debugcontext = !CheckEnvironment ("PBF_NO_DEBUG_CONTEXT");
+
+    // specify parameters for the opengl context
+    glfwWindowHint (GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint (GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint (GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint (GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint (GLFW_OPENGL_DEBUG_CONTEXT, debugcontext ? GL_TRUE : GL_FALSE);
+
+    if (hidden)
+    {
+    	glfwWindowHint (GLFW_VISIBLE, GL_FALSE);
+#ifdef GLFW_OSMESA_CONTEXT_API
+    	// without a display fall back to an offscreen OSMesa context
+    	if (getenv ("DISPLAY") == NULL && getenv ("WAYLAND_DISPLAY") == NULL)
+    		glfwWindowHint (GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+    }
+
+    // open a window and an OpenGL context
+    window = glfwCreateWindow (width, height, "PBF", NULL, NULL);
+    if (window == NULL)
+        throw std::runtime_error ("Cannot open window.");
+    glfwMakeContextCurrent (window);
+
+    // get OpenGL entry points
+    glcorewInit ((glcorewGetProcAddressCallback) glfwGetProcAddress);
+
+    // check for ATI card and enable workarounds
+    std::string vendor (reinterpret_cast<const char*> (glGetString (GL_VENDOR)));
+    if (!vendor.compare ("ATI Technologies Inc."))
+    {
+    	std::cout << "Enable ATI workarounds." << std::endl;
+    	_glMemoryBarrier_BROKEN_ATIHACK = glMemoryBarrier;
+    	glMemoryBarrier = _glMemoryBarrier_ATIHACK;
+    }
+
+    // check for environment variables and enable workarounds respectively
+    if (CheckEnvironment ("PBF_NO_MEMORY_BARRIERS"))
+    {
+    	std::cout << "Disable glMemoryBarrier" << std::endl;
+    	glMemoryBarrier = _glMemoryBarrier_DISABLED;
+    }
+
+    if (debugcontext)
+    {
+    	glDebugMessageCallback (glDebugCallback, NULL);
+    	glEnable (GL_DEBUG_OUTPUT);
+    }
+
+    // determine OpenGL extension capabilities and apply workarounds where necessary
+    GLEXTS.ARB_clear_texture = IsExtensionSupported ("GL_ARB_clear_texture");
+    GLEXTS.ARB_buffer_storage = IsExtensionSupported ("GL_ARB_buffer_storage");
+    GLEXTS.KHR_shader_subgroup_ballot = false;
+    GLEXTS.subgroupsize = 0;
+    if (IsExtensionSupported ("GL_KHR_shader_subgroup"))
+    {
+    	GLint size = 0, stages = 0, features = 0;
+    	glGetIntegerv (GL_SUBGROUP_SIZE_KHR, &size);
+    	glGetIntegerv (GL_SUBGROUP_SUPPORTED_STAGES_KHR, &stages);
+    	glGetIntegerv (GL_SUBGROUP_SUPPORTED_FEATURES_KHR, &features);
+    	const GLint required = GL_SUBGROUP_FEATURE_BASIC_BIT_KHR | GL_SUBGROUP_FEATURE_BALLOT_BIT_KHR;
+    	GLEXTS.subgroupsize = size;
+    	GLEXTS.KHR_shader_subgroup_ballot = (stages & GL_COMPUTE_SHADER_BIT) && (features & required) == required;
+    }
+    if (CheckEnvironment ("PBF_NO_SUBGROUPS"))
+    {
+    	std::cout << "Disable subgroup operations" << std::endl;
+    	GLEXTS.KHR_shader_subgroup_ballot = false;
+    }
+    {
+    	// at least 65535 work groups are guaranteed in each direction
+    	GLint count = 65535;
+    	glGetIntegeri_v (GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &count);
+    	GLEXTS.maxworkgroupcount = count;
+    }
+    if (!IsExtensionSupported ("GL_ARB_multi_bind"))
+    {
+    	glBindBuffersBase = _glBindBuffersBase;
+    }
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "GPUProfiler.h"
+#include <algorithm>
+
+GPUProfiler::GPUProfiler (const std::vector<std::string> &names, const unsigned int &_window)
+    : phases (names.size ()), window (_window)
+{
+    for (size_t i = 0; i < names.size (); i++)
+    {
+        phases[i].name = names[i];
+        phases[i].latest = 0;
+        phases[i].total = 0;
+        phases[i].free.resize (RING_SIZE);
+        glGenQueries (RING_SIZE, &phases[i].free[0]);
+    }
+}
+
+GPUProfiler::~GPUProfiler (void)
+{
+    for (size_t i = 0; i < phases.size (); i++)
+    {
+        phase_t &phase = phases[i];
+        phase.free.insert (phase.free.end (), phase.pending.begin (), phase.pending.end ());
+        glDeleteQueries (phase.free.size (), &phase.free[0]);
+    }
+}
+
+void GPUProfiler::Begin (const unsigned int &index)
+{
+    phase_t &phase = phases[index];
+    // if all queries are pending, collect the available ones and
+    // grow the ring if there are none, instead of waiting for the GPU
+    if (phase.free.empty ())
+        Collect (phase);
+    if (phase.free.empty ())
+    {
+        GLuint query;
+        glGenQueries (1, &query);
+        phase.free.push_back (query);
+    }
+    phase.pending.push_back (phase.free.back ());
+    phase.free.pop_back ();
+    glBeginQuery (GL_TIME_ELAPSED, phase.pending.back ());
+}
+
+void GPUProfiler::End (const unsigned int &index)
+{
+    (void) index;
+    glEndQuery (GL_TIME_ELAPSED);
+}
+
+void GPUProfiler::Collect (phase_t &phase)
+{
+    while (!phase.pending.empty ())
+    {
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv (phase.pending.front (), GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        glGetQueryObjecti64v (phase.pending.front (), GL_QUERY_RESULT, &phase.latest);
+        phase.free.push_back (phase.pending.front ());
+        phase.pending.pop_front ();
+
+        double v = double (phase.latest) / 1000000.0;
+        phase.total += v;
+        phase.samples.push_back (v);
+        if (phase.samples.size () > window)
+            phase.samples.pop_front ();
+    }
+}
+
+void GPUProfiler::Collect (void)
+{
+    for (size_t i = 0; i < phases.size (); i++)
+        Collect (phases[i]);
+}
+
+void GPUProfiler::Clear (void)
+{
+    for (size_t i = 0; i < phases.size (); i++)
+    {
+        phases[i].total = 0;
+        phases[i].samples.clear ();
+    }
+}
+
+void GPUProfiler::SetWindow (const unsigned int &_window)
+{
+    window = _window;
+    for (size_t i = 0; i < phases.size (); i++)
+    {
+        while (phases[i].samples.size () > window)
+            phases[i].samples.pop_front ();
+    }
+}
+
+GLint64 GPUProfiler::GetLatest (const unsigned int &index) const
+{
+    const phase_t &phase = phases[index];
+    // results become available in order, so the newest available pending query is
+    // the most recent result; otherwise it is the one collected last
+    for (auto query = phase.pending.rbegin (); query != phase.pending.rend (); query++)
+    {
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv (*query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLint64 v = 0;
+            glGetQueryObjecti64v (*query, GL_QUERY_RESULT, &v);
+            return v;
+        }
+    }
+    return phase.latest;
+}
+
+GPUProfiler::statistics_t GPUProfiler::GetStatistics (const unsigned int &index) const
+{
+    const phase_t &phase = phases[index];
+    return ComputeStatistics (std::vector<double> (phase.samples.begin (), phase.samples.end ()));
+}
+
+GPUProfiler::statistics_t GPUProfiler::ComputeStatistics (std::vector<double> samples)
+{
+    statistics_t stats = { 0, 0, 0, 0, 0 };
+    if (samples.empty ())
+        return stats;
+
+    std::sort (samples.begin (), samples.end ());
+    stats.samples = samples.size ();
+    stats.min = samples.front ();
+    for (size_t i = 0; i < samples.size (); i++)
+        stats.mean += samples[i];
+    stats.mean /= double (samples.size ());
+    // nearest rank percentiles
+    stats.p95 = samples[(samples.size () * 95 + 99) / 100 - 1];
+    stats.p99 = samples[(samples.size () * 99 + 99) / 100 - 1];
+    return stats;
+}
+
+void GPUProfiler::WriteCSV (const std::string &filename, const std::vector<const GPUProfiler*> &profilers)
+{
+    std::ofstream file (filename.c_str ());
+    if (!file.is_open ())
+        throw std::runtime_error (std::string ("Cannot open profile output file: ") + filename);
+
+    file << "phase,samples,min_ms,mean_ms,p95_ms,p99_ms" << std::endl;
+    for (size_t p = 0; p < profilers.size (); p++)
+    {
+        for (unsigned int i = 0; i < profilers[p]->GetNumPhases (); i++)
+        {
+            statistics_t stats = profilers[p]->GetStatistics (i);
+            file << profilers[p]->GetName (i) << "," << stats.samples << "," << stats.min << "," << stats.mean
+                 << "," << stats.p95 << "," << stats.p99 << std::endl;
+        }
+    }
+}
+
+void GPUProfiler::WriteJSON (const std::string &filename, const std::vector<const GPUProfiler*> &profilers)
+{
+    std::ofstream file (filename.c_str ());
+    if (!file.is_open ())
+        throw std::runtime_error (std::string ("Cannot open profile output file: ") + filename);
+
+    // the phase names do not contain characters that need to be escaped
+    file << "{" << std::endl << "  \"phases\": [";
+    bool first = true;
+    for (size_t p = 0; p < profilers.size (); p++)
+    {
+        for (unsigned int i = 0; i < profilers[p]->GetNumPhases (); i++)
+        {
+            statistics_t stats = profilers[p]->GetStatistics (i);
+            file << (first ? "" : ",") << std::endl
+                 << "    { \"name\": \"" << profilers[p]->GetName (i) << "\", \"samples\": " << stats.samples
+                 << ", \"min_ms\": " << stats.min << ", \"mean_ms\": " << stats.mean
+                 << ", \"p95_ms\": " << stats.p95 << ", \"p99_ms\": " << stats.p99 << " }";
+            first = false;
+        }
+    }
+    file << std::endl << "  ]" << std::endl << "}" << std::endl;
+}
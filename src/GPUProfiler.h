@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef GPUPROFILER_H
+#define GPUPROFILER_H
+
+#include "common.h"
+#include <deque>
+
+/** GPU profiler class.
+ * This class measures the GPU time spent in a number of phases using a ring of
+ * timer queries per phase. The results are collected a few frames late, as soon
+ * as they are available, so that profiling does not stall the pipeline, and are
+ * kept in a rolling window from which statistics are computed. If all queries of
+ * a ring are pending, the ring grows instead of waiting for the oldest one.
+ */
+class GPUProfiler
+{
+public:
+    /** Statistics.
+     * Rolling statistics of a phase in milliseconds.
+     */
+    typedef struct statistics {
+        /** Number of samples.
+         * Number of samples in the rolling window.
+         */
+        unsigned int samples;
+        /** Minimum.
+         * Minimum time.
+         */
+        double min;
+        /** Mean.
+         * Mean time.
+         */
+        double mean;
+        /** 95th percentile.
+         * Time that 95 percent of the samples do not exceed.
+         */
+        double p95;
+        /** 99th percentile.
+         * Time that 99 percent of the samples do not exceed.
+         */
+        double p99;
+    } statistics_t;
+
+    /** Constructor.
+     * \param names names of the phases
+     * \param window number of samples per phase in the rolling window
+     */
+    GPUProfiler (const std::vector<std::string> &names, const unsigned int &window = 256);
+    /** Destructor.
+     */
+    ~GPUProfiler (void);
+
+    /** Begin phase.
+     * Starts measuring the time spent in a phase. Phases must not be nested.
+     * \param phase index of the phase
+     */
+    void Begin (const unsigned int &phase);
+
+    /** End phase.
+     * Stops measuring the time spent in a phase.
+     * \param phase index of the phase
+     */
+    void End (const unsigned int &phase);
+
+    /** Collect results.
+     * Adds the results of all queries that are available to the rolling windows
+     * and the totals. Never waits for the GPU.
+     */
+    void Collect (void);
+
+    /** Clear results.
+     * Discards the rolling windows and the totals of all phases. Measurements that are
+     * still pending are added once they are collected.
+     */
+    void Clear (void);
+
+    /** Set window size.
+     * Sets the number of samples per phase in the rolling window.
+     * \param window number of samples per phase in the rolling window
+     */
+    void SetWindow (const unsigned int &window);
+
+    /** Get latest time.
+     * Returns the time spent in the most recent measurement of a phase whose result is
+     * available. Never waits for the GPU, so the result may be a few frames old.
+     * \param phase index of the phase
+     * \returns the time in nanoseconds or 0, if no measurement of the phase is available yet
+     */
+    GLint64 GetLatest (const unsigned int &phase) const;
+
+    /** Get total time.
+     * Returns the time spent in all collected measurements of a phase since the last
+     * call to Clear. Call Collect after glFinish to include all measurements.
+     * \param phase index of the phase
+     * \returns the total time in milliseconds
+     */
+    double GetTotal (const unsigned int &phase) const {
+        return phases[phase].total;
+    }
+
+    /** Get samples.
+     * Returns the rolling window of a phase in the order of the measurements.
+     * \param phase index of the phase
+     * \returns the samples in milliseconds
+     */
+    const std::deque<double> &GetSamples (const unsigned int &phase) const {
+        return phases[phase].samples;
+    }
+
+    /** Get statistics.
+     * Computes the statistics of the rolling window of a phase.
+     * \param phase index of the phase
+     * \returns the statistics of the phase
+     */
+    statistics_t GetStatistics (const unsigned int &phase) const;
+
+    /** Compute statistics.
+     * Computes the statistics of an arbitrary set of samples.
+     * \param samples the samples in milliseconds
+     * \returns the statistics of the samples
+     */
+    static statistics_t ComputeStatistics (std::vector<double> samples);
+
+    /** Get number of phases.
+     * \returns the number of phases
+     */
+    unsigned int GetNumPhases (void) const {
+        return phases.size ();
+    }
+
+    /** Get phase name.
+     * \param phase index of the phase
+     * \returns the name of the phase
+     */
+    const std::string &GetName (const unsigned int &phase) const {
+        return phases[phase].name;
+    }
+
+    /** Write CSV.
+     * Writes the statistics of all phases of some profilers to a CSV file.
+     * \param filename name of the file
+     * \param profilers the profilers
+     */
+    static void WriteCSV (const std::string &filename, const std::vector<const GPUProfiler*> &profilers);
+
+    /** Write JSON.
+     * Writes the statistics of all phases of some profilers to a JSON file.
+     * \param filename name of the file
+     * \param profilers the profilers
+     */
+    static void WriteJSON (const std::string &filename, const std::vector<const GPUProfiler*> &profilers);
+
+private:
+    /** Ring size.
+     * Initial number of queries per phase, i.e. the number of measurements that may be
+     * pending before the ring grows.
+     */
+    static const unsigned int RING_SIZE = 8;
+
+    /** Phase.
+     * Query ring and rolling window of a phase.
+     */
+    typedef struct phase {
+        /** Name.
+         * Name of the phase.
+         */
+        std::string name;
+        /** Pending queries.
+         * Timer query objects whose results have not been collected yet, oldest first.
+         */
+        std::deque<GLuint> pending;
+        /** Free queries.
+         * Timer query objects that can be used for the next measurements.
+         */
+        std::vector<GLuint> free;
+        /** Latest time.
+         * Time of the last collected measurement in nanoseconds.
+         */
+        GLint64 latest;
+        /** Total time.
+         * Sum of all measurements collected since the last call to Clear in milliseconds.
+         */
+        double total;
+        /** Samples.
+         * Rolling window of the collected times in milliseconds.
+         */
+        std::deque<double> samples;
+    } phase_t;
+
+    /** Collect results.
+     * Adds the results of the pending queries of a phase that are available to its
+     * rolling window and total.
+     * \param phase the phase
+     */
+    void Collect (phase_t &phase);
+
+    /** Phases.
+     * The measured phases.
+     */
+    std::vector<phase_t> phases;
+
+    /** Window size.
+     * Number of samples per phase in the rolling window.
+     */
+    unsigned int window;
+};
+
+#endif /* GPUPROFILER_H */
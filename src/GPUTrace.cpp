@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "GPUTrace.h"
+#include <cstdint>
+
+GPUTrace *GPUTrace::object = NULL;
+
+GPUTrace::GPUTrace (const std::string &_filename, const std::string &_description)
+	: filename (_filename), description (_description), numcollected (0), full (false)
+{
+}
+
+GPUTrace::~GPUTrace (void)
+{
+	if (!freequeries.empty ())
+		glDeleteQueries (freequeries.size (), &freequeries[0]);
+}
+
+void GPUTrace::Start (const std::string &filename, const std::string &description)
+{
+	if (object != NULL)
+		throw std::logic_error ("GPU tracing is already started.");
+	object = new GPUTrace (filename, description);
+}
+
+void GPUTrace::Finish (void)
+{
+	if (object == NULL)
+		return;
+	// make sure the trace object is released, even if the file cannot be written
+	GPUTrace *trace = object;
+	object = NULL;
+	try {
+		trace->CollectEvents (true);
+		trace->Write ();
+	} catch (...) {
+		delete trace;
+		throw;
+	}
+	delete trace;
+}
+
+GLuint GPUTrace::GetQuery (void)
+{
+	GLuint query;
+	if (freequeries.empty ())
+	{
+		glGenQueries (1, &query);
+		return query;
+	}
+	query = freequeries.back ();
+	freequeries.pop_back ();
+	return query;
+}
+
+void GPUTrace::Begin (const char *name, const int &index)
+{
+	if (object == NULL)
+		return;
+	if (object->numcollected + object->pending.size () >= MAX_EVENTS)
+	{
+		if (!object->full)
+			spdlog::get ("console")->warn ("The GPU trace is full, further events are dropped.");
+		object->full = true;
+		object->open.push_back (SIZE_MAX);
+		return;
+	}
+
+	pendingevent_t event;
+	event.name = name;
+	if (index >= 0)
+		event.name += " " + std::to_string (index);
+	event.queries[0] = object->GetQuery ();
+	event.queries[1] = object->GetQuery ();
+	event.ended = false;
+	glQueryCounter (event.queries[0], GL_TIMESTAMP);
+	object->open.push_back (object->numcollected + object->pending.size ());
+	object->pending.push_back (event);
+}
+
+void GPUTrace::End (void)
+{
+	if (object == NULL)
+		return;
+	if (object->open.empty ())
+		throw std::logic_error ("GPUTrace::End called without matching GPUTrace::Begin.");
+	size_t position = object->open.back ();
+	object->open.pop_back ();
+	if (position == SIZE_MAX)
+		return;
+	pendingevent_t &event = object->pending[position - object->numcollected];
+	glQueryCounter (event.queries[1], GL_TIMESTAMP);
+	event.ended = true;
+}
+
+void GPUTrace::Collect (void)
+{
+	if (object != NULL)
+		object->CollectEvents (false);
+}
+
+void GPUTrace::CollectEvents (const bool &wait)
+{
+	while (!pending.empty ())
+	{
+		pendingevent_t &front = pending.front ();
+		if (!front.ended)
+			break;
+		if (!wait)
+		{
+			GLint available = GL_FALSE;
+			glGetQueryObjectiv (front.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break;
+		}
+		event_t event;
+		event.name = front.name;
+		glGetQueryObjectui64v (front.queries[0], GL_QUERY_RESULT, &event.begin);
+		glGetQueryObjectui64v (front.queries[1], GL_QUERY_RESULT, &event.end);
+		events.push_back (event);
+		freequeries.push_back (front.queries[0]);
+		freequeries.push_back (front.queries[1]);
+		pending.pop_front ();
+		numcollected++;
+	}
+}
+
+void GPUTrace::Write (void) const
+{
+	std::ofstream file (filename.c_str ());
+	if (!file.is_open ())
+		throw std::runtime_error (std::string ("Cannot open trace file: ") + filename);
+
+	// timestamps are given in microseconds relative to the first event
+	GLuint64 origin = events.empty () ? 0 : events.front ().begin;
+	file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl
+		 << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": {\"name\": \""
+		 << description << "\"}}";
+	file.precision (3);
+	file << std::fixed;
+	for (size_t i = 0; i < events.size (); i++)
+	{
+		const event_t &event = events[i];
+		file << "," << std::endl << "{\"name\": \"" << event.name << "\", \"cat\": \"gpu\", \"ph\": \"X\", "
+			 << "\"pid\": 0, \"tid\": 0, \"ts\": " << double (event.begin - origin) / 1000.0
+			 << ", \"dur\": " << double (event.end - event.begin) / 1000.0 << "}";
+	}
+	file << std::endl << "]}" << std::endl;
+	spdlog::get ("console")->info ("Wrote {} GPU trace events to {}.", events.size (), filename);
+}
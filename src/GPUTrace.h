@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef GPUTRACE_H
+#define GPUTRACE_H
+
+#include "common.h"
+#include <deque>
+
+/** GPU trace.
+ * This class records the GPU time of individual dispatches and draw passes
+ * using timestamp queries and writes them to a trace event JSON file that
+ * can be viewed in chrome://tracing or Perfetto. It is a singleton class with
+ * static methods, so that it can be used throughout the code; if tracing is
+ * not started, all methods return immediately.
+ */
+class GPUTrace
+{
+public:
+	/** Start tracing.
+	 * Starts recording trace events.
+	 * \param filename name of the trace file written by Finish
+	 * \param description description of the trace shown as process name
+	 */
+	static void Start (const std::string &filename, const std::string &description);
+	/** Finish tracing.
+	 * Waits for all pending trace events, writes the trace file and stops tracing.
+	 */
+	static void Finish (void);
+	/** Check tracing.
+	 * \returns True, if tracing was started, false otherwise.
+	 */
+	static bool IsEnabled (void) {
+		return object != NULL;
+	}
+
+	/** Begin event.
+	 * Begins a trace event. Events may be nested, but each event has to be ended
+	 * before its parent.
+	 * \param name name of the event
+	 * \param index index appended to the name (e.g. an iteration), if not negative
+	 */
+	static void Begin (const char *name, const int &index = -1);
+	/** End event.
+	 * Ends the innermost trace event.
+	 */
+	static void End (void);
+
+	/** Collect events.
+	 * Collects the timestamps of all events that are available without waiting.
+	 * This should be called once per frame to recycle the query objects.
+	 */
+	static void Collect (void);
+private:
+	/** Maximum number of events.
+	 * Recording stops after this number of events to limit memory usage.
+	 */
+	static const size_t MAX_EVENTS = 1 << 20;
+
+	/** Pending event.
+	 * Event whose timestamps have not been read yet.
+	 */
+	typedef struct pendingevent {
+		/** Name.
+		 * Name of the event.
+		 */
+		std::string name;
+		/** Query objects.
+		 * Timestamp queries for the begin and the end of the event.
+		 */
+		GLuint queries[2];
+		/** Ended flag.
+		 * Flag indicating whether the end timestamp has been issued.
+		 */
+		bool ended;
+	} pendingevent_t;
+
+	/** Event.
+	 * Completed event.
+	 */
+	typedef struct event {
+		/** Name.
+		 * Name of the event.
+		 */
+		std::string name;
+		/** Begin.
+		 * GPU timestamp of the begin of the event in nanoseconds.
+		 */
+		GLuint64 begin;
+		/** End.
+		 * GPU timestamp of the end of the event in nanoseconds.
+		 */
+		GLuint64 end;
+	} event_t;
+
+	/** Global object.
+	 * The global trace object (NULL if tracing is not started).
+	 */
+	static GPUTrace *object;
+
+	/** Private constructor.
+	 * \param filename name of the trace file
+	 * \param description description of the trace
+	 */
+	GPUTrace (const std::string &filename, const std::string &description);
+	/** Private destructor.
+	 */
+	~GPUTrace (void);
+
+	/** Get query object.
+	 * Returns an unused query object.
+	 * \returns the query object
+	 */
+	GLuint GetQuery (void);
+
+	/** Collect events.
+	 * Collects the timestamps of the pending events in order.
+	 * \param wait flag indicating whether to wait for the results
+	 */
+	void CollectEvents (const bool &wait);
+
+	/** Write trace file.
+	 * Writes the completed events to the trace file.
+	 */
+	void Write (void) const;
+
+	/** File name.
+	 * Name of the trace file.
+	 */
+	std::string filename;
+	/** Description.
+	 * Description of the trace.
+	 */
+	std::string description;
+	/** Pending events.
+	 * Events in the order in which they began.
+	 */
+	std::deque<pendingevent_t> pending;
+	/** Open events.
+	 * Positions of the events that have begun, but not ended yet, counted
+	 * from the first event ever recorded (SIZE_MAX for dropped events).
+	 */
+	std::vector<size_t> open;
+	/** Number of collected events.
+	 * Number of events that were removed from the pending events.
+	 */
+	size_t numcollected;
+	/** Full flag.
+	 * Flag indicating whether the maximum number of events has been reached.
+	 */
+	bool full;
+	/** Completed events.
+	 * Events whose timestamps have been read.
+	 */
+	std::vector<event_t> events;
+	/** Free query objects.
+	 * Query objects that can be reused.
+	 */
+	std::vector<GLuint> freequeries;
+};
+
+#endif /* GPUTRACE_H */
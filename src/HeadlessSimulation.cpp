@@ -0,0 +1,527 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "HeadlessSimulation.h"
+#include "RadixSort.h"
+#include <chrono>
+#include <glm/gtc/packing.hpp>
+
+HeadlessSimulation::HeadlessSimulation (const Scene &_scene, const bool &gpu, const bool &cpu,
+		const unsigned int &numthreads)
+	: scene (_scene), sph (NULL), cpusph (NULL), tolerance (-1.0f), frametime (0.0f),
+	  substeps (0)
+{
+    if (gpu)
+    {
+        sph = new SPH (scene.GetNumberOfParticles (), scene.GetGridSize ());
+        sph->SetDomainBounds (scene.GetDomainMin (), scene.GetDomainMax ());
+        sph->SetParticles (scene.GetPositions (), scene.GetVelocities ());
+        // the CPU backend computes all corrections from the positions of the previous
+        // iteration, so the comparison runs the matching Jacobi solver on the GPU
+        if (cpu)
+            sph->SetSolverMode (SPH::SOLVER_JACOBI);
+    }
+    if (cpu)
+    {
+        cpusph = new CPUSPH (scene.GetNumberOfParticles (), scene.GetGridSize (), numthreads);
+        cpusph->SetDomainBounds (scene.GetDomainMin (), scene.GetDomainMax ());
+        cpusph->SetParticles (scene.GetPositions (), scene.GetVelocities ());
+    }
+}
+
+HeadlessSimulation::~HeadlessSimulation (void)
+{
+    if (sph != NULL)
+        delete sph;
+    if (cpusph != NULL)
+        delete cpusph;
+}
+
+/** Check for OpenGL errors.
+ * Throws an exception if an OpenGL error occurred.
+ * \param step the current simulation step
+ */
+static void CheckErrors (const SPH&, const unsigned int &step)
+{
+    GLenum err = glGetError ();
+    if (err != GL_NO_ERROR)
+    {
+        std::stringstream stream;
+        stream << "OpenGL error detected in step " << step << ": 0x" << std::hex << err;
+        throw std::runtime_error (stream.str ());
+    }
+}
+
+/** Check for errors.
+ * The CPU backend reports errors by exceptions, so there is nothing to check.
+ */
+static void CheckErrors (const CPUSPH&, const unsigned int&)
+{
+}
+
+/** Wait for completion.
+ * Waits for all pending simulation steps of the GPU backend to finish.
+ */
+static void Finish (const SPH&)
+{
+    glFinish ();
+}
+
+/** Wait for completion.
+ * The CPU backend runs synchronously, so there is nothing to wait for.
+ */
+static void Finish (const CPUSPH&)
+{
+}
+
+/** Start timings.
+ * Discards the GPU times measured so far, e.g. during the initialization.
+ * Requires all previous steps to be finished.
+ * \param solver the SPH object
+ */
+static void StartTimings (SPH &solver)
+{
+    solver.GetProfiler ().Collect ();
+    solver.GetProfiler ().Clear ();
+}
+
+/** Start timings.
+ * The CPU backend measures its steps synchronously, so there is nothing to discard.
+ */
+static void StartTimings (CPUSPH&)
+{
+}
+
+/** Accumulate timings.
+ * The GPU times are collected by the profiler without waiting for the GPU and read
+ * once after the last step, so there is nothing to do after each step.
+ */
+static void AccumulateTimings (const SPH&, double*)
+{
+}
+
+/** Accumulate timings.
+ * Adds the times of the last step of the CPU backend.
+ * \param solver the CPUSPH object
+ * \param phasetimes accumulated time of each phase in milliseconds
+ */
+static void AccumulateTimings (const CPUSPH &solver, double *phasetimes)
+{
+    for (int phase = 0; phase < SPH::TIMING_NUM_PHASES; phase++)
+        phasetimes[phase] += double (solver.GetTiming (SPH::timingphase_t (phase))) / 1000000.0;
+}
+
+/** Finish timings.
+ * Reads the GPU times of all steps and substeps since StartTimings.
+ * Requires all steps to be finished.
+ * \param solver the SPH object
+ * \param phasetimes accumulated time of each phase in milliseconds
+ */
+static void FinishTimings (SPH &solver, double *phasetimes)
+{
+    solver.GetProfiler ().Collect ();
+    for (int phase = 0; phase < SPH::TIMING_NUM_PHASES; phase++)
+        phasetimes[phase] = solver.GetProfiler ().GetTotal (phase);
+}
+
+/** Finish timings.
+ * The times of the CPU backend are accumulated after each step.
+ */
+static void FinishTimings (CPUSPH&, double*)
+{
+}
+
+/** Accumulate density errors.
+ * Adds the density errors of the last step of the GPU backend, if they are measured.
+ * The third component counts the steps that contributed to an entry, since the
+ * adaptive solver may run a different number of iterations in each step.
+ * \param solver the SPH object
+ * \param errors accumulated density errors
+ */
+static void AccumulateDensityErrors (const SPH &solver, std::vector<glm::vec3> &errors)
+{
+    if (!solver.IsDensityErrorsEnabled ())
+        return;
+    std::vector<glm::vec2> steperrors;
+    solver.GetDensityErrors (steperrors);
+    if (errors.size () < steperrors.size ())
+        errors.resize (steperrors.size (), glm::vec3 (0, 0, 0));
+    for (size_t i = 0; i < steperrors.size (); i++)
+        errors[i] += glm::vec3 (steperrors[i], 1);
+}
+
+/** Accumulate density errors.
+ * The CPU backend does not measure density errors.
+ */
+static void AccumulateDensityErrors (const CPUSPH&, std::vector<glm::vec3>&)
+{
+}
+
+void HeadlessSimulation::Step (SPH &solver)
+{
+    if (frametime > 0)
+    {
+        substeps += solver.Advance (frametime);
+    }
+    else
+    {
+        solver.Run ();
+        substeps++;
+    }
+}
+
+void HeadlessSimulation::Step (CPUSPH &solver)
+{
+    solver.Run ();
+    substeps++;
+}
+
+template<typename T>
+void HeadlessSimulation::RunSolver (T &solver, const char *name, const unsigned int &steps)
+{
+    double phasetimes[SPH::TIMING_NUM_PHASES] = { 0 };
+    std::vector<glm::vec3> densityerrors;
+    substeps = 0;
+
+    // make sure the initialization is not included in the measurement
+    Finish (solver);
+    StartTimings (solver);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+
+    for (unsigned int step = 0; step < steps; step++)
+    {
+        Step (solver);
+        AccumulateTimings (solver, phasetimes);
+        CheckErrors (solver, step);
+        AccumulateDensityErrors (solver, densityerrors);
+    }
+
+    Finish (solver);
+    double elapsed = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    // the GPU times include all substeps of each step
+    FinishTimings (solver, phasetimes);
+
+    // output the results
+    std::cout << name << " backend:" << std::endl
+              << "Steps: " << steps << std::endl
+              << "Total time: " << elapsed << " s" << std::endl
+              << "Steps per second: " << (elapsed > 0 ? double (steps) / elapsed : 0.0) << std::endl;
+    if (steps > 0)
+    {
+        for (int phase = 0; phase < SPH::TIMING_NUM_PHASES; phase++)
+        {
+            std::cout << SPH::GetTimingPhaseName (SPH::timingphase_t (phase)) << ": "
+                      << phasetimes[phase] / double (steps) << " ms" << std::endl;
+        }
+    }
+    if (steps > 0 && !densityerrors.empty ())
+    {
+        // the density errors are measured before the first and after each iteration
+        int fewest = -1;
+        std::cout << "Density error after each solver iteration (maximum, average):" << std::endl;
+        for (size_t i = 0; i < densityerrors.size (); i++)
+        {
+            glm::vec2 error = glm::vec2 (densityerrors[i]) / densityerrors[i].z;
+            std::cout << i << ": " << error.x << ", " << error.y;
+            if (densityerrors[i].z < float (steps))
+                std::cout << " (" << densityerrors[i].z << " steps)";
+            std::cout << std::endl;
+            if (fewest < 0 && tolerance > 0 && error.y < tolerance)
+                fewest = int (i);
+        }
+        if (tolerance > 0)
+        {
+            std::cout << "Fewest iterations with an average density error below " << tolerance << ": ";
+            if (fewest < 0)
+                std::cout << "not reached" << std::endl;
+            else
+                std::cout << fewest << std::endl;
+        }
+    }
+}
+
+void HeadlessSimulation::Run (const unsigned int &steps)
+{
+    if (sph != NULL)
+    {
+        std::cout << "Running " << steps << " steps with " << scene.GetNumberOfParticles () << " particles on "
+                  << reinterpret_cast<const char*> (glGetString (GL_RENDERER));
+        if (cpusph != NULL)
+            std::cout << " (" << SPH::GetSolverModeName (sph->GetSolverMode ()) << " solver like the CPU backend)";
+        std::cout << "." << std::endl;
+        const GLuint iterations = sph->GetTotalSolverIterations ();
+        const double simulationtime = sph->GetSimulationTime ();
+        const unsigned int neighboursearches = sph->GetNumNeighbourSearches ();
+        RunSolver (*sph, "GPU", steps);
+        if (frametime > 0 && steps > 0)
+            std::cout << "Simulated time: " << sph->GetSimulationTime () - simulationtime << " s of "
+                      << double (frametime) * double (steps) << " s" << std::endl
+                      << "Average substeps: " << double (substeps) / double (steps) << std::endl;
+        if (sph->GetSolverTolerance () > 0 && steps > 0)
+            std::cout << "Average solver iterations: "
+                      << double (sph->GetTotalSolverIterations () - iterations) / double (steps) << " (maximum "
+                      << sph->GetNumSolverIterations () << ")" << std::endl;
+        const glm::ivec3 &gridsize = sph->GetGridSize ();
+        const glm::ivec3 &gridorigin = sph->GetGridOrigin ();
+        std::cout << "Grid: " << gridsize.x << "x" << gridsize.y << "x" << gridsize.z << " at ("
+                  << gridorigin.x << ", " << gridorigin.y << ", " << gridorigin.z << ")" << std::endl;
+        if (sph->GetNeighbourSearchInterval () > 1)
+            std::cout << "Neighbour searches: " << sph->GetNumNeighbourSearches () - neighboursearches
+                      << " (at least every " << sph->GetNeighbourSearchInterval () << " steps)" << std::endl;
+        if (sph->IsIncrementalSortEnabled ())
+        {
+            GLuint counts[4];
+            sph->GetSortModeCounts (counts);
+            std::cout << "Incremental sort: " << counts[0] << " skipped, " << counts[1] << " local, "
+                      << counts[2] << " local and full, " << counts[3] << " full" << std::endl;
+        }
+        if (sph->IsDeterministic ())
+            std::cout << "State hash: " << SPH::FormatStateHash (sph->GetStateHash ()) << std::endl;
+    }
+    if (cpusph != NULL)
+    {
+        std::cout << "Running " << steps << " steps with " << scene.GetNumberOfParticles () << " particles on "
+                  << cpusph->GetNumThreads () << " CPU threads ("
+                  << (cpusph->IsSIMDEnabled () ? CPUKernels::GetInstructionSet () : "scalar") << " kernels)." << std::endl;
+        RunSolver (*cpusph, "CPU", steps);
+    }
+    if (sph != NULL && cpusph != NULL)
+        CompareBackends ();
+}
+
+void HeadlessSimulation::SetSIMDEnabled (const bool &flag)
+{
+    if (cpusph != NULL)
+        cpusph->SetSIMDEnabled (flag);
+}
+
+void HeadlessSimulation::SetDomainBounds (const glm::vec3 &min, const glm::vec3 &max)
+{
+    if (sph != NULL)
+        sph->SetDomainBounds (min, max);
+    if (cpusph != NULL)
+        cpusph->SetDomainBounds (min, max);
+}
+
+void HeadlessSimulation::SetAdaptiveGridInterval (const unsigned int &interval)
+{
+    if (sph != NULL)
+        sph->SetAdaptiveGridInterval (interval);
+}
+
+void HeadlessSimulation::SetTiledSolverEnabled (const bool &flag)
+{
+    if (sph != NULL)
+        sph->SetTiledSolverEnabled (flag);
+}
+
+void HeadlessSimulation::SetIncrementalSortEnabled (const bool &flag)
+{
+    if (sph != NULL)
+        sph->SetIncrementalSortEnabled (flag);
+}
+
+void HeadlessSimulation::SetNeighbourSearchInterval (const unsigned int &interval)
+{
+    if (sph != NULL)
+        sph->SetNeighbourSearchInterval (interval);
+}
+
+void HeadlessSimulation::SetDeterministic (const bool &flag)
+{
+    if (sph != NULL)
+        sph->SetDeterministic (flag);
+}
+
+void HeadlessSimulation::LoadCheckpoint (const std::string &filename)
+{
+    if (sph != NULL)
+    {
+        sph->LoadCheckpoint (filename);
+        sph->WaitForCheckpoint ();
+        std::cout << "Restored step " << sph->GetStepCounter () << " from " << filename << "." << std::endl;
+    }
+}
+
+void HeadlessSimulation::SaveCheckpoint (const std::string &filename)
+{
+    if (sph != NULL)
+    {
+        sph->SaveCheckpoint (filename);
+        sph->WaitForCheckpoint ();
+        std::cout << "Checkpoint written to " << filename << "." << std::endl;
+    }
+}
+
+void HeadlessSimulation::SetSolverMode (const SPH::solvermode_t &mode)
+{
+    // keep the Jacobi solver of the comparison
+    if (sph != NULL && cpusph == NULL)
+        sph->SetSolverMode (mode);
+}
+
+void HeadlessSimulation::EnableDensityErrors (const float &_tolerance)
+{
+    tolerance = _tolerance;
+    if (sph != NULL)
+        sph->SetDensityErrorsEnabled (true);
+}
+
+void HeadlessSimulation::SetNumSolverIterations (const unsigned int &iterations)
+{
+    if (sph != NULL)
+        sph->SetNumSolverIterations (iterations);
+}
+
+void HeadlessSimulation::SetSolverTolerance (const float &tolerance)
+{
+    if (sph != NULL)
+        sph->SetSolverTolerance (tolerance);
+}
+
+void HeadlessSimulation::EnableAdaptiveTimestep (const float &_frametime, const float &cfl)
+{
+    frametime = _frametime;
+    if (sph != NULL)
+        sph->SetCFLNumber (cfl);
+}
+
+void HeadlessSimulation::WriteProfile (const std::string &prefix) const
+{
+    if (sph == NULL)
+        throw std::logic_error ("The profile requires the GPU backend.");
+    std::vector<const GPUProfiler*> profilers (1, &sph->GetProfiler ());
+    GPUProfiler::WriteCSV (prefix + ".csv", profilers);
+    GPUProfiler::WriteJSON (prefix + ".json", profilers);
+}
+
+void HeadlessSimulation::BenchmarkSolvers (const unsigned int &steps)
+{
+    if (sph == NULL)
+        throw std::logic_error ("The solver benchmark requires the GPU backend.");
+
+    const bool tiled = sph->IsTiledSolverEnabled ();
+    const GLuint iterations = sph->GetNumSolverIterations ();
+    const float solvertolerance = sph->GetSolverTolerance ();
+    const char *names[2] = { "two-dispatch", "tiled" };
+    double solvertimes[2] = { 0, 0 };
+
+    sph->SetNumSolverIterations (5);
+    sph->SetSolverTolerance (0);
+    for (int variant = 0; variant < 2; variant++)
+    {
+        sph->SetTiledSolverEnabled (variant == 1);
+        sph->SetParticles (scene.GetPositions (), scene.GetVelocities ());
+        glFinish ();
+        sph->GetProfiler ().Collect ();
+        sph->GetProfiler ().Clear ();
+        for (unsigned int step = 0; step < steps; step++)
+        {
+            sph->Run ();
+            CheckErrors (*sph, step);
+        }
+        // the solver times are collected once all steps have completed
+        glFinish ();
+        sph->GetProfiler ().Collect ();
+        solvertimes[variant] = sph->GetProfiler ().GetTotal (SPH::TIMING_SOLVER);
+    }
+    sph->SetNumSolverIterations (iterations);
+    sph->SetSolverTolerance (solvertolerance);
+    sph->SetTiledSolverEnabled (tiled);
+
+    std::cout << "Solver (" << steps << " steps, 5 iterations):" << std::endl;
+    for (int variant = 0; variant < 2; variant++)
+        std::cout << names[variant] << ": " << (steps > 0 ? solvertimes[variant] / double (steps) : 0.0)
+                  << " ms per step" << std::endl;
+    std::cout << "Speedup: " << (solvertimes[1] > 0 ? solvertimes[0] / solvertimes[1] : 0.0) << std::endl;
+}
+
+void HeadlessSimulation::BenchmarkKernels (const unsigned int &iterations)
+{
+    if (cpusph == NULL)
+        throw std::logic_error ("The kernel benchmark requires the CPU backend.");
+
+    const bool simd = cpusph->IsSIMDEnabled ();
+    uint64_t numpairs = 0;
+
+    cpusph->SetSIMDEnabled (false);
+    double scalartime = cpusph->BenchmarkSolver (iterations, numpairs);
+    cpusph->SetSIMDEnabled (true);
+    double simdtime = cpusph->BenchmarkSolver (iterations, numpairs);
+    cpusph->SetSIMDEnabled (simd);
+
+    std::cout << "Solver kernels (" << iterations << " iterations, " << numpairs
+              << " neighbour pairs per iteration):" << std::endl
+              << "scalar: " << scalartime / 1000000.0 << " ms per iteration, "
+              << (numpairs > 0 ? scalartime / double (numpairs) : 0.0) << " ns per pair" << std::endl
+              << CPUKernels::GetInstructionSet () << ": " << simdtime / 1000000.0 << " ms per iteration, "
+              << (numpairs > 0 ? simdtime / double (numpairs) : 0.0) << " ns per pair" << std::endl
+              << "Speedup: " << (simdtime > 0 ? scalartime / simdtime : 0.0) << std::endl;
+}
+
+void HeadlessSimulation::CompareBackends (void)
+{
+    std::vector<glm::vec4> gpupositions, gpuvelocities, cpupositions, cpuvelocities;
+    sph->GetParticles (gpupositions, gpuvelocities);
+    cpusph->GetParticles (cpupositions, cpuvelocities);
+
+    double maxposdiff = 0, sumposdiff = 0, maxveldiff = 0;
+    for (size_t i = 0; i < gpupositions.size (); i++)
+    {
+        double posdiff = glm::distance (glm::vec3 (gpupositions[i]), glm::vec3 (cpupositions[i]));
+        double veldiff = glm::distance (glm::vec3 (gpuvelocities[i]), glm::vec3 (cpuvelocities[i]));
+        maxposdiff = std::max (maxposdiff, posdiff);
+        maxveldiff = std::max (maxveldiff, veldiff);
+        sumposdiff += posdiff;
+    }
+
+    std::cout << "GPU/CPU deviation:" << std::endl
+              << "Maximum position deviation: " << maxposdiff << std::endl
+              << "Average position deviation: " << sumposdiff / double (gpupositions.size ()) << std::endl
+              << "Maximum velocity deviation: " << maxveldiff << std::endl;
+
+#ifdef COMPACT_PARTICLES
+    // error introduced by storing the fp32 reference state in the compact particle layout
+    const glm::vec3 gridorigin (sph->GetGridOrigin ());
+    double maxkeyerror = 0, sumkeyerror = 0, maxhalferror = 0;
+    for (size_t i = 0; i < cpupositions.size (); i++)
+    {
+        uint32_t key[RadixSort::KEY_WORDS];
+        RadixSort::PackKey (glm::vec3 (cpupositions[i]), i, gridorigin, key);
+        double keyerror = glm::distance (RadixSort::GetKeyPosition (key, gridorigin), glm::vec3 (cpupositions[i]));
+        maxkeyerror = std::max (maxkeyerror, keyerror);
+        sumkeyerror += keyerror;
+
+        glm::vec3 velocity (cpuvelocities[i]);
+        double speed = glm::length (velocity);
+        if (speed > 0)
+        {
+            glm::vec3 half (glm::unpackHalf4x16 (glm::packHalf4x16 (cpuvelocities[i])));
+            maxhalferror = std::max (maxhalferror, double (glm::distance (half, velocity)) / speed);
+        }
+    }
+
+    std::cout << "Compact particle layout error:" << std::endl
+              << "Maximum key position error: " << maxkeyerror << std::endl
+              << "Average key position error: " << sumkeyerror / double (cpupositions.size ()) << std::endl
+              << "Maximum relative velocity error: " << maxhalferror << std::endl;
+#endif
+}
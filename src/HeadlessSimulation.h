@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef HEADLESSSIMULATION_H
+#define HEADLESSSIMULATION_H
+
+#include "common.h"
+#include "Scene.h"
+#include "SPH.h"
+#include "CPUSPH.h"
+
+/** Headless simulation class.
+ * Runs the SPH simulation back to back without any rendering in order
+ * to measure the throughput of the solver.
+ */
+class HeadlessSimulation
+{
+public:
+    /** Constructor.
+     * At least one of the backends has to be enabled. If both are enabled,
+     * the results of both backends are compared after running the simulation,
+     * and the GPU backend uses the Jacobi solver like the CPU backend.
+     * \param scene initial particle configuration
+     * \param gpu flag indicating whether to run the simulation on the GPU (requires an OpenGL context)
+     * \param cpu flag indicating whether to run the simulation on the CPU
+     * \param numthreads number of threads used by the CPU backend (0 to use one thread per hardware thread)
+     */
+    HeadlessSimulation (const Scene &scene, const bool &gpu, const bool &cpu, const unsigned int &numthreads = 0);
+    /** Destructor.
+     */
+    ~HeadlessSimulation (void);
+
+    /** Run.
+     * Runs the specified number of simulation steps and outputs the number of
+     * steps per second and the average time spent in each simulation phase.
+     * \param steps number of simulation steps to run
+     */
+    void Run (const unsigned int &steps);
+
+    /** Enable/disable SIMD kernels.
+     * Specifies whether the CPU backend uses the vectorised solver kernels.
+     * \param flag Flag indicating whether to use the vectorised kernels.
+     */
+    void SetSIMDEnabled (const bool &flag);
+
+    /** Set domain bounds.
+     * Specifies the region the particles are confined to in both backends.
+     * \param min lower corner of the domain
+     * \param max upper corner of the domain
+     */
+    void SetDomainBounds (const glm::vec3 &min, const glm::vec3 &max);
+
+    /** Set adaptive grid interval.
+     * Specifies how often the GPU backend adapts its grid to the particle bounding box.
+     * \param interval number of steps between bounding box computations (0 to disable)
+     */
+    void SetAdaptiveGridInterval (const unsigned int &interval);
+
+    /** Enable/disable tiled solver.
+     * Specifies whether the GPU backend uses the tiled solver shaders.
+     * \param flag Flag indicating whether to use the tiled solver.
+     */
+    void SetTiledSolverEnabled (const bool &flag);
+
+    /** Enable/disable incremental sort.
+     * Specifies whether the GPU backend re-sorts the particle keys incrementally.
+     * \param flag Flag indicating whether to use the incremental sort.
+     */
+    void SetIncrementalSortEnabled (const bool &flag);
+
+    /** Set neighbour search interval.
+     * Specifies the maximum number of steps between neighbour searches of the GPU backend.
+     * \param interval maximum number of steps between neighbour searches
+     */
+    void SetNeighbourSearchInterval (const unsigned int &interval);
+
+    /** Enable/disable deterministic mode.
+     * Specifies whether the GPU backend runs in the deterministic mode (see
+     * SPH::SetDeterministic). In this mode the hash of the final particle state
+     * is output after the simulation.
+     * \param flag Flag indicating whether to use the deterministic mode.
+     */
+    void SetDeterministic (const bool &flag);
+
+    /** Load checkpoint.
+     * Restores the state of the GPU backend from a checkpoint file (see SPH::LoadCheckpoint).
+     * \param filename name of the checkpoint file
+     */
+    void LoadCheckpoint (const std::string &filename);
+
+    /** Save checkpoint.
+     * Writes the state of the GPU backend to a checkpoint file and waits until it
+     * has been written (see SPH::SaveCheckpoint).
+     * \param filename name of the checkpoint file
+     */
+    void SaveCheckpoint (const std::string &filename);
+
+    /** Set solver mode.
+     * Specifies how the GPU backend applies the position corrections. When comparing
+     * the backends, the GPU backend keeps the Jacobi solver of the CPU backend.
+     * \param mode the solver mode
+     */
+    void SetSolverMode (const SPH::solvermode_t &mode);
+
+    /** Enable density error measurement.
+     * Enables measuring the density error in each solver iteration of the GPU
+     * backend. After the simulation the maximum and average density error after
+     * each iteration (averaged over all steps) is output and, if the tolerance
+     * is positive, the fewest iterations whose average density error is below it.
+     * \param tolerance tolerance for the average density error (0 for none)
+     */
+    void EnableDensityErrors (const float &tolerance);
+
+    /** Set solver iterations.
+     * Specifies the number of solver iterations of the GPU backend (the maximum
+     * number, if the adaptive solver is used).
+     * \param iterations number of solver iterations
+     */
+    void SetNumSolverIterations (const unsigned int &iterations);
+
+    /** Set adaptive solver tolerance.
+     * Lets the GPU backend stop iterating as soon as the average density error
+     * drops below the given tolerance. The average number of iterations is output
+     * after the simulation.
+     * \param tolerance tolerance for the average density error (0 for a fixed number of iterations)
+     */
+    void SetSolverTolerance (const float &tolerance);
+
+    /** Enable adaptive time steps.
+     * Lets each step of the GPU backend advance the simulation by the given frame
+     * time using CFL limited substeps. The simulated time and the average number of
+     * substeps are output after the simulation.
+     * \param frametime simulation time per step (0 to run fixed time steps)
+     * \param cfl CFL number
+     */
+    void EnableAdaptiveTimestep (const float &frametime, const float &cfl);
+
+    /** Write profile.
+     * Writes the rolling statistics of the GPU time spent in each simulation
+     * phase to a CSV file and a JSON file.
+     * \param prefix file name prefix (".csv" and ".json" are appended)
+     */
+    void WriteProfile (const std::string &prefix) const;
+
+    /** Benchmark solvers.
+     * Runs the specified number of steps from the initial scene with 5 solver iterations
+     * using the two-dispatch solver and the tiled solver on the GPU and outputs the
+     * average solver time of each variant.
+     * \param steps number of simulation steps to run for each variant
+     */
+    void BenchmarkSolvers (const unsigned int &steps);
+
+    /** Benchmark solver kernels.
+     * Runs solver iterations on the current state of the CPU backend with the
+     * scalar and the vectorised kernels and outputs the time per neighbour pair.
+     * Has to be called after Run.
+     * \param iterations number of solver iterations to run for each variant
+     */
+    void BenchmarkKernels (const unsigned int &iterations);
+private:
+    /** Run solver.
+     * Runs the specified number of simulation steps using one of the backends
+     * and outputs the results.
+     * \param solver the SPH or CPUSPH object to run
+     * \param name name of the backend
+     * \param steps number of simulation steps to run
+     */
+    template<typename T>
+    void RunSolver (T &solver, const char *name, const unsigned int &steps);
+
+    /** Simulation step.
+     * Runs a simulation step of the GPU backend, which consists of several substeps
+     * if adaptive time steps are enabled.
+     * \param solver the SPH object
+     */
+    void Step (SPH &solver);
+
+    /** Simulation step.
+     * Runs a simulation step of the CPU backend.
+     * \param solver the CPUSPH object
+     */
+    void Step (CPUSPH &solver);
+
+    /** Compare backends.
+     * Outputs the deviation between the particle states of the GPU and the CPU backend.
+     */
+    void CompareBackends (void);
+
+    /** Scene.
+     * Initial particle configuration.
+     */
+    Scene scene;
+
+    /** SPH class.
+     * Takes care of the SPH simulation on the GPU (NULL if disabled).
+     */
+    SPH *sph;
+
+    /** CPU SPH class.
+     * Takes care of the SPH simulation on the CPU (NULL if disabled).
+     */
+    CPUSPH *cpusph;
+
+    /** Density error tolerance.
+     * Tolerance for the average density error (0 for none, negative if the
+     * density error is not measured).
+     */
+    float tolerance;
+
+    /** Frame time.
+     * Simulation time per step of the GPU backend with adaptive time steps
+     * (0 for fixed time steps).
+     */
+    float frametime;
+
+    /** Number of substeps.
+     * Number of substeps run by the last call to RunSolver.
+     */
+    unsigned long substeps;
+};
+
+#endif /* HEADLESSSIMULATION_H */
@@ -20,25 +20,51 @@
  * THE SOFTWARE.
  */
 #include "NeighbourCellFinder.h"
+#include "GPUTrace.h"
 
 NeighbourCellFinder::NeighbourCellFinder (const GLuint &_numparticles, const glm::ivec3 &_gridsize)
 	: numparticles (_numparticles), gridsize (_gridsize)
 {
+#ifndef NEIGHBOUR_WIDE_ENTRIES
+	// the packed neighbour cell entries store particle indices in 24 bits
+	if (numparticles > (1u << 24))
+		throw std::logic_error ("More than 2^24 particles require the wide neighbour cell entries "
+				"(PBF_NEIGHBOUR_WIDE_ENTRIES).");
+#endif
+	// both passes have one invocation per particle in x direction
+	if ((numparticles + 255) >> 8 > GLEXTS.maxworkgroupcount)
+		throw std::runtime_error ("The number of particles exceeds the maximum number of compute work groups.");
+
 	std::stringstream stream;
 	stream << "const vec3 GRID_SIZE = vec3 (" << gridsize.x << ", " << gridsize.y << ", " << gridsize.z << ");" << std::endl
 		   << "const ivec3 GRID_HASHWEIGHTS = ivec3 (1, " << gridsize.x * gridsize.z <<  ", " << gridsize.x << ");" << std::endl
-		   << "#define BLOCKSIZE 256" << std::endl;
+		   << "#define BLOCKSIZE 256" << std::endl
+		   << "#define NUM_PARTICLES " << numparticles << std::endl
+		   << RadixSort::GetGridDefinitions (numparticles, gridsize)
+		   << RadixSort::GetKeyDefinitions ()
+		   << GetNeighbourDefinitions ();
 
 
-	findcells.CompileShader (GL_COMPUTE_SHADER, "shaders/neighbourcellfinder/findcells.glsl", stream.str ());
+	findcells.CompileShader (GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+			"shaders/grid/hash.glsl", "shaders/neighbourcellfinder/findcells.glsl"},
+			stream.str ());
     findcells.Link ();
 
-    neighbourcells.CompileShader (GL_COMPUTE_SHADER, "shaders/neighbourcellfinder/neighbourcells.glsl", stream.str ());
+    neighbourcells.CompileShader (GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+    		"shaders/grid/hash.glsl", "shaders/neighbourcellfinder/neighbourcells.glsl"}, stream.str ());
     neighbourcells.Link ();
 
 	// create buffer objects
-	glGenBuffers (1, buffers);
+	glGenBuffers (6, buffers);
 
+#ifdef HASHED_GRID
+    // allocate the hash table buffers, whose size only depends on the number of particles
+    GLuint hashtablesize = RadixSort::GetHashTableSize (numparticles, gridsize);
+    glBindBuffer (GL_SHADER_STORAGE_BUFFER, gridstartbuffer);
+    glBufferData (GL_SHADER_STORAGE_BUFFER, sizeof (GLint) * hashtablesize, NULL, GL_DYNAMIC_COPY);
+    glBindBuffer (GL_SHADER_STORAGE_BUFFER, gridendbuffer);
+    glBufferData (GL_SHADER_STORAGE_BUFFER, sizeof (GLint) * hashtablesize, NULL, GL_DYNAMIC_COPY);
+#else
     // allocate grid clear buffer
 	// (only needed if GL_ARB_clear_texture is not available)
 	GLuint tmpbuffer;
@@ -88,21 +114,66 @@ NeighbourCellFinder::NeighbourCellFinder (const GLuint &_numparticles, const glm
     glTexParameteri (GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri (GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri (GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+#endif
+
+    // allocate overflow counter
+    glBindBuffer (GL_SHADER_STORAGE_BUFFER, overflowbuffer);
+    glBufferData (GL_SHADER_STORAGE_BUFFER, sizeof (GLuint), NULL, GL_DYNAMIC_READ);
+    glClearBufferData (GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
 
     // allocate neighbour cell buffer
     glBindBuffer (GL_SHADER_STORAGE_BUFFER, neighbourcellbuffer);
-   	glBufferData (GL_SHADER_STORAGE_BUFFER, sizeof (GLuint) * 12 * numparticles, NULL, GL_DYNAMIC_COPY);
+   	glBufferData (GL_SHADER_STORAGE_BUFFER, sizeof (GLuint) * 4 * NEIGHBOUR_TEXELS * numparticles, NULL, GL_DYNAMIC_COPY);
 
     // create neighbour cell texture
     neighbourcelltexture.Bind (GL_TEXTURE_BUFFER);
     glTexBuffer (GL_TEXTURE_BUFFER, GL_RGBA32I, neighbourcellbuffer);
 
+#ifdef NEIGHBOUR_WIDE_ENTRIES
+    // allocate neighbour count buffer
+    glBindBuffer (GL_SHADER_STORAGE_BUFFER, neighbourcountbuffer);
+    glBufferData (GL_SHADER_STORAGE_BUFFER, sizeof (GLuint) * 4 * NEIGHBOUR_TEXELS * numparticles, NULL, GL_DYNAMIC_COPY);
+
+    // create neighbour count texture
+    neighbourcounttexture.Bind (GL_TEXTURE_BUFFER);
+    glTexBuffer (GL_TEXTURE_BUFFER, GL_RGBA32I, neighbourcountbuffer);
+#endif
+
+#ifdef NEIGHBOUR_CELL_TABLE
+    // allocate neighbour cell index buffer
+    glBindBuffer (GL_SHADER_STORAGE_BUFFER, neighbourcellindexbuffer);
+    glBufferData (GL_SHADER_STORAGE_BUFFER, sizeof (GLint) * numparticles, NULL, GL_DYNAMIC_COPY);
+
+    // create neighbour cell index texture
+    neighbourcellindextexture.Bind (GL_TEXTURE_BUFFER);
+    glTexBuffer (GL_TEXTURE_BUFFER, GL_R32I, neighbourcellindexbuffer);
+#endif
+
 }
 
 NeighbourCellFinder::~NeighbourCellFinder (void)
 {
 	// cleanup
-	glDeleteBuffers (1, buffers);
+	glDeleteBuffers (6, buffers);
+}
+
+std::string NeighbourCellFinder::GetNeighbourDefinitions (void)
+{
+	std::stringstream stream;
+	stream
+#ifdef NEIGHBOUR_CELL_TABLE
+		   << "#define NEIGHBOUR_CELL_TABLE" << std::endl
+#endif
+#ifdef NEIGHBOUR_WIDE_ENTRIES
+		   << "#define NEIGHBOUR_WIDE_ENTRIES" << std::endl
+#endif
+#ifdef NEIGHBOUR_SKIN
+		   << "#define NEIGHBOUR_SKIN" << std::endl
+#endif
+		   << "#define NEIGHBOUR_EXTENT " << NEIGHBOUR_EXTENT << std::endl
+		   << "#define NEIGHBOUR_RANGES " << NEIGHBOUR_RANGES << std::endl
+		   << "#define NEIGHBOUR_TEXELS " << NEIGHBOUR_TEXELS << std::endl;
+	return stream.str ();
 }
 
 const Texture &NeighbourCellFinder::GetResult (void) const
@@ -110,8 +181,88 @@ const Texture &NeighbourCellFinder::GetResult (void) const
 	return neighbourcelltexture;
 }
 
-void NeighbourCellFinder::FindNeighbourCells (const GLuint &particlebuffer)
+const Texture &NeighbourCellFinder::GetCellIndices (void) const
 {
+	return neighbourcellindextexture;
+}
+
+const Texture &NeighbourCellFinder::GetCounts (void) const
+{
+	return neighbourcounttexture;
+}
+
+GLuint NeighbourCellFinder::GetNumOverflows (void) const
+{
+	GLuint count;
+	glBindBuffer (GL_COPY_READ_BUFFER, overflowbuffer);
+	glGetBufferSubData (GL_COPY_READ_BUFFER, 0, sizeof (count), &count);
+	return count;
+}
+
+void NeighbourCellFinder::GetNeighbourCounts (std::vector<GLuint> &counts) const
+{
+	const size_t entriesperparticle = 4 * NEIGHBOUR_TEXELS;
+	std::vector<GLint> entries (entriesperparticle * numparticles);
+	glBindBuffer (GL_COPY_READ_BUFFER, neighbourcellbuffer);
+	glGetBufferSubData (GL_COPY_READ_BUFFER, 0, sizeof (GLint) * entries.size (), &entries[0]);
+#ifdef NEIGHBOUR_WIDE_ENTRIES
+	// the counts are stored separately with the same layout
+	glBindBuffer (GL_COPY_READ_BUFFER, neighbourcountbuffer);
+	glGetBufferSubData (GL_COPY_READ_BUFFER, 0, sizeof (GLint) * entries.size (), &entries[0]);
+#endif
+#ifdef NEIGHBOUR_CELL_TABLE
+	std::vector<GLint> cellindices (numparticles);
+	glBindBuffer (GL_COPY_READ_BUFFER, neighbourcellindexbuffer);
+	glGetBufferSubData (GL_COPY_READ_BUFFER, 0, sizeof (GLint) * numparticles, &cellindices[0]);
+#endif
+
+	counts.resize (numparticles);
+	for (GLuint i = 0; i < numparticles; i++)
+	{
+#ifdef NEIGHBOUR_CELL_TABLE
+		const GLint *entry = &entries[entriesperparticle * cellindices[i]];
+#else
+		const GLint *entry = &entries[entriesperparticle * i];
+#endif
+		// each texel holds three ranges in its first three components
+		counts[i] = 0;
+		for (int o = 0; o < NEIGHBOUR_RANGES; o++)
+		{
+#ifdef NEIGHBOUR_WIDE_ENTRIES
+			counts[i] += GLuint (entry[(o / 3) * 4 + o % 3]);
+#else
+			counts[i] += GLuint (entry[(o / 3) * 4 + o % 3]) >> 24;
+#endif
+		}
+	}
+}
+
+void NeighbourCellFinder::FindNeighbourCells (const GLuint &particlebuffer, const GLuint &dispatchbuffer)
+{
+	// (the grid is cleared even if the GPU skips the search, since it is not used otherwise)
+	if (dispatchbuffer != 0)
+		glBindBuffer (GL_DISPATCH_INDIRECT_BUFFER, dispatchbuffer);
+
+#ifdef HASHED_GRID
+	// clear the hash table (the end buffer is only read for non-empty buckets)
+	{
+		GLint v = -1;
+		glBindBuffer (GL_SHADER_STORAGE_BUFFER, gridstartbuffer);
+		glClearBufferData (GL_SHADER_STORAGE_BUFFER, GL_R32I, GL_RED_INTEGER, GL_INT, &v);
+	}
+
+	{
+		GLuint bufs[3] = { particlebuffer, gridstartbuffer, gridendbuffer };
+		glBindBuffersBase (GL_SHADER_STORAGE_BUFFER, 0, 3, bufs);
+	}
+
+    // find grid cells
+    GPUTrace::Begin ("findcells");
+    findcells.Use ();
+    Dispatch (dispatchbuffer);
+    glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
+    GPUTrace::End ();
+#else
     // clear grid buffer
 	if (GLEXTS.ARB_clear_texture)
 	{
@@ -130,19 +281,40 @@ void NeighbourCellFinder::FindNeighbourCells (const GLuint &particlebuffer)
     // find grid cells
     glBindImageTexture (0, gridtexture.get (), 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32I);
     glBindImageTexture (1, gridendtexture.get (), 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32I);
+    GPUTrace::Begin ("findcells");
     findcells.Use ();
-    glDispatchCompute (numparticles >> 8, 1, 1);
+    Dispatch (dispatchbuffer);
     glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    GPUTrace::End ();
 
     // grid and flag textures as input
     gridtexture.Bind (GL_TEXTURE_3D);
     glActiveTexture (GL_TEXTURE1);
     gridendtexture.Bind (GL_TEXTURE_3D);
     glActiveTexture (GL_TEXTURE0);
+#endif
 
     // find neighbour cells for each particle
     glBindImageTexture (0, neighbourcelltexture.get (), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32I);
+#ifdef NEIGHBOUR_WIDE_ENTRIES
+    glBindImageTexture (2, neighbourcounttexture.get (), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32I);
+#endif
+#ifdef NEIGHBOUR_CELL_TABLE
+    glBindImageTexture (1, neighbourcellindextexture.get (), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32I);
+#endif
+    // count the clamped ranges of the packed entries
+    glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 3, overflowbuffer);
+    GPUTrace::Begin ("neighbourcells");
     neighbourcells.Use ();
-    glDispatchCompute (numparticles >> 8, 1, 1);
+    Dispatch (dispatchbuffer);
     glMemoryBarrier (GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    GPUTrace::End ();
+}
+
+void NeighbourCellFinder::Dispatch (const GLuint &dispatchbuffer)
+{
+	if (dispatchbuffer != 0)
+		glDispatchComputeIndirect (0);
+	else
+		glDispatchCompute ((numparticles + 255) >> 8, 1, 1);
 }
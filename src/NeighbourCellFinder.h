@@ -46,17 +46,105 @@ public:
 
 	/** Find neighbour cells.
 	 * Finds neighbour cells for the particles in the specified particle buffer.
+	 * If a dispatch buffer is given, the passes take their number of work groups from the
+	 * indirect dispatch command at its start, so that the GPU can skip the search. This
+	 * command has to dispatch either none or all of the (numparticles + 255) / 256 groups.
 	 * \param particlebuffer particle buffer to process
+	 * \param dispatchbuffer buffer with the dispatch command of the passes or zero
+	 *                       to dispatch them directly
 	 */
-	void FindNeighbourCells (const GLuint &particlebuffer);
+	void FindNeighbourCells (const GLuint &particlebuffer, const GLuint &dispatchbuffer = 0);
 
 	/** Get result.
-	 * Returns a buffer texture containing 9 entries for each particle each consisting
+	 * Returns a buffer texture containing an entry for each neighbour range of each
+	 * particle (9 entries for the default extent of one cell) each consisting
 	 * of the neighbour cell id and the number of entries in the cell.
+	 * If NEIGHBOUR_WIDE_ENTRIES is defined, the entries only contain the neighbour
+	 * cell id and the number of entries is stored in the count texture.
+	 * If NEIGHBOUR_CELL_TABLE is defined, the entries are only valid for the
+	 * first particle in each grid cell and have to be accessed using the
+	 * indices returned by GetCellIndices.
 	 * \returns the buffer texture containing the found neighbour cells
 	 */
 	const Texture &GetResult (void) const;
+
+	/** Get cell indices.
+	 * Returns a buffer texture containing the index of the first particle in
+	 * the grid cell of each particle, i.e. the index of the entries in the
+	 * result texture that belong to the particle. Only valid if NEIGHBOUR_CELL_TABLE
+	 * is defined.
+	 * \returns the buffer texture containing the cell indices
+	 */
+	const Texture &GetCellIndices (void) const;
+
+	/** Get counts.
+	 * Returns a buffer texture containing the number of entries of each neighbour
+	 * cell range with the same layout as the result texture. Only valid if
+	 * NEIGHBOUR_WIDE_ENTRIES is defined.
+	 * \returns the buffer texture containing the neighbour counts
+	 */
+	const Texture &GetCounts (void) const;
+
+	/** Get number of overflows.
+	 * Returns the number of neighbour ranges found so far whose number of particles did
+	 * not fit into the 8 bits of the packed entries and was clamped to 255. This is always
+	 * zero if NEIGHBOUR_WIDE_ENTRIES is defined. Reading the counter waits for the pending
+	 * searches, unless a fence signaled their completion.
+	 * \returns the number of clamped neighbour ranges
+	 */
+	GLuint GetNumOverflows (void) const;
+
+	/** Get neighbour counts.
+	 * Reads back the total number of particles in the neighbour ranges of each particle
+	 * of the last search, decoded in the same way as by the solver, e.g. to check the
+	 * search against a count on the CPU. This waits for the search to finish.
+	 * \param counts receives the number of neighbour candidates of each sorted particle
+	 */
+	void GetNeighbourCounts (std::vector<GLuint> &counts) const;
+
+	/** Get neighbour definitions.
+	 * Returns the shader definitions describing the layout of the neighbour cell
+	 * entries, which are shared by the neighbour search and the shaders using it.
+	 * \returns a string containing the shader definitions
+	 */
+	static std::string GetNeighbourDefinitions (void);
+
+	/** Neighbour extent.
+	 * Number of cells searched in each direction around the cell of a particle.
+	 * If NEIGHBOUR_SKIN is defined, this is 2 cells instead of 1, so that the
+	 * neighbour cell entries remain valid while the particles move less than
+	 * half a cell (see SPH::SetNeighbourSearchInterval).
+	 */
+#ifdef NEIGHBOUR_SKIN
+	static const int NEIGHBOUR_EXTENT = 2;
+#else
+	static const int NEIGHBOUR_EXTENT = 1;
+#endif
+
+	/** Neighbour ranges.
+	 * Number of ranges of sorted particles that contain the neighbours of a particle.
+	 * These are the (2 * NEIGHBOUR_EXTENT + 1)^2 rows of cells in x direction, which are
+	 * contiguous in the linear order, or each of the (2 * NEIGHBOUR_EXTENT + 1)^3 cells
+	 * on their own, if MORTON_ORDER is defined.
+	 */
+#ifdef MORTON_ORDER
+	static const int NEIGHBOUR_RANGES = (2 * NEIGHBOUR_EXTENT + 1) * (2 * NEIGHBOUR_EXTENT + 1) * (2 * NEIGHBOUR_EXTENT + 1);
+#else
+	static const int NEIGHBOUR_RANGES = (2 * NEIGHBOUR_EXTENT + 1) * (2 * NEIGHBOUR_EXTENT + 1);
+#endif
+
+	/** Neighbour texels.
+	 * Number of texels of the neighbour cell entries of each particle, each
+	 * containing three of the neighbour ranges.
+	 */
+	static const int NEIGHBOUR_TEXELS = (NEIGHBOUR_RANGES + 2) / 3;
 private:
+	/** Dispatch.
+	 * Dispatches the current compute shader for all particles.
+	 * \param dispatchbuffer buffer bound as indirect dispatch buffer, whose dispatch
+	 *                       command is used, or zero to dispatch directly
+	 */
+	void Dispatch (const GLuint &dispatchbuffer);
     /** Simulation step shader program.
      * Shader program for the simulation step that finds grid cells in the
      * sorted particle array.
@@ -79,13 +167,37 @@ private:
              * Buffer used to store neighbouring cells for each particle.
              */
             GLuint neighbourcellbuffer;
-
+            /** Neighbour cell index buffer.
+             * Buffer used to store the index of the neighbour cell entries of each particle
+             * (only used if NEIGHBOUR_CELL_TABLE is defined).
+             */
+            GLuint neighbourcellindexbuffer;
+            /** Neighbour count buffer.
+             * Buffer used to store the number of entries of each neighbour cell range
+             * (only used if NEIGHBOUR_WIDE_ENTRIES is defined).
+             */
+            GLuint neighbourcountbuffer;
+            /** Grid start buffer.
+             * Buffer in which the offset of the first particle in each bucket of the
+             * hashed grid is stored (only used if HASHED_GRID is defined).
+             */
+            GLuint gridstartbuffer;
+            /** Grid end buffer.
+             * Buffer in which the offset after the last particle in each bucket of the
+             * hashed grid is stored (only used if HASHED_GRID is defined).
+             */
+            GLuint gridendbuffer;
+            /** Overflow buffer.
+             * Buffer containing the number of neighbour ranges whose number of particles
+             * was clamped to fit into the packed entries.
+             */
+            GLuint overflowbuffer;
         };
         /** Buffer objects.
          * The buffer objects are stored in a union, so that it is possible
          * to create/delete all buffer objects with a single OpenGL call.
          */
-        GLuint buffers[1];
+        GLuint buffers[6];
     };
 
     /** Grid clear texture.
@@ -108,6 +220,16 @@ private:
      */
     Texture neighbourcelltexture;
 
+    /** Neighbour cell index texture.
+     * Texture through which the neighbour cell index buffer is accessed.
+     */
+    Texture neighbourcellindextexture;
+
+    /** Neighbour count texture.
+     * Texture through which the neighbour count buffer is accessed.
+     */
+    Texture neighbourcounttexture;
+
     /** Number of particles.
      * Stores the number of particles in the simulation.
      */
@@ -20,6 +20,8 @@
  * THE SOFTWARE.
  */
 #include "RadixSort.h"
+#include "NeighbourCellFinder.h"
+#include "GPUTrace.h"
 
 unsigned int count_sortbits (uint64_t v)
 {
@@ -29,26 +31,105 @@ unsigned int count_sortbits (uint64_t v)
 	return r;
 }
 
-RadixSort::RadixSort (GLuint _blocksize, GLuint _numblocks, const glm::ivec3 &gridsize)
-	: blocksize (_blocksize), numblocks (_numblocks)
+/** Integer power.
+ * Calculates an integer power.
+ * \param x base
+ * \param y exponent
+ * \returns x to the power of y
+ */
+uint32_t intpow (uint32_t x, uint32_t y)
+{
+	uint32_t r = 1;
+	while (y)
+	{
+		if (y & 1)
+			r *= x;
+		y >>= 1;
+		x *= x;
+	}
+	return r;
+}
+
+RadixSort::RadixSort (GLuint _blocksize, GLuint _numkeys, const glm::ivec3 &gridsize)
+	: digitbits (2), incremental (false), blocksize (_blocksize), numblocks ((_numkeys + _blocksize - 1) / _blocksize),
+	  numkeys (_numkeys), numtiles (0), numscanvalues (4 * numblocks), histogram_bitshift (-1), scatter_bitshift (-1)
 {
+	if (numkeys == 0)
+		throw std::logic_error ("There has to be at least one value to sort.");
+	// the largest dispatches have one work group per block
+	if (numblocks > GLEXTS.maxworkgroupcount)
+		throw std::runtime_error ("The number of keys exceeds the maximum number of compute work groups.");
+
 	std::stringstream stream;
 	stream << "const vec3 GRID_SIZE = vec3 (" << gridsize.x << ", " << gridsize.y << ", " << gridsize.z << ");" << std::endl
 		   << "const ivec3 GRID_HASHWEIGHTS = ivec3 (1, " << gridsize.x * gridsize.z <<  ", " << gridsize.x << ");" << std::endl
 		   << "#define BLOCKSIZE " << blocksize << std::endl
-		   << "#define HALFBLOCKSIZE " << (blocksize / 2) << std::endl;
+		   << "#define HALFBLOCKSIZE " << (blocksize / 2) << std::endl
+		   << "#define NUM_KEYS " << numkeys << std::endl
+		   << "#define PADDED_KEYS " << (numblocks * blocksize) << "u" << std::endl
+		   << GetGridDefinitions (numkeys, gridsize)
+		   << GetKeyDefinitions ();
 
 	if (blocksize & 1)
 		throw std::logic_error ("The block size for sorting has to be even.");
+#ifdef COMPACT_PARTICLES
+	if (numkeys > MAX_COMPACT_KEYS)
+		throw std::logic_error ("Compact particle keys support at most 2^24 particles.");
+	if (gridsize.x > MAX_COMPACT_GRID_SIZE || gridsize.y > MAX_COMPACT_GRID_SIZE || gridsize.z > MAX_COMPACT_GRID_SIZE)
+		throw std::logic_error ("Compact particle keys support at most 1024 grid cells in each direction.");
+#endif
 
+#ifdef HASHED_GRID
+	numbits = count_sortbits (GetHashTableSize (numkeys, gridsize) - 1);
+#elif defined (MORTON_ORDER)
+	// the Morton code grows with each coordinate, so the last cell has the largest code
+	if (gridsize.x > MAX_MORTON_GRID_SIZE || gridsize.y > MAX_MORTON_GRID_SIZE || gridsize.z > MAX_MORTON_GRID_SIZE)
+		throw std::logic_error ("The Morton order supports at most 1024 grid cells in each direction.");
+	numbits = count_sortbits (GetCellHash (gridsize - glm::ivec3 (1), numkeys, gridsize));
+#else
 	numbits = count_sortbits (uint64_t (gridsize.x) * uint64_t (gridsize.y) * uint64_t (gridsize.z) - 1);
+#endif
+
+	// sort digits of up to 8 bits with subgroup ballots, if possible
+	if (GLEXTS.KHR_shader_subgroup_ballot && GLEXTS.subgroupsize >= MIN_SUBGROUP_SIZE
+			&& GLEXTS.subgroupsize <= MAX_SUBGROUP_SIZE)
+	{
+		// distribute the bits evenly among the fewest passes, e.g. 3 passes of 7 bits for 20 bits
+		unsigned int numpasses = (numbits + 7) / 8;
+		digitbits = (numbits + numpasses - 1) / numpasses;
+		numtiles = (numblocks * blocksize + DIGIT_TILESIZE - 1) / DIGIT_TILESIZE;
+		numscanvalues = numtiles << digitbits;
+
+		std::stringstream digitstream;
+		digitstream << "#extension GL_KHR_shader_subgroup_basic : require" << std::endl
+					<< "#extension GL_KHR_shader_subgroup_ballot : require" << std::endl
+					<< stream.str ()
+					<< "#define DIGIT_BITS " << digitbits << std::endl
+					<< "#define RADIX " << (1u << digitbits) << "u" << std::endl
+					<< "#define DIGIT_GROUPSIZE " << DIGIT_GROUPSIZE << "u" << std::endl
+					<< "#define DIGIT_TILESIZE " << DIGIT_TILESIZE << "u" << std::endl
+					<< "#define MAX_SUBGROUPS " << (DIGIT_GROUPSIZE / MIN_SUBGROUP_SIZE) << "u" << std::endl
+					<< "#define NUM_TILES " << numtiles << "u" << std::endl;
+		histogram.CompileShader (GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+				"shaders/grid/hash.glsl", "shaders/radixsort/histogram.glsl"}, digitstream.str ());
+		histogram.Link ();
+		scatter.CompileShader (GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+				"shaders/grid/hash.glsl", "shaders/radixsort/scatter.glsl"}, digitstream.str ());
+		scatter.Link ();
+		histogram_bitshift = histogram.GetUniformLocation ("bitshift");
+		scatter_bitshift = scatter.GetUniformLocation ("bitshift");
+	}
 
 	// load shaders
-	counting.CompileShader (GL_COMPUTE_SHADER, "shaders/radixsort/counting.glsl", stream.str ());
+	counting.CompileShader (GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+			"shaders/grid/hash.glsl", "shaders/radixsort/counting.glsl"},
+			stream.str ());
 	counting.Link ();
 	blockscan.CompileShader (GL_COMPUTE_SHADER, "shaders/radixsort/blockscan.glsl", stream.str ());
 	blockscan.Link ();
-	globalsort.CompileShader (GL_COMPUTE_SHADER, "shaders/radixsort/globalsort.glsl", stream.str ());
+	globalsort.CompileShader (GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+			"shaders/grid/hash.glsl", "shaders/radixsort/globalsort.glsl"},
+			stream.str ());
 	globalsort.Link ();
 	addblocksum.CompileShader (GL_COMPUTE_SHADER, "shaders/radixsort/addblocksum.glsl", stream.str ());
 	addblocksum.Link ();
@@ -58,14 +139,14 @@ RadixSort::RadixSort (GLuint _blocksize, GLuint _numblocks, const glm::ivec3 &gr
 
 	// allocate input buffer
 	glBindBuffer (GL_SHADER_STORAGE_BUFFER, buffer);
-	glBufferData (GL_SHADER_STORAGE_BUFFER, sizeof (glm::vec4) * blocksize * numblocks, NULL, GL_DYNAMIC_COPY);
+	glBufferData (GL_SHADER_STORAGE_BUFFER, KEY_SIZE * blocksize * numblocks, NULL, GL_DYNAMIC_COPY);
 
 	// allocate prefix sum buffer
 	glBindBuffer (GL_SHADER_STORAGE_BUFFER, prefixsums);
 	glBufferData (GL_SHADER_STORAGE_BUFFER, sizeof (uint32_t) * blocksize * numblocks, NULL, GL_DYNAMIC_COPY);
 
 	// create block sum buffers
-	uint32_t numblocksums = 4 * numblocks;
+	uint32_t numblocksums = numscanvalues;
 	{
 		int n = ceil (log (((numblocksums + blocksize - 1) / blocksize) * blocksize) / log (blocksize));
 		n++;
@@ -86,7 +167,7 @@ RadixSort::RadixSort (GLuint _blocksize, GLuint _numblocks, const glm::ivec3 &gr
 
 	// allocate output buffer
 	glBindBuffer (GL_SHADER_STORAGE_BUFFER, result);
-	glBufferData (GL_SHADER_STORAGE_BUFFER, sizeof (glm::vec4) * blocksize * numblocks, NULL, GL_DYNAMIC_COPY);
+	glBufferData (GL_SHADER_STORAGE_BUFFER, KEY_SIZE * blocksize * numblocks, NULL, GL_DYNAMIC_COPY);
 
 	// pass block sum offsets to the shader programs
 	glm::uvec4 blocksumoffsets (0, numblocks, numblocks * 2, numblocks * 3);
@@ -106,6 +187,60 @@ RadixSort::RadixSort (GLuint _blocksize, GLuint _numblocks, const glm::ivec3 &gr
 		glBindBuffer (GL_SHADER_STORAGE_BUFFER, blocksum);
 		glClearBufferData (GL_SHADER_STORAGE_BUFFER, GL_RGBA32UI, GL_RGBA_INTEGER, GL_UNSIGNED_INT, NULL);
 	}
+
+	// determine the number of work groups of each dispatch
+	dispatchgroups.resize (DISPATCH_BLOCKSCAN + 2 * blocksums.size () - 3);
+	dispatchgroups[DISPATCH_LOCALSORT] = numblocks;
+	dispatchgroups[DISPATCH_LOCALSORT_SHIFTED] = numblocks - 1;
+	dispatchgroups[DISPATCH_CHECKORDER] = numblocks;
+	dispatchgroups[DISPATCH_CHECKINPUT] = numblocks;
+	dispatchgroups[DISPATCH_COPY] = numblocks;
+	dispatchgroups[DISPATCH_COUNTING] = (numtiles > 0) ? numtiles : numblocks;
+	dispatchgroups[DISPATCH_GLOBALSORT] = dispatchgroups[DISPATCH_COUNTING];
+	numblocksums = numscanvalues;
+	for (int i = 0; i < blocksums.size () - 1; i++)
+	{
+		numblocksums = (numblocksums + blocksize - 1) / blocksize;
+		dispatchgroups[DISPATCH_BLOCKSCAN + i] = numblocksums;
+	}
+	for (int i = blocksums.size () - 3; i >= 0; i--)
+	{
+		uint32_t divisor = intpow (blocksize, i + 1);
+		dispatchgroups[DISPATCH_BLOCKSCAN + blocksums.size () - 1 + i] = (numscanvalues + divisor - 1) / divisor;
+	}
+
+	// load the shaders of the incremental mode
+	stream << "#define LOCAL_SORT_LIMIT " << (numkeys / LOCAL_SORT_RATIO) << "u" << std::endl
+		   << "#define NUM_SORT_DISPATCHES " << dispatchgroups.size () << std::endl
+		   << "#define FIRST_FULL_SORT_DISPATCH " << int (DISPATCH_COUNTING) << std::endl
+		   << "#define COPY_SORT_DISPATCH " << int (DISPATCH_COPY) << std::endl
+		   << "#define CHECKINPUT_SORT_DISPATCH " << int (DISPATCH_CHECKINPUT) << std::endl
+		   << "const uint SORT_DISPATCH_GROUPS[NUM_SORT_DISPATCHES] = uint[NUM_SORT_DISPATCHES] (";
+	for (size_t i = 0; i < dispatchgroups.size (); i++)
+		stream << (i > 0 ? ", " : "") << dispatchgroups[i] << "u";
+	stream << ");" << std::endl;
+	checkorder.CompileShader (GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+			"shaders/grid/hash.glsl", "shaders/radixsort/checkorder.glsl"}, stream.str ());
+	checkorder.Link ();
+	localsort.CompileShader (GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+			"shaders/grid/hash.glsl", "shaders/radixsort/localsort.glsl"}, stream.str ());
+	localsort.Link ();
+	sortmode.CompileShader (GL_COMPUTE_SHADER, "shaders/radixsort/sortmode.glsl", stream.str ());
+	sortmode.Link ();
+	copy.CompileShader (GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+			"shaders/radixsort/copy.glsl"}, stream.str ());
+	copy.Link ();
+	checkorder_target = checkorder.GetUniformLocation ("target");
+	localsort_tileoffset = localsort.GetUniformLocation ("tileoffset");
+	sortmode_stage = sortmode.GetUniformLocation ("stage");
+	sortmode_incremental = sortmode.GetUniformLocation ("incremental");
+
+	// create the sort state buffer with zero counters
+	glGenBuffers (1, &statebuffer);
+	glBindBuffer (GL_SHADER_STORAGE_BUFFER, statebuffer);
+	glBufferData (GL_SHADER_STORAGE_BUFFER, SORT_STATE_HEADER_SIZE + sizeof (glm::uvec4) * dispatchgroups.size (),
+			NULL, GL_DYNAMIC_COPY);
+	glClearBufferData (GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
 }
 
 RadixSort::~RadixSort (void)
@@ -113,6 +248,122 @@ RadixSort::~RadixSort (void)
 	// cleanup
 	glDeleteBuffers (blocksums.size (), &blocksums[0]);
 	glDeleteBuffers (3, buffers);
+	glDeleteBuffers (1, &statebuffer);
+}
+
+uint32_t RadixSort::GetHashTableSize (const uint32_t &numparticles, const glm::ivec3 &gridsize)
+{
+	uint64_t numcells = uint64_t (gridsize.x) * uint64_t (gridsize.y) * uint64_t (gridsize.z);
+	// the neighbour rows of a cell span NEIGHBOUR_EXTENT layers and rows in each direction
+	const uint64_t extent = NeighbourCellFinder::NEIGHBOUR_EXTENT;
+	uint64_t minsize = 2 * extent * (uint64_t (gridsize.x) * uint64_t (gridsize.z) + uint64_t (gridsize.x) + 1) + 1;
+	if (minsize < numparticles)
+		minsize = numparticles;
+	uint64_t size = gridsize.x;
+	while (size < minsize && size < numcells)
+		size <<= 1;
+	if (size > numcells)
+		size = numcells;
+	if (size > (uint64_t (1) << 30))
+		throw std::logic_error ("The hash table of the particle grid is too large.");
+	return uint32_t (size);
+}
+
+uint32_t RadixSort::GetHashIndexOffset (const uint32_t &numparticles, const glm::ivec3 &gridsize)
+{
+	uint64_t tablesize = GetHashTableSize (numparticles, gridsize);
+	// offset that makes the linear indices of all cells accessed by the neighbour search positive
+	uint64_t minindex = NeighbourCellFinder::NEIGHBOUR_EXTENT
+			* (uint64_t (gridsize.x) * uint64_t (gridsize.z) + uint64_t (gridsize.x) + 1);
+	uint64_t offset = ((minindex + tablesize - 1) / tablesize) * tablesize;
+	if (offset + uint64_t (gridsize.x) * uint64_t (gridsize.y) * uint64_t (gridsize.z) + minindex > (uint64_t (1) << 31) - 1)
+		throw std::logic_error ("The particle grid is too large for the hashed grid.");
+	return uint32_t (offset);
+}
+
+std::string RadixSort::GetGridDefinitions (const uint32_t &numparticles, const glm::ivec3 &gridsize)
+{
+	std::stringstream stream;
+#ifdef HASHED_GRID
+	stream << "#define HASHED_GRID" << std::endl
+		   << "#define HASH_TABLE_SIZE " << GetHashTableSize (numparticles, gridsize) << std::endl
+		   << "#define HASH_INDEX_OFFSET " << GetHashIndexOffset (numparticles, gridsize) << std::endl;
+#endif
+#ifdef MORTON_ORDER
+	stream << "#define MORTON_ORDER" << std::endl;
+#endif
+	return stream.str ();
+}
+
+std::string RadixSort::GetKeyDefinitions (void)
+{
+	std::stringstream stream;
+#ifdef COMPACT_PARTICLES
+	stream << "#define COMPACT_PARTICLES" << std::endl
+		   << "#define KEY_FRACTION_BITS " << KEY_FRACTION_BITS << std::endl;
+#endif
+	return stream.str ();
+}
+
+void RadixSort::PackKey (const glm::vec3 &position, const uint32_t &id, const glm::vec3 &gridorigin, uint32_t *key)
+{
+	// same as MakeKey in shaders/grid/key.glsl
+#ifdef COMPACT_PARTICLES
+	const float scale = float (1u << KEY_FRACTION_BITS);
+	for (int i = 0; i < 3; i++)
+	{
+		float coord = std::min (std::max ((position[i] - gridorigin[i]) * scale + 0.5f, 0.0f), float (0xFFFFFFu));
+		key[i] = uint32_t (coord) | (((id >> (8 * i)) & 0xFFu) << 24);
+	}
+#else
+	memcpy (key, &position[0], 3 * sizeof (float));
+	key[3] = id;
+#endif
+}
+
+glm::vec3 RadixSort::GetKeyPosition (const uint32_t *key, const glm::vec3 &gridorigin)
+{
+#ifdef COMPACT_PARTICLES
+	const float scale = 1.0f / float (1u << KEY_FRACTION_BITS);
+	return glm::vec3 (float (key[0] & 0xFFFFFFu), float (key[1] & 0xFFFFFFu), float (key[2] & 0xFFFFFFu)) * scale
+			+ gridorigin;
+#else
+	glm::vec3 position;
+	memcpy (&position[0], key, 3 * sizeof (float));
+	return position;
+#endif
+}
+
+uint32_t RadixSort::GetKeyId (const uint32_t *key)
+{
+#ifdef COMPACT_PARTICLES
+	return (key[0] >> 24) | ((key[1] >> 24) << 8) | ((key[2] >> 24) << 16);
+#else
+	return key[3];
+#endif
+}
+
+uint32_t RadixSort::GetCellHash (const glm::ivec3 &cell, const uint32_t &numparticles, const glm::ivec3 &gridsize)
+{
+	// same as GetCellHash in shaders/grid/hash.glsl
+#ifdef MORTON_ORDER
+	uint32_t code = 0;
+	for (int bit = 0; bit < 10; bit++)
+	{
+		code |= ((uint32_t (cell.x) >> bit) & 1) << (3 * bit);
+		code |= ((uint32_t (cell.y) >> bit) & 1) << (3 * bit + 1);
+		code |= ((uint32_t (cell.z) >> bit) & 1) << (3 * bit + 2);
+	}
+	return code;
+#else
+	int64_t index = int64_t (cell.x) + int64_t (cell.y) * int64_t (gridsize.x) * int64_t (gridsize.z)
+			+ int64_t (cell.z) * int64_t (gridsize.x);
+#ifdef HASHED_GRID
+	return uint32_t ((index + GetHashIndexOffset (numparticles, gridsize)) % GetHashTableSize (numparticles, gridsize));
+#else
+	return uint32_t (index);
+#endif
+#endif
 }
 
 GLuint RadixSort::GetBuffer (void) const
@@ -121,37 +372,119 @@ GLuint RadixSort::GetBuffer (void) const
 	return buffer;
 }
 
-void RadixSort::Run (void)
+void RadixSort::Run (const GLuint &conditionbuffer)
 {
+	// in incremental mode the GPU skips all passes, if the keys are sorted or the local sort
+	// was sufficient, and in a conditional run, if the condition is not met
+	const unsigned int numpasses = GetNumPasses ();
+	const bool conditional = (conditionbuffer != 0);
+	const bool indirect = incremental || conditional;
+	if (conditional)
+	{
+		GLuint bufs[2] = { statebuffer, conditionbuffer };
+		glBindBuffersBase (GL_SHADER_STORAGE_BUFFER, 1, 2, bufs);
+		glProgramUniform1i (sortmode.get (), sortmode_stage, 0);
+		glProgramUniform1i (sortmode.get (), sortmode_incremental, incremental ? 1 : 0);
+		sortmode.Use ();
+		glDispatchCompute (1, 1, 1);
+		glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+	}
+	if (incremental)
+		CheckOrder (conditional);
+
 	// sort bits from least to most significant
-	for (int i = 0; i < (numbits + 1) >> 1; i++)
+	for (unsigned int i = 0; i < numpasses; i++)
 	{
-		SortBits (2 * i);
+		GPUTrace::Begin ("radix pass", i);
+		if (numtiles > 0)
+			SortDigit (i * digitbits, indirect);
+		else
+			SortBits (2 * i, indirect);
+		GPUTrace::End ();
 		// swap the buffer objects
 		std::swap (result, buffer);
 	}
+
+	// after an odd number of skipped passes the keys are still in the other buffer
+	if (indirect && (numpasses & 1))
+	{
+		GLuint bufs[2] = { result, buffer };
+		glBindBuffersBase (GL_SHADER_STORAGE_BUFFER, 0, 2, bufs);
+		GPUTrace::Begin ("copy");
+		copy.Use ();
+		Dispatch (DISPATCH_COPY, true);
+		glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
+		GPUTrace::End ();
+	}
 }
 
-/** Integer power.
- * Calculates an integer power.
- * \param x base
- * \param y exponent
- * \returns x to the power of y
- */
-uint32_t intpow (uint32_t x, uint32_t y)
+void RadixSort::CheckOrder (const bool &conditional)
 {
-	uint32_t r = 1;
-	while (y)
+	// reset the counters of keys in the wrong order and the mode of the last run, unless
+	// the mode was just set by the condition
+	const GLuint zero[3] = { 0, 0, 0 };
+	glBindBuffer (GL_SHADER_STORAGE_BUFFER, statebuffer);
+	glBufferSubData (GL_SHADER_STORAGE_BUFFER, 0, conditional ? 2 * sizeof (GLuint) : sizeof (zero), zero);
 	{
-		if (y & 1)
-			r *= x;
-		y >>= 1;
-		x *= x;
+		GLuint bufs[2] = { buffer, statebuffer };
+		glBindBuffersBase (GL_SHADER_STORAGE_BUFFER, 0, 2, bufs);
 	}
-	return r;
+
+	GPUTrace::Begin ("checkorder");
+	glProgramUniform1i (checkorder.get (), checkorder_target, 0);
+	checkorder.Use ();
+	Dispatch (DISPATCH_CHECKINPUT, conditional);
+	glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
+	GPUTrace::End ();
+
+	glProgramUniform1i (sortmode.get (), sortmode_stage, 1);
+	sortmode.Use ();
+	glDispatchCompute (1, 1, 1);
+	glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+	// sort overlapping tiles in place, if only a few keys are in the wrong order
+	GPUTrace::Begin ("localsort");
+	localsort.Use ();
+	glProgramUniform1ui (localsort.get (), localsort_tileoffset, 0);
+	Dispatch (DISPATCH_LOCALSORT, true);
+	glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
+	glProgramUniform1ui (localsort.get (), localsort_tileoffset, blocksize / 2);
+	Dispatch (DISPATCH_LOCALSORT_SHIFTED, true);
+	glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
+	GPUTrace::End ();
+
+	// check whether the local sort was sufficient
+	glProgramUniform1i (checkorder.get (), checkorder_target, 1);
+	checkorder.Use ();
+	Dispatch (DISPATCH_CHECKORDER, true);
+	glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glProgramUniform1i (sortmode.get (), sortmode_stage, 2);
+	sortmode.Use ();
+	glDispatchCompute (1, 1, 1);
+	glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+void RadixSort::GetSortModeCounts (GLuint counts[4]) const
+{
+	glBindBuffer (GL_SHADER_STORAGE_BUFFER, statebuffer);
+	glGetBufferSubData (GL_SHADER_STORAGE_BUFFER, 4 * sizeof (GLuint), 4 * sizeof (GLuint), counts);
 }
 
-void RadixSort::SortBits (int bits)
+void RadixSort::Dispatch (const unsigned int &index, const bool &indirect)
+{
+	if (indirect)
+	{
+		glBindBuffer (GL_DISPATCH_INDIRECT_BUFFER, statebuffer);
+		glDispatchComputeIndirect (SORT_STATE_HEADER_SIZE + sizeof (glm::uvec4) * index);
+	}
+	else
+	{
+		glDispatchCompute (dispatchgroups[index], 1, 1);
+	}
+}
+
+void RadixSort::SortBits (int bits, const bool &indirect)
 {
 	// pass current bit shift to the shader programs
 	glProgramUniform1i (counting.get (), counting_bitshift, bits);
@@ -164,37 +497,79 @@ void RadixSort::SortBits (int bits)
 	}
 
 	// counting
+	GPUTrace::Begin ("counting");
 	counting.Use ();
-	glDispatchCompute (numblocks, 1, 1);
+	Dispatch (DISPATCH_COUNTING, indirect);
+	glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
+	GPUTrace::End ();
+
+	ScanBlockSums (indirect);
+
+	// map values to their global position in the output buffer
+	{
+		GLuint bufs[2] = { buffer, prefixsums };
+		glBindBuffersBase (GL_SHADER_STORAGE_BUFFER, 0, 2, bufs);
+	}
+	GPUTrace::Begin ("globalsort");
+	globalsort.Use ();
+	Dispatch (DISPATCH_GLOBALSORT, indirect);
+	glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
+	GPUTrace::End ();
+}
+
+void RadixSort::SortDigit (int bits, const bool &indirect)
+{
+	// pass current bit shift to the shader programs
+	glProgramUniform1i (histogram.get (), histogram_bitshift, bits);
+	glProgramUniform1i (scatter.get (), scatter_bitshift, bits);
+
+	// count the digits of each tile
+	{
+		GLuint bufs[2] = { buffer, blocksums.front () };
+		glBindBuffersBase (GL_SHADER_STORAGE_BUFFER, 0, 2, bufs);
+	}
+	GPUTrace::Begin ("histogram");
+	histogram.Use ();
+	Dispatch (DISPATCH_COUNTING, indirect);
 	glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
+	GPUTrace::End ();
+
+	ScanBlockSums (indirect);
 
+	// map values to their global position in the output buffer
+	{
+		GLuint bufs[4] = { buffer, blocksums.front (), 0, result };
+		glBindBuffersBase (GL_SHADER_STORAGE_BUFFER, 0, 4, bufs);
+	}
+	GPUTrace::Begin ("scatter");
+	scatter.Use ();
+	Dispatch (DISPATCH_GLOBALSORT, indirect);
+	glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
+	GPUTrace::End ();
+}
+
+void RadixSort::ScanBlockSums (const bool &indirect)
+{
 	// create block sums level by level
+	// (the number of work groups of each level is precomputed in the constructor)
 	blockscan.Use ();
-	uint32_t numblocksums = (4 * numblocks) / blocksize;
 	for (int i = 0; i < blocksums.size () - 1; i++)
 	{
+		GPUTrace::Begin ("blockscan", i);
 		glBindBuffersBase (GL_SHADER_STORAGE_BUFFER, 0, 2, &blocksums[i]);
-		glDispatchCompute (numblocksums > 0 ? numblocksums : 1, 1, 1);
-		numblocksums /= blocksize;
+		Dispatch (DISPATCH_BLOCKSCAN + i, indirect);
 		glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
+		GPUTrace::End ();
 	}
 
 	// add block sums level by level (in reversed order)
 	addblocksum.Use ();
 	for (int i = blocksums.size () - 3; i >= 0; i--)
 	{
-		uint32_t numblocksums = (4 * numblocks) / intpow (blocksize, i + 1);
+		GPUTrace::Begin ("addblocksum", i);
 		glBindBuffersBase (GL_SHADER_STORAGE_BUFFER, 0, 2, &blocksums[i]);
-		glDispatchCompute (numblocksums > 0 ? numblocksums : 1, 1, 1);
+		Dispatch (DISPATCH_BLOCKSCAN + blocksums.size () - 1 + i, indirect);
 		glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
+		GPUTrace::End ();
 	}
-
-	// map values to their global position in the output buffer
-	{
-		GLuint bufs[2] = { buffer, prefixsums };
-		glBindBuffersBase (GL_SHADER_STORAGE_BUFFER, 0, 2, bufs);
-	}
-	globalsort.Use ();
-	glDispatchCompute (numblocks, 1, 1);
-	glMemoryBarrier (GL_SHADER_STORAGE_BARRIER_BIT);
 }
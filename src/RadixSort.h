@@ -29,16 +29,25 @@
  * This class is responsible for sorting the particle buffer
  * with respect to their grid id that is computed from their
  * position.
+ * If subgroup ballots are available (see GLEXTS), each pass sorts a digit of up to
+ * 8 bits: a histogram of the digits of each tile of keys is scanned and the keys are
+ * scattered to their global positions, ranked within each subgroup by ballots.
+ * Otherwise each pass sorts 2 bits using a prefix sum over the whole buffer.
+ * The incremental mode exploits that the keys are usually still sorted from the
+ * previous run (see SetIncremental).
  */
 class RadixSort
 {
 public:
 	/** Constructor.
+	 * The number of keys does not have to be a multiple of the block size.
+	 * The internal buffers are padded to a whole number of blocks and the
+	 * padding is always sorted to the end of the buffer.
 	 * \param blocksize Block size used for sortig the particles.
-	 * \param numblocks Number of blocks of values to sort.
+	 * \param numkeys Number of values to sort.
 	 * \param gridsize size of the particle grid
 	 */
-	 RadixSort (GLuint blocksize, GLuint numblocks, const glm::ivec3 &gridsize);
+	 RadixSort (GLuint blocksize, GLuint numkeys, const glm::ivec3 &gridsize);
 	 /** Destuctor.
 	  */
 	 ~RadixSort (void);
@@ -53,20 +62,271 @@ public:
 	 GLuint GetBuffer (void) const;
 	 /** Sort the buffer.
 	  * Sorts the buffer.
+	  * If a condition buffer is given, the GPU skips the whole run, if the number of work
+	  * groups of the indirect dispatch command at the start of this buffer is zero. All
+	  * passes are then dispatched indirectly and the keys keep their order.
+	  * \param conditionbuffer buffer with the dispatch command that decides whether the
+	  *                        keys are sorted or zero to sort them unconditionally
 	  */
-	 void Run (void);
+	 void Run (const GLuint &conditionbuffer = 0);
+
+	 /** Get hash table size.
+	  * Returns the number of buckets of the hashed grid, i.e. the smallest multiple of the
+	  * grid size in x direction by a power of two that is at least the number of particles
+	  * and large enough that the neighbour rows of a cell map to distinct buckets.
+	  * The result is capped at the number of grid cells.
+	  * \param numparticles number of particles
+	  * \param gridsize size of the particle grid
+	  * \returns the number of buckets
+	  */
+	 static uint32_t GetHashTableSize (const uint32_t &numparticles, const glm::ivec3 &gridsize);
+
+	 /** Get grid definitions.
+	  * Returns the shader definitions that select the grid hash function in
+	  * shaders/grid/hash.glsl. If neither HASHED_GRID nor MORTON_ORDER is defined,
+	  * this is empty.
+	  * \param numparticles number of particles
+	  * \param gridsize size of the particle grid
+	  * \returns the shader definitions
+	  */
+	 static std::string GetGridDefinitions (const uint32_t &numparticles, const glm::ivec3 &gridsize);
+
+	 /** Get cell hash.
+	  * Computes the sort key of a grid cell on the CPU in the same way as shaders/grid/hash.glsl.
+	  * \param cell the grid cell
+	  * \param numparticles number of particles
+	  * \param gridsize size of the particle grid
+	  * \returns the sort key of the cell
+	  */
+	 static uint32_t GetCellHash (const glm::ivec3 &cell, const uint32_t &numparticles, const glm::ivec3 &gridsize);
+
+	 /** Key words.
+	  * Number of 32-bit words of each sort key (see shaders/grid/key.glsl).
+	  */
+#ifdef COMPACT_PARTICLES
+	 static const unsigned int KEY_WORDS = 3;
+#else
+	 static const unsigned int KEY_WORDS = 4;
+#endif
+
+	 /** Key size.
+	  * Size of each sort key in bytes.
+	  */
+	 static const GLsizeiptr KEY_SIZE = KEY_WORDS * sizeof (GLuint);
+
+	 /** Key fraction bits.
+	  * Number of bits of the fixed point coordinates of compact keys below the grid cell.
+	  */
+	 static const unsigned int KEY_FRACTION_BITS = 14;
+
+	 /** Get key definitions.
+	  * Returns the shader definitions that select the layout of the sort keys in
+	  * shaders/grid/key.glsl.
+	  * \returns the shader definitions
+	  */
+	 static std::string GetKeyDefinitions (void);
+
+	 /** Pack key.
+	  * Stores the position and the id of a particle as sort key on the CPU
+	  * in the same way as MakeKey in shaders/grid/key.glsl.
+	  * \param position position of the particle
+	  * \param id id of the particle
+	  * \param gridorigin origin of the particle grid
+	  * \param key receives the KEY_WORDS words of the key
+	  */
+	 static void PackKey (const glm::vec3 &position, const uint32_t &id, const glm::vec3 &gridorigin, uint32_t *key);
+
+	 /** Get key position.
+	  * Returns the position stored in a sort key.
+	  * \param key the KEY_WORDS words of the key
+	  * \param gridorigin origin of the particle grid
+	  * \returns the position of the particle
+	  */
+	 static glm::vec3 GetKeyPosition (const uint32_t *key, const glm::vec3 &gridorigin);
+
+	 /** Get key id.
+	  * Returns the particle id stored in a sort key.
+	  * \param key the KEY_WORDS words of the key
+	  * \returns the id of the particle
+	  */
+	 static uint32_t GetKeyId (const uint32_t *key);
+
+	 /** Check incremental mode.
+	  * Checks whether the incremental mode is enabled.
+	  * \returns True, if the incremental mode is enabled, false, if not.
+	  */
+	 const bool &IsIncremental (void) const {
+		 return incremental;
+	 }
+	 /** Enable/disable incremental mode.
+	  * In incremental mode each run first counts the neighbouring keys in the wrong order
+	  * on the GPU. If there are none, all passes are skipped (after an odd number of passes
+	  * a copy moves the keys back into the right buffer). If there are only a few, the keys
+	  * are sorted locally in overlapping tiles of the block size and checked again. Only if
+	  * that is not sufficient all passes are run. The CPU never waits for the decision, since
+	  * the skipped dispatches are indirect.
+	  * The local sort requires the block size to be a power of two.
+	  * \param flag Flag indicating whether to use the incremental mode.
+	  */
+	 void SetIncremental (const bool &flag) {
+		 if (flag && (blocksize & (blocksize - 1)))
+			 throw std::logic_error ("The block size for incremental sorting has to be a power of two.");
+		 incremental = flag;
+	 }
+
+	 /** Get sort mode counts.
+	  * Returns how many incremental runs skipped the sort, used only the local sort,
+	  * needed a full sort after the local sort and needed a full sort right away.
+	  * Waits for all pending runs to finish.
+	  * \param counts array that receives the four counts
+	  */
+	 void GetSortModeCounts (GLuint counts[4]) const;
+
+	 /** Get digit bits.
+	  * Returns the number of bits sorted in each pass.
+	  * \returns the number of bits per pass
+	  */
+	 unsigned int GetDigitBits (void) const {
+		 return digitbits;
+	 }
+
+	 /** Get number of passes.
+	  * Returns the number of sorting passes of each run.
+	  * \returns the number of passes
+	  */
+	 unsigned int GetNumPasses (void) const {
+		 return (numbits + digitbits - 1) / digitbits;
+	 }
 private:
+	 /** Get hash index offset.
+	  * Returns the multiple of the hash table size that is added to the linear cell index
+	  * before hashing, so that the indices of all cells accessed by the neighbour search are positive.
+	  * \param numparticles number of particles
+	  * \param gridsize size of the particle grid
+	  * \returns the offset
+	  */
+	 static uint32_t GetHashIndexOffset (const uint32_t &numparticles, const glm::ivec3 &gridsize);
+
 	 /** Sort bits.
 	  * Sorts the internal buffer with respect to two bits.
 	  * \param bits specifies less significant bit with respect to which to sort
 	  */
-	 void SortBits (int bits);
+	 void SortBits (int bits, const bool &indirect);
+
+	 /** Sort digit.
+	  * Sorts the internal buffer with respect to a digit of digitbits bits.
+	  * \param bits specifies less significant bit of the digit
+	  * \param indirect flag indicating whether the GPU decides whether to run the pass
+	  */
+	 void SortDigit (int bits, const bool &indirect);
+
+	 /** Scan block sums.
+	  * Computes the exclusive prefix sum of the first block sum buffer level by level.
+	  * \param indirect flag indicating whether the GPU decides whether to run the scan
+	  */
+	 void ScanBlockSums (const bool &indirect);
+
+	 /** Check order.
+	  * Counts the neighbouring keys in the wrong order, sorts the keys locally if there
+	  * are only a few and decides on the GPU which of the sorting passes are needed.
+	  * \param conditional flag indicating whether the GPU may already have skipped the run
+	  */
+	 void CheckOrder (const bool &conditional);
+
+	 /** Dispatch.
+	  * Dispatches the current compute shader.
+	  * \param index index of the dispatch in dispatchgroups
+	  * \param indirect flag indicating whether to take the number of work groups from the
+	  *                 sort state buffer, where it is zero for skipped dispatches
+	  */
+	 void Dispatch (const unsigned int &index, const bool &indirect);
+
+	 /** Dispatches.
+	  * Indices of the dispatches with a distinct number of work groups.
+	  */
+	 enum {
+		 /** Local sort of the aligned tiles. */
+		 DISPATCH_LOCALSORT = 0,
+		 /** Local sort of the tiles shifted by half the block size. */
+		 DISPATCH_LOCALSORT_SHIFTED,
+		 /** Order check after the local sort. */
+		 DISPATCH_CHECKORDER,
+		 /** Order check of the input of a conditional run. */
+		 DISPATCH_CHECKINPUT,
+		 /** Copy of the keys that were not sorted by an odd number of skipped passes. */
+		 DISPATCH_COPY,
+		 /** Counting or histogram (the first dispatch of the full sort). */
+		 DISPATCH_COUNTING,
+		 /** Global sort or scatter. */
+		 DISPATCH_GLOBALSORT,
+		 /** First block scan level, followed by the other block scan levels and the block sum levels. */
+		 DISPATCH_BLOCKSCAN
+	 };
+
+	 /** Sort state header size.
+	  * Size of the counters in the sort state buffer that precede the indirect
+	  * dispatch arguments (see shaders/radixsort/sortmode.glsl).
+	  */
+	 static const GLintptr SORT_STATE_HEADER_SIZE = 8 * sizeof (GLuint);
+
+	 /** Maximum Morton grid size.
+	  * Maximum number of grid cells in each direction for MORTON_ORDER, whose
+	  * cell hash interleaves 10 bits of each coordinate.
+	  */
+	 static const int MAX_MORTON_GRID_SIZE = 1024;
+
+	 /** Maximum compact grid size.
+	  * Maximum number of grid cells in each direction for COMPACT_PARTICLES, whose
+	  * keys store each coordinate in 24-bit fixed point.
+	  */
+	 static const int MAX_COMPACT_GRID_SIZE = 1 << (24 - KEY_FRACTION_BITS);
+
+	 /** Maximum compact key count.
+	  * Maximum number of keys for COMPACT_PARTICLES, whose keys store 24 bits of the particle id.
+	  */
+	 static const uint32_t MAX_COMPACT_KEYS = 1u << 24;
+
+	 /** Local sort ratio.
+	  * The local sort is only tried if at most one in this many neighbouring keys are in the wrong order.
+	  */
+	 static const uint32_t LOCAL_SORT_RATIO = 64;
+
+	 /** Digit group size.
+	  * Number of invocations of the histogram and scatter shaders.
+	  */
+	 static const uint32_t DIGIT_GROUPSIZE = 256;
+
+	 /** Digit tile size.
+	  * Number of keys handled by each work group of the histogram and scatter shaders.
+	  */
+	 static const uint32_t DIGIT_TILESIZE = 8 * DIGIT_GROUPSIZE;
+
+	 /** Minimum subgroup size.
+	  * Smallest subgroup size that is supported by the scatter shader, which limits the number
+	  * of subgroups per work group and thereby the shared memory needed for their digit counts.
+	  */
+	 static const uint32_t MIN_SUBGROUP_SIZE = 16;
+
+	 /** Maximum subgroup size.
+	  * Largest subgroup size that fits into a ballot.
+	  */
+	 static const uint32_t MAX_SUBGROUP_SIZE = 128;
 
 	 /** Number of relevant bits.
 	  * Number of relevant bits that have to be sorted.
 	  */
 	 unsigned int numbits;
 
+	 /** Digit bits.
+	  * Number of bits sorted in each pass (2 without subgroup ballots).
+	  */
+	 unsigned int digitbits;
+
+	 /** Incremental flag.
+	  * Flag indicating whether the incremental mode is enabled.
+	  */
+	 bool incremental;
+
 	 /** Counting shader program.
 	  * Shader program used to count the key bits and thereby generate a prefix sum.
 	  */
@@ -84,6 +344,39 @@ private:
 	  * to some blocks.
 	  */
 	 ShaderProgram addblocksum;
+	 /** Histogram shader program.
+	  * Shader program used to count the digits of each tile of keys.
+	  */
+	 ShaderProgram histogram;
+	 /** Scatter shader program.
+	  * Shader program used to map the keys to their global position according to a digit.
+	  */
+	 ShaderProgram scatter;
+	 /** Order check shader program.
+	  * Shader program used to count the neighbouring keys in the wrong order.
+	  */
+	 ShaderProgram checkorder;
+	 /** Local sort shader program.
+	  * Shader program used to sort tiles of keys in place.
+	  */
+	 ShaderProgram localsort;
+	 /** Copy shader program.
+	  * Shader program used to copy the keys to the other buffer, if the incremental
+	  * sort skipped an odd number of passes.
+	  */
+	 ShaderProgram copy;
+	 /** Sort mode shader program.
+	  * Shader program used to decide which passes of the incremental or conditional sort are needed.
+	  */
+	 ShaderProgram sortmode;
+	 /** Sort state buffer.
+	  * Buffer object containing the counters and indirect dispatch arguments of the incremental sort.
+	  */
+	 GLuint statebuffer;
+	 /** Dispatch work groups.
+	  * Number of work groups of each dispatch (see DISPATCH_LOCALSORT etc.).
+	  */
+	 std::vector<GLuint> dispatchgroups;
 	 union {
 		 struct {
 			 /** Source buffer.
@@ -120,6 +413,19 @@ private:
 	  * Stores the number of blocks to be sorted.
 	  */
 	 const uint32_t numblocks;
+	 /** Number of keys.
+	  * Stores the number of values to be sorted (without padding).
+	  */
+	 const uint32_t numkeys;
+	 /** Number of tiles.
+	  * Stores the number of tiles of the histogram and scatter shaders.
+	  */
+	 uint32_t numtiles;
+	 /** Number of scanned values.
+	  * Stores the number of values in the first block sum buffer whose prefix sum is computed
+	  * in each pass, i.e. four per block for 2 bits or one per digit and tile otherwise.
+	  */
+	 uint32_t numscanvalues;
 	 /** Bit shift uniform location (counting shader).
 	  * Uniform location for the bit shift variable in the counting shader.
 	  */
@@ -128,6 +434,30 @@ private:
 	  * Uniform location for the bit shift variable in the global sort shader.
 	  */
 	 int globalsort_bitshift;
+	 /** Bit shift uniform location (histogram shader).
+	  * Uniform location for the bit shift variable in the histogram shader.
+	  */
+	 int histogram_bitshift;
+	 /** Bit shift uniform location (scatter shader).
+	  * Uniform location for the bit shift variable in the scatter shader.
+	  */
+	 int scatter_bitshift;
+	 /** Target uniform location (order check shader).
+	  * Uniform location for the counter index in the order check shader.
+	  */
+	 int checkorder_target;
+	 /** Tile offset uniform location (local sort shader).
+	  * Uniform location for the offset of the first tile in the local sort shader.
+	  */
+	 int localsort_tileoffset;
+	 /** Stage uniform location (sort mode shader).
+	  * Uniform location for the stage variable in the sort mode shader.
+	  */
+	 int sortmode_stage;
+	 /** Incremental uniform location (sort mode shader).
+	  * Uniform location for the incremental flag in the sort mode shader.
+	  */
+	 int sortmode_incremental;
 };
 
 #endif /* !defined RADIXSORT_H */
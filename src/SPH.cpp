@@ -20,10 +20,107 @@
  * THE SOFTWARE.
  */
 #include "SPH.h"
+#include "GPUTrace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <glm/gtc/packing.hpp>
+
+/** Grid margin.
+ * Number of cells that the adaptive grid keeps free around the particle bounding box.
+ */
+static const int GRID_MARGIN = 4;
+
+/** Density error work groups.
+ * Number of work groups used to reduce the density errors of a solver iteration.
+ */
+static const GLuint DENSITY_ERROR_GROUPS = 64;
+
+/** Solver state size.
+ * Number of unsigned integers in the solver state buffer (see shaders/sph/converge.glsl):
+ * two indirect dispatch commands, the convergence flag, the iterations of the current
+ * step and the total number of iterations.
+ */
+static const GLuint SOLVER_STATE_SIZE = 9;
+
+/** Smoothing length.
+ * Smoothing length used by the shaders (see the shader header), which is the
+ * length scale of the CFL condition.
+ */
+static const float SMOOTHING_LENGTH = 2.0f;
+
+/** Neighbour skin trigger.
+ * Distance in grid cells a particle may move after a neighbour search before it requests
+ * a new one. The search with a skin of one cell stays valid up to half a cell, and the GPU
+ * decides before the neighbours are used in the same step (see SetNeighbourSearchInterval).
+ */
+static const float NEIGHBOUR_SKIN_TRIGGER = 0.5f;
+
+/** Neighbour search state size.
+ * Number of unsigned integers in the neighbour search state buffer (see
+ * shaders/sph/neighboursearch.glsl): the indirect dispatch command of the search, the
+ * skin flag, the steps since the last search, the number of searches and padding.
+ */
+static const GLuint SEARCH_STATE_SIZE = 8;
+
+#ifdef COMPACT_PARTICLES
+/** Velocity format.
+ * Format of the velocity buffer, which stores four half floats per particle.
+ */
+static const GLenum VELOCITY_FORMAT = GL_RGBA16F;
+#else
+/** Velocity format.
+ * Format of the velocity buffer, which stores four floats per particle.
+ */
+static const GLenum VELOCITY_FORMAT = GL_RGBA32F;
+#endif
+
+/** Velocity size.
+ * Size of the velocity of a particle in the velocity buffer in bytes.
+ */
+#ifdef COMPACT_PARTICLES
+static const GLsizeiptr VELOCITY_SIZE = 4 * sizeof(uint16_t);
+#else
+static const GLsizeiptr VELOCITY_SIZE = 4 * sizeof(float);
+#endif
+
+/** Ordered integer to float.
+ * Inverts the mapping of floats to integers with the same ordering used by shaders/grid/aabb.glsl.
+ * \param u the ordered integer
+ * \returns the float value
+ */
+static float OrderedUintToFloat(GLuint u) {
+    u = (u & 0x80000000u) ? (u & 0x7FFFFFFFu) : ~u;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/** Timing phase names.
+ * Returns the names of all timing phases for the profiler.
+ * \returns the names of the timing phases
+ */
+static std::vector<std::string> GetTimingPhaseNames(void) {
+    std::vector<std::string> names;
+    for (int phase = 0; phase < SPH::TIMING_NUM_PHASES; phase++)
+        names.push_back(SPH::GetTimingPhaseName(SPH::timingphase_t(phase)));
+    return names;
+}
+
+SPH::SPH(const GLuint &_numparticles, const glm::ivec3 &_gridsize)
+        : numparticles(_numparticles), neighbourcellfinder(NULL), vorticityconfinement(false), tiledsolver(false), incrementalsort(false), solvermode(SOLVER_INPLACE),
+          densityerrors(false), deterministic(false), numdensityerrors(0), densityerrorcapacity(0), solvertolerance(0),
+          radixsort(NULL),
+          gridsize(_gridsize), gridorigin(0, 0, 0), adaptivegridinterval(0), stepcounter(0), aabbfence(NULL), boundsrequest(false),
+          cflnumber(0.4f), maxtimestep(0.02f), maxsubsteps(4), maxvelocity(0), maxvelocityfence(NULL),
+          neighboursearchinterval(1), neighboursearchrequest(true), overflowfence(NULL), numneighbouroverflows(0),
+          simulationtime(0), checkpointstate(CHECKPOINT_STATE_IDLE), checkpointfence(NULL), checkpointmapping(NULL),
+          checkpointthreaddone(false),
+          sortedstate(0), positionbuffervalid(true), num_solveriterations(5), profiler(GetTimingPhaseNames()) {
+    // all particle passes are dispatched with one invocation per particle in x direction
+    if ((numparticles + 255) >> 8 > GLEXTS.maxworkgroupcount)
+        throw std::runtime_error("The number of particles exceeds the maximum number of compute work groups.");
 
-SPH::SPH(const GLuint &_numparticles, const glm::ivec3 &gridsize)
-        : numparticles(_numparticles), vorticityconfinement(false), radixsort(512, _numparticles >> 9, gridsize),
-          neighbourcellfinder(_numparticles, gridsize), num_solveriterations(5) {
     // shader definitions
     std::stringstream stream;
     stream << "const vec3 GRID_SIZE = vec3 (" << gridsize.x << ", " << gridsize.y << ", " << gridsize.z << ");"
@@ -57,30 +154,106 @@ SPH::SPH(const GLuint &_numparticles, const glm::ivec3 &gridsize)
            #endif
            << "const float h = 2.0;" << std::endl
            << std::endl
-           << "#define BLOCKSIZE 256" << std::endl;
+           << "#define BLOCKSIZE 256" << std::endl
+           << "#define NUM_PARTICLES " << numparticles << std::endl
+           << "#define NEIGHBOUR_SKIN_TRIGGER " << NEIGHBOUR_SKIN_TRIGGER << std::endl
+           #ifdef COMPACT_PARTICLES
+           << "#define VELOCITY_FORMAT rgba16f" << std::endl
+           #else
+           << "#define VELOCITY_FORMAT rgba32f" << std::endl
+           #endif
+           #ifdef SORTED_PARTICLES
+           << "#define SORTED_PARTICLES" << std::endl
+           #endif
+           << RadixSort::GetKeyDefinitions()
+           << NeighbourCellFinder::GetNeighbourDefinitions();
 
     // prepare shader programs
-    predictpos.CompileShader(GL_COMPUTE_SHADER, {"shaders/sph/foreachneighbour.glsl", "shaders/sph/predictpos.glsl"},
+    predictpos.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+                                                 "shaders/sph/foreachneighbour.glsl", "shaders/sph/predictpos.glsl"},
                              stream.str());
     predictpos.Link();
 
-    calclambdaprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/sph/foreachneighbour.glsl", "shaders/sph/calclambda.glsl"},
+    calclambdaprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+                                                     "shaders/sph/foreachneighbour.glsl", "shaders/sph/calclambda.glsl"},
                                  stream.str());
     calclambdaprog.Link();
 
-    updateposprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/sph/foreachneighbour.glsl", "shaders/sph/updatepos.glsl"},
+    updateposprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+                                                    "shaders/sph/foreachneighbour.glsl", "shaders/sph/updatepos.glsl"},
                                 stream.str());
     updateposprog.Link();
 
-    vorticityprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/sph/foreachneighbour.glsl", "shaders/sph/vorticity.glsl"},
+    {
+        // the tile uses four floats per entry and may use most of the shared memory
+        GLint maxsharedmemory = 32768;
+        glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &maxsharedmemory);
+        std::stringstream tiledstream;
+        tiledstream << stream.str() << "#define TILED_SOLVER" << std::endl
+                    << "#define TILE_CAPACITY " << (maxsharedmemory - 256) / 16 << std::endl;
+
+        tiledcalclambdaprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+                                                              "shaders/sph/foreachneighbour.glsl",
+                                                              "shaders/sph/calclambda.glsl", "shaders/sph/tile.glsl"},
+                                          tiledstream.str());
+        tiledcalclambdaprog.Link();
+
+        tiledupdateposprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+                                                             "shaders/sph/foreachneighbour.glsl",
+                                                             "shaders/sph/updatepos.glsl", "shaders/sph/tile.glsl"},
+                                         tiledstream.str());
+        tiledupdateposprog.Link();
+
+        tiledpingpongupdateposprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl",
+                                                                     "shaders/grid/key.glsl",
+                                                                     "shaders/sph/foreachneighbour.glsl",
+                                                                     "shaders/sph/updatepos.glsl",
+                                                                     "shaders/sph/tile.glsl"},
+                                                 tiledstream.str() + "#define SEPARATE_OUTPUT\n");
+        tiledpingpongupdateposprog.Link();
+    }
+
+    pingpongupdateposprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl",
+                                                            "shaders/grid/key.glsl",
+                                                            "shaders/sph/foreachneighbour.glsl",
+                                                            "shaders/sph/updatepos.glsl"},
+                                        stream.str() + "#define SEPARATE_OUTPUT\n");
+    pingpongupdateposprog.Link();
+
+    colourprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+                                                 "shaders/grid/hash.glsl", "shaders/sph/colour.glsl"}, stream.str());
+    colourprog.Link();
+
+    densityerrorprog.CompileShader(GL_COMPUTE_SHADER, "shaders/sph/densityerror.glsl", stream.str());
+    densityerrorprog.Link();
+
+    {
+        std::stringstream convergestream;
+        convergestream << stream.str() << "#define DENSITY_ERROR_GROUPS " << DENSITY_ERROR_GROUPS << std::endl;
+        convergeprog.CompileShader(GL_COMPUTE_SHADER, "shaders/sph/converge.glsl", convergestream.str());
+        convergeprog.Link();
+    }
+
+    vorticityprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+                                                    "shaders/sph/foreachneighbour.glsl",
+                                                    "shaders/sph/particlestate.glsl", "shaders/sph/vorticity.glsl"},
                                 stream.str());
     vorticityprog.Link();
 
-    updateprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/sph/foreachneighbour.glsl", "shaders/sph/update.glsl"},
+    confinementprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+                                                      "shaders/sph/foreachneighbour.glsl",
+                                                      "shaders/sph/particlestate.glsl", "shaders/sph/confinement.glsl"},
+                                  stream.str());
+    confinementprog.Link();
+
+    updateprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+                                                 "shaders/sph/foreachneighbour.glsl",
+                                                 "shaders/sph/particlestate.glsl", "shaders/sph/update.glsl"},
                              stream.str());
     updateprog.Link();
 
-    highlightprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/sph/foreachneighbour.glsl", "shaders/sph/highlight.glsl"},
+    highlightprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+                                                    "shaders/sph/foreachneighbour.glsl", "shaders/sph/highlight.glsl"},
                                 stream.str());
     highlightprog.Link();
 
@@ -89,11 +262,26 @@ SPH::SPH(const GLuint &_numparticles, const glm::ivec3 &gridsize)
                                      stream.str());
     clearhighlightprog.Link();
 
-    // create query objects
-    glGenQueries(5, queries);
+    aabbprog.CompileShader(GL_COMPUTE_SHADER, "shaders/grid/aabb.glsl", stream.str());
+    aabbprog.Link();
+
+    maxvelocityprog.CompileShader(GL_COMPUTE_SHADER, "shaders/sph/maxvelocity.glsl", stream.str());
+    maxvelocityprog.Link();
+
+    unsortprog.CompileShader(GL_COMPUTE_SHADER, "shaders/sph/unsort.glsl", stream.str());
+    unsortprog.Link();
+
+    neighboursearchprog.CompileShader(GL_COMPUTE_SHADER, "shaders/sph/neighboursearch.glsl", stream.str());
+    neighboursearchprog.Link();
+    glProgramUniform1ui(neighboursearchprog.get(), neighboursearchprog.GetUniformLocation("searchinterval"), 1);
+
+    skinprog.CompileShader(GL_COMPUTE_SHADER, {"shaders/grid/domain.glsl", "shaders/grid/key.glsl",
+                                               "shaders/sph/skin.glsl"},
+                           stream.str());
+    skinprog.Link();
 
     // create buffer objects
-    glGenBuffers(6, buffers);
+    glGenBuffers(22, buffers);
 
     // allocate lambda buffer
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, lambdabuffer);
@@ -116,6 +304,10 @@ SPH::SPH(const GLuint &_numparticles, const glm::ivec3 &gridsize)
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, vorticitybuffer);
     glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * numparticles, NULL, GL_DYNAMIC_COPY);
 
+    // allocate vorticity vector buffer
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, vorticityvectorbuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float) * numparticles, NULL, GL_DYNAMIC_COPY);
+
     // allocate position buffer
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, positionbuffer);
     glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float) * numparticles, NULL, GL_DYNAMIC_COPY);
@@ -126,22 +318,80 @@ SPH::SPH(const GLuint &_numparticles, const glm::ivec3 &gridsize)
 
     // allocate velocity buffer
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, velocitybuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float) * numparticles, NULL, GL_DYNAMIC_COPY);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, VELOCITY_SIZE * numparticles, NULL, GL_DYNAMIC_COPY);
 
     // create velocity texture
     velocitytexture.Bind(GL_TEXTURE_BUFFER);
-    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, velocitybuffer);
+    glTexBuffer(GL_TEXTURE_BUFFER, VELOCITY_FORMAT, velocitybuffer);
+
+    // allocate solver buffer
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, solverbuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, RadixSort::KEY_SIZE * numparticles, NULL, GL_DYNAMIC_COPY);
+
+    // allocate colour buffer
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, colourbuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * numparticles, NULL, GL_DYNAMIC_COPY);
+
+    // create colour texture
+    colourtexture.Bind(GL_TEXTURE_BUFFER);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, colourbuffer);
+
+    // allocate density error buffer
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, densityerrorbuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * numparticles, NULL, GL_DYNAMIC_COPY);
+
+    // create density error texture
+    densityerrortexture.Bind(GL_TEXTURE_BUFFER);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, densityerrorbuffer);
+
+    // allocate solver state buffer
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, solverstatebuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, SOLVER_STATE_SIZE * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+
+    // allocate maximum velocity buffer
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, maxvelocitybuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+
+#ifdef NEIGHBOUR_SKIN
+    // allocate neighbour skin buffer
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, skinbuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, RadixSort::KEY_SIZE * numparticles, NULL, GL_DYNAMIC_COPY);
+
+    // allocate neighbour search state buffer
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, searchstatebuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, SEARCH_STATE_SIZE * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+#endif
+
+#ifdef SORTED_PARTICLES
+    // allocate sorted position and id buffers
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, sortedpositionbuffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(float) * numparticles, NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, sortedidbuffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * numparticles, NULL, GL_DYNAMIC_COPY);
+    }
+#endif
+
+    // allocate bounding box buffer
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, aabbbuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 6 * sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+
+    // create domain parameter buffer
+    // (by default the particles are confined to the grid without a wall of 16 cells in x and z direction)
+    domainparams.gridorigin = glm::vec4(0, 0, 0, 0);
+    domainparams.domainmin = glm::vec4(16, 0, 16, 0);
+    domainparams.domainmax = glm::vec4(gridsize.x - 16, gridsize.y, gridsize.z - 16, 0);
+    glBindBuffer(GL_UNIFORM_BUFFER, domainparambuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(domainparams_t), &domainparams, GL_STATIC_DRAW);
+
+    // create sorting and neighbour search for the initial grid
+    CreateGrid(gridsize);
 
     // create sph parameter buffer
+    sphparams = GetDefaultParameters();
 #ifndef SPH_CONSTANT_PARAMETERS
-    sphparams.one_over_rho_0 = 1.0f;
-    sphparams.epsilon = 5.0f;
-    sphparams.gravity = 10.0f;
-    sphparams.timestep = 0.016f;
-    sphparams.tensile_instability_k = 0.1f;
-    sphparams.tensile_instability_scale = 1.0f / Wpoly6(0.2f, 2.0f);
-    sphparams.xsph_viscosity_c = 0.01f;
-    sphparams.vorticity_epsilon = 5;
 
     glBindBuffer(GL_UNIFORM_BUFFER, sphparambuffer);
     glBufferData(GL_UNIFORM_BUFFER, sizeof(sphparams_t), &sphparams, GL_STATIC_DRAW);
@@ -151,9 +401,36 @@ SPH::SPH(const GLuint &_numparticles, const glm::ivec3 &gridsize)
 }
 
 SPH::~SPH(void) {
+    // complete a pending checkpoint
+    try {
+        WaitForCheckpoint();
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+    }
+
     // cleanup
-    glDeleteBuffers(6, buffers);
-    glDeleteQueries(5, queries);
+    if (aabbfence != NULL)
+        glDeleteSync(aabbfence);
+    if (maxvelocityfence != NULL)
+        glDeleteSync(maxvelocityfence);
+    if (overflowfence != NULL)
+        glDeleteSync(overflowfence);
+    delete neighbourcellfinder;
+    delete radixsort;
+    glDeleteBuffers(22, buffers);
+}
+
+SPH::sphparams_t SPH::GetDefaultParameters(void) {
+    sphparams_t params;
+    params.one_over_rho_0 = 1.0f;
+    params.epsilon = 5.0f;
+    params.gravity = 10.0f;
+    params.timestep = 0.016f;
+    params.tensile_instability_k = 0.1f;
+    params.tensile_instability_scale = 1.0f / Wpoly6(0.2f, 2.0f);
+    params.xsph_viscosity_c = 0.01f;
+    params.vorticity_epsilon = 5;
+    return params;
 }
 
 float SPH::Wpoly6(const float &r, const float &h) {
@@ -163,6 +440,29 @@ float SPH::Wpoly6(const float &r, const float &h) {
     return 1.56668147106f * tmp * tmp * tmp / (h * h * h * h * h * h * h * h * h);
 }
 
+GLuint SPH::GetPositionBuffer(void) const {
+#ifdef SORTED_PARTICLES
+    UpdatePositionBuffer();
+#endif
+    return positionbuffer;
+}
+
+void SPH::UpdatePositionBuffer(void) const {
+    if (positionbuffervalid)
+        return;
+
+    {
+        GLuint bufs[3] = {sortedpositionbuffers[sortedstate], sortedidbuffers[sortedstate], positionbuffer};
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 3, bufs);
+    }
+    GPUTrace::Begin("unsort");
+    unsortprog.Use();
+    glDispatchCompute((numparticles + 255) >> 8, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    GPUTrace::End();
+    positionbuffervalid = true;
+}
+
 void SPH::SetRestDensity(const float &rho) {
     sphparams.one_over_rho_0 = 1.0f / rho;
     UploadSPHParams();
@@ -215,28 +515,749 @@ void SPH::UploadSPHParams(void) {
 #endif
 }
 
+void SPH::UploadDomainParams(void) {
+    GLuint tmpbuffer;
+    glGenBuffers(1, &tmpbuffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, tmpbuffer);
+    glBufferData(GL_COPY_READ_BUFFER, sizeof(domainparams_t), &domainparams, GL_STREAM_COPY);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, domainparambuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(domainparams_t));
+    glDeleteBuffers(1, &tmpbuffer);
+}
+
+void SPH::SetDomainBounds(const glm::vec3 &min, const glm::vec3 &max) {
+    domainparams.domainmin = glm::vec4(min, 0);
+    domainparams.domainmax = glm::vec4(max, 0);
+    UploadDomainParams();
+}
+
+void SPH::CreateGrid(const glm::ivec3 &size) {
+    delete neighbourcellfinder;
+    delete radixsort;
+    gridsize = size;
+    radixsort = new RadixSort(512, numparticles, gridsize);
+    neighbourcellfinder = new NeighbourCellFinder(numparticles, gridsize);
+
+    // start from the identity order, which predictpos keeps in incremental mode
+    std::vector<GLuint> keys(RadixSort::KEY_WORDS * numparticles);
+    for (GLuint i = 0; i < numparticles; i++)
+        RadixSort::PackKey(glm::vec3(gridorigin), i, glm::vec3(gridorigin), &keys[RadixSort::KEY_WORDS * i]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, radixsort->GetBuffer());
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, RadixSort::KEY_SIZE * numparticles, &keys[0]);
+    radixsort->SetIncremental(incrementalsort);
+
+    // the neighbour cells of the old grid are no longer valid
+    neighboursearchrequest = true;
+    numneighbouroverflows = 0;
+}
+
+void SPH::SetIncrementalSortEnabled(const bool &flag) {
+    incrementalsort = flag;
+    UpdateKeepOrder();
+    radixsort->SetIncremental(flag);
+}
+
+void SPH::SetNeighbourSearchInterval(const unsigned int &interval) {
+    if (interval == 0)
+        throw std::logic_error("The neighbour search interval has to be at least one step.");
+#ifndef NEIGHBOUR_SKIN
+    if (interval > 1)
+        throw std::logic_error("Searching neighbours less often than every step requires the neighbour "
+                               "search with a skin (PBF_NEIGHBOUR_SKIN).");
+#endif
+    neighboursearchinterval = interval;
+    glProgramUniform1ui(neighboursearchprog.get(), neighboursearchprog.GetUniformLocation("searchinterval"), interval);
+    UpdateKeepOrder();
+}
+
+unsigned int SPH::GetNumNeighbourSearches(void) const {
+#ifdef NEIGHBOUR_SKIN
+    GLuint count;
+    glBindBuffer(GL_COPY_READ_BUFFER, searchstatebuffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 5 * sizeof(GLuint), sizeof(count), &count);
+    return count;
+#else
+    // without the skin the neighbours are searched in every step
+    return stepcounter;
+#endif
+}
+
+void SPH::UpdateKeepOrder(void) {
+    const bool keeporder = incrementalsort || neighboursearchinterval > 1;
+    glProgramUniform1i(predictpos.get(), predictpos.GetUniformLocation("keeporder"), keeporder ? 1 : 0);
+}
+
+bool SPH::IsSignaled(GLsync fence) const {
+    // in the deterministic mode the result is always used in the step after it was requested
+    GLenum status = deterministic ? glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED)
+                                  : glClientWaitSync(fence, 0, 0);
+    return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+void SPH::UpdateNeighbourOverflows(void) {
+    if (overflowfence == NULL || !IsSignaled(overflowfence))
+        return;
+    glDeleteSync(overflowfence);
+    overflowfence = NULL;
+
+    // the counter only grows, so a difference means that new ranges were clamped
+    const GLuint overflows = neighbourcellfinder->GetNumOverflows();
+    if (overflows > numneighbouroverflows)
+        spdlog::get("console")->warn("{} neighbour ranges held more than 255 particles and lost neighbours "
+                                     "(PBF_NEIGHBOUR_WIDE_ENTRIES stores their full counts).",
+                                     overflows - numneighbouroverflows);
+    numneighbouroverflows = overflows;
+}
+
+void SPH::GetSortModeCounts(GLuint counts[4]) const {
+    radixsort->GetSortModeCounts(counts);
+}
+
+void SPH::ComputeBounds(void) {
+    // initialize the bounds to an empty box
+    const GLuint bounds[6] = {0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu, 0, 0, 0};
+    glBindBuffer(GL_COPY_WRITE_BUFFER, aabbbuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(bounds), bounds);
+
+    {
+#ifdef SORTED_PARTICLES
+        // the bounding box does not depend on the order of the particles
+        GLuint bufs[2] = {sortedpositionbuffers[sortedstate], aabbbuffer};
+#else
+        GLuint bufs[2] = {positionbuffer, aabbbuffer};
+#endif
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 2, bufs);
+    }
+    GPUTrace::Begin("aabb");
+    aabbprog.Use();
+    glDispatchCompute((numparticles + 255) >> 8, 1, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    GPUTrace::End();
+
+    // the result is read back in one of the next steps, as soon as it is available
+    aabbfence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void SPH::UpdateGrid(void) {
+    if (aabbfence == NULL || !IsSignaled(aabbfence))
+        return;
+    glDeleteSync(aabbfence);
+    aabbfence = NULL;
+
+    GLuint bounds[6];
+    glBindBuffer(GL_COPY_READ_BUFFER, aabbbuffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(bounds), bounds);
+
+    // particles outside of the grid are clamped into its boundary cells, which may then hold
+    // more particles than the neighbour cell entries can count, so the bounding box is
+    // computed in every step until the grid contains all particles again
+    bool outside = false;
+    for (int i = 0; i < 3; i++) {
+        if (OrderedUintToFloat(bounds[i]) < float(gridorigin[i]) ||
+            OrderedUintToFloat(bounds[i + 3]) >= float(gridorigin[i] + gridsize[i]))
+            outside = true;
+    }
+    if (outside && !boundsrequest)
+        spdlog::get("console")->warn("Particles have left the particle grid, updating it in every step.");
+    boundsrequest = outside;
+
+    // keep a margin around the particles, since they keep moving until the next update
+    glm::ivec3 lower, upper;
+    bool grow = false, move = false;
+    for (int i = 0; i < 3; i++) {
+        lower[i] = int(floorf(OrderedUintToFloat(bounds[i]))) - GRID_MARGIN;
+        upper[i] = int(ceilf(OrderedUintToFloat(bounds[i + 3]))) + GRID_MARGIN;
+        if (upper[i] - lower[i] > gridsize[i])
+            grow = true;
+        if (lower[i] < gridorigin[i] || upper[i] > gridorigin[i] + gridsize[i])
+            move = true;
+    }
+
+    if (grow) {
+        // enlarge the grid with some headroom, so that this does not happen every update
+        glm::ivec3 size;
+        for (int i = 0; i < 3; i++) {
+            size[i] = std::max(gridsize[i], (upper[i] - lower[i]) * 5 / 4);
+            size[i] = (size[i] + 15) & ~15;
+        }
+        spdlog::get("console")->info("Enlarging the particle grid to {}x{}x{}.", size.x, size.y, size.z);
+        CreateGrid(size);
+    }
+
+    if (move) {
+        // center the grid around the particles
+        for (int i = 0; i < 3; i++)
+            gridorigin[i] = (lower[i] + upper[i]) / 2 - gridsize[i] / 2;
+        domainparams.gridorigin = glm::vec4(gridorigin, 0);
+        UploadDomainParams();
+        neighboursearchrequest = true;
+    }
+}
+
+void SPH::ComputeMaxVelocity(void) {
+    const GLuint zero = 0;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, maxvelocitybuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(zero), &zero);
+
+    {
+        GLuint bufs[2] = {velocitybuffer, maxvelocitybuffer};
+        glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 0, 2, bufs);
+    }
+    GPUTrace::Begin("maxvelocity");
+    maxvelocityprog.Use();
+    glDispatchCompute((numparticles + 255) >> 8, 1, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    GPUTrace::End();
+
+    // the result is read back in one of the next frames, as soon as it is available
+    maxvelocityfence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void SPH::UpdateMaxVelocity(void) {
+    if (maxvelocityfence == NULL || !IsSignaled(maxvelocityfence))
+        return;
+    glDeleteSync(maxvelocityfence);
+    maxvelocityfence = NULL;
+
+    GLuint bits;
+    glBindBuffer(GL_COPY_READ_BUFFER, maxvelocitybuffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(bits), &bits);
+    memcpy(&maxvelocity, &bits, sizeof(maxvelocity));
+}
+
+unsigned int SPH::Advance(const float &time) {
+    UpdateMaxVelocity();
+
+#ifdef SPH_CONSTANT_PARAMETERS
+    // the time step is a shader constant
+    Run();
+    return 1;
+#else
+    // the velocity is read back with a delay, so account for the acceleration by gravity since then
+    float velocity = maxvelocity + fabsf(sphparams.gravity) * time;
+    float timestep = maxtimestep;
+    if (velocity > 0)
+        timestep = std::min(timestep, cflnumber * SMOOTHING_LENGTH / velocity);
+
+    // split the time into equal substeps, but never exceed the CFL time step
+    unsigned int substeps = std::min(maxsubsteps, std::max(1u, (unsigned int) ceilf(time / timestep)));
+    timestep = std::min(timestep, time / float(substeps));
+    if (timestep != sphparams.timestep)
+        SetTimestep(timestep);
+
+    for (unsigned int substep = 0; substep < substeps; substep++)
+        Run();
+
+    if (maxvelocityfence == NULL)
+        ComputeMaxVelocity();
+    return substeps;
+#endif
+}
+
+const char *SPH::GetSolverModeName(const solvermode_t &mode) {
+    static const char *names[SOLVER_NUM_MODES] = {"inplace", "jacobi", "gauss-seidel"};
+    return names[mode];
+}
+
+void SPH::SetDensityErrorsEnabled(const bool &flag) {
+    densityerrors = flag;
+    UpdateDensityErrorOutput();
+}
+
+void SPH::SetSolverTolerance(const float &tolerance) {
+    solvertolerance = std::max(tolerance, 0.0f);
+    glProgramUniform1f(convergeprog.get(), convergeprog.GetUniformLocation("tolerance"), solvertolerance);
+    UpdateDensityErrorOutput();
+}
+
+void SPH::UpdateDensityErrorOutput(void) {
+    const bool flag = densityerrors || solvertolerance > 0;
+    glProgramUniform1i(calclambdaprog.get(), calclambdaprog.GetUniformLocation("computedensityerror"), flag);
+    glProgramUniform1i(tiledcalclambdaprog.get(), tiledcalclambdaprog.GetUniformLocation("computedensityerror"),
+                       flag);
+}
+
+GLuint SPH::GetTotalSolverIterations(void) const {
+    GLuint iterations = 0;
+    glBindBuffer(GL_COPY_READ_BUFFER, solverstatebuffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 8 * sizeof(GLuint), sizeof(GLuint), &iterations);
+    return iterations;
+}
+
+void SPH::GetDensityErrors(std::vector<glm::vec2> &errors) const {
+    errors.clear();
+    if (numdensityerrors == 0)
+        return;
+
+    // the adaptive solver skips the entries after the one in which it converged
+    GLuint count = numdensityerrors;
+    if (solvertolerance > 0) {
+        GLuint iterations = 0;
+        glBindBuffer(GL_COPY_READ_BUFFER, solverstatebuffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 7 * sizeof(GLuint), sizeof(GLuint), &iterations);
+        count = std::min(count, iterations + 1);
+    }
+
+    std::vector<glm::vec2> partialerrors(count * DENSITY_ERROR_GROUPS);
+    glBindBuffer(GL_COPY_READ_BUFFER, densityerrorsbuffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(glm::vec2) * partialerrors.size(), &partialerrors[0]);
+
+    // combine the partial results of the work groups
+    errors.resize(count, glm::vec2(0, 0));
+    for (GLuint i = 0; i < count; i++) {
+        for (GLuint group = 0; group < DENSITY_ERROR_GROUPS; group++) {
+            const glm::vec2 &partial = partialerrors[i * DENSITY_ERROR_GROUPS + group];
+            errors[i].x = std::max(errors[i].x, partial.x);
+            errors[i].y += partial.y;
+        }
+        errors[i].y /= float(numparticles);
+    }
+}
+
+void SPH::CalcLambdas(const GLuint &iteration) {
+    GPUTrace::Begin("calclambda", iteration);
+    if (tiledsolver)
+        tiledcalclambdaprog.Use();
+    else
+        calclambdaprog.Use();
+    // the solver passes are dispatched indirectly, so that the adaptive solver can skip them
+    glDispatchComputeIndirect(0);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT
+                    | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    GPUTrace::End();
+
+    if (densityerrors || solvertolerance > 0) {
+        // reduce the density errors into the entry of this iteration
+        GPUTrace::Begin("densityerror", iteration);
+        densityerrorprog.Use();
+        glProgramUniform1i(densityerrorprog.get(), densityerrorprog.GetUniformLocation("iteration"), iteration);
+        glDispatchComputeIndirect(3 * sizeof(GLuint));
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        GPUTrace::End();
+    }
+}
+
+GLint64 SPH::GetTiming(const timingphase_t &phase) const {
+    return profiler.GetLatest(phase);
+}
+
+const char *SPH::GetTimingPhaseName(const timingphase_t &phase) {
+    static const char *names[TIMING_NUM_PHASES] = {
+            "Position prediction", "Sorting", "Neighbour cell search", "Solver", "Vorticity confinement"
+    };
+    return names[phase];
+}
+
 void SPH::OutputTiming(void) {
-    GLint64 v;
-    if (glIsQuery(predictposquery)) {
-        glGetQueryObjecti64v(predictposquery, GL_QUERY_RESULT, &v);
-        std::cout << "Position prediction: " << double(v) / 1000000.0 << " ms" << std::endl;
+    profiler.Collect();
+    for (int phase = 0; phase < TIMING_NUM_PHASES; phase++) {
+        GPUProfiler::statistics_t stats = profiler.GetStatistics(phase);
+        if (stats.samples > 0) {
+            std::cout << GetTimingPhaseName(timingphase_t(phase)) << ": min " << stats.min << " ms, mean "
+                      << stats.mean << " ms, p95 " << stats.p95 << " ms, p99 " << stats.p99 << " ms ("
+                      << stats.samples << " samples)" << std::endl;
+        }
+    }
+}
+
+void SPH::SetParticles(const std::vector<glm::vec4> &positions, const std::vector<glm::vec4> &velocities) {
+    if (positions.size() != numparticles || velocities.size() != numparticles)
+        throw std::runtime_error("The particle data does not match the number of particles in the simulation.");
+
+    // create temporary buffer
+    GLuint tmpbuffer;
+    glGenBuffers(1, &tmpbuffer);
+
+    // upload position data
+    glBindBuffer(GL_COPY_READ_BUFFER, tmpbuffer);
+    glBufferData(GL_COPY_READ_BUFFER, 4 * sizeof(float) * numparticles, &positions[0], GL_STREAM_COPY);
+
+    // copy the new position data to the position buffer
+    glBindBuffer(GL_COPY_WRITE_BUFFER, positionbuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 4 * sizeof(float) * numparticles);
+
+#ifdef SORTED_PARTICLES
+    // the particles start in the order of their ids
+    glBindBuffer(GL_COPY_WRITE_BUFFER, sortedpositionbuffers[sortedstate]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 4 * sizeof(float) * numparticles);
+    {
+        std::vector<GLuint> ids(numparticles);
+        for (GLuint i = 0; i < numparticles; i++)
+            ids[i] = i;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, sortedidbuffers[sortedstate]);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(GLuint) * numparticles, &ids[0]);
+    }
+    positionbuffervalid = true;
+#endif
+
+    // upload velocity data
+#ifdef COMPACT_PARTICLES
+    std::vector<uint64_t> halfvelocities(numparticles);
+    for (GLuint i = 0; i < numparticles; i++)
+        halfvelocities[i] = glm::packHalf4x16(velocities[i]);
+    glBufferData(GL_COPY_READ_BUFFER, VELOCITY_SIZE * numparticles, &halfvelocities[0], GL_STREAM_COPY);
+#else
+    glBufferData(GL_COPY_READ_BUFFER, VELOCITY_SIZE * numparticles, &velocities[0], GL_STREAM_COPY);
+#endif
+
+    // copy the new velocity data to the velocity buffer
+    glBindBuffer(GL_COPY_WRITE_BUFFER, velocitybuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, VELOCITY_SIZE * numparticles);
+
+    // delete temporary buffer
+    glDeleteBuffers(1, &tmpbuffer);
+
+    // the particles may have moved arbitrarily far
+    neighboursearchrequest = true;
+
+    // clear highlight buffer
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, highlightbuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R8UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+}
+
+void SPH::GetParticles(std::vector<glm::vec4> &positions, std::vector<glm::vec4> &velocities) const {
+    positions.resize(numparticles);
+    velocities.resize(numparticles);
+
+#ifdef SORTED_PARTICLES
+    glBindBuffer(GL_COPY_READ_BUFFER, sortedpositionbuffers[sortedstate]);
+#else
+    glBindBuffer(GL_COPY_READ_BUFFER, positionbuffer);
+#endif
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, 4 * sizeof(float) * numparticles, &positions[0]);
+    glBindBuffer(GL_COPY_READ_BUFFER, velocitybuffer);
+#ifdef COMPACT_PARTICLES
+    std::vector<uint64_t> halfvelocities(numparticles);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, VELOCITY_SIZE * numparticles, &halfvelocities[0]);
+    for (GLuint i = 0; i < numparticles; i++)
+        velocities[i] = glm::unpackHalf4x16(halfvelocities[i]);
+#else
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, VELOCITY_SIZE * numparticles, &velocities[0]);
+#endif
+
+#ifdef SORTED_PARTICLES
+    // move the particles from the order of the sorted keys to their ids
+    std::vector<GLuint> ids(numparticles);
+    glBindBuffer(GL_COPY_READ_BUFFER, sortedidbuffers[sortedstate]);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(GLuint) * numparticles, &ids[0]);
+    std::vector<glm::vec4> sortedpositions(positions), sortedvelocities(velocities);
+    for (GLuint i = 0; i < numparticles; i++) {
+        positions[ids[i]] = sortedpositions[i];
+        velocities[ids[i]] = sortedvelocities[i];
+    }
+#endif
+}
+
+uint64_t SPH::GetStateHash(void) const {
+    std::vector<glm::vec4> positions, velocities;
+    GetParticles(positions, velocities);
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    const std::vector<glm::vec4> *data[2] = {&positions, &velocities};
+    for (const std::vector<glm::vec4> *values : data) {
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&(*values)[0]);
+        for (size_t i = 0; i < values->size() * sizeof(glm::vec4); i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+std::string SPH::FormatStateHash(const uint64_t &hash) {
+    char str[17];
+    snprintf(str, sizeof(str), "%016llx", (unsigned long long) hash);
+    return str;
+}
+
+GLsizeiptr SPH::GetCheckpointStagingSize(void) const {
+    // positions, velocities and highlighting flags (and the ids of the sorted particles)
+    GLsizeiptr size = (4 * sizeof(float) + VELOCITY_SIZE + sizeof(GLuint)) * numparticles;
+#ifdef SORTED_PARTICLES
+    size += sizeof(GLuint) * numparticles;
+#endif
+    return size;
+}
+
+void SPH::AllocateCheckpointBuffer(void) {
+    if (checkpointmapping != NULL || !checkpointdata.empty())
+        return;
+
+    // allocate the staging buffer and keep it mapped, if possible
+    const GLsizeiptr size = GetCheckpointStagingSize();
+    glBindBuffer(GL_COPY_WRITE_BUFFER, checkpointbuffer);
+    if (GLEXTS.ARB_buffer_storage) {
+        const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags | GL_CLIENT_STORAGE_BIT);
+        checkpointmapping = reinterpret_cast<char *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+    } else {
+        glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_DYNAMIC_READ);
+    }
+    if (checkpointmapping == NULL)
+        checkpointdata.resize(size);
+}
+
+void SPH::GetCheckpointBuffers(GLuint buffers[4], GLsizeiptr sizes[4]) const {
+    // the staging buffer contains the positions, the velocities, the highlighting flags
+    // and with SORTED_PARTICLES the ids in the order in which they are stored on the GPU
+#ifdef SORTED_PARTICLES
+    buffers[0] = sortedpositionbuffers[sortedstate];
+#else
+    buffers[0] = positionbuffer;
+#endif
+    buffers[1] = velocitybuffer;
+    buffers[2] = highlightbuffer;
+    buffers[3] = sortedidbuffers[sortedstate];
+    sizes[0] = 4 * sizeof(float) * numparticles;
+    sizes[1] = VELOCITY_SIZE * numparticles;
+    sizes[2] = sizeof(GLuint) * numparticles;
+#ifdef SORTED_PARTICLES
+    sizes[3] = sizeof(GLuint) * numparticles;
+#else
+    sizes[3] = 0;
+#endif
+}
+
+void SPH::SaveCheckpoint(const std::string &filename) {
+    WaitForCheckpoint();
+    AllocateCheckpointBuffer();
+
+    // copy the particle state to the staging buffer
+    GLuint sources[4];
+    GLsizeiptr sizes[4];
+    GetCheckpointBuffers(sources, sizes);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, checkpointbuffer);
+    GLintptr offset = 0;
+    for (int i = 0; i < 4; i++) {
+        if (sizes[i] == 0)
+            continue;
+        glBindBuffer(GL_COPY_READ_BUFFER, sources[i]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, offset, sizes[i]);
+        offset += sizes[i];
+    }
+
+    // the state is read back in one of the next frames, as soon as it is available
+    checkpointfence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    checkpointstate = CHECKPOINT_STATE_COPYING;
+
+    checkpointheader.magic = CHECKPOINT_MAGIC;
+    checkpointheader.version = CHECKPOINT_VERSION;
+    checkpointheader.numparticles = numparticles;
+    checkpointheader.num_solveriterations = num_solveriterations;
+    checkpointheader.stepcounter = stepcounter;
+    checkpointheader.padding = 0;
+    checkpointheader.simulationtime = simulationtime;
+    checkpointheader.sphparams = sphparams;
+    checkpointfilename = filename;
+    checkpointerror.clear();
+}
+
+void SPH::LoadCheckpoint(const std::string &filename) {
+    // the file may be the one that is still being written
+    WaitForCheckpoint();
+    AllocateCheckpointBuffer();
+
+    // the file is read and converted to the layout of the staging buffer by a separate thread
+    checkpointfilename = filename;
+    checkpointerror.clear();
+    checkpointstate = CHECKPOINT_STATE_READING;
+    checkpointthreaddone = false;
+    checkpointthread = std::thread(&SPH::ReadCheckpoint, this,
+                                   (checkpointmapping != NULL) ? checkpointmapping : &checkpointdata[0]);
+}
+
+SPH::checkpointresult_t SPH::PollCheckpoint(void) {
+    return UpdateCheckpoint(false);
+}
+
+void SPH::WaitForCheckpoint(void) {
+    if (UpdateCheckpoint(true) == CHECKPOINT_FAILED)
+        throw std::runtime_error(checkpointerror);
+}
+
+SPH::checkpointresult_t SPH::UpdateCheckpoint(const bool &wait) {
+    switch (checkpointstate) {
+    case CHECKPOINT_STATE_IDLE:
+        // release the staging buffer once the state of a restored checkpoint has been uploaded
+        if (checkpointfence != NULL) {
+            if (wait)
+                glClientWaitSync(checkpointfence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            else if (!IsSignaled(checkpointfence))
+                return CHECKPOINT_NONE;
+            glDeleteSync(checkpointfence);
+            checkpointfence = NULL;
+        }
+        return CHECKPOINT_NONE;
+    case CHECKPOINT_STATE_COPYING:
+        if (wait)
+            glClientWaitSync(checkpointfence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        else if (!IsSignaled(checkpointfence))
+            return CHECKPOINT_PENDING;
+        glDeleteSync(checkpointfence);
+        checkpointfence = NULL;
+
+        // the persistent mapping is coherent, otherwise the staging buffer is copied,
+        // since it cannot stay mapped while the writer thread runs
+        if (checkpointmapping == NULL) {
+            glBindBuffer(GL_COPY_READ_BUFFER, checkpointbuffer);
+            const void *ptr = glMapBufferRange(GL_COPY_READ_BUFFER, 0, checkpointdata.size(), GL_MAP_READ_BIT);
+            if (ptr == NULL) {
+                checkpointstate = CHECKPOINT_STATE_IDLE;
+                checkpointerror = "Cannot map the checkpoint buffer.";
+                return CHECKPOINT_FAILED;
+            }
+            memcpy(&checkpointdata[0], ptr, checkpointdata.size());
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+        }
+
+        checkpointstate = CHECKPOINT_STATE_WRITING;
+        checkpointthreaddone = false;
+        checkpointthread = std::thread(&SPH::WriteCheckpoint, this,
+                                       (checkpointmapping != NULL) ? checkpointmapping : &checkpointdata[0]);
+        // fall through
+    case CHECKPOINT_STATE_WRITING:
+    case CHECKPOINT_STATE_READING: {
+        if (!wait && !checkpointthreaddone)
+            return CHECKPOINT_PENDING;
+        checkpointthread.join();
+        const bool reading = (checkpointstate == CHECKPOINT_STATE_READING);
+        checkpointstate = CHECKPOINT_STATE_IDLE;
+        if (!checkpointerror.empty())
+            return CHECKPOINT_FAILED;
+        if (!reading)
+            return CHECKPOINT_SAVED;
+        ApplyCheckpoint();
+        return CHECKPOINT_LOADED;
     }
-    if (glIsQuery(sortquery)) {
-        glGetQueryObjecti64v(sortquery, GL_QUERY_RESULT, &v);
-        std::cout << "Sorting: " << double(v) / 1000000.0 << " ms" << std::endl;
     }
-    if (glIsQuery(neighbourcellquery)) {
-        glGetQueryObjecti64v(neighbourcellquery, GL_QUERY_RESULT, &v);
-        std::cout << "Neighbour cell search: " << double(v) / 1000000.0 << " ms" << std::endl;
+    return CHECKPOINT_NONE;
+}
+
+void SPH::WriteCheckpoint(const char *data) {
+    try {
+        // move the particles to the order of their ids and drop the unused fourth components
+        const glm::vec4 *positions = reinterpret_cast<const glm::vec4 *>(data);
+        const char *velocities = data + 4 * sizeof(float) * numparticles;
+        const GLuint *highlights = reinterpret_cast<const GLuint *>(velocities + VELOCITY_SIZE * numparticles);
+        std::vector<glm::vec3> outpositions(numparticles), outvelocities(numparticles);
+        std::vector<unsigned char> outhighlights(numparticles);
+        for (GLuint i = 0; i < numparticles; i++) {
+#ifdef SORTED_PARTICLES
+            const GLuint id = highlights[numparticles + i];
+            if (id >= numparticles)
+                throw std::runtime_error("The checkpoint contains an invalid particle id.");
+#else
+            const GLuint id = i;
+#endif
+            outpositions[id] = glm::vec3(positions[i]);
+#ifdef COMPACT_PARTICLES
+            uint64_t halfvelocity;
+            memcpy(&halfvelocity, velocities + VELOCITY_SIZE * i, sizeof(halfvelocity));
+            outvelocities[id] = glm::vec3(glm::unpackHalf4x16(halfvelocity));
+#else
+            outvelocities[id] = glm::vec3(reinterpret_cast<const glm::vec4 *>(velocities)[i]);
+#endif
+            outhighlights[i] = (unsigned char) highlights[i];
+        }
+
+        std::ofstream file(checkpointfilename.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        if (!file.is_open())
+            throw std::runtime_error(std::string("Cannot open checkpoint file ") + checkpointfilename + ".");
+        file.write(reinterpret_cast<const char *>(&checkpointheader), sizeof(checkpointheader_t));
+        file.write(reinterpret_cast<const char *>(&outpositions[0]), sizeof(glm::vec3) * numparticles);
+        file.write(reinterpret_cast<const char *>(&outvelocities[0]), sizeof(glm::vec3) * numparticles);
+        file.write(reinterpret_cast<const char *>(&outhighlights[0]), numparticles);
+        file.close();
+        if (file.fail())
+            throw std::runtime_error(std::string("Cannot write checkpoint file ") + checkpointfilename + ".");
+    } catch (std::exception &e) {
+        checkpointerror = e.what();
     }
-    if (glIsQuery(solverquery)) {
-        glGetQueryObjecti64v(solverquery, GL_QUERY_RESULT, &v);
-        std::cout << "Solver: " << double(v) / 1000000.0 << " ms" << std::endl;
+    checkpointthreaddone = true;
+}
+
+void SPH::ReadCheckpoint(char *data) {
+    try {
+        std::ifstream file(checkpointfilename.c_str(), std::ios_base::in | std::ios_base::binary);
+        if (!file.is_open())
+            throw std::runtime_error(std::string("Cannot open checkpoint file ") + checkpointfilename + ".");
+
+        checkpointheader_t &header = checkpointheader;
+        if (!file.read(reinterpret_cast<char *>(&header), sizeof(checkpointheader_t)) || header.magic != CHECKPOINT_MAGIC)
+            throw std::runtime_error(checkpointfilename + " is no checkpoint file.");
+        if (header.version != CHECKPOINT_VERSION)
+            throw std::runtime_error(std::string("The checkpoint file ") + checkpointfilename + " has an unsupported version.");
+        if (header.numparticles != numparticles)
+            throw std::runtime_error("The checkpoint does not match the number of particles in the simulation.");
+
+        std::vector<glm::vec3> inpositions(numparticles), invelocities(numparticles);
+        std::vector<unsigned char> inhighlights(numparticles);
+        file.read(reinterpret_cast<char *>(&inpositions[0]), sizeof(glm::vec3) * numparticles);
+        file.read(reinterpret_cast<char *>(&invelocities[0]), sizeof(glm::vec3) * numparticles);
+        file.read(reinterpret_cast<char *>(&inhighlights[0]), numparticles);
+        if (!file)
+            throw std::runtime_error(std::string("The checkpoint file ") + checkpointfilename + " is truncated.");
+
+        // the restored particles start in the order of their ids
+        char *velocities = data + 4 * sizeof(float) * numparticles;
+        GLuint *highlights = reinterpret_cast<GLuint *>(velocities + VELOCITY_SIZE * numparticles);
+        for (GLuint i = 0; i < numparticles; i++) {
+            const glm::vec4 position(inpositions[i], 0);
+            memcpy(data + sizeof(glm::vec4) * i, &position, sizeof(position));
+#ifdef COMPACT_PARTICLES
+            const uint64_t halfvelocity = glm::packHalf4x16(glm::vec4(invelocities[i], 0));
+            memcpy(velocities + VELOCITY_SIZE * i, &halfvelocity, sizeof(halfvelocity));
+#else
+            const glm::vec4 velocity(invelocities[i], 0);
+            memcpy(velocities + VELOCITY_SIZE * i, &velocity, sizeof(velocity));
+#endif
+            highlights[i] = inhighlights[i];
+#ifdef SORTED_PARTICLES
+            highlights[numparticles + i] = i;
+#endif
+        }
+    } catch (std::exception &e) {
+        checkpointerror = e.what();
     }
-    if (glIsQuery(vorticityquery)) {
-        glGetQueryObjecti64v(vorticityquery, GL_QUERY_RESULT, &v);
-        std::cout << "Vorticity confinement: " << double(v) / 1000000.0 << " ms" << std::endl;
+    checkpointthreaddone = true;
+}
+
+void SPH::ApplyCheckpoint(void) {
+    glBindBuffer(GL_COPY_READ_BUFFER, checkpointbuffer);
+    if (checkpointmapping == NULL)
+        glBufferSubData(GL_COPY_READ_BUFFER, 0, checkpointdata.size(), &checkpointdata[0]);
+
+    // copy the particle state from the staging buffer
+    GLuint destinations[4];
+    GLsizeiptr sizes[4];
+    GetCheckpointBuffers(destinations, sizes);
+    GLintptr offset = 0;
+    for (int i = 0; i < 4; i++) {
+        if (sizes[i] == 0)
+            continue;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, destinations[i]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, sizes[i]);
+        offset += sizes[i];
     }
+#ifdef SORTED_PARTICLES
+    // the particles are in the order of their ids, so the position buffer is up to date as well
+    glBindBuffer(GL_COPY_WRITE_BUFFER, positionbuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizes[0]);
+    positionbuffervalid = true;
+#endif
+
+    // the staging buffer may only be reused after the copies are complete
+    checkpointfence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    // the particles may have moved arbitrarily far
+    neighboursearchrequest = true;
+
+    sphparams = checkpointheader.sphparams;
+    UploadSPHParams();
+    num_solveriterations = checkpointheader.num_solveriterations;
+    stepcounter = checkpointheader.stepcounter;
+    simulationtime = checkpointheader.simulationtime;
 }
 
 void SPH::SetExternalForce(bool state) {
@@ -244,91 +1265,302 @@ void SPH::SetExternalForce(bool state) {
 }
 
 void SPH::Run(void) {
-    glBeginQuery(GL_TIME_ELAPSED, predictposquery);
+    // collect the timings of previous steps that are available by now
+    profiler.Collect();
+    GPUTrace::Collect();
+    GPUTrace::Begin("step");
+
+    // move or enlarge the grid, if necessary
+    if (adaptivegridinterval > 0)
+        UpdateGrid();
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, 3, domainparambuffer);
+
+    // report neighbour ranges that were clamped by a previous search
+    UpdateNeighbourOverflows();
+
+    profiler.Begin(TIMING_PREDICTPOS);
     {
         // predict positions
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, radixsort.GetBuffer());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, radixsort->GetBuffer());
+#ifdef NEIGHBOUR_SKIN
+        // check the displacements since the last neighbour search
+        {
+            GLuint bufs[2] = {skinbuffer, searchstatebuffer};
+            glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 2, 2, bufs);
+        }
+#endif
 
+#ifdef SORTED_PARTICLES
+        // the positions are read in the order of the keys of the previous step
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, sortedpositionbuffers[sortedstate]);
+#else
         positiontexture.Bind(GL_TEXTURE_BUFFER);
+#endif
         glActiveTexture(GL_TEXTURE1);
         velocitytexture.Bind(GL_TEXTURE_BUFFER);
         glActiveTexture(GL_TEXTURE0);
 
+        GPUTrace::Begin("predictpos");
         predictpos.Use();
-        glDispatchCompute(numparticles >> 8, 1, 1);
+        glDispatchCompute((numparticles + 255) >> 8, 1, 1);
         glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        GPUTrace::End();
+
+#ifdef NEIGHBOUR_SKIN
+        // decide on the GPU whether to search the neighbours in this step, so that the
+        // displacement check above is used without waiting for a read back
+        neighboursearchprog.Use();
+        glProgramUniform1i(neighboursearchprog.get(), neighboursearchprog.GetUniformLocation("searchrequest"),
+                           neighboursearchrequest ? 1 : 0);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+#endif
     }
-    glEndQuery(GL_TIME_ELAPSED);
+    profiler.End(TIMING_PREDICTPOS);
 
-    glBeginQuery(GL_TIME_ELAPSED, sortquery);
+#ifdef NEIGHBOUR_SKIN
+    // the sort and the neighbour search are dispatched indirectly and skipped by the GPU,
+    // if the neighbour cells of the last search are reused (their timings are still recorded)
+    const GLuint searchbuffer = searchstatebuffer;
+#else
+    const GLuint searchbuffer = 0;
+#endif
+
+    profiler.Begin(TIMING_SORT);
     {
         // sort particles
-        radixsort.Run();
+        GPUTrace::Begin("sort");
+        radixsort->Run(searchbuffer);
+        GPUTrace::End();
     }
-    glEndQuery(GL_TIME_ELAPSED);
+    profiler.End(TIMING_SORT);
 
-    glBeginQuery(GL_TIME_ELAPSED, neighbourcellquery);
+    profiler.Begin(TIMING_NEIGHBOURCELLS);
     {
         // find neighbour cells
-        neighbourcellfinder.FindNeighbourCells(radixsort.GetBuffer());
+        GPUTrace::Begin("neighbour search");
+        neighbourcellfinder->FindNeighbourCells(radixsort->GetBuffer(), searchbuffer);
+        GPUTrace::End();
+
+        // the overflow counter is read back in one of the next steps, as soon as it is available
+        if (overflowfence == NULL)
+            overflowfence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+#ifdef NEIGHBOUR_SKIN
+        // remember the keys of this search
+        {
+            GLuint bufs[2] = {radixsort->GetBuffer(), skinbuffer};
+            glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 1, 2, bufs);
+        }
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, searchstatebuffer);
+        skinprog.Use();
+        glDispatchComputeIndirect(0);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+#endif
+        neighboursearchrequest = false;
     }
-    glEndQuery(GL_TIME_ELAPSED);
+    profiler.End(TIMING_NEIGHBOURCELLS);
 
-    glBeginQuery(GL_TIME_ELAPSED, solverquery);
+    profiler.Begin(TIMING_SOLVER);
+    GPUTrace::Begin("solver");
     {
         // set buffer bindings
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, radixsort.GetBuffer());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, radixsort->GetBuffer());
 
         glActiveTexture(GL_TEXTURE2);
-        neighbourcellfinder.GetResult().Bind(GL_TEXTURE_BUFFER);
+        neighbourcellfinder->GetResult().Bind(GL_TEXTURE_BUFFER);
         glActiveTexture(GL_TEXTURE3);
         lambdatexture.Bind(GL_TEXTURE_BUFFER);
+#ifdef NEIGHBOUR_CELL_TABLE
+        glActiveTexture(GL_TEXTURE5);
+        neighbourcellfinder->GetCellIndices().Bind(GL_TEXTURE_BUFFER);
+#endif
+#ifdef NEIGHBOUR_WIDE_ENTRIES
+        glActiveTexture(GL_TEXTURE6);
+        neighbourcellfinder->GetCounts().Bind(GL_TEXTURE_BUFFER);
+#endif
         glActiveTexture(GL_TEXTURE0);
 
         // particle highlighting
         glBindImageTexture(0, highlighttexture.get(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+#ifdef SORTED_PARTICLES
+        // the keys refer to the ids in the order of the previous step
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, sortedidbuffers[sortedstate]);
+#endif
+        GPUTrace::Begin("highlight");
         // clear previously highlighted neighbours
         clearhighlightprog.Use();
-        glDispatchCompute(numparticles >> 8, 1, 1);
+        glDispatchCompute((numparticles + 255) >> 8, 1, 1);
         glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
         // highlight current neighbours
         highlightprog.Use();
-        glDispatchCompute(numparticles >> 8, 1, 1);
+        glDispatchCompute((numparticles + 255) >> 8, 1, 1);
+        GPUTrace::End();
 
         glBindImageTexture(0, lambdatexture.get(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
 
 
+        // reset the solver state, so that all solver passes of this step are dispatched
+        {
+            const GLuint state[8] = {(numparticles + 255) >> 8, 1, 1, DENSITY_ERROR_GROUPS, 1, 1, 0, 0};
+            glBindBuffer(GL_COPY_WRITE_BUFFER, solverstatebuffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(state), state);
+        }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, solverstatebuffer);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, solverstatebuffer);
+
         // solver iteration
+        if (densityerrors || solvertolerance > 0) {
+            // make sure there is an entry for each iteration and for the final state
+            if (densityerrorcapacity < num_solveriterations + 1) {
+                densityerrorcapacity = num_solveriterations + 1;
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, densityerrorsbuffer);
+                glBufferData(GL_SHADER_STORAGE_BUFFER,
+                             sizeof(glm::vec2) * DENSITY_ERROR_GROUPS * densityerrorcapacity, NULL, GL_DYNAMIC_READ);
+            }
+            glBindImageTexture(1, densityerrortexture.get(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, densityerrorsbuffer);
+        }
+
+        // the result of the in-place solver depends on the order in which the particles are corrected
+        const solvermode_t mode = (deterministic && solvermode == SOLVER_INPLACE) ? SOLVER_JACOBI : solvermode;
+
+        if (mode == SOLVER_GAUSS_SEIDEL) {
+            // colour the particles by their grid cells
+            glBindImageTexture(0, colourtexture.get(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32UI);
+            GPUTrace::Begin("colour");
+            colourprog.Use();
+            glDispatchCompute((numparticles + 255) >> 8, 1, 1);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+            GPUTrace::End();
+            glActiveTexture(GL_TEXTURE7);
+            colourtexture.Bind(GL_TEXTURE_BUFFER);
+            glActiveTexture(GL_TEXTURE0);
+            glBindImageTexture(0, lambdatexture.get(), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        }
+
+        // the Jacobi and Gauss-Seidel modes alternate between the sorted keys and the solver buffer
+        GLuint keys[2] = {radixsort->GetBuffer(), solverbuffer};
+        int current = 0;
+        ShaderProgram &pingpongprog = tiledsolver ? tiledpingpongupdateposprog : pingpongupdateposprog;
+        GLint colourlocation = pingpongprog.GetUniformLocation("colour");
 
         for (int iteration = 0; iteration < num_solveriterations; iteration++) {
-            calclambdaprog.Use();
-            glDispatchCompute(numparticles >> 8, 1, 1);
-            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT
-                            | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-            updateposprog.Use();
-            glDispatchCompute(numparticles >> 8, 1, 1);
-            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, keys[current]);
+            CalcLambdas(iteration);
+
+            if (solvertolerance > 0) {
+                // stop dispatching the solver passes, if the density error is below the tolerance
+                GPUTrace::Begin("converge", iteration);
+                convergeprog.Use();
+                glProgramUniform1i(convergeprog.get(), convergeprog.GetUniformLocation("iteration"), iteration);
+                glDispatchCompute(1, 1, 1);
+                glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+                GPUTrace::End();
+            }
+
+            if (mode == SOLVER_INPLACE) {
+                if (tiledsolver)
+                    tiledupdateposprog.Use();
+                else
+                    updateposprog.Use();
+                GPUTrace::Begin("updatepos", iteration);
+                glDispatchComputeIndirect(0);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                GPUTrace::End();
+                continue;
+            }
+
+            // Jacobi: a single pass correcting all particles (colour -1)
+            // Gauss-Seidel: one pass for each of the eight colours
+            // (these passes are always dispatched and only copy the particles once the solver
+            // has converged, since the host relies on the number of passes to find the result)
+            GPUTrace::Begin("updatepos", iteration);
+            pingpongprog.Use();
+            for (int colour = (mode == SOLVER_JACOBI) ? -1 : 0; colour < 8; colour++) {
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, keys[current]);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, keys[1 - current]);
+                glProgramUniform1i(pingpongprog.get(), colourlocation, colour);
+                glDispatchCompute((numparticles + 255) >> 8, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+                current = 1 - current;
+                if (colour < 0)
+                    break;
+            }
+            GPUTrace::End();
+        }
+
+        if (densityerrors) {
+            // measure the density error of the final state
+            // (skipped, if the adaptive solver has converged, since it is already measured)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, keys[current]);
+            CalcLambdas(num_solveriterations);
+            numdensityerrors = num_solveriterations + 1;
+        } else
+            numdensityerrors = 0;
+
+        // the following passes expect the result in the sorted keys
+        if (current != 0) {
+            glBindBuffer(GL_COPY_READ_BUFFER, solverbuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, radixsort->GetBuffer());
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, RadixSort::KEY_SIZE * numparticles);
         }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, radixsort->GetBuffer());
     }
-    glEndQuery(GL_TIME_ELAPSED);
+    GPUTrace::End();
+    profiler.End(TIMING_SOLVER);
 
-    glBeginQuery(GL_TIME_ELAPSED, vorticityquery);
+    profiler.Begin(TIMING_VORTICITY);
     {
-        // update positions and velocities
-        updateprog.Use();
+        // the state of the previous step is read through the keys and the new state is stored
+#ifdef SORTED_PARTICLES
+        // (the positions and ids are moved into the order of the current keys)
+        {
+            GLuint bufs[4] = {sortedpositionbuffers[sortedstate], sortedidbuffers[sortedstate],
+                              sortedpositionbuffers[1 - sortedstate], sortedidbuffers[1 - sortedstate]};
+            glBindBuffersBase(GL_SHADER_STORAGE_BUFFER, 4, 4, bufs);
+        }
+#else
         glBindImageTexture(0, positiontexture.get(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
-        glBindImageTexture(1, velocitytexture.get(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+#endif
+        glBindImageTexture(1, velocitytexture.get(), 0, GL_FALSE, 0, GL_READ_WRITE, VELOCITY_FORMAT);
 
-        glDispatchCompute(numparticles >> 8, 1, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT
-                        | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
         if (vorticityconfinement) {
-            // calculate vorticity
+            // calculate vorticity and apply XSPH viscosity
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, vorticityvectorbuffer);
             glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, vorticitybuffer);
+            GPUTrace::Begin("vorticity");
             vorticityprog.Use();
-            glDispatchCompute(numparticles >> 8, 1, 1);
-            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            glDispatchCompute((numparticles + 255) >> 8, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            GPUTrace::End();
+
+            // apply vorticity confinement and update positions and velocities
+            // (in a separate pass, since it requires the vorticities of all neighbours)
+            GPUTrace::Begin("confinement");
+            confinementprog.Use();
+        } else {
+            // update positions and velocities
+            GPUTrace::Begin("update");
+            updateprog.Use();
         }
+        glDispatchCompute((numparticles + 255) >> 8, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT
+                        | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        GPUTrace::End();
+#ifdef SORTED_PARTICLES
+        sortedstate = 1 - sortedstate;
+        positionbuffervalid = false;
+#endif
     }
-    glEndQuery(GL_TIME_ELAPSED);
+    profiler.End(TIMING_VORTICITY);
+
+    // compute the bounding box of the particles every adaptivegridinterval steps
+    // (or in every step, while particles are outside of the grid)
+    if (adaptivegridinterval > 0 && aabbfence == NULL && (boundsrequest || stepcounter % adaptivegridinterval == 0))
+        ComputeBounds();
+    stepcounter++;
+    simulationtime += sphparams.timestep;
+    GPUTrace::End();
 }
@@ -26,6 +26,9 @@
 #include "ShaderProgram.h"
 #include "NeighbourCellFinder.h"
 #include "RadixSort.h"
+#include "GPUProfiler.h"
+#include <thread>
+#include <atomic>
 
 /** SPH class.
  * This class is responsible for the SPH simulation.
@@ -33,6 +36,86 @@
 class SPH
 {
 public:
+	/** Timing phases.
+	 * Phases of a simulation step whose GPU time is recorded separately.
+	 */
+	typedef enum timingphase {
+		TIMING_PREDICTPOS = 0,
+		TIMING_SORT,
+		TIMING_NEIGHBOURCELLS,
+		TIMING_SOLVER,
+		TIMING_VORTICITY,
+		TIMING_NUM_PHASES
+	} timingphase_t;
+
+	/** Solver modes.
+	 * Specifies how the position corrections of a solver iteration are applied.
+	 */
+	typedef enum solvermode {
+		/** In place.
+		 * The corrected positions are written in place, so that a particle may
+		 * see corrected or uncorrected positions of its neighbours.
+		 */
+		SOLVER_INPLACE = 0,
+		/** Jacobi.
+		 * The corrected positions are written to a second buffer, so that all
+		 * particles see the positions of the previous iteration.
+		 */
+		SOLVER_JACOBI,
+		/** Gauss-Seidel.
+		 * The particles are coloured by the parity of their grid cells and each
+		 * iteration corrects one colour after the other, so that the particles
+		 * see the positions already corrected for the preceding colours.
+		 */
+		SOLVER_GAUSS_SEIDEL,
+		SOLVER_NUM_MODES
+	} solvermode_t;
+
+	/** Data type for SPH uniform parameters.
+	 * This structure represents the memory layout of the uniform buffer
+	 * object in which the SPH parameters are stored.
+	 */
+	typedef struct sphparams {
+		/** One over rest density.
+		 * One over the rest density.
+		 */
+		float one_over_rho_0;
+		/** CFM epsilon.
+		 * Constraint force mixing epsilon.
+		 */
+		float epsilon;
+		/** Gravity.
+		 * Magnitude of the gravity.
+		 */
+		float gravity;
+		/** Timestep.
+		 * Simulation timestep.
+		 */
+		float timestep;
+		/** Tensile instability K.
+		 * A parameter for the tensile instability calculations.
+		 */
+		float tensile_instability_k;
+		/** Tensile instability scale.
+		 * A parameter for the tensile instability calculations.
+		 */
+		float tensile_instability_scale;
+		/** XSPH viscosity factor.
+		 * A parameter for the XSPH viscosity calculations.
+		 */
+		float xsph_viscosity_c;
+		/** Vorticity confinement epsilon.
+		 * A parameter for the vorticity confinement.
+		 */
+		float vorticity_epsilon;
+	} sphparams_t;
+
+	/** Get default parameters.
+	 * Returns the SPH parameters used at simulation start.
+	 * \returns the default SPH parameters
+	 */
+	static sphparams_t GetDefaultParameters (void);
+
 	/** Constructor.
 	 * \param numparticles number of particles in the simulation
 	 * \param gridsize size of the particle grid
@@ -43,12 +126,12 @@ public:
 	~SPH (void);
 
 	/** Get position buffer.
-	 * Returns a buffer object containing the particle positions.
+	 * Returns a buffer object containing the particle positions indexed by particle id.
+	 * With SORTED_PARTICLES the simulation keeps the positions in the order of the
+	 * sorted keys and this buffer is only updated when it is requested.
 	 * \returns the position buffer
 	 */
-	GLuint GetPositionBuffer (void) const {
-		return positionbuffer;
-	}
+	GLuint GetPositionBuffer (void) const;
 
 	/** Get rest density.
 	 * Returns the current rest density.
@@ -176,6 +259,7 @@ public:
 
 	/** Get velocity buffer.
 	 * Returns a buffer object containing the particle velocities.
+	 * With SORTED_PARTICLES the velocities are stored in the order of the sorted keys.
 	 * \returns the velocity buffer
 	 */
 	GLuint GetVelocityBuffer (void) const {
@@ -198,6 +282,29 @@ public:
 		num_solveriterations = iter;
 	}
 
+	/** Get solver tolerance.
+	 * Returns the tolerance for the average density error of the adaptive solver.
+	 * \returns the solver tolerance (0 if a fixed number of iterations is used)
+	 */
+	const float &GetSolverTolerance (void) const {
+		return solvertolerance;
+	}
+	/** Set solver tolerance.
+	 * Specifies the tolerance for the average density error of the adaptive solver.
+	 * If it is positive, the solver stops iterating as soon as the average density
+	 * error drops below it and the number of solver iterations is only used as
+	 * maximum. The decision is made on the GPU, so that there is no readback.
+	 * \param tolerance the solver tolerance (0 to always use the number of solver iterations)
+	 */
+	void SetSolverTolerance (const float &tolerance);
+
+	/** Get total solver iterations.
+	 * Reads back the number of solver iterations run in all simulation steps so far.
+	 * This waits for the GPU and is only meant for statistics.
+	 * \returns the total number of solver iterations
+	 */
+	GLuint GetTotalSolverIterations (void) const;
+
 	/** Get highlight buffer.
 	 * Returns a buffer object containing the particle highlighting information.
 	 * \returns the highlight buffer
@@ -221,68 +328,611 @@ public:
 		vorticityconfinement = flag;
 	}
 
+	/** Check tiled solver.
+	 * Checks whether the solver iterations use the tiled solver shaders.
+	 * \returns True, if the tiled solver is enabled, false, if not.
+	 */
+	const bool &IsTiledSolverEnabled (void) const {
+		return tiledsolver;
+	}
+	/** Enable/disable tiled solver.
+	 * Specifies whether the solver iterations stage the neighbour data of each
+	 * work group in shared memory (see shaders/sph/tile.glsl) instead of reading
+	 * it from global memory for every neighbour pair.
+	 * \param flag Flag indicating whether to use the tiled solver.
+	 */
+	void SetTiledSolverEnabled (const bool &flag) {
+		tiledsolver = flag;
+	}
+
+	/** Check incremental sort.
+	 * Checks whether the particle keys are re-sorted incrementally.
+	 * \returns True, if the incremental sort is enabled, false, if not.
+	 */
+	const bool &IsIncrementalSortEnabled (void) const {
+		return incrementalsort;
+	}
+	/** Enable/disable incremental sort.
+	 * Specifies whether the particles keep their order of the previous step when
+	 * predicting their positions, so that the radix sort can skip or shorten the
+	 * sort of the nearly sorted keys (see RadixSort::SetIncremental).
+	 * \param flag Flag indicating whether to use the incremental sort.
+	 */
+	void SetIncrementalSortEnabled (const bool &flag);
+
+	/** Get sort mode counts.
+	 * Returns how many steps skipped the sort, used only the local sort, needed a
+	 * full sort after the local sort and needed a full sort right away since the
+	 * grid was last created.
+	 * \param counts array that receives the four counts
+	 */
+	void GetSortModeCounts (GLuint counts[4]) const;
+
+	/** Set domain bounds.
+	 * Specifies the region the particles are confined to. By default this is
+	 * the initial grid without a wall of 16 cells in x and z direction.
+	 * \param min lower corner of the domain
+	 * \param max upper corner of the domain
+	 */
+	void SetDomainBounds (const glm::vec3 &min, const glm::vec3 &max);
+
+	/** Set adaptive grid interval.
+	 * If enabled, the bounding box of the particles is computed on the GPU every
+	 * interval steps and read back with a delay. The grid origin is moved, if the
+	 * particles leave the grid, and the grid is enlarged (which requires recompiling
+	 * the sorting and neighbour search shaders), if they no longer fit into it.
+	 * While the bounding box shows particles outside of the grid, which are clamped into
+	 * its boundary cells, it is computed in every step and a warning is logged.
+	 * \param interval number of steps between bounding box computations (0 to disable)
+	 */
+	void SetAdaptiveGridInterval (const unsigned int &interval) {
+		adaptivegridinterval = interval;
+	}
+
+	/** Get neighbour search interval.
+	 * Returns the maximum number of steps between neighbour searches.
+	 * \returns the neighbour search interval
+	 */
+	const unsigned int &GetNeighbourSearchInterval (void) const {
+		return neighboursearchinterval;
+	}
+	/** Set neighbour search interval.
+	 * Specifies how often the particles are sorted and their neighbour cells are searched.
+	 * In between the particles keep their order and the neighbour cells of the last search.
+	 * This requires the neighbour search with a skin of one cell (PBF_NEIGHBOUR_SKIN),
+	 * which finds all particles that were neighbours at the last search as long as no
+	 * particle has moved more than half a cell since then. The GPU checks this after
+	 * predicting the positions and decides itself whether to search the neighbours in the
+	 * same step, since the sort and the search are dispatched indirectly.
+	 * \param interval maximum number of steps between neighbour searches (1 for every step)
+	 */
+	void SetNeighbourSearchInterval (const unsigned int &interval);
+
+	/** Get number of neighbour searches.
+	 * Returns the number of steps in which the particles were sorted and their
+	 * neighbour cells were searched. With PBF_NEIGHBOUR_SKIN this is counted on the
+	 * GPU, so this waits for all pending steps.
+	 * \returns the number of neighbour searches
+	 */
+	unsigned int GetNumNeighbourSearches (void) const;
+
+	/** Get grid size.
+	 * Returns the current size of the particle grid.
+	 * \returns the grid size
+	 */
+	const glm::ivec3 &GetGridSize (void) const {
+		return gridsize;
+	}
+
+	/** Get grid origin.
+	 * Returns the current origin of the particle grid.
+	 * \returns the grid origin
+	 */
+	const glm::ivec3 &GetGridOrigin (void) const {
+		return gridorigin;
+	}
+
 	/** Activate/deactivate an external force.
 	 * Activates or deactivates an external force in negative z direction
 	 * that is applied to all particles with a z-coordinate larger than
-	 * half the grid size.
+	 * the center of the domain.
 	 * \param state true to enable the external force, false to disable it
 	 */
 	void SetExternalForce (bool state);
 
+	/** Set particles.
+	 * Uploads new particle positions and velocities and clears all highlighting information.
+	 * \param positions particle positions (one entry for each particle)
+	 * \param velocities particle velocities (one entry for each particle)
+	 */
+	void SetParticles (const std::vector<glm::vec4> &positions, const std::vector<glm::vec4> &velocities);
+
+	/** Get particles.
+	 * Reads back the current particle positions and velocities.
+	 * Waits for all pending simulation steps to finish.
+	 * \param positions vector to store the particle positions in
+	 * \param velocities vector to store the particle velocities in
+	 */
+	void GetParticles (std::vector<glm::vec4> &positions, std::vector<glm::vec4> &velocities) const;
+
+	/** Checkpoint results.
+	 * Results of polling a checkpoint (see PollCheckpoint).
+	 */
+	typedef enum checkpointresult {
+		/** No checkpoint is pending. */
+		CHECKPOINT_NONE = 0,
+		/** A checkpoint is still being saved or loaded. */
+		CHECKPOINT_PENDING,
+		/** A checkpoint has been saved. */
+		CHECKPOINT_SAVED,
+		/** A checkpoint has been loaded and the simulation state is restored. */
+		CHECKPOINT_LOADED,
+		/** Saving or loading a checkpoint failed (see GetCheckpointError). */
+		CHECKPOINT_FAILED
+	} checkpointresult_t;
+
+	/** Save checkpoint.
+	 * Starts writing the particle positions, velocities and highlighting information,
+	 * the SPH parameters, the number of solver iterations and the step counter to a
+	 * checkpoint file. The state is copied to a staging buffer on the GPU and read back
+	 * as soon as the copy is complete, and the file is written by a separate thread, so
+	 * that the simulation is not stalled. The checkpoint has to be completed by calling
+	 * PollCheckpoint regularly or WaitForCheckpoint. A checkpoint that is still pending
+	 * is completed first.
+	 * \param filename name of the checkpoint file
+	 */
+	void SaveCheckpoint (const std::string &filename);
+
+	/** Load checkpoint.
+	 * Starts restoring the simulation state from a checkpoint file written by SaveCheckpoint.
+	 * The file is read into the staging buffer by a separate thread, and the state is copied
+	 * to the particle buffers on the GPU by the call to PollCheckpoint or WaitForCheckpoint
+	 * that finds the file read. The checkpoint has to contain the same number of particles.
+	 * A checkpoint that is still pending is completed first.
+	 * \param filename name of the checkpoint file
+	 */
+	void LoadCheckpoint (const std::string &filename);
+
+	/** Poll checkpoint.
+	 * Advances a pending checkpoint without waiting. This should be called once per frame,
+	 * whether the simulation is running or not. Never throws an exception.
+	 * \returns CHECKPOINT_SAVED, CHECKPOINT_LOADED or CHECKPOINT_FAILED once, when the
+	 *          checkpoint is complete, otherwise CHECKPOINT_PENDING or CHECKPOINT_NONE
+	 */
+	checkpointresult_t PollCheckpoint (void);
+
+	/** Wait for checkpoint.
+	 * Waits until a pending checkpoint has been saved or loaded. Throws an exception, if
+	 * this failed.
+	 */
+	void WaitForCheckpoint (void);
+
+	/** Get checkpoint error.
+	 * Returns the error of the last checkpoint for which PollCheckpoint returned CHECKPOINT_FAILED.
+	 * \returns the error message
+	 */
+	const std::string &GetCheckpointError (void) const {
+		return checkpointerror;
+	}
+
 	/** Run simulation.
 	 * Runs the SPH simulation.
 	 */
 	void Run (void);
 
+	/** Advance simulation.
+	 * Advances the simulation by the given time using as many substeps as the CFL
+	 * condition for the maximum particle velocity requires (up to the maximum number
+	 * of substeps). The maximum velocity is reduced on the GPU and read back without
+	 * stalling, so it may be a few frames old. If the CFL condition cannot be met with
+	 * the maximum number of substeps, the simulation advances less than the given time.
+	 * With SPH_CONSTANT_PARAMETERS the time step is a shader constant and a single
+	 * step is run.
+	 * \param time the time by which to advance the simulation
+	 * \returns the number of substeps
+	 */
+	unsigned int Advance (const float &time);
+
+	/** Get CFL number.
+	 * Returns the CFL number used by Advance.
+	 * \returns the CFL number
+	 */
+	const float &GetCFLNumber (void) const {
+		return cflnumber;
+	}
+	/** Set CFL number.
+	 * Specifies the fraction of the smoothing length a particle may travel in a
+	 * substep of Advance.
+	 * \param cfl the CFL number
+	 */
+	void SetCFLNumber (const float &cfl) {
+		cflnumber = cfl;
+	}
+
+	/** Get maximum time step.
+	 * Returns the maximum time step used by Advance.
+	 * \returns the maximum time step
+	 */
+	const float &GetMaxTimestep (void) const {
+		return maxtimestep;
+	}
+	/** Set maximum time step.
+	 * Specifies the maximum time step used by Advance, which limits the time step
+	 * of calm scenes.
+	 * \param timestep the maximum time step
+	 */
+	void SetMaxTimestep (const float &timestep) {
+		maxtimestep = timestep;
+	}
+
+	/** Get maximum number of substeps.
+	 * Returns the maximum number of substeps per call to Advance.
+	 * \returns the maximum number of substeps
+	 */
+	const unsigned int &GetMaxSubsteps (void) const {
+		return maxsubsteps;
+	}
+	/** Set maximum number of substeps.
+	 * Specifies the maximum number of substeps per call to Advance.
+	 * \param substeps the maximum number of substeps
+	 */
+	void SetMaxSubsteps (const unsigned int &substeps) {
+		maxsubsteps = (substeps > 0) ? substeps : 1;
+	}
+
+	/** Get maximum velocity.
+	 * Returns the last maximum particle velocity read back by Advance.
+	 * \returns the maximum particle velocity
+	 */
+	const float &GetMaxVelocity (void) const {
+		return maxvelocity;
+	}
+
+	/** Get simulation time.
+	 * Returns the sum of the time steps of all simulation steps run so far.
+	 * \returns the simulation time
+	 */
+	const double &GetSimulationTime (void) const {
+		return simulationtime;
+	}
+
+	/** Get step counter.
+	 * Returns the number of simulation steps run so far.
+	 * \returns the step counter
+	 */
+	const unsigned int &GetStepCounter (void) const {
+		return stepcounter;
+	}
+
+	/** Get timing.
+	 * Returns the GPU time spent in a phase of the most recent simulation step whose
+	 * result is available. Never waits for the GPU; use the totals of the profiler to
+	 * accumulate the times of all steps.
+	 * \param phase the phase for which to return the time
+	 * \returns the time spent in the phase in nanoseconds or 0, if no result is available yet
+	 */
+	GLint64 GetTiming (const timingphase_t &phase) const;
+
+	/** Get timing phase name.
+	 * Returns a human readable name of a timing phase.
+	 * \param phase the timing phase
+	 * \returns the name of the timing phase
+	 */
+	static const char *GetTimingPhaseName (const timingphase_t &phase);
+
+	/** Get solver mode name.
+	 * Returns a name of a solver mode as used on the command line.
+	 * \param mode the solver mode
+	 * \returns the name of the solver mode
+	 */
+	static const char *GetSolverModeName (const solvermode_t &mode);
+
+	/** Get solver mode.
+	 * Returns how the position corrections of the solver are applied.
+	 * \returns the solver mode
+	 */
+	const solvermode_t &GetSolverMode (void) const {
+		return solvermode;
+	}
+	/** Set solver mode.
+	 * Specifies how the position corrections of the solver are applied.
+	 * \param mode the solver mode
+	 */
+	void SetSolverMode (const solvermode_t &mode) {
+		solvermode = mode;
+	}
+
+	/** Check deterministic mode.
+	 * Checks whether the simulation is run in the deterministic mode.
+	 * \returns True, if the deterministic mode is enabled, false, if not.
+	 */
+	const bool &IsDeterministic (void) const {
+		return deterministic;
+	}
+	/** Enable/disable deterministic mode.
+	 * Specifies whether the simulation is bitwise reproducible. In the deterministic mode
+	 * the in-place solver is replaced by the Jacobi solver, whose result does not depend on
+	 * the order in which the particles are corrected, and the results that are read back
+	 * with a delay (the maximum velocity and the particle bounding box) are waited for in
+	 * the next step, so that they are always used in the same step.
+	 * Together with the fixed seed of the scene, two runs on the same GPU and driver then
+	 * result in the same particle state (see GetStateHash).
+	 * \param flag Flag indicating whether to use the deterministic mode.
+	 */
+	void SetDeterministic (const bool &flag) {
+		deterministic = flag;
+	}
+
+	/** Get state hash.
+	 * Computes a 64-bit FNV-1a hash of the particle positions and velocities in the
+	 * order of the particle ids. Waits for all pending simulation steps to finish.
+	 * \returns the state hash
+	 */
+	uint64_t GetStateHash (void) const;
+
+	/** Format state hash.
+	 * Returns a state hash as a string of 16 hexadecimal digits.
+	 * \param hash the state hash
+	 * \returns the formatted state hash
+	 */
+	static std::string FormatStateHash (const uint64_t &hash);
+
+	/** Enable/disable density error measurement.
+	 * Specifies whether the density error is measured before and after each solver
+	 * iteration. This requires an additional density evaluation per step.
+	 * \param flag Flag indicating whether to measure the density error.
+	 */
+	void SetDensityErrorsEnabled (const bool &flag);
+	/** Check density error measurement.
+	 * Checks whether the density error is measured in each solver iteration.
+	 * \returns True, if the density error is measured, false, if not.
+	 */
+	const bool &IsDensityErrorsEnabled (void) const {
+		return densityerrors;
+	}
+
+	/** Get density errors.
+	 * Reads back the density errors of the last simulation step, which are only
+	 * available if the measurement is enabled. Entry i contains the maximum and
+	 * the average of the positive part of the density constraint after i solver
+	 * iterations, i.e. there is one more entry than solver iterations (with the
+	 * adaptive solver only than the iterations actually run).
+	 * \param errors vector in which to store the maximum and average errors
+	 */
+	void GetDensityErrors (std::vector<glm::vec2> &errors) const;
+
+	/** Get profiler.
+	 * Returns the profiler that measures the GPU time spent in each timing phase.
+	 * \returns the profiler
+	 */
+	GPUProfiler &GetProfiler (void) {
+		return profiler;
+	}
+	/** Get profiler.
+	 * Returns the profiler that measures the GPU time spent in each timing phase.
+	 * \returns the profiler
+	 */
+	const GPUProfiler &GetProfiler (void) const {
+		return profiler;
+	}
+
 	/** Output timing information.
-	 * Outputs timing information about the simulation steps to the
-	 * standard output.
+	 * Outputs the rolling statistics of the time spent in each simulation phase
+	 * to the standard output.
 	 */
 	void OutputTiming (void);
 private:
-	/** Upload SPH parameters.
-	 * Uploads the SPH parameter buffer to the contents of the sphparams
-	 * structure to the GPU.
-	 */
-	void UploadSPHParams (void);
-	/** Data type for SPH uniform parameters.
+	/** Data type for domain uniform parameters.
 	 * This structure represents the memory layout of the uniform buffer
-	 * object in which the SPH parameters are stored.
+	 * object in which the grid origin and the domain bounds are stored.
 	 */
-	typedef struct sphparams {
-		/** One over rest density.
-		 * One over the rest density.
+	typedef struct domainparams {
+		/** Grid origin.
+		 * Origin of the particle grid in world space.
 		 */
-		float one_over_rho_0;
-		/** CFM epsilon.
-		 * Constraint force mixing epsilon.
+		glm::vec4 gridorigin;
+		/** Domain minimum.
+		 * Lower corner of the region the particles are confined to.
 		 */
-		float epsilon;
-		/** Gravity.
-		 * Magnitude of the gravity.
+		glm::vec4 domainmin;
+		/** Domain maximum.
+		 * Upper corner of the region the particles are confined to.
 		 */
-		float gravity;
-		/** Timestep.
-		 * Simulation timestep.
+		glm::vec4 domainmax;
+	} domainparams_t;
+
+	/** Data type for checkpoint headers.
+	 * This structure represents the memory layout of the header of a checkpoint file.
+	 * It is followed by the positions, the velocities (three floats each) and the
+	 * highlighting flags (one byte each) of all particles in the order of their ids.
+	 */
+	typedef struct checkpointheader {
+		/** Magic number.
+		 * Identifies checkpoint files (CHECKPOINT_MAGIC).
 		 */
-		float timestep;
-		/** Tensile instability K.
-		 * A parameter for the tensile instability calculations.
+		GLuint magic;
+		/** Version.
+		 * Version of the checkpoint format (CHECKPOINT_VERSION).
 		 */
-		float tensile_instability_k;
-		/** Tensile instability scale.
-		 * A parameter for the tensile instability calculations.
+		GLuint version;
+		/** Number of particles.
+		 * Number of particles in the checkpoint.
 		 */
-		float tensile_instability_scale;
-		/** XSPH viscosity factor.
-		 * A parameter for the XSPH viscosity calculations.
+		GLuint numparticles;
+		/** Number of solver iterations.
+		 * Number of solver iterations used for the constraint solver.
 		 */
-		float xsph_viscosity_c;
-		/** Vorticity confinement epsilon.
-		 * A parameter for the vorticity confinement.
+		GLuint num_solveriterations;
+		/** Step counter.
+		 * Number of simulation steps run so far.
 		 */
-		float vorticity_epsilon;
-	} sphparams_t;
+		GLuint stepcounter;
+		/** Padding.
+		 * Aligns the simulation time (always zero).
+		 */
+		GLuint padding;
+		/** Simulation time.
+		 * Sum of the time steps of all simulation steps run so far.
+		 */
+		double simulationtime;
+		/** SPH parameters.
+		 * Contents of the SPH parameter buffer.
+		 */
+		sphparams_t sphparams;
+	} checkpointheader_t;
+
+	/** Checkpoint magic number.
+	 * Magic number at the start of each checkpoint file ("PBFC").
+	 */
+	static const GLuint CHECKPOINT_MAGIC = 0x43464250;
+
+	/** Checkpoint version.
+	 * Version of the checkpoint format written by SaveCheckpoint.
+	 */
+	static const GLuint CHECKPOINT_VERSION = 1;
+
+	/** Checkpoint states.
+	 * Stages of a pending checkpoint.
+	 */
+	typedef enum checkpointstate {
+		/** No checkpoint is pending. */
+		CHECKPOINT_STATE_IDLE = 0,
+		/** The state is being copied to the staging buffer. */
+		CHECKPOINT_STATE_COPYING,
+		/** The staging buffer is being written to the file. */
+		CHECKPOINT_STATE_WRITING,
+		/** The file is being read into the staging buffer. */
+		CHECKPOINT_STATE_READING
+	} checkpointstate_t;
+
+	/** Create grid.
+	 * (Re-)creates the radix sort and the neighbour cell finder for a grid size.
+	 * \param size the new grid size
+	 */
+	void CreateGrid (const glm::ivec3 &size);
+
+	/** Update grid.
+	 * Reads back the last particle bounding box, if it is available, and moves
+	 * or enlarges the grid, if the particles no longer fit into it.
+	 */
+	void UpdateGrid (void);
+
+	/** Compute bounds.
+	 * Starts the computation of the particle bounding box on the GPU.
+	 */
+	void ComputeBounds (void);
+
+	/** Compute maximum velocity.
+	 * Starts the computation of the maximum particle velocity on the GPU.
+	 */
+	void ComputeMaxVelocity (void);
+
+	/** Update maximum velocity.
+	 * Reads back the last maximum particle velocity, if it is available.
+	 */
+	void UpdateMaxVelocity (void);
+
+	/** Check fence.
+	 * Checks whether a fence of a delayed read back is signaled. In the deterministic
+	 * mode this waits for the fence.
+	 * \param fence the fence
+	 * \returns True, if the fence is signaled, false, if not.
+	 */
+	bool IsSignaled (GLsync fence) const;
+
+	/** Get checkpoint staging size.
+	 * Returns the size of the staging buffer to which the particle state of a
+	 * checkpoint is copied on the GPU.
+	 * \returns the size of the staging buffer in bytes
+	 */
+	GLsizeiptr GetCheckpointStagingSize (void) const;
+
+	/** Allocate checkpoint buffer.
+	 * Allocates the staging buffer of the checkpoints, if this has not been done yet.
+	 */
+	void AllocateCheckpointBuffer (void);
+
+	/** Get checkpoint buffers.
+	 * Returns the buffers holding the particle state in the order in which they are stored
+	 * in the staging buffer and the sizes of their contents (0 for unused buffers).
+	 * \param buffers array that receives the buffer objects
+	 * \param sizes array that receives the sizes in bytes
+	 */
+	void GetCheckpointBuffers (GLuint buffers[4], GLsizeiptr sizes[4]) const;
+
+	/** Update checkpoint.
+	 * Advances a pending checkpoint: starts the writer thread once the copy to the staging
+	 * buffer is complete, joins the writer or reader thread once it is done and uploads the
+	 * state read from a checkpoint file.
+	 * \param wait Flag indicating whether to wait until the checkpoint is complete.
+	 * \returns the checkpoint result (see PollCheckpoint)
+	 */
+	checkpointresult_t UpdateCheckpoint (const bool &wait);
+
+	/** Write checkpoint.
+	 * Writes the pending checkpoint to its file. Runs on the checkpoint thread
+	 * and records errors in checkpointerror.
+	 * \param data the particle state read back from the staging buffer
+	 */
+	void WriteCheckpoint (const char *data);
+
+	/** Read checkpoint.
+	 * Reads the pending checkpoint from its file and converts the particle state to the
+	 * layout of the staging buffer. Runs on the checkpoint thread and records errors in
+	 * checkpointerror.
+	 * \param data the memory to which the particle state is written
+	 */
+	void ReadCheckpoint (char *data);
+
+	/** Apply checkpoint.
+	 * Copies the particle state read from a checkpoint file from the staging buffer to the
+	 * particle buffers and restores the simulation parameters.
+	 */
+	void ApplyCheckpoint (void);
+
+	/** Update neighbour overflows.
+	 * Reads back the number of neighbour ranges that were clamped to fit into the packed
+	 * neighbour cell entries, if the last check is complete, and logs a warning for new ones.
+	 */
+	void UpdateNeighbourOverflows (void);
+
+	/** Update key order.
+	 * Specifies whether predictpos keeps the particle order of the previous step,
+	 * which is needed by the incremental sort and between neighbour searches.
+	 */
+	void UpdateKeepOrder (void);
+
+	/** Update position buffer.
+	 * Scatters the sorted particle positions to the position buffer indexed by
+	 * particle id, if they have changed since the last update (only used if
+	 * SORTED_PARTICLES is defined).
+	 */
+	void UpdatePositionBuffer (void) const;
+
+	/** Upload domain parameters.
+	 * Uploads the domain parameter buffer to the contents of the domainparams
+	 * structure to the GPU.
+	 */
+	void UploadDomainParams (void);
+
+	/** Calculate lambdas.
+	 * Dispatches the lambda calculation for the particle keys bound to binding point 1
+	 * and measures the density error, if enabled.
+	 * \param iteration index of the density error entry
+	 */
+	void CalcLambdas (const GLuint &iteration);
+
+	/** Update density error output.
+	 * Enables the density error output of the lambda calculation, if it is needed
+	 * for the density error measurement or the adaptive solver.
+	 */
+	void UpdateDensityErrorOutput (void);
+
+	/** Upload SPH parameters.
+	 * Uploads the SPH parameter buffer to the contents of the sphparams
+	 * structure to the GPU.
+	 */
+	void UploadSPHParams (void);
 
 	/** SPH uniform parameters.
 	 * This structure stores a copy of the contents of the uniform buffer
@@ -307,14 +957,56 @@ private:
      */
     ShaderProgram updateposprog;
 
+    /** Tiled lambda calculation program.
+     * Variant of calclambdaprog that stages the neighbour data in shared memory.
+     */
+    ShaderProgram tiledcalclambdaprog;
+
+    /** Tiled position update program.
+     * Variant of updateposprog that stages the neighbour data in shared memory.
+     */
+    ShaderProgram tiledupdateposprog;
+
+    /** Ping-pong position update program.
+     * Variant of updateposprog that writes the corrected positions to a separate buffer.
+     */
+    ShaderProgram pingpongupdateposprog;
+
+    /** Tiled ping-pong position update program.
+     * Variant of tiledupdateposprog that writes the corrected positions to a separate buffer.
+     */
+    ShaderProgram tiledpingpongupdateposprog;
+
+    /** Colour program.
+     * Shader program for colouring the particles for the Gauss-Seidel solver.
+     */
+    ShaderProgram colourprog;
+
+    /** Density error program.
+     * Shader program for reducing the density errors of a solver iteration.
+     */
+    ShaderProgram densityerrorprog;
+
+    /** Convergence program.
+     * Shader program for the convergence test of the adaptive solver.
+     */
+    ShaderProgram convergeprog;
+
     /** Vorticity program.
-     * Shader program for calculating particle vorticity.
+     * Shader program for calculating particle vorticity and applying the XSPH viscosity.
      */
     ShaderProgram vorticityprog;
 
+    /** Confinement program.
+     * Shader program for applying the vorticity confinement force, which requires the
+     * vorticities of all particles computed by the vorticity program.
+     */
+    ShaderProgram confinementprog;
+
     /** Update program.
      * Shader program for updating particle information.
-     * This is done by the vorticity program, if vorticity confinement is enabled.
+     * This is done by the vorticity and confinement programs, if vorticity confinement
+     * is enabled.
      */
     ShaderProgram updateprog;
 
@@ -328,22 +1020,240 @@ private:
      */
     ShaderProgram clearhighlightprog;
 
+    /** Bounding box program.
+     * Shader program for computing the bounding box of the particles.
+     */
+    ShaderProgram aabbprog;
+
+    /** Maximum velocity program.
+     * Shader program for computing the maximum particle velocity.
+     */
+    ShaderProgram maxvelocityprog;
+
+    /** Unsort program.
+     * Shader program for scattering the sorted particle positions to the position buffer.
+     */
+    ShaderProgram unsortprog;
+
+    /** Neighbour search program.
+     * Shader program that decides on the GPU whether the neighbours are searched in the
+     * current step (only used if NEIGHBOUR_SKIN is defined).
+     */
+    ShaderProgram neighboursearchprog;
+
+    /** Skin program.
+     * Shader program for remembering the keys of a neighbour search (only used if
+     * NEIGHBOUR_SKIN is defined).
+     */
+    ShaderProgram skinprog;
+
 
     /** Neighbour Cell finder.
      * Takes care of finding neighbour cells for the particles.
      */
-    NeighbourCellFinder neighbourcellfinder;
+    NeighbourCellFinder *neighbourcellfinder;
 
     /** Vorticity confinement flag.
      * flag indicating whether vorticity confinement should be used.
      */
     bool vorticityconfinement;
 
+    /** Tiled solver flag.
+     * Flag indicating whether the solver iterations use the tiled solver shaders.
+     */
+    bool tiledsolver;
+
+    /** Incremental sort flag.
+     * Flag indicating whether the particle keys are re-sorted incrementally.
+     */
+    bool incrementalsort;
+
+    /** Solver mode.
+     * Specifies how the position corrections of the solver are applied.
+     */
+    solvermode_t solvermode;
+
+    /** Density error flag.
+     * Flag indicating whether the density error is measured in each solver iteration.
+     */
+    bool densityerrors;
+
+    /** Deterministic flag.
+     * Flag indicating whether the simulation is run in the deterministic mode.
+     */
+    bool deterministic;
+
+    /** Number of density error entries.
+     * Number of solver iterations plus one for which the density errors
+     * of the last step were measured.
+     */
+    GLuint numdensityerrors;
+
+    /** Density error capacity.
+     * Number of entries for which the density error buffer is allocated.
+     */
+    GLuint densityerrorcapacity;
+
+    /** Solver tolerance.
+     * Tolerance for the average density error of the adaptive solver (0 for a fixed
+     * number of iterations).
+     */
+    float solvertolerance;
+
     /** Radix sort.
      * Takes care of sorting the particle list.
      * The contained buffer object is used as particle buffer.
      */
-    RadixSort radixsort;
+    RadixSort *radixsort;
+
+    /** Domain parameters.
+     * This structure stores a copy of the contents of the uniform buffer
+     * in which the grid origin and the domain bounds are stored.
+     */
+    domainparams_t domainparams;
+
+    /** Grid size.
+     * Current size of the particle grid.
+     */
+    glm::ivec3 gridsize;
+
+    /** Grid origin.
+     * Current origin of the particle grid.
+     */
+    glm::ivec3 gridorigin;
+
+    /** Adaptive grid interval.
+     * Number of steps between bounding box computations (0 if the grid is fixed).
+     */
+    unsigned int adaptivegridinterval;
+
+    /** Step counter.
+     * Number of simulation steps run so far.
+     */
+    unsigned int stepcounter;
+
+    /** Bounding box fence.
+     * Fence that is signaled when the last bounding box computation is complete
+     * (NULL if there is no pending computation).
+     */
+    GLsync aabbfence;
+
+    /** Bounding box request.
+     * Flag indicating whether the last bounding box showed particles outside of the grid,
+     * in which case the bounding box is computed in every step until they are inside again.
+     */
+    bool boundsrequest;
+
+    /** CFL number.
+     * Fraction of the smoothing length a particle may travel in a substep of Advance.
+     */
+    float cflnumber;
+
+    /** Maximum time step.
+     * Maximum time step used by Advance.
+     */
+    float maxtimestep;
+
+    /** Maximum number of substeps.
+     * Maximum number of substeps per call to Advance.
+     */
+    unsigned int maxsubsteps;
+
+    /** Maximum velocity.
+     * Last maximum particle velocity read back from the GPU.
+     */
+    float maxvelocity;
+
+    /** Maximum velocity fence.
+     * Fence that is signaled when the last maximum velocity computation is complete
+     * (NULL if there is no pending computation).
+     */
+    GLsync maxvelocityfence;
+
+    /** Neighbour search interval.
+     * Maximum number of steps between neighbour searches.
+     */
+    unsigned int neighboursearchinterval;
+
+    /** Neighbour search request.
+     * Flag indicating whether the neighbours have to be searched in the next step,
+     * since the grid or the particles have changed.
+     */
+    bool neighboursearchrequest;
+
+    /** Neighbour overflow fence.
+     * Fence that is signaled when the neighbour search that was last checked for clamped
+     * neighbour ranges is complete (NULL if there is no pending check).
+     */
+    GLsync overflowfence;
+
+    /** Number of neighbour overflows.
+     * Number of clamped neighbour ranges of the current neighbour cell finder that have
+     * already been reported.
+     */
+    GLuint numneighbouroverflows;
+
+    /** Simulation time.
+     * Sum of the time steps of all simulation steps run so far.
+     */
+    double simulationtime;
+
+    /** Checkpoint state.
+     * Stage of the pending checkpoint.
+     */
+    checkpointstate_t checkpointstate;
+
+    /** Checkpoint fence.
+     * Fence that is signaled when the particle state has been copied to the checkpoint
+     * buffer or, after a checkpoint has been loaded, from it (NULL if there is no pending copy).
+     */
+    GLsync checkpointfence;
+
+    /** Checkpoint header.
+     * Header of the pending or last loaded checkpoint.
+     */
+    checkpointheader_t checkpointheader;
+
+    /** Checkpoint file name.
+     * Name of the file to which the pending checkpoint is written or from which it is read.
+     */
+    std::string checkpointfilename;
+
+    /** Checkpoint mapping.
+     * Persistent mapping of the checkpoint buffer (NULL if ARB_buffer_storage is not supported
+     * or the buffer has not been allocated yet).
+     */
+    char *checkpointmapping;
+
+    /** Checkpoint data.
+     * Copy of the checkpoint buffer used if it cannot be mapped persistently.
+     */
+    std::vector<char> checkpointdata;
+
+    /** Checkpoint thread.
+     * Thread that writes the pending checkpoint to its file or reads it from the file.
+     */
+    std::thread checkpointthread;
+
+    /** Checkpoint thread done flag.
+     * Flag set by the checkpoint thread when it is done.
+     */
+    std::atomic<bool> checkpointthreaddone;
+
+    /** Checkpoint error.
+     * Error message of the last checkpoint (empty if there was no error).
+     */
+    std::string checkpointerror;
+
+    /** Sorted state.
+     * Index of the sorted position and id buffers that contain the current particle state.
+     */
+    int sortedstate;
+
+    /** Position buffer flag.
+     * Flag indicating whether the position buffer contains the current sorted positions.
+     */
+    mutable bool positionbuffervalid;
 
     /** Lambda texture.
      * Texture used to access the lambda buffer.
@@ -365,6 +1275,16 @@ private:
      */
     Texture highlighttexture;
 
+    /** Colour texture.
+     * Texture used to access the colour buffer.
+     */
+    Texture colourtexture;
+
+    /** Density error texture.
+     * Texture used to access the per particle density error buffer.
+     */
+    Texture densityerrortexture;
+
     /** Number of solver iterations.
      * Number of solver iterations used for the constraint solver.
      */
@@ -393,51 +1313,108 @@ private:
             GLuint lambdabuffer;
 
             /** Vorticity buffer.
-             * Buffer in which the vorticity of each particle is stored.
+             * Buffer in which the magnitude of the vorticity of each particle is stored.
              */
             GLuint vorticitybuffer;
 
+            /** Vorticity vector buffer.
+             * Buffer in which the vorticity of each particle is stored.
+             */
+            GLuint vorticityvectorbuffer;
+
             /** SPH parameter buffer.
              * Uniform buffer in which the SPH parameters are stored.
              */
             GLuint sphparambuffer;
+
+            /** Domain parameter buffer.
+             * Uniform buffer in which the grid origin and the domain bounds are stored.
+             */
+            GLuint domainparambuffer;
+
+            /** Bounding box buffer.
+             * Buffer in which the bounding box of the particles is computed.
+             */
+            GLuint aabbbuffer;
+
+            /** Solver buffer.
+             * Buffer to which the corrected particle keys are written by the
+             * Jacobi and Gauss-Seidel solver modes.
+             */
+            GLuint solverbuffer;
+
+            /** Colour buffer.
+             * Buffer in which the colour of each particle is stored for the Gauss-Seidel solver.
+             */
+            GLuint colourbuffer;
+
+            /** Density error buffer.
+             * Buffer in which the density error of each particle is stored.
+             */
+            GLuint densityerrorbuffer;
+
+            /** Density errors buffer.
+             * Buffer in which the partial maxima and sums of the density errors
+             * of each solver iteration are stored.
+             */
+            GLuint densityerrorsbuffer;
+
+            /** Solver state buffer.
+             * Buffer containing the indirect dispatch arguments of the solver passes
+             * and the convergence state of the adaptive solver.
+             */
+            GLuint solverstatebuffer;
+
+            /** Maximum velocity buffer.
+             * Buffer in which the maximum particle velocity is computed.
+             */
+            GLuint maxvelocitybuffer;
+
+            /** Neighbour skin buffer.
+             * Buffer containing the keys of the particles at the last neighbour search
+             * (only used if NEIGHBOUR_SKIN is defined).
+             */
+            GLuint skinbuffer;
+
+            /** Neighbour search state buffer.
+             * Buffer containing the indirect dispatch arguments of the neighbour search,
+             * the flag set by particles that moved too far since the last search, the
+             * number of steps since then and the number of searches (only used if
+             * NEIGHBOUR_SKIN is defined).
+             */
+            GLuint searchstatebuffer;
+
+            /** Sorted position buffers.
+             * Buffers in which the particle positions are stored in the order of the
+             * sorted keys of the previous and the current step (only used if
+             * SORTED_PARTICLES is defined).
+             */
+            GLuint sortedpositionbuffers[2];
+
+            /** Sorted id buffers.
+             * Buffers in which the particle ids are stored in the order of the sorted
+             * keys of the previous and the current step (only used if SORTED_PARTICLES
+             * is defined).
+             */
+            GLuint sortedidbuffers[2];
+
+            /** Checkpoint buffer.
+             * Staging buffer through which the particle state of a checkpoint is read back
+             * or uploaded (allocated by the first checkpoint).
+             */
+            GLuint checkpointbuffer;
         };
         /** Buffer objects.
          * The buffer objects are stored in a union, so that it is possible
          * to create/delete all buffer objects with a single OpenGL call.
          */
-        GLuint buffers[6];
+        GLuint buffers[22];
     };
 
-    union {
-    	struct {
-    		/** Predict position query object.
-    		 * Query object to record the time spent in the predict position phase.
-    		 */
-    		GLuint predictposquery;
-    		/** Sorting query object.
-    		 * Query object to record the time spent in the sorting phase.
-    		 */
-    		GLuint sortquery;
-    		/** Neighbour cell query object.
-    		 * Query object to record the time spent in the neighbour cell phase.
-    		 */
-    		GLuint neighbourcellquery;
-    		/** Solver query object.
-    		 * Query object to record the time spent in the solver phase.
-    		 */
-    		GLuint solverquery;
-    		/** Vorticity query object.
-    		 * Query object to record the time spent in the vorticity confinement phase.
-    		 */
-    		GLuint vorticityquery;
-    	};
-        /** Query objects.
-         * The query objects are stored in a union, so that it is possible
-         * to create/delete all buffer objects with a single OpenGL call.
-         */
-        GLuint queries[5];
-    };
+    /** Profiler.
+     * Measures the GPU time spent in each timing phase.
+     */
+    GPUProfiler profiler;
 
 
     /** Number of particles.
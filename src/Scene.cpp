@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "Scene.h"
+#include <algorithm>
+
+/** Default number of particles.
+ * Number of particles in the default scene.
+ */
+static const unsigned int DEFAULT_NUM_PARTICLES = 32 * 32 * 32 * 2;
+
+/** Wall size.
+ * Distance between the domain and the grid boundary in x and z direction.
+ */
+static const float WALL_SIZE = 16.0f;
+
+Scene::Scene (void) : Scene (SCENARIO_DOUBLE_DAM_BREAK, DEFAULT_NUM_PARTICLES)
+{
+}
+
+Scene::Scene (const unsigned int &numparticles) : Scene (SCENARIO_DOUBLE_DAM_BREAK, numparticles)
+{
+}
+
+Scene::Scene (const scenario_t &scenario, const unsigned int &numparticles, const unsigned int &seed)
+	: spacing (0.94f), jitter (0.01f), random (seed)
+{
+    if (numparticles == 0)
+        throw std::runtime_error ("A scene has to contain at least one particle.");
+    CreateDomain (numparticles);
+    positions.reserve (numparticles);
+    velocities.reserve (numparticles);
+    switch (scenario)
+    {
+    case SCENARIO_DAM_BREAK:
+        CreateDamBreak (numparticles, 1);
+        break;
+    case SCENARIO_DOUBLE_DAM_BREAK:
+        CreateDamBreak (numparticles, 2);
+        break;
+    case SCENARIO_DROP:
+    {
+        // a quarter of the particles falls from twice its radius above the pool
+        const unsigned int dropparticles = numparticles / 4;
+        const float height = CreatePool (numparticles - dropparticles);
+        const float radius = spacing * cbrtf (3.0f * float (dropparticles) / (4.0f * float (M_PI)));
+        glm::vec3 center = 0.5f * (domainmin + domainmax);
+        center.y = height + 3.0f * radius;
+        domainmax.y = std::max (domainmax.y, ceilf (center.y + 2.0f * radius));
+        CreateDrop (center, dropparticles);
+        break;
+    }
+    case SCENARIO_SETTLE:
+        CreatePool (numparticles);
+        break;
+    default:
+        throw std::runtime_error ("Invalid scenario.");
+    }
+}
+
+Scene::Scene (const std::string &filename, const unsigned int &seed)
+	: spacing (0.94f), jitter (0.01f), random (seed)
+{
+    std::ifstream f (filename.c_str (), std::ios_base::in);
+    if (!f.is_open ())
+        throw std::runtime_error (std::string ("Cannot open ") + filename + ".");
+
+    bool hasdomain = false;
+    std::string line;
+    unsigned int linenumber = 0;
+    while (std::getline (f, line))
+    {
+        linenumber++;
+        std::stringstream stream (line);
+        std::string command;
+        if (!(stream >> command) || command[0] == '#')
+            continue;
+
+        std::vector<float> args;
+        float v;
+        while (stream >> v)
+            args.push_back (v);
+
+        std::stringstream error;
+        error << filename << ":" << linenumber << ": ";
+        if (!stream.eof ())
+        {
+            error << "invalid argument for " << command << ".";
+            throw std::runtime_error (error.str ());
+        }
+
+        // optional trailing velocity of boxes and spheres
+        glm::vec3 velocity (0, 0, 0);
+        if ((command == "box" && args.size () == 9) || (command == "sphere" && args.size () == 7))
+            velocity = glm::vec3 (args[args.size () - 3], args[args.size () - 2], args[args.size () - 1]);
+
+        if (command == "spacing" && args.size () == 1 && args[0] > 0)
+            spacing = args[0];
+        else if (command == "jitter" && args.size () == 1 && args[0] >= 0)
+            jitter = args[0];
+        else if (command == "domain" && args.size () == 6)
+        {
+            domainmin = glm::vec3 (args[0], args[1], args[2]);
+            domainmax = glm::vec3 (args[3], args[4], args[5]);
+            hasdomain = true;
+        }
+        else if (command == "box" && (args.size () == 6 || args.size () == 9))
+            AddBox (glm::vec3 (args[0], args[1], args[2]), glm::vec3 (args[3], args[4], args[5]), velocity);
+        else if (command == "sphere" && (args.size () == 4 || args.size () == 7))
+            AddSphere (glm::vec3 (args[0], args[1], args[2]), args[3], velocity);
+        else if (command == "emitter" && args.size () == 9)
+            AddEmitter (glm::vec3 (args[0], args[1], args[2]), glm::vec3 (args[3], args[4], args[5]),
+            		args[6], args[7], args[8]);
+        else
+        {
+            error << "invalid command " << command << " with " << args.size () << " arguments.";
+            throw std::runtime_error (error.str ());
+        }
+    }
+
+    if (positions.empty ())
+        throw std::runtime_error (filename + " contains no particles.");
+
+    if (!hasdomain)
+    {
+        // use the bounding box of the particles with some space around them
+        domainmin = domainmax = glm::vec3 (positions[0]);
+        for (const glm::vec4 &p : positions)
+        {
+            domainmin = glm::min (domainmin, glm::vec3 (p));
+            domainmax = glm::max (domainmax, glm::vec3 (p));
+        }
+        domainmin = glm::vec3 (domainmin.x - WALL_SIZE, 0, domainmin.z - WALL_SIZE);
+        domainmax += glm::vec3 (WALL_SIZE, 2 * WALL_SIZE, WALL_SIZE);
+    }
+
+    if (domainmax.x <= domainmin.x || domainmax.y <= domainmin.y || domainmax.z <= domainmin.z)
+        throw std::runtime_error (filename + " specifies an empty domain.");
+}
+
+Scene::~Scene (void)
+{
+}
+
+glm::ivec3 Scene::GetGridSize (void) const
+{
+    glm::ivec3 gridsize;
+    for (int i = 0; i < 3; i++)
+    {
+        float size = domainmax[i] + ((i == 1) ? 0.0f : WALL_SIZE);
+        gridsize[i] = std::max (16, (int (ceilf (size)) + 15) & ~15);
+    }
+    return gridsize;
+}
+
+const char *Scene::GetScenarioName (const scenario_t &scenario)
+{
+    switch (scenario)
+    {
+    case SCENARIO_DAM_BREAK:
+        return "dambreak";
+    case SCENARIO_DOUBLE_DAM_BREAK:
+        return "doubledambreak";
+    case SCENARIO_DROP:
+        return "drop";
+    case SCENARIO_SETTLE:
+        return "settle";
+    default:
+        return "unknown";
+    }
+}
+
+void Scene::CreateDomain (const unsigned int &numparticles)
+{
+    // the default scene has a domain of 96x64x96 cells for 2x32^3 particles
+    const float scale = cbrtf (float (numparticles) / float (DEFAULT_NUM_PARTICLES));
+    domainmin = glm::vec3 (WALL_SIZE, 0, WALL_SIZE);
+    domainmax = domainmin + glm::vec3 (ceilf (96.0f * scale), std::max (64.0f, ceilf (64.0f * scale)),
+    		ceilf (96.0f * scale));
+}
+
+void Scene::CreateDamBreak (const unsigned int &numparticles, const unsigned int &numblocks)
+{
+    // each block consists of layers of size x size particles,
+    // a single block holds the particles of two blocks of the default scene
+    const float scale = cbrtf (float (numparticles) / float (DEFAULT_NUM_PARTICLES));
+    const float blockscale = (numblocks == 1) ? cbrtf (2.0f) : 1.0f;
+    const unsigned int size = std::max (1u, (unsigned int) (roundf (32.0f * scale * blockscale)));
+    const float offset = 16.0f * scale + 0.5f;
+    for (unsigned int block = 0; block < numblocks; block++)
+    {
+        // the last block gets the remaining particles
+        unsigned int count = (block + 1 < numblocks) ? numparticles / numblocks
+        		: numparticles - block * (numparticles / numblocks);
+        glm::vec3 origin = (block == 0) ? glm::vec3 (domainmin.x + offset, 0.5f, domainmin.z + offset)
+        		: glm::vec3 (domainmax.x - offset, 0.5f, domainmax.z - offset);
+        glm::vec3 dir = (block == 0) ? glm::vec3 (1, 1, 1) : glm::vec3 (-1, 1, -1);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            unsigned int x = i % size, z = (i / size) % size, y = i / (size * size);
+            AddParticle (origin + spacing * dir * glm::vec3 (x, y, z), glm::vec3 (0, 0, 0));
+        }
+    }
+}
+
+float Scene::CreatePool (const unsigned int &numparticles)
+{
+    // each layer covers the whole floor, the last layer may be incomplete
+    const glm::vec3 extent = domainmax - domainmin;
+    const unsigned int sizex = std::max (1u, (unsigned int) (extent.x / spacing));
+    const unsigned int sizez = std::max (1u, (unsigned int) (extent.z / spacing));
+    const glm::vec3 origin = domainmin + 0.5f * spacing;
+    for (unsigned int i = 0; i < numparticles; i++)
+    {
+        unsigned int x = i % sizex, z = (i / sizex) % sizez, y = i / (sizex * sizez);
+        AddParticle (origin + spacing * glm::vec3 (x, y, z), glm::vec3 (0, 0, 0));
+    }
+    const unsigned int layers = (numparticles + sizex * sizez - 1) / (sizex * sizez);
+    return float (layers) * spacing;
+}
+
+void Scene::CreateDrop (const glm::vec3 &center, const unsigned int &numparticles)
+{
+    // collect the lattice points of a cube that is large enough to contain the sphere
+    const int n = int (ceilf (cbrtf (3.0f * float (numparticles) / (4.0f * float (M_PI))))) + 1;
+    std::vector<glm::ivec3> points;
+    points.reserve ((2 * n + 1) * (2 * n + 1) * (2 * n + 1));
+    for (int y = -n; y <= n; y++)
+        for (int z = -n; z <= n; z++)
+            for (int x = -n; x <= n; x++)
+                points.push_back (glm::ivec3 (x, y, z));
+
+    // the stable sort keeps the generation order of points at the same distance
+    std::stable_sort (points.begin (), points.end (), [] (const glm::ivec3 &a, const glm::ivec3 &b) {
+        return a.x * a.x + a.y * a.y + a.z * a.z < b.x * b.x + b.y * b.y + b.z * b.z;
+    });
+    for (unsigned int i = 0; i < numparticles && i < points.size (); i++)
+        AddParticle (center + spacing * glm::vec3 (points[i]), glm::vec3 (0, 0, 0));
+}
+
+void Scene::AddParticle (const glm::vec3 &position, const glm::vec3 &velocity)
+{
+    // use the raw generator output, since the standard distributions differ between implementations
+    glm::vec3 displacement;
+    for (int i = 0; i < 3; i++)
+        displacement[i] = float (double (random ()) / double (std::mt19937::max ()) - 0.5);
+    positions.push_back (glm::vec4 (position + jitter * displacement, 0));
+    velocities.push_back (glm::vec4 (velocity, 0));
+}
+
+void Scene::AddBox (const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &velocity)
+{
+    for (float y = min.y + 0.5f * spacing; y < max.y; y += spacing)
+        for (float z = min.z + 0.5f * spacing; z < max.z; z += spacing)
+            for (float x = min.x + 0.5f * spacing; x < max.x; x += spacing)
+                AddParticle (glm::vec3 (x, y, z), velocity);
+}
+
+void Scene::AddSphere (const glm::vec3 &center, const float &radius, const glm::vec3 &velocity)
+{
+    const int n = int (radius / spacing);
+    for (int y = -n; y <= n; y++)
+        for (int z = -n; z <= n; z++)
+            for (int x = -n; x <= n; x++)
+            {
+                glm::vec3 offset = spacing * glm::vec3 (x, y, z);
+                if (glm::dot (offset, offset) <= radius * radius)
+                    AddParticle (center + offset, velocity);
+            }
+}
+
+void Scene::AddEmitter (const glm::vec3 &origin, const glm::vec3 &direction, const float &radius,
+		const float &length, const float &speed)
+{
+    if (glm::dot (direction, direction) == 0)
+        throw std::runtime_error ("The direction of an emitter must not be zero.");
+    const glm::vec3 dir = glm::normalize (direction);
+
+    // orthonormal basis of the disc the jet leaves
+    glm::vec3 u = glm::cross (dir, (fabsf (dir.y) < 0.9f) ? glm::vec3 (0, 1, 0) : glm::vec3 (1, 0, 0));
+    u = glm::normalize (u);
+    const glm::vec3 v = glm::cross (dir, u);
+
+    const int n = int (radius / spacing);
+    for (float t = 0; t < length; t += spacing)
+        for (int i = -n; i <= n; i++)
+            for (int j = -n; j <= n; j++)
+            {
+                if (float (i * i + j * j) * spacing * spacing > radius * radius)
+                    continue;
+                AddParticle (origin + t * dir + spacing * (float (i) * u + float (j) * v), speed * dir);
+            }
+}
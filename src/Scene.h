@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "common.h"
+#include <random>
+
+/** Scene class.
+ * This class generates the initial particle configuration of a simulation.
+ * A scene consists of the particles and the domain the particles are confined to.
+ * Besides a few built-in scenarios, scenes can be loaded from a scene description
+ * file, which contains one command per line (empty lines and lines starting with '#'
+ * are ignored):
+ *
+ * - `spacing d`: distance between neighbouring particles of the following shapes (default: 0.94)
+ * - `jitter a`: amplitude of the random displacement of the particles (default: 0.01)
+ * - `domain x0 y0 z0 x1 y1 z1`: box the particles are confined to (default: the bounding box
+ *   of all particles with a margin of 16 in x and z and 32 in y direction above the floor)
+ * - `box x0 y0 z0 x1 y1 z1 [vx vy vz]`: box filled with particles with an initial velocity
+ * - `sphere x y z r [vx vy vz]`: sphere filled with particles with an initial velocity
+ * - `emitter x y z dx dy dz r length speed`: jet of particles leaving a disc of radius r at
+ *   (x, y, z) in direction (dx, dy, dz); the jet is created at full length with all particles
+ *   moving at the given speed, since the number of particles cannot change during the simulation
+ *
+ * The particle grid always starts at the origin. Its size is the upper corner of the domain
+ * enlarged by 16 cells in x and z direction and rounded up to a multiple of 16.
+ *
+ * The random displacement of the particles is drawn from a generator with a fixed seed,
+ * so that a scene always produces the same particle configuration.
+ */
+class Scene
+{
+public:
+    /** Scenario.
+     * Built-in particle configurations that are scaled to an arbitrary number of particles.
+     */
+    typedef enum scenario {
+        /** Dam break.
+         * A single block of particles in a corner of the domain.
+         */
+        SCENARIO_DAM_BREAK = 0,
+        /** Double dam break.
+         * Two blocks of particles in opposite corners of the domain (the default scene).
+         */
+        SCENARIO_DOUBLE_DAM_BREAK,
+        /** Drop.
+         * A sphere containing a quarter of the particles falling into a pool.
+         */
+        SCENARIO_DROP,
+        /** Settle.
+         * A pool covering the floor of the domain that comes to rest.
+         */
+        SCENARIO_SETTLE,
+        /** Number of scenarios.
+         */
+        SCENARIO_NUM_SCENARIOS
+    } scenario_t;
+
+    /** Default seed.
+     * Seed of the random displacement of the particles unless specified otherwise.
+     */
+    static constexpr unsigned int DEFAULT_SEED = 0;
+
+    /** Constructor.
+     * Creates the default scene, which consists of two blocks of
+     * 32x32x32 particles in opposite corners of the grid.
+     */
+    Scene (void);
+    /** Constructor.
+     * Creates the default dam break scene scaled to an arbitrary number of particles.
+     * The domain and the grid are scaled accordingly.
+     * \param numparticles number of particles
+     */
+    Scene (const unsigned int &numparticles);
+    /** Constructor.
+     * Creates a built-in scenario scaled to an arbitrary number of particles.
+     * \param scenario the scenario
+     * \param numparticles number of particles
+     * \param seed seed of the random displacement of the particles
+     */
+    Scene (const scenario_t &scenario, const unsigned int &numparticles, const unsigned int &seed = DEFAULT_SEED);
+    /** Constructor.
+     * Loads a scene description file. Throws an exception on errors.
+     * \param filename name of the scene description file
+     * \param seed seed of the random displacement of the particles
+     */
+    Scene (const std::string &filename, const unsigned int &seed = DEFAULT_SEED);
+    /** Destructor.
+     */
+    ~Scene (void);
+
+    /** Get positions.
+     * Returns the initial particle positions.
+     * \returns the initial particle positions
+     */
+    const std::vector<glm::vec4> &GetPositions (void) const {
+        return positions;
+    }
+
+    /** Get velocities.
+     * Returns the initial particle velocities.
+     * \returns the initial particle velocities
+     */
+    const std::vector<glm::vec4> &GetVelocities (void) const {
+        return velocities;
+    }
+
+    /** Get number of particles.
+     * Returns the number of particles in the scene.
+     * \returns the number of particles in the scene
+     */
+    unsigned int GetNumberOfParticles (void) const {
+        return positions.size ();
+    }
+
+    /** Get domain minimum.
+     * Returns the lower corner of the region the particles are confined to.
+     * \returns the lower corner of the domain
+     */
+    const glm::vec3 &GetDomainMin (void) const {
+        return domainmin;
+    }
+
+    /** Get domain maximum.
+     * Returns the upper corner of the region the particles are confined to.
+     * \returns the upper corner of the domain
+     */
+    const glm::vec3 &GetDomainMax (void) const {
+        return domainmax;
+    }
+
+    /** Get grid size.
+     * Returns the size of the particle grid needed for the domain.
+     * \returns the grid size
+     */
+    glm::ivec3 GetGridSize (void) const;
+
+    /** Get scenario name.
+     * Returns the name of a scenario as used on the command line.
+     * \param scenario the scenario
+     * \returns the name of the scenario
+     */
+    static const char *GetScenarioName (const scenario_t &scenario);
+private:
+    /** Create domain.
+     * Sets up a domain that is scaled to the number of particles.
+     * \param numparticles number of particles
+     */
+    void CreateDomain (const unsigned int &numparticles);
+
+    /** Create dam break.
+     * Creates one block of particles in a corner or two blocks of particles
+     * in opposite corners of a domain that is scaled to the number of particles.
+     * \param numparticles number of particles
+     * \param numblocks number of blocks (1 or 2)
+     */
+    void CreateDamBreak (const unsigned int &numparticles, const unsigned int &numblocks);
+
+    /** Create pool.
+     * Fills the floor of the domain layer by layer with particles.
+     * \param numparticles number of particles
+     * \returns the height of the pool
+     */
+    float CreatePool (const unsigned int &numparticles);
+
+    /** Create drop.
+     * Creates a sphere of particles by taking the lattice points closest to its center.
+     * \param center center of the sphere
+     * \param numparticles number of particles
+     */
+    void CreateDrop (const glm::vec3 &center, const unsigned int &numparticles);
+
+    /** Add particle.
+     * Adds a particle with a random displacement.
+     * \param position position of the particle
+     * \param velocity velocity of the particle
+     */
+    void AddParticle (const glm::vec3 &position, const glm::vec3 &velocity);
+
+    /** Add box.
+     * Fills a box with particles.
+     * \param min lower corner of the box
+     * \param max upper corner of the box
+     * \param velocity initial velocity of the particles
+     */
+    void AddBox (const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &velocity);
+
+    /** Add sphere.
+     * Fills a sphere with particles.
+     * \param center center of the sphere
+     * \param radius radius of the sphere
+     * \param velocity initial velocity of the particles
+     */
+    void AddSphere (const glm::vec3 &center, const float &radius, const glm::vec3 &velocity);
+
+    /** Add emitter.
+     * Creates a jet of particles.
+     * \param origin center of the disc the jet leaves
+     * \param direction direction of the jet
+     * \param radius radius of the jet
+     * \param length length of the jet
+     * \param speed speed of the particles
+     */
+    void AddEmitter (const glm::vec3 &origin, const glm::vec3 &direction, const float &radius,
+    		const float &length, const float &speed);
+
+    /** Positions.
+     * Initial positions of all particles.
+     */
+    std::vector<glm::vec4> positions;
+    /** Velocities.
+     * Initial velocities of all particles.
+     */
+    std::vector<glm::vec4> velocities;
+    /** Domain minimum.
+     * Lower corner of the region the particles are confined to.
+     */
+    glm::vec3 domainmin;
+    /** Domain maximum.
+     * Upper corner of the region the particles are confined to.
+     */
+    glm::vec3 domainmax;
+    /** Particle spacing.
+     * Distance between neighbouring particles.
+     */
+    float spacing;
+    /** Jitter.
+     * Amplitude of the random displacement of the particles.
+     */
+    float jitter;
+    /** Random number generator.
+     * Generator of the random displacement of the particles.
+     */
+    std::mt19937 random;
+};
+
+#endif /* SCENE_H */
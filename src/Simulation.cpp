@@ -20,11 +20,21 @@
  * THE SOFTWARE.
  */
 #include "Simulation.h"
+#include "GPUTrace.h"
+#include <iomanip>
 
-
-Simulation::Simulation (void) : width (0), height (0), font ("textures/font.png"),
-    last_fps_time (glfwGetTime ()), framecount (0), fps (0), running (false),
-    usesurfacereconstruction (false), sph (GetNumberOfParticles ()), useskybox (false),
+/** Maximum frame time.
+ * Maximum wall clock time by which the simulation is advanced in a single frame
+ * with adaptive time steps, so that slow frames do not cause ever slower frames.
+ */
+static const float MAX_FRAME_TIME = 1.0f / 20.0f;
+
+Simulation::Simulation (const Scene &_scene) : width (0), height (0), font ("textures/font.png"),
+    profiler (std::vector<std::string> (1, "Rendering")), showprofiler (false),
+    checkpointfile ("pbf.checkpoint"),
+    last_fps_time (glfwGetTime ()), framecount (0), fps (0), running (false), adaptivetimestep (false), fixedtimestep (0.0f), substeps (0),
+    usesurfacereconstruction (false), scene (_scene), sph (_scene.GetNumberOfParticles (), _scene.GetGridSize ()),
+    useskybox (false),
     envmap (NULL), usenoise (false), guitimer (0.0f), guistate (GUISTATE_REST_DENSITY)
 {
 	// load shaders
@@ -35,9 +45,6 @@ Simulation::Simulation (void) : width (0), height (0), font ("textures/font.png"
     // create buffer objects
     glGenBuffers (2, buffers);
 
-    // create query objects
-    glGenQueries (1, &renderingquery);
-
     // initialize the camera position and rotation and the transformation matrix buffer.
     camera.SetPosition (glm::vec3 (20, 10, 10));
     camera.Rotate (30.0f, 240.0f);
@@ -71,7 +78,8 @@ Simulation::Simulation (void) : width (0), height (0), font ("textures/font.png"
     glClearColor (0.25f, 0.25f, 0.25f, 1.0f);
     glClearDepth (1.0f);
 
-    // Initialize particle buffer
+    // Initialize domain and particle buffer
+    sph.SetDomainBounds (scene.GetDomainMin (), scene.GetDomainMax ());
     ResetParticleBuffer ();
 
     // pass position and color to the point sprite class
@@ -89,10 +97,18 @@ Simulation::~Simulation (void)
 {
     // cleanup
 	if (envmap) delete envmap;
-	glDeleteQueries (1, &renderingquery);
     glDeleteBuffers (2, buffers);
 }
 
+void Simulation::WriteProfile (const std::string &prefix) const
+{
+	std::vector<const GPUProfiler*> profilers;
+	profilers.push_back (&sph.GetProfiler ());
+	profilers.push_back (&profiler);
+	GPUProfiler::WriteCSV (prefix + ".csv", profilers);
+	GPUProfiler::WriteJSON (prefix + ".json", profilers);
+}
+
 void Simulation::Resize (const unsigned int &_width, const unsigned int &_height)
 {
     // update the stored framebuffer dimensions
@@ -199,77 +215,20 @@ void Simulation::OnMouseDown (const int &button)
 
 const unsigned int Simulation::GetNumberOfParticles (void) const
 {
-	// must be a multiple of 512
-    return 32 * 32 * 32 * 2;
+    return scene.GetNumberOfParticles ();
 }
 
 void Simulation::ResetParticleBuffer (void)
 {
-    // regenerate particle information
-	std::vector<glm::vec4> positions;
-	std::vector<glm::vec4> velocities;
-
-    const float scale = 0.94f;
-    int id = 0;
-
-    srand (time (NULL));
-    for (int x = 0; x < 32; x++)
-    {
-        for (int z = 0; z < 32; z++)
-        {
-            for (int y = 0; y < 32; y++)
-            {
-                glm::vec4 position = glm::vec4 (32.5f, 0.5f, 32.5f, 0.0f) + scale * glm::vec4 (x, y, z, 0.0f);
-                position += 0.01f * glm::vec4 (float (rand ()) / float (RAND_MAX) - 0.5f,
-                		float (rand ()) / float (RAND_MAX) - 0.5f, float (rand ()) / float (RAND_MAX) - 0.5f, 0);
-                glm::vec4 velocity = glm::vec4 (0, 0, 0, 0);
-                positions.push_back (position);
-                velocities.push_back (velocity);
-            }
-        }
-    }
-    for (int x = 0; x < 32; x++)
-    {
-        for (int z = 0; z < 32; z++)
-        {
-            for (int y = 0; y < 32; y++)
-            {
-                glm::vec4 position = glm::vec4 (32.5f + 63.0f, 0.5f, 32.5f + 63.0f, 0.0f)
-                	+ scale * glm::vec4 (-x, y, -z, 0.0f);
-                position += 0.01f * glm::vec4 (float (rand ()) / float (RAND_MAX) - 0.5f,
-                		float (rand ()) / float (RAND_MAX) - 0.5f, float (rand ()) / float (RAND_MAX) - 0.5f, 0);
-                glm::vec4 velocity = glm::vec4 (0, 0, 0, 0);
-                positions.push_back (position);
-                velocities.push_back (velocity);
-            }
-        }
-    }
-
-    // create temporary buffer
-    GLuint tmpbuffer;
-    glGenBuffers (1, &tmpbuffer);
-
-    // upload position data
-    glBindBuffer (GL_COPY_READ_BUFFER, tmpbuffer);
-    glBufferData (GL_COPY_READ_BUFFER, 4 * sizeof (float) * positions.size (), &positions[0], GL_STREAM_COPY);
-
-    // copy the new position data to SPH position buffer
-    glBindBuffer (GL_COPY_WRITE_BUFFER, sph.GetPositionBuffer ());
-    glCopyBufferSubData (GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 4 * sizeof (float) * positions.size ());
-
-    // upload velocity data
-    glBufferData (GL_COPY_READ_BUFFER, 4 * sizeof (float) * velocities.size (), &velocities[0], GL_STREAM_COPY);
-
-    // copy the new velocity data to SPH position buffer
-    glBindBuffer (GL_COPY_WRITE_BUFFER, sph.GetVelocityBuffer ());
-    glCopyBufferSubData (GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 4 * sizeof (float) * velocities.size ());
-
-    // delete temporary buffer
-    glDeleteBuffers (1, &tmpbuffer);
+    // restore the initial particle configuration
+    sph.SetParticles (scene.GetPositions (), scene.GetVelocities ());
+}
 
-    // clear highlight buffer
-    glBindBuffer (GL_SHADER_STORAGE_BUFFER, sph.GetHighlightBuffer ());
-    glClearBufferData (GL_SHADER_STORAGE_BUFFER, GL_R8UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+void Simulation::LoadCheckpoint (const std::string &filename)
+{
+	sph.LoadCheckpoint (filename);
+	sph.WaitForCheckpoint ();
+	std::cout << "Restored step " << sph.GetStepCounter () << " from " << filename << "." << std::endl;
 }
 
 void Simulation::OnKeyDown (int key)
@@ -295,27 +254,60 @@ void Simulation::OnKeyUp (int key)
     case GLFW_KEY_SPACE:
     	running = !running;
     	break;
+    // toggle adaptive time steps
+    case GLFW_KEY_C:
+    	adaptivetimestep = !adaptivetimestep;
+    	// Advance overwrites the time step, so keep the fixed one
+    	if (adaptivetimestep)
+    		fixedtimestep = sph.GetTimestep ();
+    	else
+    		sph.SetTimestep (fixedtimestep);
+    	break;
     // toggle vorticity confinement
     case GLFW_KEY_V:
     	sph.SetVorticityConfinementEnabled (!sph.IsVorticityConfinementEnabled ());
     	break;
+    // toggle incremental sorting
+    case GLFW_KEY_I:
+    	sph.SetIncrementalSortEnabled (!sph.IsIncrementalSortEnabled ());
+    	break;
     // reset to initial particle configuration
     case GLFW_KEY_TAB:
         ResetParticleBuffer ();
         break;
+    // save the simulation state (written in the background)
+    case GLFW_KEY_K:
+    	try {
+    		sph.SaveCheckpoint (checkpointfile);
+    		std::cout << "Saving checkpoint to " << checkpointfile << "." << std::endl;
+    	} catch (std::exception &e) {
+    		std::cerr << "Exception: " << e.what () << std::endl;
+    	}
+    	break;
+    // restore the simulation state (read in the background)
+    case GLFW_KEY_L:
+    	try {
+    		sph.LoadCheckpoint (checkpointfile);
+    		std::cout << "Loading checkpoint from " << checkpointfile << "." << std::endl;
+    	} catch (std::exception &e) {
+    		std::cerr << "Exception: " << e.what () << std::endl;
+    	}
+    	break;
     // output the queried time frames spent in the
     // different simulation stages
     case GLFW_KEY_T:
     {
     	sph.OutputTiming ();
-    	if (glIsQuery (renderingquery))
-    	{
-    		GLint64 v;
-    		glGetQueryObjecti64v (renderingquery, GL_QUERY_RESULT, &v);
-    		std::cout << "Rendering: " << double (v) / 1000000.0 << " ms" << std::endl;
-    	}
+    	GPUProfiler::statistics_t stats = profiler.GetStatistics (0);
+    	if (stats.samples > 0)
+    		std::cout << "Rendering: min " << stats.min << " ms, mean " << stats.mean << " ms, p95 "
+    				<< stats.p95 << " ms, p99 " << stats.p99 << " ms (" << stats.samples << " samples)" << std::endl;
     	break;
     }
+    // toggle the profiler overlay
+    case GLFW_KEY_P:
+    	showprofiler = !showprofiler;
+    	break;
     // toggle environment map
     case GLFW_KEY_E:
     	useskybox = !useskybox;
@@ -396,7 +388,11 @@ void Simulation::OnKeyUp (int key)
     		sph.SetGravity (sph.GetGravity () + factor);
     		break;
     	case GUISTATE_TIMESTEP:
-    		sph.SetTimestep (glm::max (sph.GetTimestep () + 0.001 * factor, 0.001));
+    		// with adaptive time steps the time step is chosen by Advance up to the maximum
+    		if (adaptivetimestep)
+    			sph.SetMaxTimestep (glm::max (sph.GetMaxTimestep () + 0.001 * factor, 0.001));
+    		else
+    			sph.SetTimestep (glm::max (sph.GetTimestep () + 0.001 * factor, 0.001));
     		break;
     	case GUISTATE_NUM_SOLVER_ITERATIONS:
     	{
@@ -460,11 +456,36 @@ bool Simulation::Frame (void)
     // render the framing
     framing.Render ();
 
+    // complete a pending checkpoint (also while the simulation is paused)
+    switch (sph.PollCheckpoint ())
+    {
+    case SPH::CHECKPOINT_SAVED:
+    	std::cout << "Checkpoint written to " << checkpointfile << "." << std::endl;
+    	break;
+    case SPH::CHECKPOINT_LOADED:
+    	std::cout << "Restored step " << sph.GetStepCounter () << " from " << checkpointfile << "." << std::endl;
+    	break;
+    case SPH::CHECKPOINT_FAILED:
+    	std::cerr << "Checkpoint failed: " << sph.GetCheckpointError () << std::endl;
+    	break;
+    default:
+    	break;
+    }
+
     // run simulation step 1
     if (running)
-    	sph.Run ();
+    {
+    	if (adaptivetimestep)
+    		substeps = sph.Advance (std::min (time_passed, MAX_FRAME_TIME));
+    	else
+    		sph.Run ();
+    }
 
-	glBeginQuery (GL_TIME_ELAPSED, renderingquery);
+    // collect the rendering times of previous frames that are available by now
+    profiler.Collect ();
+    GPUTrace::Collect ();
+    profiler.Begin (0);
+    GPUTrace::Begin ("render");
     if (!usesurfacereconstruction)
     {
     	// render icosahedra/spheres
@@ -478,7 +499,8 @@ bool Simulation::Frame (void)
     	// render reconstructed surface
     	surfacereconstruction.Render (sph.GetPositionBuffer (), GetNumberOfParticles (), width, height);
     }
-	glEndQuery (GL_TIME_ELAPSED);
+    GPUTrace::End ();
+    profiler.End (0);
 
     // determine the framerate every second
     framecount++;
@@ -493,6 +515,31 @@ bool Simulation::Frame (void)
         std::stringstream stream;
         stream << "FPS: " << fps << std::endl;
         font.PrintStr (0, 0, stream.str ());
+        if (adaptivetimestep)
+        {
+        	std::stringstream stream;
+        	stream << "Substeps: " << substeps << " (dt " << sph.GetTimestep () << ")";
+        	font.PrintStr (0, 1, stream.str ());
+        }
+
+        if (showprofiler)
+        {
+        	// display the rolling statistics of the simulation phases and the rendering
+        	const GPUProfiler *profilers[2] = { &sph.GetProfiler (), &profiler };
+        	float row = 2;
+        	for (int p = 0; p < 2; p++)
+        	{
+        		for (unsigned int phase = 0; phase < profilers[p]->GetNumPhases (); phase++)
+        		{
+        			GPUProfiler::statistics_t stats = profilers[p]->GetStatistics (phase);
+        			std::stringstream stream;
+        			stream << std::fixed << std::setprecision (2) << profilers[p]->GetName (phase) << ": "
+        					<< stats.mean << " ms (min " << stats.min << ", p95 " << stats.p95
+        					<< ", p99 " << stats.p99 << ")";
+        			font.PrintStr (0, row++, stream.str ());
+        		}
+        	}
+        }
 
         if (guitimer > 0)
         {
@@ -510,7 +557,10 @@ bool Simulation::Frame (void)
         		stream << "Gravity: " << sph.GetGravity ();
         		break;
         	case GUISTATE_TIMESTEP:
-        		stream << "Timestep: " << sph.GetTimestep ();
+        		if (adaptivetimestep)
+        			stream << "Maximum timestep: " << sph.GetMaxTimestep ();
+        		else
+        			stream << "Timestep: " << sph.GetTimestep ();
         		break;
         	case GUISTATE_NUM_SOLVER_ITERATIONS:
         		stream << "Solver iterations: " << sph.GetNumSolverIterations ();
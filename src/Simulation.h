@@ -30,6 +30,7 @@
 #include "FullscreenQuad.h"
 #include "PointSprite.h"
 #include "SPH.h"
+#include "Scene.h"
 #include "SurfaceReconstruction.h"
 #include "Skybox.h"
 #include "Selection.h"
@@ -41,8 +42,9 @@ class Simulation
 {
 public:
     /** Constructor.
+     * \param scene initial particle configuration
      */
-    Simulation (void);
+    Simulation (const Scene &scene);
     /** Destructor.
      */
     ~Simulation (void);
@@ -90,6 +92,21 @@ public:
      */
     void Resize (const unsigned int &width, const unsigned int &height);
 
+    /** Set checkpoint file.
+     * Specifies the file to which the simulation state is saved by pressing K
+     * and from which it is restored by pressing L.
+     * \param filename name of the checkpoint file
+     */
+    void SetCheckpointFile (const std::string &filename) {
+    	checkpointfile = filename;
+    }
+
+    /** Load checkpoint.
+     * Restores the simulation state from a checkpoint file and waits until it is restored.
+     * \param filename name of the checkpoint file
+     */
+    void LoadCheckpoint (const std::string &filename);
+
     /** Get number of particles.
      * Obtains the number of particles in the simulation.
      * \returns the number of particles in the simulation.
@@ -101,6 +118,13 @@ public:
      * \returns True, if there were no errors, false otherwise.
      */
     bool Frame (void);
+
+    /** Write profile.
+     * Writes the rolling statistics of the GPU time spent in each phase to
+     * a CSV file and a JSON file.
+     * \param prefix file name prefix (".csv" and ".json" are appended)
+     */
+    void WriteProfile (const std::string &prefix) const;
 private:
     /** Transformation buffer layout.
      * Structure representing the memory layout of the uniform buffer
@@ -185,6 +209,11 @@ private:
      */
     PointSprite pointsprite;
 
+    /** Scene.
+     * Initial particle configuration.
+     */
+    Scene scene;
+
     /** SPH class.
      * Takes care of the SPH simulation.
      */
@@ -215,6 +244,22 @@ private:
      */
     bool running;
 
+    /** Adaptive time step flag.
+     * Flag indicating whether the simulation advances by the elapsed wall clock time
+     * using CFL limited substeps instead of running one fixed step per frame.
+     */
+    bool adaptivetimestep;
+
+    /** Fixed time step.
+     * Time step of the fixed steps, which is restored when adaptive time steps are disabled.
+     */
+    float fixedtimestep;
+
+    /** Number of substeps.
+     * Number of substeps run in the last frame.
+     */
+    unsigned int substeps;
+
     /** Surface reconstruction flag.
      * flag indicating whether the particles should be rendered
      * as spheres or whether a reconstructed water surface should
@@ -251,10 +296,20 @@ private:
      */
     Font font;
 
-	/** Rendering query object.
-	 * Query object to record the time spent in the rendering phase.
-	 */
-    GLuint renderingquery;
+    /** Profiler.
+     * Measures the GPU time spent in the rendering phase.
+     */
+    GPUProfiler profiler;
+
+    /** Profiler overlay flag.
+     * Flag indicating whether to display the profiling statistics.
+     */
+    bool showprofiler;
+
+    /** Checkpoint file.
+     * Name of the file to which the simulation state is saved and from which it is restored.
+     */
+    std::string checkpointfile;
 
     /** Projection matrix.
      * Matrix describing the perspective projection.
@@ -20,6 +20,7 @@
  * THE SOFTWARE.
  */
 #include "SurfaceReconstruction.h"
+#include "GPUTrace.h"
 
 SurfaceReconstruction::SurfaceReconstruction (void)
 	: offscreen_width (1280), offscreen_height (720), envmap (NULL), usenoise (false)
@@ -163,17 +164,20 @@ void SurfaceReconstruction::Render (const GLuint &positionbuffer, const GLuint &
 	pointsprite.SetPositionBuffer (positionbuffer, 4 * sizeof (float), 0);
 
 	// render point sprites, storing depth
+	GPUTrace::Begin ("surface depth");
 	glBindFramebuffer (GL_FRAMEBUFFER, depthfb);
 	glViewport (0, 0, offscreen_width, offscreen_height);
 	glClear (GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 	particledepthprogram.Use ();
 	pointsprite.Render (numparticles);
+	GPUTrace::End ();
 
     glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 0, depthblurweights);
     // blur depth
 	depthblurprog.Use ();
 	for (int i = 0; i < 3; i++)
 	{
+		GPUTrace::Begin ("depth blur", i);
 		depthtexture.Bind (GL_TEXTURE_2D);
 		glBindFramebuffer (GL_FRAMEBUFFER, depthhblurfb);
 		glClear (GL_DEPTH_BUFFER_BIT);
@@ -184,9 +188,11 @@ void SurfaceReconstruction::Render (const GLuint &positionbuffer, const GLuint &
 		glClear (GL_DEPTH_BUFFER_BIT);
 		glProgramUniform2f (depthblurprog.get (), depthbluroffsetscale, 0.0f, 1.0f / offscreen_height);
 		fullscreenquad.Render ();
+		GPUTrace::End ();
 	}
 
 	// render point sprites storing thickness
+	GPUTrace::Begin ("surface thickness");
 	glBindFramebuffer (GL_FRAMEBUFFER, thicknessfb);
 	if (usenoise)
 	{
@@ -212,8 +218,10 @@ void SurfaceReconstruction::Render (const GLuint &positionbuffer, const GLuint &
 	thicknessprog.Use ();
 	glViewport (0, 0, 512, 512);
 	pointsprite.Render (numparticles);
+	GPUTrace::End ();
 
 	// blur thickness texture
+	GPUTrace::Begin ("thickness blur");
 	glDisable (GL_BLEND);
 	glBindFramebuffer (GL_FRAMEBUFFER, thicknessblurfb);
 	thicknesstexture.Bind (GL_TEXTURE_2D);
@@ -225,6 +233,9 @@ void SurfaceReconstruction::Render (const GLuint &positionbuffer, const GLuint &
 	}
 	thicknessblurtexture.Bind (GL_TEXTURE_2D);
 	thicknessblur.Apply (glm::vec2 (0, 1.0f / 512.0f), thicknessblurweights);
+	GPUTrace::End ();
+
+	GPUTrace::Begin ("surface composite");
 
 	// use depth texture as input
 	depthtexture.Bind (GL_TEXTURE_2D);
@@ -259,4 +270,5 @@ void SurfaceReconstruction::Render (const GLuint &positionbuffer, const GLuint &
 	glViewport (0, 0, width, height);
 	fsquadprog.Use ();
 	fullscreenquad.Render ();
+	GPUTrace::End ();
 }
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool (unsigned int numthreads)
+	: job (NULL), jobsize (0), jobgrain (1), nextitem (0), generation (0), busy (0), quit (false)
+{
+	if (numthreads == 0)
+		numthreads = std::max (std::thread::hardware_concurrency (), 1u);
+
+	// the calling thread takes part in the processing
+	for (unsigned int i = 1; i < numthreads; i++)
+		workers.push_back (std::thread (&ThreadPool::Worker, this));
+}
+
+ThreadPool::~ThreadPool (void)
+{
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		quit = true;
+	}
+	wakeup.notify_all ();
+	for (auto &worker : workers)
+		worker.join ();
+}
+
+void ThreadPool::ParallelFor (const size_t &n, const std::function<void (size_t, size_t)> &func, size_t grain)
+{
+	if (n == 0)
+		return;
+	if (grain == 0)
+		grain = std::max<size_t> (n / (4 * GetNumThreads ()), 1);
+
+	// process small jobs directly
+	if (workers.empty () || n <= grain)
+	{
+		func (0, n);
+		return;
+	}
+
+	// publish the job
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		job = &func;
+		jobsize = n;
+		jobgrain = grain;
+		nextitem = 0;
+		busy = workers.size ();
+		generation++;
+	}
+	wakeup.notify_all ();
+
+	ProcessJob ();
+
+	// wait for the workers to finish
+	std::unique_lock<std::mutex> lock (mutex);
+	finished.wait (lock, [this] { return busy == 0; });
+	job = NULL;
+}
+
+void ThreadPool::ProcessJob (void)
+{
+	for (;;)
+	{
+		size_t begin = nextitem.fetch_add (jobgrain);
+		if (begin >= jobsize)
+			break;
+		(*job) (begin, std::min (begin + jobgrain, jobsize));
+	}
+}
+
+void ThreadPool::Worker (void)
+{
+	uint64_t lastgeneration = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			wakeup.wait (lock, [&] { return quit || generation != lastgeneration; });
+			if (quit)
+				return;
+			lastgeneration = generation;
+		}
+
+		ProcessJob ();
+
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			busy--;
+		}
+		finished.notify_one ();
+	}
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "common.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/** Thread pool class.
+ * A fixed set of worker threads used to process ranges of items in parallel.
+ */
+class ThreadPool
+{
+public:
+    /** Constructor.
+     * \param numthreads total number of threads including the calling thread
+     *                   (0 to use one thread per hardware thread)
+     */
+    ThreadPool (unsigned int numthreads = 0);
+    /** Destructor.
+     */
+    ~ThreadPool (void);
+
+    /** Get number of threads.
+     * Returns the number of threads processing work items, including the calling thread.
+     * \returns the number of threads
+     */
+    unsigned int GetNumThreads (void) const {
+        return workers.size () + 1;
+    }
+
+    /** Parallel for.
+     * Splits the range [0, n) into chunks and calls the specified function for
+     * each chunk. The calling thread takes part in the processing and the function
+     * only returns once all chunks have been processed.
+     * \param n number of items to process
+     * \param func function that is called with the begin and the end of each chunk
+     * \param grain chunk size (0 to choose a chunk size automatically)
+     */
+    void ParallelFor (const size_t &n, const std::function<void (size_t, size_t)> &func, size_t grain = 0);
+private:
+    /** Worker thread.
+     * Main function of the worker threads.
+     */
+    void Worker (void);
+    /** Process job.
+     * Processes chunks of the current job until none are left.
+     */
+    void ProcessJob (void);
+
+    /** Worker threads.
+     */
+    std::vector<std::thread> workers;
+    /** Mutex.
+     * Protects the job description and the busy counter.
+     */
+    std::mutex mutex;
+    /** Wakeup condition.
+     * Signalled when a new job is available or the pool is shut down.
+     */
+    std::condition_variable wakeup;
+    /** Finished condition.
+     * Signalled when a worker has finished processing the current job.
+     */
+    std::condition_variable finished;
+    /** Current job.
+     * Function to call for each chunk of the current job.
+     */
+    const std::function<void (size_t, size_t)> *job;
+    /** Job size.
+     * Number of items in the current job.
+     */
+    size_t jobsize;
+    /** Job grain.
+     * Chunk size of the current job.
+     */
+    size_t jobgrain;
+    /** Next item.
+     * First item of the next chunk to be processed.
+     */
+    std::atomic<size_t> nextitem;
+    /** Job generation.
+     * Incremented for each new job, so that the workers can detect new jobs.
+     */
+    uint64_t generation;
+    /** Busy workers.
+     * Number of workers that have not yet finished the current job.
+     */
+    unsigned int busy;
+    /** Quit flag.
+     * Flag indicating that the worker threads should terminate.
+     */
+    bool quit;
+};
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,1518 @@
+/*
+ * Copyright (c) 2013-2014 Daniel Kirchner
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE ANDNONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include "common.h"
+#include "Scene.h"
+#include "SPH.h"
+#include "GPUProfiler.h"
+#include "RadixSort.h"
+#include "NeighbourCellFinder.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+#include <stdlib.h>
+
+/** \file bench.cpp
+ * Benchmark source file.
+ * The source file that contains the main entry point of the standalone benchmark, which runs
+ * reproducible scenarios on the GPU and writes the time spent in each phase in a machine-readable
+ * form, so that the results of different commits can be compared. Alternatively it benchmarks
+ * the radix sort in isolation on synthetic key distributions, checks the neighbour cell
+ * search against a count on the CPU or checks the error of the compact particle layout.
+ */
+
+/** Key distribution.
+ * Synthetic key distributions of the sort benchmark.
+ */
+typedef enum distribution {
+	/** Uniform.
+	 * Keys uniformly distributed over all grid cells.
+	 */
+	DISTRIBUTION_UNIFORM = 0,
+	/** Clustered.
+	 * Keys concentrated in a few blocks of grid cells, like the particles of a fluid.
+	 */
+	DISTRIBUTION_CLUSTERED,
+	/** Sorted.
+	 * Uniformly distributed keys in ascending order.
+	 */
+	DISTRIBUTION_SORTED,
+	/** Nearly sorted.
+	 * Sorted keys with one percent of them swapped with a close neighbour,
+	 * like the particles after a simulation step.
+	 */
+	DISTRIBUTION_NEARLY_SORTED,
+	/** Number of distributions.
+	 */
+	DISTRIBUTION_NUM_DISTRIBUTIONS
+} distribution_t;
+
+/** Get distribution name.
+ * Returns the name of a key distribution as used on the command line.
+ * \param distribution the key distribution
+ * \returns the name of the key distribution
+ */
+const char *GetDistributionName (const distribution_t &distribution)
+{
+	switch (distribution)
+	{
+	case DISTRIBUTION_UNIFORM:
+		return "uniform";
+	case DISTRIBUTION_CLUSTERED:
+		return "clustered";
+	case DISTRIBUTION_SORTED:
+		return "sorted";
+	case DISTRIBUTION_NEARLY_SORTED:
+		return "nearlysorted";
+	default:
+		return "unknown";
+	}
+}
+
+/** Benchmark options.
+ * Structure that contains the settings specified on the command line.
+ */
+typedef struct options {
+	/** Scenarios.
+	 * Scenarios to run (empty for all scenarios).
+	 */
+	std::vector<Scene::scenario_t> scenarios;
+	/** Numbers of particles.
+	 * Numbers of particles each scenario is run with (empty for the default number).
+	 */
+	std::vector<unsigned int> particles;
+	/** Number of steps.
+	 * Number of measured simulation steps (0 for the default of each scenario).
+	 */
+	unsigned int steps;
+	/** Number of warm-up steps.
+	 * Number of simulation steps that are run before the measurement starts.
+	 */
+	unsigned int warmup;
+	/** Seed.
+	 * Seed of the random displacement of the particles.
+	 */
+	unsigned int seed;
+	/** Output prefix.
+	 * File name prefix of the CSV and JSON result files (empty to only print the results).
+	 */
+	std::string output;
+	/** Label.
+	 * Label stored with the results, e.g. the commit that was benchmarked.
+	 */
+	std::string label;
+	/** Sort flag.
+	 * Flag indicating whether to benchmark the radix sort instead of running the scenarios.
+	 */
+	bool sort;
+	/** Key distributions.
+	 * Key distributions of the sort benchmark (empty for all distributions).
+	 */
+	std::vector<distribution_t> distributions;
+	/** Numbers of keys.
+	 * Numbers of keys of the sort benchmark (empty for 64k to 16M keys).
+	 */
+	std::vector<unsigned int> keys;
+	/** Number of repetitions.
+	 * Number of measured sorts of each key distribution and number of keys.
+	 */
+	unsigned int repetitions;
+	/** Incremental flag.
+	 * Flag indicating whether to use the incremental mode of the radix sort.
+	 */
+	bool incremental;
+	/** Neighbour search interval.
+	 * Maximum number of steps between neighbour searches of the scenarios.
+	 */
+	unsigned int neighbourinterval;
+	/** Deterministic flag.
+	 * Flag indicating whether to run the scenarios in the deterministic mode and report
+	 * the hash of the final particle state.
+	 */
+	bool deterministic;
+	/** Neighbour check flag.
+	 * Flag indicating whether to check the neighbour cell search instead of running the scenarios.
+	 */
+	bool neighbourcheck;
+	/** Compact check flag.
+	 * Flag indicating whether to check the error of the compact particle layout instead of
+	 * measuring the scenarios.
+	 */
+	bool compactcheck;
+} options_t;
+
+/** Command line options.
+ * The settings specified on the command line.
+ */
+options_t options = { {}, {}, 0, 10, Scene::DEFAULT_SEED, "", "", false, {}, {}, 20, false, 1, false, false, false };
+
+/** Cell order.
+ * Name of the order of the grid cells in the sorted particle array.
+ */
+#ifdef MORTON_ORDER
+const char *cellorder = "morton";
+#else
+const char *cellorder = "linear";
+#endif
+
+/** Particle order.
+ * Name of the order in which the simulation stores the particle state.
+ */
+#ifdef SORTED_PARTICLES
+const char *particleorder = "sorted";
+#else
+const char *particleorder = "id";
+#endif
+
+/** Default number of particles.
+ * Number of particles each scenario is run with unless specified otherwise.
+ */
+const unsigned int defaultparticles = 65536;
+
+/** Default numbers of steps.
+ * Number of measured simulation steps of each scenario unless specified otherwise.
+ * The settle scenario runs longer, since it measures a fluid at rest.
+ */
+const unsigned int defaultsteps[Scene::SCENARIO_NUM_SCENARIOS] = { 500, 500, 500, 5000 };
+
+/** Sort benchmark grid size.
+ * Size of the particle grid of the sort benchmark, which determines the number of sorted key bits.
+ * This is the default grid size of the SPH class.
+ */
+const glm::ivec3 sortgridsize (128, 64, 128);
+
+/** Maximum number of keys.
+ * Largest number of keys of the sort benchmark. The original index of each key is stored in
+ * the key to check the stability of the sort, which holds up to 2^24 indices in the compact layout.
+ */
+const unsigned int maxsortkeys = 1u << 24;
+
+/** Dense cell particles.
+ * Number of particles the neighbour check puts into a single grid cell, which is more than
+ * the 255 particles a neighbour range of the packed neighbour cell entries can count.
+ */
+const unsigned int densecellparticles = 300;
+
+/** Maximum number of packed particles.
+ * Largest number of particles whose indices fit into the 24 bits of the packed neighbour
+ * cell entries. Beyond it the neighbour check puts this number plus one of the particles into
+ * the dense cell, so that both its neighbour ranges and the cell indices behind it need the
+ * wide entries.
+ */
+const unsigned int maxpackedparticles = 1u << 24;
+
+/** Maximum number of neighbour check particles.
+ * Largest number of particles of the neighbour check.
+ */
+const unsigned int maxcheckparticles = 1u << 26;
+
+/** Default numbers of neighbour check particles.
+ * Numbers of particles of the neighbour check unless specified otherwise. The compact
+ * particle keys only hold 2^24 particle indices, so they are only checked with the first one.
+ */
+#ifdef COMPACT_PARTICLES
+const unsigned int defaultcheckparticles[] = { 65536 };
+#else
+const unsigned int defaultcheckparticles[] = { 65536, maxpackedparticles + (1u << 20) };
+#endif
+
+/** Compact check steps.
+ * Number of simulation steps before the compact particle layout is checked unless specified otherwise.
+ */
+const unsigned int defaultcompactsteps = 100;
+
+/** Compact position tolerance.
+ * Largest distance between an fp32 position and its fixed point key tolerated by the compact
+ * check. The keys round each coordinate to 2^-(KEY_FRACTION_BITS + 1) of a cell, i.e. by at
+ * most about 5.3e-5 for the diagonal, plus the fp32 rounding of the coordinates.
+ */
+const double compactpositiontolerance = 1e-4;
+
+/** Compact density tolerance.
+ * Largest difference of the density constraint rho_i / rho_0 - 1 between the fp32 positions
+ * and the positions of the fixed point keys tolerated by the compact check.
+ */
+const double compactdensitytolerance = 1e-3;
+
+/** Benchmark result.
+ * Timings of a single scenario run.
+ */
+typedef struct result {
+	/** Scenario.
+	 * The scenario that was run.
+	 */
+	Scene::scenario_t scenario;
+	/** Number of particles.
+	 * Number of particles of the scenario.
+	 */
+	unsigned int particles;
+	/** Number of steps.
+	 * Number of measured simulation steps.
+	 */
+	unsigned int steps;
+	/** Elapsed time.
+	 * Wall clock time of the measured steps in seconds.
+	 */
+	double elapsed;
+	/** Number of neighbour searches.
+	 * Number of measured steps in which the neighbours were searched.
+	 */
+	unsigned int neighboursearches;
+	/** Neighbour cache lines.
+	 * Average number of cache lines of sorted particle keys read by the neighbour
+	 * loop of a particle in the final state (see GetNeighbourCacheLines).
+	 */
+	double cachelines;
+	/** State hash.
+	 * Hash of the final particle state (only computed in the deterministic mode).
+	 */
+	uint64_t statehash;
+	/** Phase statistics.
+	 * Statistics of the GPU time per step of each phase followed by the sum of all phases.
+	 */
+	GPUProfiler::statistics_t phases[SPH::TIMING_NUM_PHASES + 1];
+} result_t;
+
+/** Get phase name.
+ * Returns the name of a phase of the results including the sum of all phases.
+ * \param phase index of the phase
+ * \returns the name of the phase
+ */
+const char *GetPhaseName (const int &phase)
+{
+	if (phase == SPH::TIMING_NUM_PHASES)
+		return "Total";
+	return SPH::GetTimingPhaseName (SPH::timingphase_t (phase));
+}
+
+/** Cache line size.
+ * Size of the cache lines assumed by the locality estimate in bytes.
+ */
+const unsigned int cachelinesize = 128;
+
+/** Get neighbour cache lines.
+ * Estimates the memory locality of the neighbour loops independently of the hardware,
+ * since OpenGL provides no cache counters. The particles are sorted by the hash of
+ * their grid cell on the CPU in the same way as on the GPU. For each particle the
+ * distinct cache lines holding the sorted keys of the particles in its neighbour
+ * cells are counted.
+ * \param sph the simulation
+ * \returns the average number of cache lines per particle
+ */
+double GetNeighbourCacheLines (const SPH &sph)
+{
+	std::vector<glm::vec4> positions, velocities;
+	sph.GetParticles (positions, velocities);
+	const glm::ivec3 &gridsize = sph.GetGridSize ();
+	const glm::ivec3 gridorigin = sph.GetGridOrigin ();
+	const uint32_t numparticles = positions.size ();
+
+	// sort the particles by the hash of their grid cell
+	std::vector<std::pair<uint32_t, glm::ivec3>> cells (numparticles);
+	for (uint32_t i = 0; i < numparticles; i++)
+	{
+		glm::ivec3 cell (glm::floor (glm::vec3 (positions[i]) - glm::vec3 (gridorigin)));
+		cell = glm::clamp (cell, glm::ivec3 (0), gridsize - glm::ivec3 (1));
+		cells[i] = std::make_pair (RadixSort::GetCellHash (cell, numparticles, gridsize), cell);
+	}
+	std::stable_sort (cells.begin (), cells.end (),
+			[] (const std::pair<uint32_t, glm::ivec3> &a, const std::pair<uint32_t, glm::ivec3> &b) {
+		return a.first < b.first;
+	});
+
+	// determine the range of sorted particles of each hash
+	std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>> ranges;
+	for (uint32_t i = 0; i < numparticles; i++)
+	{
+		auto it = ranges.find (cells[i].first);
+		if (it == ranges.end ())
+			ranges[cells[i].first] = std::make_pair (i, i + 1);
+		else
+			it->second.second = i + 1;
+	}
+
+	// count the distinct cache lines of the neighbour ranges of each particle
+	// (with PBF_COMPACT_PARTICLES the keys do not evenly divide the cache lines)
+	const uint64_t keysize = RadixSort::KEY_SIZE;
+	const int extent = NeighbourCellFinder::NEIGHBOUR_EXTENT;
+	uint64_t total = 0;
+	std::vector<std::pair<uint32_t, uint32_t>> lines;
+	for (uint32_t i = 0; i < numparticles; i++)
+	{
+		lines.clear ();
+		for (int z = -extent; z <= extent; z++)
+		for (int y = -extent; y <= extent; y++)
+		for (int x = -extent; x <= extent; x++)
+		{
+			glm::ivec3 cell = cells[i].second + glm::ivec3 (x, y, z);
+			if (glm::clamp (cell, glm::ivec3 (0), gridsize - glm::ivec3 (1)) != cell)
+				continue;
+			auto it = ranges.find (RadixSort::GetCellHash (cell, numparticles, gridsize));
+			if (it != ranges.end ())
+				lines.push_back (std::make_pair (uint32_t ((it->second.first * keysize) / cachelinesize),
+						uint32_t ((it->second.second * keysize - 1) / cachelinesize)));
+		}
+		std::sort (lines.begin (), lines.end ());
+		uint32_t covered = 0;
+		for (const std::pair<uint32_t, uint32_t> &range : lines)
+		{
+			uint32_t first = std::max (range.first, covered);
+			if (range.second + 1 > first)
+			{
+				total += range.second + 1 - first;
+				covered = range.second + 1;
+			}
+		}
+	}
+	return double (total) / double (numparticles);
+}
+
+/** Run scenario.
+ * Runs a scenario and measures the GPU time spent in each phase of every step.
+ * \param scenario the scenario
+ * \param numparticles number of particles
+ * \returns the timings
+ */
+result_t RunScenario (const Scene::scenario_t &scenario, const unsigned int &numparticles)
+{
+	result_t result;
+	result.scenario = scenario;
+	result.particles = numparticles;
+	result.steps = (options.steps > 0) ? options.steps : defaultsteps[scenario];
+
+	Scene scene (scenario, numparticles, options.seed);
+	SPH sph (scene.GetNumberOfParticles (), scene.GetGridSize ());
+	sph.SetDomainBounds (scene.GetDomainMin (), scene.GetDomainMax ());
+	sph.SetParticles (scene.GetPositions (), scene.GetVelocities ());
+	sph.SetIncrementalSortEnabled (options.incremental);
+	sph.SetNeighbourSearchInterval (options.neighbourinterval);
+	sph.SetDeterministic (options.deterministic);
+
+	for (unsigned int step = 0; step < options.warmup; step++)
+		sph.Run ();
+	glFinish ();
+
+	// keep the times of all measured steps, which are collected without waiting for the GPU
+	GPUProfiler &profiler = sph.GetProfiler ();
+	profiler.Collect ();
+	profiler.Clear ();
+	profiler.SetWindow (result.steps);
+
+	const unsigned int neighboursearches = sph.GetNumNeighbourSearches ();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+	for (unsigned int step = 0; step < result.steps; step++)
+	{
+		sph.Run ();
+
+		GLenum err = glGetError ();
+		if (err != GL_NO_ERROR)
+		{
+			std::stringstream stream;
+			stream << "OpenGL error detected in step " << step << " of " << Scene::GetScenarioName (scenario)
+					<< ": 0x" << std::hex << err;
+			throw std::runtime_error (stream.str ());
+		}
+	}
+	glFinish ();
+	result.elapsed = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+	// every step measures each phase once
+	profiler.Collect ();
+	std::vector<double> samples[SPH::TIMING_NUM_PHASES + 1];
+	samples[SPH::TIMING_NUM_PHASES].resize (profiler.GetSamples (0).size (), 0.0);
+	for (int phase = 0; phase < SPH::TIMING_NUM_PHASES; phase++)
+	{
+		const std::deque<double> &phasesamples = profiler.GetSamples (phase);
+		samples[phase].assign (phasesamples.begin (), phasesamples.end ());
+		for (size_t step = 0; step < samples[phase].size () && step < samples[SPH::TIMING_NUM_PHASES].size (); step++)
+			samples[SPH::TIMING_NUM_PHASES][step] += samples[phase][step];
+	}
+	result.neighboursearches = sph.GetNumNeighbourSearches () - neighboursearches;
+	result.cachelines = GetNeighbourCacheLines (sph);
+	result.statehash = options.deterministic ? sph.GetStateHash () : 0;
+
+	for (int phase = 0; phase <= SPH::TIMING_NUM_PHASES; phase++)
+		result.phases[phase] = GPUProfiler::ComputeStatistics (samples[phase]);
+	return result;
+}
+
+/** Sort result.
+ * Timings of the radix sort of a key distribution.
+ */
+typedef struct sortresult {
+	/** Key distribution.
+	 * The sorted key distribution.
+	 */
+	distribution_t distribution;
+	/** Number of keys.
+	 * Number of sorted keys.
+	 */
+	unsigned int keys;
+	/** Statistics.
+	 * Statistics of the GPU time per sort.
+	 */
+	GPUProfiler::statistics_t stats;
+	/** Digit bits.
+	 * Number of bits sorted in each pass.
+	 */
+	unsigned int digitbits;
+	/** Correctness flag.
+	 * Flag indicating whether the result matches a stable sort on the CPU.
+	 */
+	bool correct;
+} sortresult_t;
+
+/** Neighbour check result.
+ * Result of comparing the neighbour cell search with a count on the CPU.
+ */
+typedef struct neighbourresult {
+	/** Number of particles.
+	 * Number of particles of the check.
+	 */
+	unsigned int particles;
+	/** Number of mismatches.
+	 * Number of particles whose neighbour ranges hold a different number of particles
+	 * than counted on the CPU.
+	 */
+	unsigned int mismatches;
+	/** Number of overflows.
+	 * Number of neighbour ranges that the GPU reported as clamped to 255 particles.
+	 */
+	unsigned int overflows;
+	/** Expected number of overflows.
+	 * Number of neighbour ranges with more than 255 particles counted on the CPU
+	 * (zero if PBF_NEIGHBOUR_WIDE_ENTRIES is enabled).
+	 */
+	unsigned int expectedoverflows;
+	/** Rejected flag.
+	 * Flag indicating whether the neighbour cell finder refused the number of particles,
+	 * as the packed neighbour cell entries have to for more than 2^24 particles.
+	 */
+	bool rejected;
+	/** Correctness flag.
+	 * Flag indicating whether the counts and the overflows match the CPU.
+	 */
+	bool correct;
+} neighbourresult_t;
+
+/** Compact check result.
+ * Error of the compact particle layout against the fp32 particle state of a scenario.
+ */
+typedef struct compactresult {
+	/** Scenario.
+	 * The checked scenario.
+	 */
+	Scene::scenario_t scenario;
+	/** Number of particles.
+	 * Number of particles of the scenario.
+	 */
+	unsigned int particles;
+	/** Number of steps.
+	 * Number of simulation steps before the check.
+	 */
+	unsigned int steps;
+	/** Maximum position error.
+	 * Largest distance between an fp32 position and the position of its fixed point key.
+	 */
+	double maxpositionerror;
+	/** Mean position error.
+	 * Average distance between the fp32 positions and the positions of their fixed point keys.
+	 */
+	double meanpositionerror;
+	/** Maximum density error.
+	 * Largest difference of the density constraint between the fp32 and the key positions.
+	 */
+	double maxdensityerror;
+	/** Mean density error.
+	 * Average difference of the density constraint between the fp32 and the key positions.
+	 */
+	double meandensityerror;
+	/** Correctness flag.
+	 * Flag indicating whether both maximum errors are within their tolerances.
+	 */
+	bool correct;
+} compactresult_t;
+
+/** Generate keys.
+ * Generates the grid cells of a synthetic key distribution. Only the raw output
+ * of the random number generator is used, so the keys are the same everywhere.
+ * \param distribution the key distribution
+ * \param numkeys number of keys
+ * \param random random number generator
+ * \returns the grid cells
+ */
+std::vector<glm::ivec3> GenerateKeys (const distribution_t &distribution, const unsigned int &numkeys, std::mt19937 &random)
+{
+	const uint32_t numcells = sortgridsize.x * sortgridsize.y * sortgridsize.z;
+	// linear cell indices in the order of the dense grid hash (see shaders/grid/hash.glsl)
+	std::vector<uint32_t> indices (numkeys);
+	if (distribution == DISTRIBUTION_CLUSTERED)
+	{
+		// 16 blocks of 16^3 cells at random positions
+		const int numclusters = 16, clustersize = 16;
+		std::vector<glm::ivec3> origins (numclusters);
+		for (glm::ivec3 &origin : origins)
+			origin = glm::ivec3 (random () % (sortgridsize.x - clustersize), random () % (sortgridsize.y - clustersize),
+					random () % (sortgridsize.z - clustersize));
+		for (uint32_t &index : indices)
+		{
+			glm::ivec3 cell = origins[random () % numclusters] + glm::ivec3 (random () % clustersize,
+					random () % clustersize, random () % clustersize);
+			index = cell.x + cell.y * sortgridsize.x * sortgridsize.z + cell.z * sortgridsize.x;
+		}
+	}
+	else
+	{
+		for (uint32_t &index : indices)
+			index = random () % numcells;
+	}
+	if (distribution == DISTRIBUTION_SORTED || distribution == DISTRIBUTION_NEARLY_SORTED)
+		std::sort (indices.begin (), indices.end ());
+	if (distribution == DISTRIBUTION_NEARLY_SORTED)
+	{
+		// swap one percent of the keys with a key at most 32 positions further
+		for (unsigned int i = 0; i < numkeys / 100; i++)
+		{
+			uint32_t a = random () % numkeys;
+			uint32_t b = std::min<uint32_t> (numkeys - 1, a + 1 + random () % 32);
+			std::swap (indices[a], indices[b]);
+		}
+	}
+
+	std::vector<glm::ivec3> cells (numkeys);
+	for (unsigned int i = 0; i < numkeys; i++)
+		cells[i] = glm::ivec3 (indices[i] % sortgridsize.x, indices[i] / (sortgridsize.x * sortgridsize.z),
+				(indices[i] / sortgridsize.x) % sortgridsize.z);
+	return cells;
+}
+
+/** Create domain buffer.
+ * Creates the uniform buffer of the domain parameters with the grid at the origin and binds
+ * it, since the sort and the neighbour search shaders read the grid origin from it.
+ * \returns the buffer object, which the caller has to delete
+ */
+GLuint CreateDomainBuffer (void)
+{
+	GLuint domainbuffer;
+	glm::vec4 domainparams[3] = { glm::vec4 (0, 0, 0, 0), glm::vec4 (0, 0, 0, 0), glm::vec4 (sortgridsize, 0) };
+	glGenBuffers (1, &domainbuffer);
+	glBindBuffer (GL_UNIFORM_BUFFER, domainbuffer);
+	glBufferData (GL_UNIFORM_BUFFER, sizeof (domainparams), domainparams, GL_STATIC_DRAW);
+	glBindBufferBase (GL_UNIFORM_BUFFER, 3, domainbuffer);
+	return domainbuffer;
+}
+
+/** Run sort.
+ * Sorts a synthetic key distribution repeatedly, measures the GPU time of each sort and
+ * checks the result against a stable sort on the CPU.
+ * \param distribution the key distribution
+ * \param numkeys number of keys
+ * \returns the timings
+ */
+sortresult_t RunSort (const distribution_t &distribution, const unsigned int &numkeys)
+{
+	sortresult_t result;
+	result.distribution = distribution;
+	result.keys = numkeys;
+
+	// the keys are positions in the centre of the grid cells together with their original index
+	std::mt19937 random (options.seed);
+	std::vector<glm::ivec3> cells = GenerateKeys (distribution, numkeys, random);
+	std::vector<uint32_t> data (RadixSort::KEY_WORDS * numkeys);
+	for (unsigned int i = 0; i < numkeys; i++)
+		RadixSort::PackKey (glm::vec3 (cells[i]) + 0.5f, i, glm::vec3 (0, 0, 0), &data[RadixSort::KEY_WORDS * i]);
+
+	GLuint domainbuffer = CreateDomainBuffer ();
+	RadixSort radixsort (512, numkeys, sortgridsize);
+	result.digitbits = radixsort.GetDigitBits ();
+	radixsort.SetIncremental (options.incremental);
+	GPUProfiler profiler ({ "Sort" }, options.repetitions);
+	for (unsigned int i = 0; i < options.warmup + options.repetitions; i++)
+	{
+		// the input is uploaded again for every sort, since sorting swaps the internal buffers
+		glBindBuffer (GL_SHADER_STORAGE_BUFFER, radixsort.GetBuffer ());
+		glBufferSubData (GL_SHADER_STORAGE_BUFFER, 0, RadixSort::KEY_SIZE * numkeys, &data[0]);
+		if (i >= options.warmup)
+			profiler.Begin (0);
+		radixsort.Run ();
+		if (i >= options.warmup)
+			profiler.End (0);
+	}
+	glFinish ();
+	profiler.Collect ();
+	result.stats = profiler.GetStatistics (0);
+
+	// compare the result of the last sort with a stable sort on the CPU
+	std::vector<uint32_t> sorted (RadixSort::KEY_WORDS * numkeys);
+	glBindBuffer (GL_SHADER_STORAGE_BUFFER, radixsort.GetBuffer ());
+	glGetBufferSubData (GL_SHADER_STORAGE_BUFFER, 0, RadixSort::KEY_SIZE * numkeys, &sorted[0]);
+	std::vector<std::pair<uint32_t, uint32_t>> reference (numkeys);
+	for (unsigned int i = 0; i < numkeys; i++)
+		reference[i] = std::make_pair (RadixSort::GetCellHash (cells[i], numkeys, sortgridsize), i);
+	std::stable_sort (reference.begin (), reference.end (),
+			[] (const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b) {
+		return a.first < b.first;
+	});
+	result.correct = true;
+	for (unsigned int i = 0; i < numkeys && result.correct; i++)
+		result.correct = (RadixSort::GetKeyId (&sorted[RadixSort::KEY_WORDS * i]) == reference[i].second);
+
+	glDeleteBuffers (1, &domainbuffer);
+
+	GLenum err = glGetError ();
+	if (err != GL_NO_ERROR)
+	{
+		std::stringstream stream;
+		stream << "OpenGL error detected while sorting " << numkeys << " " << GetDistributionName (distribution)
+				<< " keys: 0x" << std::hex << err;
+		throw std::runtime_error (stream.str ());
+	}
+	return result;
+}
+
+/** Run neighbour check.
+ * Searches the neighbour cells of particles spread uniformly over the inner cells of the
+ * sort benchmark grid plus a single dense cell, and compares the number of particles in the
+ * neighbour ranges of each particle with a count on the CPU. The dense cell holds
+ * densecellparticles particles, or 2^24 + 1 particles for more than 2^24 particles.
+ * With the packed neighbour cell entries the ranges of the dense cell are clamped to 255
+ * particles, which the GPU has to report as overflows, and more than 2^24 particles have to
+ * be rejected.
+ * \param numparticles number of particles
+ * \returns the result of the check
+ */
+neighbourresult_t RunNeighbourCheck (const unsigned int &numparticles)
+{
+	neighbourresult_t result;
+	result.particles = numparticles;
+	result.mismatches = 0;
+	result.overflows = 0;
+	result.expectedoverflows = 0;
+	result.rejected = false;
+
+#ifndef NEIGHBOUR_WIDE_ENTRIES
+	if (numparticles > maxpackedparticles)
+	{
+		try {
+			NeighbourCellFinder finder (numparticles, sortgridsize);
+		} catch (std::logic_error &) {
+			result.rejected = true;
+		}
+		result.correct = result.rejected;
+		return result;
+	}
+#endif
+
+	// keep the neighbour ranges of all particles inside the grid
+	const int extent = NeighbourCellFinder::NEIGHBOUR_EXTENT;
+	const glm::ivec3 innersize = sortgridsize - glm::ivec3 (2 * extent + 2);
+	const glm::ivec3 densecell = sortgridsize / 2;
+	const unsigned int densecount = (numparticles > maxpackedparticles) ? maxpackedparticles + 1 : densecellparticles;
+	std::mt19937 random (options.seed);
+	std::vector<glm::ivec3> cells (numparticles);
+	for (unsigned int i = 0; i < numparticles; i++)
+	{
+		if (i < densecount)
+			cells[i] = densecell;
+		else
+			cells[i] = glm::ivec3 (random () % innersize.x, random () % innersize.y, random () % innersize.z)
+					+ glm::ivec3 (extent + 1);
+	}
+	std::vector<uint32_t> data (size_t (RadixSort::KEY_WORDS) * numparticles);
+	for (unsigned int i = 0; i < numparticles; i++)
+		RadixSort::PackKey (glm::vec3 (cells[i]) + 0.5f, i, glm::vec3 (0, 0, 0), &data[size_t (RadixSort::KEY_WORDS) * i]);
+
+	GLuint domainbuffer = CreateDomainBuffer ();
+	RadixSort radixsort (512, numparticles, sortgridsize);
+	NeighbourCellFinder finder (numparticles, sortgridsize);
+	glBindBuffer (GL_SHADER_STORAGE_BUFFER, radixsort.GetBuffer ());
+	glBufferSubData (GL_SHADER_STORAGE_BUFFER, 0, RadixSort::KEY_SIZE * numparticles, &data[0]);
+	radixsort.Run ();
+	finder.FindNeighbourCells (radixsort.GetBuffer ());
+
+	std::vector<GLuint> counts;
+	finder.GetNeighbourCounts (counts);
+	result.overflows = finder.GetNumOverflows ();
+	// reuse the key storage for the sorted keys
+	glBindBuffer (GL_SHADER_STORAGE_BUFFER, radixsort.GetBuffer ());
+	glGetBufferSubData (GL_SHADER_STORAGE_BUFFER, 0, RadixSort::KEY_SIZE * numparticles, &data[0]);
+
+	// count the particles of each hash
+	std::unordered_map<uint32_t, uint32_t> hashcounts;
+	for (unsigned int i = 0; i < numparticles; i++)
+		hashcounts[RadixSort::GetCellHash (cells[i], numparticles, sortgridsize)]++;
+
+	// sum the neighbour ranges in the same way as shaders/neighbourcellfinder/neighbourcells.glsl:
+	// rows of cells in x direction or single cells in Morton order
+#ifdef MORTON_ORDER
+	const int rowlength = 1;
+#else
+	const int rowlength = 2 * extent + 1;
+#endif
+	// number of neighbours and clamped ranges of each occupied cell
+	std::unordered_map<uint32_t, glm::uvec2> references;
+#ifdef NEIGHBOUR_CELL_TABLE
+	uint32_t lasthash = 0;
+#endif
+	for (unsigned int i = 0; i < numparticles; i++)
+	{
+		const glm::ivec3 &cell = cells[RadixSort::GetKeyId (&data[size_t (RadixSort::KEY_WORDS) * i])];
+		const uint32_t index = cell.x + sortgridsize.x * (cell.y + sortgridsize.y * cell.z);
+		auto reference = references.find (index);
+		if (reference == references.end ())
+		{
+			glm::uvec2 expected (0, 0);
+			for (int y = -extent; y <= extent; y++)
+			for (int z = -extent; z <= extent; z++)
+			for (int x = -extent; x <= extent; x += rowlength)
+			{
+				uint32_t entries = 0;
+				for (int j = x; j < x + rowlength; j++)
+				{
+					auto it = hashcounts.find (RadixSort::GetCellHash (cell + glm::ivec3 (j, y, z), numparticles, sortgridsize));
+					if (it != hashcounts.end ())
+						entries += it->second;
+				}
+#ifndef NEIGHBOUR_WIDE_ENTRIES
+				if (entries > 255)
+				{
+					entries = 255;
+					expected.y++;
+				}
+#endif
+				expected.x += entries;
+			}
+			reference = references.emplace (index, expected).first;
+		}
+
+#ifdef NEIGHBOUR_CELL_TABLE
+		// only the first particle of each cell (or bucket) searches its neighbour ranges
+		const uint32_t hash = RadixSort::GetCellHash (cell, numparticles, sortgridsize);
+		if (i == 0 || hash != lasthash)
+			result.expectedoverflows += reference->second.y;
+		lasthash = hash;
+#else
+		result.expectedoverflows += reference->second.y;
+#endif
+		if (counts[i] != reference->second.x)
+			result.mismatches++;
+	}
+	result.correct = (result.mismatches == 0 && result.overflows == result.expectedoverflows);
+
+	glDeleteBuffers (1, &domainbuffer);
+
+	GLenum err = glGetError ();
+	if (err != GL_NO_ERROR)
+	{
+		std::stringstream stream;
+		stream << "OpenGL error detected while checking the neighbours of " << numparticles
+				<< " particles: 0x" << std::hex << err;
+		throw std::runtime_error (stream.str ());
+	}
+	return result;
+}
+
+/** Compute density constraints.
+ * Computes rho_i / rho_0 - 1 for all particles on the CPU in the same way as the lambda
+ * pass of the solver (without the particle itself and with the default rest density).
+ * \param positions particle positions
+ * \param constraints receives the density constraint of each particle
+ */
+void ComputeDensityConstraints (const std::vector<glm::vec3> &positions, std::vector<double> &constraints)
+{
+	// the smoothing kernel width of the solver is two grid cells
+	const float h = 2.0f;
+	const int extent = 2;
+	std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+	auto GetCellKey = [] (const glm::ivec3 &cell) {
+		return (uint64_t (uint32_t (cell.x) & 0x1FFFFF) << 42) | (uint64_t (uint32_t (cell.y) & 0x1FFFFF) << 21)
+				| uint64_t (uint32_t (cell.z) & 0x1FFFFF);
+	};
+	for (uint32_t i = 0; i < positions.size (); i++)
+		cells[GetCellKey (glm::ivec3 (glm::floor (positions[i])))].push_back (i);
+
+	constraints.resize (positions.size ());
+	for (uint32_t i = 0; i < positions.size (); i++)
+	{
+		const glm::ivec3 cell (glm::floor (positions[i]));
+		double rho = 0.0;
+		for (int z = -extent; z <= extent; z++)
+		for (int y = -extent; y <= extent; y++)
+		for (int x = -extent; x <= extent; x++)
+		{
+			auto it = cells.find (GetCellKey (cell + glm::ivec3 (x, y, z)));
+			if (it == cells.end ())
+				continue;
+			for (const uint32_t &j : it->second)
+			{
+				if (j != i)
+					rho += SPH::Wpoly6 (glm::distance (positions[i], positions[j]), h);
+			}
+		}
+		constraints[i] = rho - 1.0;
+	}
+}
+
+/** Run compact check.
+ * Runs a scenario and compares the fp32 positions of the resulting particle state with
+ * the positions stored in the fixed point sort keys of the compact particle layout, both
+ * directly and through the density constraints computed from them on the CPU.
+ * \param scenario the scenario
+ * \param numparticles number of particles
+ * \returns the result of the check
+ */
+compactresult_t RunCompactCheck (const Scene::scenario_t &scenario, const unsigned int &numparticles)
+{
+	compactresult_t result;
+	result.scenario = scenario;
+	result.particles = numparticles;
+	result.steps = (options.steps > 0) ? options.steps : defaultcompactsteps;
+
+	Scene scene (scenario, numparticles, options.seed);
+	SPH sph (scene.GetNumberOfParticles (), scene.GetGridSize ());
+	sph.SetDomainBounds (scene.GetDomainMin (), scene.GetDomainMax ());
+	sph.SetParticles (scene.GetPositions (), scene.GetVelocities ());
+	sph.SetDeterministic (options.deterministic);
+	for (unsigned int step = 0; step < result.steps; step++)
+		sph.Run ();
+
+	std::vector<glm::vec4> positions, velocities;
+	sph.GetParticles (positions, velocities);
+	const glm::vec3 gridorigin (sph.GetGridOrigin ());
+	std::vector<glm::vec3> fp32positions (positions.size ()), keypositions (positions.size ());
+	result.maxpositionerror = 0.0;
+	result.meanpositionerror = 0.0;
+	for (uint32_t i = 0; i < positions.size (); i++)
+	{
+		uint32_t key[RadixSort::KEY_WORDS];
+		fp32positions[i] = glm::vec3 (positions[i]);
+		RadixSort::PackKey (fp32positions[i], i, gridorigin, key);
+		keypositions[i] = RadixSort::GetKeyPosition (key, gridorigin);
+		double error = glm::distance (fp32positions[i], keypositions[i]);
+		result.maxpositionerror = std::max (result.maxpositionerror, error);
+		result.meanpositionerror += error;
+	}
+
+	std::vector<double> fp32constraints, keyconstraints;
+	ComputeDensityConstraints (fp32positions, fp32constraints);
+	ComputeDensityConstraints (keypositions, keyconstraints);
+	result.maxdensityerror = 0.0;
+	result.meandensityerror = 0.0;
+	for (size_t i = 0; i < fp32constraints.size (); i++)
+	{
+		double error = std::abs (keyconstraints[i] - fp32constraints[i]);
+		result.maxdensityerror = std::max (result.maxdensityerror, error);
+		result.meandensityerror += error;
+	}
+	if (!positions.empty ())
+	{
+		result.meanpositionerror /= double (positions.size ());
+		result.meandensityerror /= double (positions.size ());
+	}
+	result.correct = (result.maxpositionerror <= compactpositiontolerance
+			&& result.maxdensityerror <= compactdensitytolerance);
+
+	GLenum err = glGetError ();
+	if (err != GL_NO_ERROR)
+	{
+		std::stringstream stream;
+		stream << "OpenGL error detected while checking the compact layout of " << Scene::GetScenarioName (scenario)
+				<< ": 0x" << std::hex << err;
+		throw std::runtime_error (stream.str ());
+	}
+	return result;
+}
+
+/** Get keys per second.
+ * Computes the sort throughput from the mean time per sort.
+ * \param result the sort result
+ * \returns the number of keys sorted per second
+ */
+double GetKeysPerSecond (const sortresult_t &result)
+{
+	return (result.stats.mean > 0) ? double (result.keys) / (result.stats.mean / 1000.0) : 0.0;
+}
+
+/** Escape JSON string.
+ * Escapes the characters of a string that must not occur in a JSON string literal.
+ * \param str the string
+ * \returns the escaped string
+ */
+std::string EscapeJSON (const std::string &str)
+{
+	std::stringstream stream;
+	for (const char &c : str)
+	{
+		if (c == '"' || c == '\\')
+			stream << '\\' << c;
+		else if ((unsigned char) c < 0x20)
+			stream << ' ';
+		else
+			stream << c;
+	}
+	return stream.str ();
+}
+
+/** Write CSV.
+ * Writes one line per phase of each result to a CSV file.
+ * \param filename name of the file
+ * \param renderer name of the OpenGL renderer
+ * \param results the results
+ */
+void WriteCSV (const std::string &filename, const std::string &renderer, const std::vector<result_t> &results)
+{
+	std::ofstream file (filename.c_str ());
+	if (!file.is_open ())
+		throw std::runtime_error (std::string ("Cannot open benchmark output file: ") + filename);
+
+	// labels and renderer names are quoted, since they may contain commas
+	file << "label,renderer,scenario,particles,seed,steps,steps_per_second,phase,samples,min_ms,mean_ms,p95_ms,p99_ms"
+			<< std::endl;
+	for (const result_t &result : results)
+	{
+		for (int phase = 0; phase <= SPH::TIMING_NUM_PHASES; phase++)
+		{
+			const GPUProfiler::statistics_t &stats = result.phases[phase];
+			file << "\"" << EscapeJSON (options.label) << "\",\"" << EscapeJSON (renderer) << "\","
+					<< Scene::GetScenarioName (result.scenario) << "," << result.particles << "," << options.seed << ","
+					<< result.steps << "," << double (result.steps) / result.elapsed << "," << GetPhaseName (phase) << ","
+					<< stats.samples << "," << stats.min << "," << stats.mean << "," << stats.p95 << "," << stats.p99
+					<< std::endl;
+		}
+	}
+}
+
+/** Write JSON.
+ * Writes the results to a JSON file.
+ * \param filename name of the file
+ * \param renderer name of the OpenGL renderer
+ * \param results the results
+ */
+void WriteJSON (const std::string &filename, const std::string &renderer, const std::vector<result_t> &results)
+{
+	std::ofstream file (filename.c_str ());
+	if (!file.is_open ())
+		throw std::runtime_error (std::string ("Cannot open benchmark output file: ") + filename);
+
+	file << "{" << std::endl
+			<< "  \"label\": \"" << EscapeJSON (options.label) << "\"," << std::endl
+			<< "  \"renderer\": \"" << EscapeJSON (renderer) << "\"," << std::endl
+			<< "  \"seed\": " << options.seed << "," << std::endl
+			<< "  \"warmup\": " << options.warmup << "," << std::endl
+			<< "  \"incremental\": " << (options.incremental ? "true" : "false") << "," << std::endl
+			<< "  \"neighbour_interval\": " << options.neighbourinterval << "," << std::endl
+			<< "  \"cell_order\": \"" << cellorder << "\"," << std::endl
+			<< "  \"particle_order\": \"" << particleorder << "\"," << std::endl
+			<< "  \"deterministic\": " << (options.deterministic ? "true" : "false") << "," << std::endl
+			<< "  \"runs\": [";
+	for (size_t i = 0; i < results.size (); i++)
+	{
+		const result_t &result = results[i];
+		file << (i > 0 ? "," : "") << std::endl
+				<< "    { \"scenario\": \"" << Scene::GetScenarioName (result.scenario) << "\", \"particles\": "
+				<< result.particles << ", \"steps\": " << result.steps << ", \"seconds\": " << result.elapsed
+				<< ", \"steps_per_second\": " << double (result.steps) / result.elapsed
+				<< ", \"neighbour_searches\": " << result.neighboursearches
+				<< ", \"neighbour_cache_lines\": " << result.cachelines;
+		if (options.deterministic)
+			file << ", \"state_hash\": \"" << SPH::FormatStateHash (result.statehash) << "\"";
+		file << "," << std::endl
+				<< "      \"phases\": [";
+		for (int phase = 0; phase <= SPH::TIMING_NUM_PHASES; phase++)
+		{
+			const GPUProfiler::statistics_t &stats = result.phases[phase];
+			file << (phase > 0 ? "," : "") << std::endl
+					<< "        { \"name\": \"" << GetPhaseName (phase) << "\", \"samples\": " << stats.samples
+					<< ", \"min_ms\": " << stats.min << ", \"mean_ms\": " << stats.mean
+					<< ", \"p95_ms\": " << stats.p95 << ", \"p99_ms\": " << stats.p99 << " }";
+		}
+		file << std::endl << "      ] }";
+	}
+	file << std::endl << "  ]" << std::endl << "}" << std::endl;
+}
+
+/** Write sort CSV.
+ * Writes one line per sort result to a CSV file.
+ * \param filename name of the file
+ * \param renderer name of the OpenGL renderer
+ * \param results the sort results
+ */
+void WriteCSV (const std::string &filename, const std::string &renderer, const std::vector<sortresult_t> &results)
+{
+	std::ofstream file (filename.c_str ());
+	if (!file.is_open ())
+		throw std::runtime_error (std::string ("Cannot open benchmark output file: ") + filename);
+
+	file << "label,renderer,distribution,keys,seed,digit_bits,samples,min_ms,mean_ms,p95_ms,p99_ms,keys_per_second,correct"
+			<< std::endl;
+	for (const sortresult_t &result : results)
+	{
+		file << "\"" << EscapeJSON (options.label) << "\",\"" << EscapeJSON (renderer) << "\","
+				<< GetDistributionName (result.distribution) << "," << result.keys << "," << options.seed << ","
+				<< result.digitbits << "," << result.stats.samples << "," << result.stats.min << ","
+				<< result.stats.mean << "," << result.stats.p95 << "," << result.stats.p99 << ","
+				<< GetKeysPerSecond (result) << ","
+				<< (result.correct ? "true" : "false") << std::endl;
+	}
+}
+
+/** Write sort JSON.
+ * Writes the sort results to a JSON file.
+ * \param filename name of the file
+ * \param renderer name of the OpenGL renderer
+ * \param results the sort results
+ */
+void WriteJSON (const std::string &filename, const std::string &renderer, const std::vector<sortresult_t> &results)
+{
+	std::ofstream file (filename.c_str ());
+	if (!file.is_open ())
+		throw std::runtime_error (std::string ("Cannot open benchmark output file: ") + filename);
+
+	file << "{" << std::endl
+			<< "  \"label\": \"" << EscapeJSON (options.label) << "\"," << std::endl
+			<< "  \"renderer\": \"" << EscapeJSON (renderer) << "\"," << std::endl
+			<< "  \"seed\": " << options.seed << "," << std::endl
+			<< "  \"warmup\": " << options.warmup << "," << std::endl
+			<< "  \"incremental\": " << (options.incremental ? "true" : "false") << "," << std::endl
+			<< "  \"sorts\": [";
+	for (size_t i = 0; i < results.size (); i++)
+	{
+		const sortresult_t &result = results[i];
+		file << (i > 0 ? "," : "") << std::endl
+				<< "    { \"distribution\": \"" << GetDistributionName (result.distribution) << "\", \"keys\": "
+				<< result.keys << ", \"digit_bits\": " << result.digitbits << ", \"samples\": " << result.stats.samples
+				<< ", \"min_ms\": " << result.stats.min << ", \"mean_ms\": " << result.stats.mean << ", \"p95_ms\": " << result.stats.p95 << ", \"p99_ms\": "
+				<< result.stats.p99 << ", \"keys_per_second\": " << GetKeysPerSecond (result) << ", \"correct\": "
+				<< (result.correct ? "true" : "false") << " }";
+	}
+	file << std::endl << "  ]" << std::endl << "}" << std::endl;
+}
+
+/** Print result.
+ * Outputs the timings of a scenario run.
+ * \param result the result
+ */
+void PrintResult (const result_t &result)
+{
+	std::cout << Scene::GetScenarioName (result.scenario) << ", " << result.particles << " particles, "
+			<< result.steps << " steps: " << double (result.steps) / result.elapsed << " steps per second";
+	if (options.neighbourinterval > 1)
+		std::cout << ", " << result.neighboursearches << " neighbour searches";
+	std::cout << std::endl << "  Neighbour cache lines per particle (" << cellorder << " order): "
+			<< result.cachelines << std::endl;
+	if (options.deterministic)
+		std::cout << "  State hash: " << SPH::FormatStateHash (result.statehash) << std::endl;
+	for (int phase = 0; phase <= SPH::TIMING_NUM_PHASES; phase++)
+	{
+		const GPUProfiler::statistics_t &stats = result.phases[phase];
+		std::cout << "  " << GetPhaseName (phase) << ": mean " << stats.mean << " ms, min " << stats.min
+				<< " ms, p95 " << stats.p95 << " ms, p99 " << stats.p99 << " ms" << std::endl;
+	}
+}
+
+/** Print sort result.
+ * Outputs the timings of a sort benchmark.
+ * \param result the sort result
+ */
+void PrintResult (const sortresult_t &result)
+{
+	std::cout << GetDistributionName (result.distribution) << ", " << result.keys << " keys, "
+			<< result.digitbits << " bits per pass: "
+			<< GetKeysPerSecond (result) << " keys per second (mean " << result.stats.mean << " ms, min "
+			<< result.stats.min << " ms, p95 " << result.stats.p95 << " ms)"
+			<< (result.correct ? "" : ", INCORRECT") << std::endl;
+}
+
+/** Print neighbour check result.
+ * Outputs the result of a neighbour check.
+ * \param result the neighbour check result
+ */
+void PrintResult (const neighbourresult_t &result)
+{
+	std::cout << "neighbour check, " << result.particles << " particles: ";
+	if (result.particles > maxpackedparticles && !result.rejected)
+		std::cout << "accepted by the wide entries, ";
+	if (result.rejected)
+		std::cout << "rejected by the packed entries";
+	else
+		std::cout << result.overflows << " clamped neighbour ranges reported (" << result.expectedoverflows << " expected)";
+	if (result.mismatches > 0)
+		std::cout << ", " << result.mismatches << " particles with wrong neighbour counts";
+	std::cout << (result.correct ? "" : ", INCORRECT") << std::endl;
+}
+
+/** Print compact check result.
+ * Outputs the errors of the compact particle layout of a scenario.
+ * \param result the compact check result
+ */
+void PrintResult (const compactresult_t &result)
+{
+	std::cout << Scene::GetScenarioName (result.scenario) << ", " << result.particles << " particles, "
+			<< result.steps << " steps: compact layout errors" << (result.correct ? "" : ", INCORRECT") << std::endl
+			<< "  Position: max " << result.maxpositionerror << ", mean " << result.meanpositionerror
+			<< " (tolerance " << compactpositiontolerance << ")" << std::endl
+			<< "  Density constraint: max " << result.maxdensityerror << ", mean " << result.meandensityerror
+			<< " (tolerance " << compactdensitytolerance << ")" << std::endl;
+}
+
+/** Print usage.
+ * Outputs the supported command line options.
+ * \param name name of the executable
+ */
+void PrintUsage (const char *name)
+{
+	std::cerr << "Usage: " << name << " [options]" << std::endl
+			<< "Options:" << std::endl
+			<< "  --scenario NAME" << std::endl
+			<< "               run a scenario: dambreak, doubledambreak, drop or settle" << std::endl
+			<< "               (may be repeated, default: all)" << std::endl
+			<< "  --particles N" << std::endl
+			<< "               run each scenario with N particles (may be repeated, default: "
+			<< defaultparticles << ")" << std::endl
+			<< "  --steps N    number of measured steps (default: " << defaultsteps[Scene::SCENARIO_DAM_BREAK]
+			<< ", " << defaultsteps[Scene::SCENARIO_SETTLE] << " for settle)" << std::endl
+			<< "  --warmup N   number of steps before the measurement starts (default: " << options.warmup << ")" << std::endl
+			<< "  --seed S     seed of the random displacement of the particles (default: " << options.seed << ")"
+			<< std::endl
+			<< "  --label TEXT label stored with the results, e.g. the benchmarked commit" << std::endl
+			<< "  --output PREFIX" << std::endl
+			<< "               write the results to PREFIX.csv and PREFIX.json" << std::endl
+			<< "  --sort       benchmark the radix sort instead of running the scenarios" << std::endl
+			<< "  --distribution NAME" << std::endl
+			<< "               key distribution of --sort: uniform, clustered, sorted or nearlysorted" << std::endl
+			<< "               (may be repeated, default: all)" << std::endl
+			<< "  --keys N     number of keys of --sort (may be repeated, default: 64k to 16M)" << std::endl
+			<< "               or particles of --neighbour-check (up to 64M, default: 64k and 17M)" << std::endl
+			<< "  --neighbour-check" << std::endl
+			<< "               check the neighbour cell search against a count on the CPU, including a cell" << std::endl
+			<< "               with " << densecellparticles << " particles (2^24 + 1 particles for more than 2^24)" << std::endl
+			<< "  --compact-check" << std::endl
+			<< "               check the position and density errors of the compact particle layout after" << std::endl
+			<< "               the given steps of each scenario (default: " << defaultcompactsteps << ")" << std::endl
+			<< "  --repetitions N" << std::endl
+			<< "               number of measured sorts with --sort (default: " << options.repetitions << ")" << std::endl
+			<< "  --incremental" << std::endl
+			<< "               use the incremental mode of the radix sort" << std::endl
+			<< "  --neighbour-interval N" << std::endl
+			<< "               search the neighbours at least every N steps (requires PBF_NEIGHBOUR_SKIN, default: "
+			<< options.neighbourinterval << ")" << std::endl
+			<< "  --deterministic" << std::endl
+			<< "               run the scenarios in the deterministic mode and report the hash of the final state"
+			<< std::endl;
+}
+
+/** Parse unsigned integer.
+ * Parses a command line argument as an unsigned integer.
+ * \param arg the argument
+ * \param value the parsed value
+ * \returns True, if the argument is a valid unsigned integer, false otherwise.
+ */
+bool ParseUnsigned (const char *arg, unsigned int &value)
+{
+	char *end = NULL;
+	value = strtoul (arg, &end, 10);
+	return end != NULL && end != arg && *end == '\0';
+}
+
+/** Parse command line.
+ * Parses the command line arguments and stores the result in the global options.
+ * \param argc number of arguments
+ * \param argv argument array
+ * \returns True, if the command line was valid, false otherwise.
+ */
+bool ParseCommandLine (int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg (argv[i]);
+		unsigned int value = 0;
+		if (!arg.compare ("--scenario") && i + 1 < argc)
+		{
+			std::string name (argv[++i]);
+			int s = 0;
+			while (s < Scene::SCENARIO_NUM_SCENARIOS && name.compare (Scene::GetScenarioName (Scene::scenario_t (s))))
+				s++;
+			if (s == Scene::SCENARIO_NUM_SCENARIOS)
+				return false;
+			options.scenarios.push_back (Scene::scenario_t (s));
+		}
+		else if (!arg.compare ("--particles") && i + 1 < argc)
+		{
+			if (!ParseUnsigned (argv[++i], value) || value == 0)
+				return false;
+			options.particles.push_back (value);
+		}
+		else if (!arg.compare ("--steps") && i + 1 < argc)
+		{
+			if (!ParseUnsigned (argv[++i], options.steps) || options.steps == 0)
+				return false;
+		}
+		else if (!arg.compare ("--warmup") && i + 1 < argc)
+		{
+			if (!ParseUnsigned (argv[++i], options.warmup))
+				return false;
+		}
+		else if (!arg.compare ("--seed") && i + 1 < argc)
+		{
+			if (!ParseUnsigned (argv[++i], options.seed))
+				return false;
+		}
+		else if (!arg.compare ("--label") && i + 1 < argc)
+		{
+			options.label = argv[++i];
+		}
+		else if (!arg.compare ("--output") && i + 1 < argc)
+		{
+			options.output = argv[++i];
+		}
+		else if (!arg.compare ("--sort"))
+		{
+			options.sort = true;
+		}
+		else if (!arg.compare ("--neighbour-check"))
+		{
+			options.neighbourcheck = true;
+		}
+		else if (!arg.compare ("--compact-check"))
+		{
+			options.compactcheck = true;
+		}
+		else if (!arg.compare ("--distribution") && i + 1 < argc)
+		{
+			std::string name (argv[++i]);
+			int d = 0;
+			while (d < DISTRIBUTION_NUM_DISTRIBUTIONS && name.compare (GetDistributionName (distribution_t (d))))
+				d++;
+			if (d == DISTRIBUTION_NUM_DISTRIBUTIONS)
+				return false;
+			options.distributions.push_back (distribution_t (d));
+		}
+		else if (!arg.compare ("--keys") && i + 1 < argc)
+		{
+			if (!ParseUnsigned (argv[++i], value) || value == 0 || value > maxcheckparticles)
+				return false;
+			options.keys.push_back (value);
+		}
+		else if (!arg.compare ("--neighbour-interval") && i + 1 < argc)
+		{
+			if (!ParseUnsigned (argv[++i], options.neighbourinterval) || options.neighbourinterval == 0)
+				return false;
+		}
+		else if (!arg.compare ("--incremental"))
+		{
+			options.incremental = true;
+		}
+		else if (!arg.compare ("--deterministic"))
+		{
+			options.deterministic = true;
+		}
+		else if (!arg.compare ("--repetitions") && i + 1 < argc)
+		{
+			if (!ParseUnsigned (argv[++i], options.repetitions) || options.repetitions == 0)
+				return false;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Main.
+ * Main entry point of the benchmark.
+ * \param argc number of arguments
+ * \param argv argument array
+ * \returns error code
+ */
+int main (int argc, char *argv[])
+{
+    // initialize logging
+    auto console = spdlog::stdout_color_mt("console");
+
+    // parse command line
+    if (!ParseCommandLine (argc, argv))
+    {
+    	PrintUsage (argv[0]);
+    	return -1;
+    }
+    if (options.sort && (!options.scenarios.empty () || !options.particles.empty () || options.steps > 0))
+    {
+    	std::cerr << "--scenario, --particles and --steps cannot be combined with --sort." << std::endl;
+    	return -1;
+    }
+    if (options.neighbourcheck && (options.sort || !options.scenarios.empty () || !options.particles.empty ()
+    		|| options.steps > 0 || !options.distributions.empty () || !options.output.empty ()))
+    {
+    	std::cerr << "--neighbour-check can only be combined with --keys and --seed." << std::endl;
+    	return -1;
+    }
+    if (options.compactcheck && (options.sort || options.neighbourcheck || !options.output.empty ()))
+    {
+    	std::cerr << "--compact-check cannot be combined with --sort, --neighbour-check and --output." << std::endl;
+    	return -1;
+    }
+#ifndef COMPACT_PARTICLES
+    if (options.compactcheck)
+    {
+    	std::cerr << "--compact-check requires a build with PBF_COMPACT_PARTICLES." << std::endl;
+    	return -1;
+    }
+#endif
+    if (!options.sort && !options.distributions.empty ())
+    {
+    	std::cerr << "--distribution requires --sort." << std::endl;
+    	return -1;
+    }
+    if (!options.sort && !options.neighbourcheck && !options.keys.empty ())
+    {
+    	std::cerr << "--keys requires --sort or --neighbour-check." << std::endl;
+    	return -1;
+    }
+    if (options.sort)
+    {
+    	for (const unsigned int &keys : options.keys)
+    	{
+    		if (keys > maxsortkeys)
+    		{
+    			std::cerr << "--sort supports at most " << maxsortkeys << " keys." << std::endl;
+    			return -1;
+    		}
+    	}
+    }
+    if (options.neighbourcheck)
+    {
+    	for (const unsigned int &keys : options.keys)
+    	{
+    		if (keys <= densecellparticles)
+    		{
+    			std::cerr << "--neighbour-check requires more than " << densecellparticles << " particles." << std::endl;
+    			return -1;
+    		}
+    	}
+    	if (options.keys.empty ())
+    		options.keys.assign (std::begin (defaultcheckparticles), std::end (defaultcheckparticles));
+    }
+    if (options.distributions.empty ())
+    {
+    	for (int d = 0; d < DISTRIBUTION_NUM_DISTRIBUTIONS; d++)
+    		options.distributions.push_back (distribution_t (d));
+    }
+    if (options.keys.empty ())
+    {
+    	for (unsigned int keys = 1u << 16; keys <= maxsortkeys; keys <<= 2)
+    		options.keys.push_back (keys);
+    }
+    if (options.scenarios.empty ())
+    {
+    	for (int s = 0; s < Scene::SCENARIO_NUM_SCENARIOS; s++)
+    		options.scenarios.push_back (Scene::scenario_t (s));
+    }
+    if (options.particles.empty ())
+    	options.particles.push_back (defaultparticles);
+
+    // set GLFW error callback
+    glfwSetErrorCallback (glfwErrorCallback);
+    if (!glfwInit ())
+    {
+        std::cerr << "Cannot initialize GLFW." << std::endl;
+        return -1;
+    }
+
+    int error = 0;
+    try {
+        // the window is only needed to obtain an OpenGL context
+        CreateContext (64, 64, true);
+        std::string renderer (reinterpret_cast<const char*> (glGetString (GL_RENDERER)));
+        std::cout << "Benchmarking on " << renderer << "." << std::endl;
+
+        if (options.neighbourcheck)
+        {
+        	for (const unsigned int &particles : options.keys)
+        	{
+        		neighbourresult_t result = RunNeighbourCheck (particles);
+        		PrintResult (result);
+        		if (!result.correct)
+        			error = -1;
+        	}
+        }
+        else if (options.compactcheck)
+        {
+        	for (const unsigned int &particles : options.particles)
+        	{
+        		for (const Scene::scenario_t &scenario : options.scenarios)
+        		{
+        			compactresult_t result = RunCompactCheck (scenario, particles);
+        			PrintResult (result);
+        			if (!result.correct)
+        				error = -1;
+        		}
+        	}
+        }
+        else if (options.sort)
+        {
+        	std::vector<sortresult_t> results;
+        	for (const unsigned int &keys : options.keys)
+        	{
+        		for (const distribution_t &distribution : options.distributions)
+        		{
+        			results.push_back (RunSort (distribution, keys));
+        			PrintResult (results.back ());
+        			if (!results.back ().correct)
+        				error = -1;
+        		}
+        	}
+
+        	if (!options.output.empty ())
+        	{
+        		WriteCSV (options.output + ".csv", renderer, results);
+        		WriteJSON (options.output + ".json", renderer, results);
+        	}
+        }
+        else
+        {
+        	std::vector<result_t> results;
+        	for (const unsigned int &particles : options.particles)
+        	{
+        		for (const Scene::scenario_t &scenario : options.scenarios)
+        		{
+        			results.push_back (RunScenario (scenario, particles));
+        			PrintResult (results.back ());
+        		}
+        	}
+
+        	if (!options.output.empty ())
+        	{
+        		WriteCSV (options.output + ".csv", renderer, results);
+        		WriteJSON (options.output + ".json", renderer, results);
+        	}
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what () << std::endl;
+        error = -1;
+    }
+
+    if (window != NULL)
+        glfwDestroyWindow (window);
+    glfwTerminate ();
+    return error;
+}
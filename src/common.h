@@ -60,6 +60,31 @@ extern GLFWwindow *window;
  */
 bool IsExtensionSupported (const std::string &name);
 
+/** Check for boolean environment setting.
+ * Checks whether a environment variable is set and returns true,
+ * if it is, unless its value starts with 0, f, F, n or N.
+ * \param varname Environment variable to check.
+ * \returns Whether the environment setting is set or not.
+ */
+bool CheckEnvironment (const char *varname);
+
+/** GLFW error callback.
+ * Outputs error messages from GLFW.
+ * \param error error id
+ * \param msg error message
+ */
+void glfwErrorCallback (int error, const char *msg);
+
+/** Create OpenGL context.
+ * Opens the GLFW window with an OpenGL 4.3 core context, makes the context current,
+ * loads the OpenGL entry points and applies driver workarounds. GLFW has to be
+ * initialized. Throws an exception on errors.
+ * \param width width of the window
+ * \param height height of the window
+ * \param hidden flag indicating whether the window is only needed to obtain a context
+ */
+void CreateContext (const int &width, const int &height, const bool &hidden);
+
 /** OpenGL extension support flags.
  * Type of a structure that contains flags indicating whether
  * specific OpenGL extensions are supported or not.
@@ -69,6 +94,24 @@ typedef struct glextflags {
 	 * True if ARB_clear_texture is supported, false otherwise.
 	 */
 	bool ARB_clear_texture;
+	/** ARB_buffer_storage support.
+	 * True if ARB_buffer_storage is supported, false otherwise.
+	 */
+	bool ARB_buffer_storage;
+	/** KHR_shader_subgroup ballot support.
+	 * True if KHR_shader_subgroup is supported with basic and ballot operations
+	 * in compute shaders, false otherwise.
+	 */
+	bool KHR_shader_subgroup_ballot;
+	/** Subgroup size.
+	 * Number of invocations in a subgroup (0 if KHR_shader_subgroup is not supported).
+	 */
+	unsigned int subgroupsize;
+	/** Maximum work group count.
+	 * Maximum number of work groups of a compute dispatch in x direction, which limits
+	 * the number of particles, since all particle passes are dispatched in x direction.
+	 */
+	unsigned int maxworkgroupcount;
 } glextflags_t;
 
 extern glextflags_t GLEXTS;
@@ -21,7 +21,9 @@
  */
 #include "common.h"
 #include "Simulation.h"
+#include "HeadlessSimulation.h"
 #include "FullscreenQuad.h"
+#include "GPUTrace.h"
 #include <stdlib.h>
 
 /** \file main.cpp
@@ -29,47 +31,169 @@
  * The source file that contains the main entry point and performs initialization and cleanup.
  */
 
-/** GLFW window.
- * The GLFW window.
+/** Simulation class.
+ * The global Simulation object.
  */
-GLFWwindow *window = NULL;
+Simulation *simulation = NULL;
 
-/** OpenGL extension support flags.
- * Structure that contains flags indicating whether
- * specific OpenGL extensions are supported or not.
+/** Headless simulation class.
+ * The global HeadlessSimulation object (only used in headless mode).
  */
-glextflags_t GLEXTS;
+HeadlessSimulation *headlesssimulation = NULL;
 
-/** Simulation class.
- * The global Simulation object.
+/** Command line options.
+ * Structure that contains the settings specified on the command line.
  */
-Simulation *simulation = NULL;
+typedef struct options {
+	/** Headless flag.
+	 * Flag indicating whether to run the simulation without window and rendering.
+	 */
+	bool headless;
+	/** Number of steps.
+	 * Number of simulation steps to run in headless mode.
+	 */
+	unsigned int steps;
+	/** CPU flag.
+	 * Flag indicating whether to run the headless simulation on the CPU.
+	 */
+	bool cpu;
+	/** Compare flag.
+	 * Flag indicating whether to run the headless simulation on both the GPU and
+	 * the CPU and compare the results.
+	 */
+	bool compare;
+	/** Number of threads.
+	 * Number of threads used by the CPU backend (0 to use one thread per hardware thread).
+	 */
+	unsigned int threads;
+	/** Scalar flag.
+	 * Flag indicating whether the CPU backend should use the scalar instead of the vectorised solver kernels.
+	 */
+	bool scalar;
+	/** Kernel benchmark flag.
+	 * Flag indicating whether to benchmark the scalar and vectorised CPU solver kernels after the simulation.
+	 */
+	bool kernelbench;
+	/** Adaptive grid interval.
+	 * Number of steps between adapting the grid to the particle bounding box (0 for a fixed grid).
+	 */
+	unsigned int adaptivegrid;
+	/** Open domain flag.
+	 * Flag indicating whether to remove the walls, so that the particles are only bounded by the floor.
+	 */
+	bool opendomain;
+	/** Scene file.
+	 * Name of the scene description file (empty for the default scene).
+	 */
+	std::string scene;
+	/** Number of particles.
+	 * Number of particles of the default scene (0 for the default number).
+	 */
+	unsigned int particles;
+	/** Tiled solver flag.
+	 * Flag indicating whether to use the tiled solver shaders on the GPU.
+	 */
+	bool tiled;
+	/** Solver benchmark flag.
+	 * Flag indicating whether to benchmark the two-dispatch and the tiled GPU solver after the simulation.
+	 */
+	bool solverbench;
+	/** Incremental sort flag.
+	 * Flag indicating whether to re-sort the particle keys incrementally on the GPU.
+	 */
+	bool incrementalsort;
+	/** Neighbour search interval.
+	 * Maximum number of steps between GPU neighbour searches (0 for every step).
+	 */
+	unsigned int neighbourinterval;
+	/** Solver mode.
+	 * Specifies how the GPU solver applies the position corrections.
+	 */
+	SPH::solvermode_t solvermode;
+	/** Density error flag.
+	 * Flag indicating whether to measure and output the density error in each GPU solver iteration.
+	 */
+	bool densityerrors;
+	/** Density error tolerance.
+	 * Tolerance for the average density error used to report the required number of iterations (0 for none).
+	 */
+	float tolerance;
+	/** Number of solver iterations.
+	 * Number of GPU solver iterations (maximum number for the adaptive solver, 0 for the default).
+	 */
+	unsigned int iterations;
+	/** Adaptive solver tolerance.
+	 * Average density error below which the GPU solver stops iterating (0 for a fixed number of iterations).
+	 */
+	float adaptive;
+	/** CFL number.
+	 * CFL number of the adaptive time steps of the GPU backend (0 for fixed time steps).
+	 */
+	float cfl;
+	/** Profile prefix.
+	 * File name prefix of the CSV and JSON files to which the GPU timing statistics
+	 * are written on exit (empty for none).
+	 */
+	std::string profile;
+	/** Trace file.
+	 * Name of the file to which a trace of the individual GPU passes is written on exit (empty for none).
+	 */
+	std::string trace;
+	/** Deterministic flag.
+	 * Flag indicating whether to run the GPU simulation in the deterministic mode.
+	 */
+	bool deterministic;
+	/** Checkpoint file.
+	 * Name of the file to which the GPU simulation state is saved after the headless
+	 * simulation or by pressing K (empty for the default in interactive mode and none in headless mode).
+	 */
+	std::string checkpoint;
+	/** Restore file.
+	 * Name of the checkpoint file from which the GPU simulation state is restored at start (empty for none).
+	 */
+	std::string restore;
+} options_t;
+
+/** Command line options.
+ * The settings specified on the command line.
+ */
+options_t options = { false, 1000, false, false, 0, false, false, 0, false, "", 0, false, false, false, 0, SPH::SOLVER_INPLACE, false, 0.0f, 0, 0.0f, 0.0f, "", "", false, "", "" };
+
+/** Headless frame time.
+ * Simulation time per step of the headless simulation with --cfl.
+ */
+const float headlessframetime = 1.0f / 60.0f;
 
-/** GLFW error callback.
- * Outputs error messages from GLFW.
- * \param error error id
- * \param msg error message
+/** Create scene.
+ * Creates the initial particle configuration according to the command line options.
+ * \returns the scene
  */
-void glfwErrorCallback (int error, const char *msg)
+Scene CreateScene (void)
 {
-    std::cerr << "GLFW error: " << msg << std::endl;
+	if (!options.scene.empty ())
+		return Scene (options.scene);
+	if (options.particles > 0)
+		return Scene (options.particles);
+	return Scene ();
 }
 
-/** OpenGL debug callback.
- * Outputs a debug message from OpenGL.
- * \param source source of the debug message
- * \param type type of the debug message
- * \param id debug message id
- * \param severity severity of the debug message
- * \param length length of the debug message
- * \param message debug message
- * \param userParam user pointer
- *
+/** Open domain size.
+ * Extent of the domain in which the particles are confined with --open-domain.
+ */
+const float opendomainsize = 1.0e6f;
+
+/** Apply domain options.
+ * Configures the domain of a headless simulation according to the command line options.
+ * \param simulation the headless simulation
  */
-void glDebugCallback (GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
-        const GLchar *message, const void *userParam)
+void ApplyDomainOptions (HeadlessSimulation &simulation)
 {
-    std::cerr << "OpenGL debug message: " << std::string (message, length) << std::endl;
+	if (options.opendomain)
+	{
+		simulation.SetDomainBounds (glm::vec3 (-opendomainsize, 0, -opendomainsize),
+				glm::vec3 (opendomainsize, opendomainsize, opendomainsize));
+	}
+	simulation.SetAdaptiveGridInterval (options.adaptivegrid);
 }
 
 /** Cursor position.
@@ -135,138 +259,53 @@ void OnResize (GLFWwindow *window, int width, int height)
     simulation->Resize (width, height);
 }
 
-/** Broken ATI glMemoryBarrier entry point.
- * This stores the non functional glMemoryBarrier entry point provided by ATI drivers.
- */
-PFNGLMEMORYBARRIERPROC _glMemoryBarrier_BROKEN_ATIHACK = 0;
-
-/** Workaround for broken glMemoryBarrier provided by ATI drivers.
- * This is used as a hack to work around the broken implementation
- * of glMemoryBarrier provided by ATI drivers. It synchronizes
- * the GPU command queue using a sync object before calling the
- * apparently non functional entry point provided by the driver.
- * It is not clear whether this actually results in the desired
- * behavior, but it seems to produce much better results than
- * just calling glMemoryBarrier (which seems to have no effect
- * at all).
- * \param bitfield Specifies the barriers to insert.
- */
-void _glMemoryBarrier_ATIHACK (GLbitfield bitfield)
-{
-	GLsync syncobj = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-	glWaitSync (syncobj, 0, GL_TIMEOUT_IGNORED);
-	glDeleteSync (syncobj);
-	_glMemoryBarrier_BROKEN_ATIHACK (bitfield);
-}
-
-/** Dummy override for glMemoryBarrier.
- * This is used as a dummy function that does nothing. glMemoryBarrier
- * will be overridden by this function, if the environment variable
- * PBF_NO_MEMORY_BARRIERS is set to 1.
- * \param bitfield ignored argument
- */
-void _glMemoryBarrier_DISABLED (GLbitfield bitfield)
-{
-}
-
-/** Legacy glBindBuffersBase.
- * Legacy implementation of glBindBuffersBase. This is used as a fallback if
- * GL_ARB_multi_bind is not available.
- * \param target Specify the target of the bind operation.
- * \param first Specify the index of the first binding point within the array specified by target.
- * \param count Specify the number of contiguous binding points to which to bind buffers.
- * \param buffers A pointer to an array of names of buffer objects to bind to the targets on the specified binding point, or NULL.
- */
-void _glBindBuffersBase (GLenum target, GLuint first, GLsizei count, const GLuint *buffers)
-{
-	for (GLsizei i = 0; i < count; i++)
-	{
-		if (buffers == NULL)
-			glBindBufferBase (target, first + i, 0);
-		else
-			glBindBufferBase (target, first + i, buffers[i]);
-	}
-}
-
-/** Check for boolean environment setting.
- * Checks whether a environment variable is set and returns true,
- * if it is, unless its value starts with 0, f, F, n or N.
- * \param varname Environment variable to check.
- * \returns Whether the environment setting is set or not.
- */
-bool CheckEnvironment (const char *varname)
-{
-	const char *env = getenv (varname);
-	if (env != NULL) {
-		switch (env[0])
-		{
-		case '0':
-		case 'f':
-		case 'F':
-		case 'n':
-		case 'N':
-			return false;
-		}
-		return true;
-	}
-	return false;
-}
-
 /** Initialization.
  * Perform general initialization tasks.
  */
 void initialize (void)
 {
-	// check whether a debug context should be created
-	bool debugcontext = !CheckEnvironment ("PBF_NO_DEBUG_CONTEXT");
-
-    // specify parameters for the opengl context
-    glfwWindowHint (GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint (GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint (GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint (GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint (GLFW_OPENGL_DEBUG_CONTEXT, debugcontext ? GL_TRUE : GL_FALSE);
-
-    // open a window and an OpenGL context
-    window = glfwCreateWindow (1280, 720, "PBF", NULL, NULL);
-    if (window == NULL)
-        throw std::runtime_error ("Cannot open window.");
-    glfwMakeContextCurrent (window);
-
-    // get OpenGL entry points
-    glcorewInit ((glcorewGetProcAddressCallback) glfwGetProcAddress);
-
-    // check for ATI card and enable workarounds
-    std::string vendor (reinterpret_cast<const char*> (glGetString (GL_VENDOR)));
-    if (!vendor.compare ("ATI Technologies Inc."))
-    {
-    	std::cout << "Enable ATI workarounds." << std::endl;
-    	_glMemoryBarrier_BROKEN_ATIHACK = glMemoryBarrier;
-    	glMemoryBarrier = _glMemoryBarrier_ATIHACK;
-    }
+    // open a window and an OpenGL context, the window is only needed for the context in headless mode
+    CreateContext (options.headless ? 64 : 1280, options.headless ? 64 : 720, options.headless);
 
-    // check for environment variables and enable workarounds respectively
-    if (CheckEnvironment ("PBF_NO_MEMORY_BARRIERS"))
+    Scene scene = CreateScene ();
+    if (!options.trace.empty ())
     {
-    	std::cout << "Disable glMemoryBarrier" << std::endl;
-    	glMemoryBarrier = _glMemoryBarrier_DISABLED;
+    	std::stringstream description;
+    	description << "pbf (" << scene.GetNumberOfParticles () << " particles, "
+    			<< reinterpret_cast<const char*> (glGetString (GL_RENDERER)) << ")";
+    	GPUTrace::Start (options.trace, description.str ());
     }
 
-    if (debugcontext)
+    if (options.headless)
     {
-    	glDebugMessageCallback (glDebugCallback, NULL);
-    	glEnable (GL_DEBUG_OUTPUT);
-    }
-
-    // determine OpenGL extension capabilities and apply workarounds where necessary
-    GLEXTS.ARB_clear_texture = IsExtensionSupported ("GL_ARB_clear_texture");
-    if (!IsExtensionSupported ("GL_ARB_multi_bind"))
-    {
-    	glBindBuffersBase = _glBindBuffersBase;
+    	// create the headless simulation class, no rendering or event handling is needed
+    	headlesssimulation = new HeadlessSimulation (scene, true, options.compare, options.threads);
+    	headlesssimulation->SetSIMDEnabled (!options.scalar);
+    	ApplyDomainOptions (*headlesssimulation);
+    	headlesssimulation->SetTiledSolverEnabled (options.tiled);
+    	headlesssimulation->SetIncrementalSortEnabled (options.incrementalsort);
+    	if (options.neighbourinterval > 0)
+    		headlesssimulation->SetNeighbourSearchInterval (options.neighbourinterval);
+    	headlesssimulation->SetSolverMode (options.solvermode);
+    	headlesssimulation->SetDeterministic (options.deterministic);
+    	if (options.densityerrors)
+    		headlesssimulation->EnableDensityErrors (options.tolerance);
+    	if (options.iterations > 0)
+    		headlesssimulation->SetNumSolverIterations (options.iterations);
+    	headlesssimulation->SetSolverTolerance (options.adaptive);
+    	if (options.cfl > 0)
+    		headlesssimulation->EnableAdaptiveTimestep (headlessframetime, options.cfl);
+    	if (!options.restore.empty ())
+    		headlesssimulation->LoadCheckpoint (options.restore);
+    	return;
     }
 
     // create the simulation class
-    simulation = new Simulation ();
+    simulation = new Simulation (scene);
+    if (!options.checkpoint.empty ())
+    	simulation->SetCheckpointFile (options.checkpoint);
+    if (!options.restore.empty ())
+    	simulation->LoadCheckpoint (options.restore);
 
     // setup event callbacks
     glfwSetWindowUserPointer (window, simulation);
@@ -286,9 +325,17 @@ void initialize (void)
  */
 void cleanup (void)
 {
+	// write the GPU trace while the OpenGL context still exists
+	try {
+		GPUTrace::Finish ();
+	} catch (std::exception &e) {
+		std::cerr << "Exception: " << e.what () << std::endl;
+	}
 	// release simulation class
     if (simulation != NULL)
         delete simulation;
+    if (headlesssimulation != NULL)
+        delete headlesssimulation;
     // release signleton classes
     FullscreenQuad::Release ();
     // destroy window and shutdown glfw
@@ -297,17 +344,216 @@ void cleanup (void)
     glfwTerminate ();
 }
 
-bool IsExtensionSupported (const std::string &name)
+/** Print usage.
+ * Outputs the supported command line options.
+ * \param name name of the executable
+ */
+void PrintUsage (const char *name)
+{
+	std::cerr << "Usage: " << name << " [options]" << std::endl
+			<< "Options:" << std::endl
+			<< "  --headless   run the simulation without window and rendering" << std::endl
+			<< "  --scene FILE load the initial particle configuration from a scene description file" << std::endl
+			<< "  --particles N" << std::endl
+			<< "               number of particles of the default scene (default: 65536)" << std::endl
+			<< "  --steps N    number of simulation steps to run in headless mode (default: "
+			<< options.steps << ")" << std::endl
+			<< "  --cpu        run the headless simulation on the CPU (no OpenGL context required)" << std::endl
+			<< "  --compare    run the headless simulation on the GPU and the CPU and compare the results" << std::endl
+			<< "  --threads N  number of threads used on the CPU (default: one per hardware thread)" << std::endl
+			<< "  --scalar     use the scalar instead of the vectorised solver kernels on the CPU" << std::endl
+			<< "  --kernel-bench" << std::endl
+			<< "               benchmark the scalar and vectorised CPU solver kernels after the simulation" << std::endl
+			<< "  --tiled      use the tiled solver on the GPU" << std::endl
+			<< "  --solver-bench" << std::endl
+			<< "               benchmark the two-dispatch and the tiled GPU solver after the simulation" << std::endl
+			<< "  --incremental-sort" << std::endl
+			<< "               keep the particle order between steps and re-sort it incrementally on the GPU" << std::endl
+			<< "  --neighbour-interval N" << std::endl
+			<< "               search the neighbours on the GPU at least every N steps" << std::endl
+			<< "               (requires PBF_NEIGHBOUR_SKIN, default: 1)" << std::endl
+			<< "  --solver MODE" << std::endl
+			<< "               GPU solver mode: inplace, jacobi or gauss-seidel (default: inplace)" << std::endl
+			<< "  --deterministic" << std::endl
+			<< "               run the GPU simulation reproducibly and output the hash of the final state" << std::endl
+			<< "  --checkpoint FILE" << std::endl
+			<< "               save the GPU simulation state to FILE after the headless simulation" << std::endl
+			<< "               or by pressing K (default: pbf.checkpoint)" << std::endl
+			<< "  --restore FILE" << std::endl
+			<< "               restore the GPU simulation state from the checkpoint FILE at start" << std::endl
+			<< "  --density-errors" << std::endl
+			<< "               output the density error after each GPU solver iteration" << std::endl
+			<< "  --tolerance T" << std::endl
+			<< "               report the fewest iterations with an average density error below T" << std::endl
+			<< "  --iterations N" << std::endl
+			<< "               number of GPU solver iterations, maximum for --adaptive (default: 5)" << std::endl
+			<< "  --adaptive T stop the GPU solver iterations once the average density error is below T" << std::endl
+			<< "  --cfl C      advance the GPU simulation by " << headlessframetime
+			<< " s per step using substeps with CFL number C" << std::endl
+			<< "  --profile PREFIX" << std::endl
+			<< "               write the GPU timing statistics to PREFIX.csv and PREFIX.json on exit" << std::endl
+			<< "  --trace FILE write a trace of the individual GPU passes to FILE on exit" << std::endl
+			<< "               (trace event JSON for chrome://tracing or Perfetto)" << std::endl
+			<< "  --adaptive-grid N" << std::endl
+			<< "               adapt the GPU grid to the particle bounding box every N steps" << std::endl
+			<< "  --open-domain" << std::endl
+			<< "               remove the walls, so that the particles are only bounded by the floor" << std::endl;
+}
+
+/** Parse command line.
+ * Parses the command line arguments and stores the result in the global options.
+ * \param argc number of arguments
+ * \param argv argument array
+ * \returns True, if the command line was valid, false otherwise.
+ */
+bool ParseCommandLine (int argc, char *argv[])
 {
-	GLint n = 0;
-	glGetIntegerv (GL_NUM_EXTENSIONS, &n);
-	for (int i = 0; i < n; i++)
+	for (int i = 1; i < argc; i++)
 	{
-		const char *ext = reinterpret_cast<const char*> (glGetStringi (GL_EXTENSIONS, i));
-		if (ext != NULL && !name.compare (ext))
-			return true;
+		std::string arg (argv[i]);
+		if (!arg.compare ("--headless"))
+		{
+			options.headless = true;
+		}
+		else if (!arg.compare ("--steps") && i + 1 < argc)
+		{
+			char *end = NULL;
+			options.steps = strtoul (argv[++i], &end, 10);
+			if (end == NULL || *end != '\0')
+				return false;
+		}
+		else if (!arg.compare ("--cpu"))
+		{
+			options.cpu = true;
+		}
+		else if (!arg.compare ("--compare"))
+		{
+			options.compare = true;
+		}
+		else if (!arg.compare ("--scalar"))
+		{
+			options.scalar = true;
+		}
+		else if (!arg.compare ("--kernel-bench"))
+		{
+			options.kernelbench = true;
+		}
+		else if (!arg.compare ("--scene") && i + 1 < argc)
+		{
+			options.scene = argv[++i];
+		}
+		else if (!arg.compare ("--particles") && i + 1 < argc)
+		{
+			char *end = NULL;
+			options.particles = strtoul (argv[++i], &end, 10);
+			if (end == NULL || *end != '\0' || options.particles == 0)
+				return false;
+		}
+		else if (!arg.compare ("--tiled"))
+		{
+			options.tiled = true;
+		}
+		else if (!arg.compare ("--incremental-sort"))
+		{
+			options.incrementalsort = true;
+		}
+		else if (!arg.compare ("--neighbour-interval") && i + 1 < argc)
+		{
+			char *end = NULL;
+			options.neighbourinterval = strtoul (argv[++i], &end, 10);
+			if (end == NULL || *end != '\0' || options.neighbourinterval == 0)
+				return false;
+		}
+		else if (!arg.compare ("--solver-bench"))
+		{
+			options.solverbench = true;
+		}
+		else if (!arg.compare ("--solver") && i + 1 < argc)
+		{
+			std::string mode (argv[++i]);
+			int m = 0;
+			while (m < SPH::SOLVER_NUM_MODES && mode.compare (SPH::GetSolverModeName (SPH::solvermode_t (m))))
+				m++;
+			if (m == SPH::SOLVER_NUM_MODES)
+				return false;
+			options.solvermode = SPH::solvermode_t (m);
+		}
+		else if (!arg.compare ("--deterministic"))
+		{
+			options.deterministic = true;
+		}
+		else if (!arg.compare ("--checkpoint") && i + 1 < argc)
+		{
+			options.checkpoint = argv[++i];
+		}
+		else if (!arg.compare ("--restore") && i + 1 < argc)
+		{
+			options.restore = argv[++i];
+		}
+		else if (!arg.compare ("--density-errors"))
+		{
+			options.densityerrors = true;
+		}
+		else if (!arg.compare ("--tolerance") && i + 1 < argc)
+		{
+			char *end = NULL;
+			options.tolerance = strtof (argv[++i], &end);
+			if (end == NULL || *end != '\0' || options.tolerance <= 0)
+				return false;
+		}
+		else if (!arg.compare ("--iterations") && i + 1 < argc)
+		{
+			char *end = NULL;
+			options.iterations = strtoul (argv[++i], &end, 10);
+			if (end == NULL || *end != '\0' || options.iterations == 0)
+				return false;
+		}
+		else if (!arg.compare ("--adaptive") && i + 1 < argc)
+		{
+			char *end = NULL;
+			options.adaptive = strtof (argv[++i], &end);
+			if (end == NULL || *end != '\0' || options.adaptive <= 0)
+				return false;
+		}
+		else if (!arg.compare ("--cfl") && i + 1 < argc)
+		{
+			char *end = NULL;
+			options.cfl = strtof (argv[++i], &end);
+			if (end == NULL || *end != '\0' || options.cfl <= 0)
+				return false;
+		}
+		else if (!arg.compare ("--profile") && i + 1 < argc)
+		{
+			options.profile = argv[++i];
+		}
+		else if (!arg.compare ("--trace") && i + 1 < argc)
+		{
+			options.trace = argv[++i];
+		}
+		else if (!arg.compare ("--open-domain"))
+		{
+			options.opendomain = true;
+		}
+		else if (!arg.compare ("--adaptive-grid") && i + 1 < argc)
+		{
+			char *end = NULL;
+			options.adaptivegrid = strtoul (argv[++i], &end, 10);
+			if (end == NULL || *end != '\0')
+				return false;
+		}
+		else if (!arg.compare ("--threads") && i + 1 < argc)
+		{
+			char *end = NULL;
+			options.threads = strtoul (argv[++i], &end, 10);
+			if (end == NULL || *end != '\0')
+				return false;
+		}
+		else
+		{
+			return false;
+		}
 	}
-	return false;
+	return true;
 }
 
 /** Main.
@@ -321,6 +567,87 @@ int main (int argc, char *argv[])
     // initialize logging
     auto console = spdlog::stdout_color_mt("console");
 
+    // parse command line
+    if (!ParseCommandLine (argc, argv))
+    {
+    	PrintUsage (argv[0]);
+    	return -1;
+    }
+    if ((options.cpu || options.compare) && !options.headless)
+    {
+    	std::cerr << "The CPU backend is only available in headless mode." << std::endl;
+    	return -1;
+    }
+
+    if (!options.scene.empty () && options.particles > 0)
+    {
+    	std::cerr << "--scene and --particles cannot be combined." << std::endl;
+    	return -1;
+    }
+
+    if ((options.tiled || options.solverbench || options.incrementalsort || options.neighbourinterval > 0
+    		|| options.deterministic) && (!options.headless || (options.cpu && !options.compare)))
+    {
+    	std::cerr << "--tiled, --solver-bench, --incremental-sort, --neighbour-interval and --deterministic are "
+    			"only available for the GPU in headless mode." << std::endl;
+    	return -1;
+    }
+
+    if ((options.solvermode != SPH::SOLVER_INPLACE || options.densityerrors || options.tolerance > 0
+    		|| options.iterations > 0 || options.adaptive > 0 || options.cfl > 0)
+    		&& (!options.headless || (options.cpu && !options.compare)))
+    {
+    	std::cerr << "--solver, --density-errors, --tolerance, --iterations, --adaptive and --cfl are only available for the GPU in headless mode." << std::endl;
+    	return -1;
+    }
+
+    if (options.tolerance > 0 && !options.densityerrors)
+    {
+    	std::cerr << "--tolerance requires --density-errors." << std::endl;
+    	return -1;
+    }
+
+    if ((!options.profile.empty () || !options.trace.empty ()) && options.cpu && !options.compare)
+    {
+    	std::cerr << "--profile and --trace are only available for the GPU." << std::endl;
+    	return -1;
+    }
+
+    if ((options.adaptivegrid > 0 || options.opendomain) && !options.headless)
+    {
+    	std::cerr << "--adaptive-grid and --open-domain are only available in headless mode." << std::endl;
+    	return -1;
+    }
+
+    if ((!options.checkpoint.empty () || !options.restore.empty ()) && (options.cpu || options.compare))
+    {
+    	std::cerr << "--checkpoint and --restore are only available for the GPU without --compare." << std::endl;
+    	return -1;
+    }
+
+    if ((options.scalar || options.kernelbench) && !options.cpu && !options.compare)
+    {
+    	std::cerr << "--scalar and --kernel-bench require --cpu or --compare." << std::endl;
+    	return -1;
+    }
+
+    if (options.cpu && !options.compare)
+    {
+    	// the CPU backend does not need an OpenGL context
+    	try {
+    		HeadlessSimulation cpusimulation (CreateScene (), false, true, options.threads);
+    		cpusimulation.SetSIMDEnabled (!options.scalar);
+    		ApplyDomainOptions (cpusimulation);
+    		cpusimulation.Run (options.steps);
+    		if (options.kernelbench)
+    			cpusimulation.BenchmarkKernels (10);
+    		return 0;
+    	} catch (std::exception &e) {
+    		std::cerr << "Exception: " << e.what () << std::endl;
+    		return -1;
+    	}
+    }
+
     // set GLFW error callback
     glfwSetErrorCallback (glfwErrorCallback);
     if (!glfwInit ())
@@ -333,6 +660,22 @@ int main (int argc, char *argv[])
         // initialization
         initialize ();
 
+        if (options.headless)
+        {
+        	// run the requested number of steps without rendering
+        	headlesssimulation->Run (options.steps);
+        	if (!options.checkpoint.empty ())
+        		headlesssimulation->SaveCheckpoint (options.checkpoint);
+        	if (!options.profile.empty ())
+        		headlesssimulation->WriteProfile (options.profile);
+        	if (options.kernelbench)
+        		headlesssimulation->BenchmarkKernels (10);
+        	if (options.solverbench)
+        		headlesssimulation->BenchmarkSolvers (options.steps);
+        	cleanup ();
+        	return 0;
+        }
+
         // simulation loop
         while (!glfwWindowShouldClose (window))
         {
@@ -343,6 +686,9 @@ int main (int argc, char *argv[])
             glfwPollEvents ();
         }
 
+        if (!options.profile.empty ())
+        	simulation->WriteProfile (options.profile);
+
         // cleanup
         cleanup ();
         return 0;